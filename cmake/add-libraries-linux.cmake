@@ -2,8 +2,6 @@ include_directories("${CMAKE_SOURCE_DIR}/3rd_party/glad/include")
 include_directories("${CMAKE_SOURCE_DIR}/3rd_party/glfw3/include")
 include_directories("${CMAKE_SOURCE_DIR}/3rd_party/glm")
 include_directories("${CMAKE_SOURCE_DIR}/3rd_party/freeimage/include")
-include_directories("${CMAKE_SOURCE_DIR}/3rd_party/opencv/include")
 link_directories("${CMAKE_SOURCE_DIR}/3rd_party/glad/lib/linux")
 link_directories("${CMAKE_SOURCE_DIR}/3rd_party/glfw3/lib/linux")
-link_directories("${CMAKE_SOURCE_DIR}/3rd_party/freeimage/lib/linux")
-link_directories("${CMAKE_SOURCE_DIR}/3rd_party/opencv/lib/linux")
\ No newline at end of file
+link_directories("${CMAKE_SOURCE_DIR}/3rd_party/freeimage/lib/linux")
\ No newline at end of file
@@ -6,7 +6,11 @@ target_link_libraries(
         dl
         X11
         freeimage
-        opencv_core
-        opencv_imgproc
-        opencv_imgcodecs
-)
\ No newline at end of file
+)
+
+# EGL gives the headless mode a context without any display; without it, a hidden window is used instead.
+find_library(EGL_LIBRARY EGL)
+if(EGL_LIBRARY)
+   target_compile_definitions(BumpMapping PRIVATE USE_EGL)
+   target_link_libraries(BumpMapping ${EGL_LIBRARY})
+endif()
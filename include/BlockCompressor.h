@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+// Encodes 8-bit images into 4x4 texel blocks on the CPU, one band of block rows per worker.
+// BC1 keeps RGB in 8 bytes per block, BC5 keeps RG as two BC4 channels, and BC7 emits mode 6 blocks only (one RGBA
+// subset with 4-bit indices). Every encoded format can be decoded back, so the quality can be measured without a GPU.
+class BlockCompressor final
+{
+public:
+   enum class Format { BC1 = 0, BC5, BC7 };
+
+   BlockCompressor() = delete;
+
+   [[nodiscard]] static int getBytesPerBlock(Format format) { return format == Format::BC1 ? 8 : 16; }
+   [[nodiscard]] static size_t getCompressedSize(int width, int height, Format format);
+
+   // texels have channel_num (1 to 4) channels; BC5 reads the first two, BC1 and BC7 read RGB(A) in the given order.
+   static void encode(
+      std::vector<uint8_t>& blocks,
+      const uint8_t* texels,
+      int width,
+      int height,
+      int channel_num,
+      std::ptrdiff_t row_stride,
+      bool is_bgr,
+      Format format
+   );
+
+   // Writes tightly packed RGBA texels in the same row order the blocks were encoded from.
+   static void decode(std::vector<uint8_t>& texels, const uint8_t* blocks, int width, int height, Format format);
+
+   // PSNR in dB over the first channel_num channels of two RGBA images.
+   [[nodiscard]] static double getPSNR(const uint8_t* texels, const uint8_t* reference, int texel_num, int channel_num);
+
+private:
+   static void encodeBC1(uint8_t* block, const uint8_t (*rgba)[4]);
+   static void encodeBC4(uint8_t* block, const uint8_t* values);
+   static void encodeBC7(uint8_t* block, const uint8_t (*rgba)[4]);
+   static void decodeBC1(uint8_t (*rgba)[4], const uint8_t* block);
+   static void decodeBC4(uint8_t (*rgba)[4], const uint8_t* block, int channel);
+   static void decodeBC7(uint8_t (*rgba)[4], const uint8_t* block);
+};
\ No newline at end of file
@@ -2,9 +2,13 @@
 
 #include "_Common.h"
 
+// The view and projection live in one uniform block (std140, binding CameraBinding) that every program reads. It is
+// written once per frame, so a draw only has to provide its world matrix.
 class CameraGL
 {
 public:
+   inline static constexpr GLuint CameraBinding = 0;
+
    CameraGL();
    CameraGL(
       const glm::vec3& cam_position,
@@ -14,11 +18,17 @@ public:
       float near_plane = 0.1f,
       float far_plane = 10000.0f
    );
+   ~CameraGL();
+
+   CameraGL(const CameraGL&) = delete;
+   CameraGL& operator=(const CameraGL&) = delete;
 
    [[nodiscard]] bool getMovingState() const { return IsMoving; }
    [[nodiscard]] glm::vec3 getCameraPosition() const { return CamPos; }
    [[nodiscard]] const glm::mat4& getViewMatrix() const { return ViewMatrix; }
    [[nodiscard]] const glm::mat4& getProjectionMatrix() const { return ProjectionMatrix; }
+   [[nodiscard]] float getNearPlane() const { return NearPlane; }
+   [[nodiscard]] float getFarPlane() const { return FarPlane; }
    void setMovingState(bool is_moving) { IsMoving = is_moving; }
    void updateCamera();
    void pitch(int angle);
@@ -33,9 +43,26 @@ public:
    void zoomIn();
    void zoomOut();
    void resetCamera();
+   // Places the camera directly, as a scripted camera path does; the other camera moves continue from there.
+   void setView(
+      const glm::vec3& cam_position,
+      const glm::vec3& view_reference_position,
+      const glm::vec3& view_up_vector
+   );
    void updateWindowSize(int width, int height);
+   // Uploads the matrices of the current frame and binds the block to CameraBinding.
+   void updateCameraBuffer();
 
 private:
+   struct CameraBlock
+   {
+      glm::mat4 ViewMatrix;
+      glm::mat4 ProjectionMatrix;
+      glm::mat4 ViewProjectionMatrix;
+      glm::mat4 InverseViewMatrix;
+      glm::mat4 InverseProjectionMatrix;
+   };
+
    bool IsMoving;
    int Width;
    int Height;
@@ -53,4 +80,5 @@ private:
    glm::vec3 CamPos;
    glm::mat4 ViewMatrix;
    glm::mat4 ProjectionMatrix;
+   GLuint CameraBuffer;
 };
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "StateCache.h"
+#include "Object.h"
+
+// Collects the draws of a pass, sorts them so that draws sharing a program, then textures, then a vertex array end
+// up next to each other, and submits them through a StateCacheGL, so the state changes between neighbors are all
+// that reaches the driver. Every draw of the renderer goes through here.
+class DrawQueueGL final
+{
+public:
+   struct DrawCommand
+   {
+      const ShaderGL* Shader = nullptr;
+      GLuint VAO = 0;
+      std::array<GLuint, StateCacheGL::TextureUnitNum> Textures{}; // the texture of every unit, 0 to unbind it
+      GLenum DrawMode = GL_TRIANGLES;
+      GLsizei VertexNum = 0;
+      GLsizei InstanceNum = 1;
+      GLuint BaseInstance = 0;
+      const ObjectGL* Material = nullptr; // the object whose material goes into the Material uniforms, if any
+      GLint IntUniformLocation = -1; // one more int uniform of the draw, if the location is not -1
+      GLint IntUniformValue = 0;
+   };
+
+   DrawQueueGL() = default;
+
+   DrawQueueGL(const DrawQueueGL&) = delete;
+   DrawQueueGL& operator=(const DrawQueueGL&) = delete;
+
+   // A draw of the object with its vertex array, textures and material.
+   [[nodiscard]] static DrawCommand getObjectDrawCommand(
+      const ShaderGL* shader,
+      const ObjectGL* object,
+      GLsizei instance_num,
+      GLuint base_instance = 0
+   );
+   [[nodiscard]] const StateCacheGL& getStateCache() const { return State; }
+   [[nodiscard]] int getDrawNum() const { return DrawNum; }
+   void resetCounters();
+   void invalidate() { State.invalidate(); }
+   void submit(const DrawCommand& command) { Commands.emplace_back( command ); }
+   // Issues the queued draws in sorted order and empties the queue.
+   void flush();
+
+private:
+   int DrawNum = 0;
+   StateCacheGL State;
+   std::vector<DrawCommand> Commands;
+   std::vector<uint32_t> Order;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "FrameEncoder.h"
+
+// Reads rendered frames back without waiting for the GPU. glReadPixels only starts a copy into the next of SlotNum
+// pixel pack buffers and puts a fence behind it; the frame is taken out of its persistently mapped buffer in a later
+// capture() once the fence has signaled, by which time the GPU has long finished it, and handed to a FrameEncoder.
+// Only when all slots are still in flight does capture() wait for the oldest one.
+class FrameCaptureGL final
+{
+public:
+   inline static constexpr int SlotNum = 3;
+
+   struct CaptureStats
+   {
+      int CapturedFrameNum = 0;
+      int FenceWaitNum = 0; // how often every slot was in flight and capture() had to wait for the oldest one
+      int DroppedFrameNum = 0; // frames whose readback could not be waited for, which never reach the encoder
+      double Milliseconds = 0.0; // CPU time spent in capture(), including the copies out of the slots
+   };
+
+   FrameCaptureGL();
+   ~FrameCaptureGL();
+
+   FrameCaptureGL(const FrameCaptureGL&) = delete;
+   FrameCaptureGL& operator=(const FrameCaptureGL&) = delete;
+
+   // Allocates the slots for frames of the given size and starts the encoder with thread_num threads.
+   [[nodiscard]] bool start(
+      const glm::ivec2& size,
+      const std::string& directory,
+      FrameEncoder::Format format,
+      int thread_num
+   );
+   // Starts reading the first color attachment of the framebuffer, 0 for the default one, as the frame of frame_index.
+   void capture(GLuint framebuffer, int frame_index);
+   // Waits for the frames in flight and until the encoder has written them. It returns false if any frame was dropped
+   // or could not be written.
+   bool finish();
+   [[nodiscard]] const CaptureStats& getStats() const { return Stats; }
+   [[nodiscard]] const FrameEncoder& getEncoder() const { return Encoder; }
+
+private:
+   struct Slot
+   {
+      GLuint Buffer = 0;
+      const uint8_t* Pixels = nullptr; // mapped for as long as the buffer lives
+      GLsync Fence = nullptr; // not null while the copy into the buffer is in flight
+      int FrameIndex = -1;
+   };
+
+   glm::ivec2 Size;
+   int NextSlot; // the slot that the next capture() fills, which is also the oldest one in flight
+   std::array<Slot, SlotNum> Slots;
+   CaptureStats Stats;
+   FrameEncoder Encoder;
+
+   // Hands the frame of the slot to the encoder if its fence has signaled, or after waiting for it if wait is true.
+   bool collect(Slot& slot, bool wait);
+   void deleteSlots();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Image.h"
+
+// Writes a sequence of frames into a directory on its own threads, so that the thread that renders them only hands
+// their pixels over. The frames are named frame_NNNNN after their index, so they may finish in any order. When the
+// threads fall behind, submit() waits for a free place in the queue rather than dropping frames.
+class FrameEncoder final
+{
+public:
+   enum class Format { PNG = 0, EXR, Raw };
+
+   // At 1920 x 1080, this keeps at most about 130 MB of frames waiting.
+   inline static constexpr int MaxQueuedFrameNum = 16;
+
+   FrameEncoder();
+   ~FrameEncoder();
+
+   FrameEncoder(const FrameEncoder&) = delete;
+   FrameEncoder& operator=(const FrameEncoder&) = delete;
+
+   // Creates the directory and starts thread_num threads for frames of the given size.
+   [[nodiscard]] bool start(const std::string& directory, Format format, const glm::ivec2& size, int thread_num);
+   // Waits until every queued frame is written and stops the threads. It returns false if any frame failed.
+   bool finish();
+   // Images take the channel order of Image, i.e. BGRA where FreeImage uses it. Raw frames are always RGBA.
+   [[nodiscard]] bool isBGR() const { return FrameFormat != Format::Raw && FI_RGBA_RED == 2; }
+   [[nodiscard]] bool isStarted() const { return !Workers.empty(); }
+   [[nodiscard]] int getWrittenFrameNum() const { return WrittenFrameNum; }
+   [[nodiscard]] double getStallMilliseconds() const { return StallMilliseconds; }
+   // A buffer for the tightly packed bottom-up rows of one frame, which reuses the buffers of written frames.
+   [[nodiscard]] std::vector<uint8_t> acquireBuffer();
+   // Queues the pixels of a buffer from acquireBuffer() to be written as the frame of frame_index.
+   void submit(std::vector<uint8_t>&& pixels, int frame_index);
+   [[nodiscard]] static std::optional<Format> getFormat(const std::string& name);
+
+private:
+   struct Frame
+   {
+      int Index;
+      std::vector<uint8_t> Pixels;
+   };
+
+   bool Stop;
+   Format FrameFormat;
+   glm::ivec2 Size;
+   std::filesystem::path Directory;
+   int WrittenFrameNum;
+   int FailedFrameNum;
+   double StallMilliseconds; // how long submit() waited for a place in the queue
+   std::vector<std::thread> Workers;
+   std::queue<Frame> Frames;
+   std::vector<std::vector<uint8_t>> FreeBuffers;
+   std::mutex QueueMutex;
+   std::condition_variable FrameCondition;
+   std::condition_variable SpaceCondition;
+
+   void work();
+   [[nodiscard]] bool write(const Frame& frame) const;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "_Common.h"
+
+// The render targets of the deferred path: the geometry pass fills them, and the lighting pass reads them back one
+// texel per pixel. Per pixel it keeps 4 bytes of base color, 4 bytes of octahedral world space normal, 2 bytes of
+// Toksvig factor and material index, and 4 bytes of depth, from which the lighting pass rebuilds the position.
+class GBufferGL final
+{
+public:
+   enum Target { AlbedoTarget = 0, NormalTarget, MaterialTarget, DepthTarget, TargetNum };
+   // The material index is stored as the unsigned normalized green channel of MaterialTarget, in 8 bits.
+   inline static constexpr int MaxMaterialNum = 256;
+
+   GBufferGL();
+   ~GBufferGL();
+
+   GBufferGL(const GBufferGL&) = delete;
+   GBufferGL& operator=(const GBufferGL&) = delete;
+
+   [[nodiscard]] GLuint getFramebuffer() const { return Framebuffer; }
+   [[nodiscard]] const glm::ivec2& getSize() const { return Size; }
+   [[nodiscard]] GLuint getTexture(Target target) const { return Textures[target]; }
+   // Reallocates the targets if the size changed, and returns false if the framebuffer is not complete.
+   bool setSize(const glm::ivec2& size);
+   // Binds the framebuffer and clears it, so the pixels no object covers keep the far plane depth.
+   void beginGeometryPass() const;
+
+private:
+   glm::ivec2 Size;
+   GLuint Framebuffer;
+   GLuint Textures[TargetNum];
+
+   void deleteTargets();
+};
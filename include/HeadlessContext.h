@@ -0,0 +1,28 @@
+#pragma once
+
+#include "_Common.h"
+
+// An OpenGL 4.6 core context without a window or a display, made through EGL. It prefers the surfaceless Mesa
+// platform, which runs on llvmpipe when there is no GPU, and falls back to the default display with a 1x1 pbuffer.
+// There is no default framebuffer to draw into, so everything has to be rendered into framebuffer objects.
+// Builds without EGL (USE_EGL undefined) cannot create it, and create() returns false there.
+class HeadlessContextGL final
+{
+public:
+   HeadlessContextGL();
+   ~HeadlessContextGL();
+
+   HeadlessContextGL(const HeadlessContextGL&) = delete;
+   HeadlessContextGL& operator=(const HeadlessContextGL&) = delete;
+
+   // Creates the context, makes it current on this thread and loads the GL functions.
+   [[nodiscard]] bool create();
+
+private:
+   // The EGL handles, which are all pointers; egl.h stays out of this header as it may pull in X11 macros.
+   void* Display;
+   void* Surface;
+   void* Context;
+
+   void destroy();
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "_Common.h"
+
+// A decoded image that is shared by every consumer of the same source, e.g. a base texture and its normal map.
+// The pixels are kept as FreeImage decoded them: bottom-up rows of 8-bit gray or 32-bit BGRA (RGBA on big-endian).
+class Image final
+{
+public:
+   Image(const Image&) = delete;
+   Image& operator=(const Image&) = delete;
+   ~Image();
+
+   [[nodiscard]] static std::shared_ptr<const Image> load(const std::string& file_path, bool is_grayscale = false);
+   [[nodiscard]] static std::shared_ptr<const Image> create(int width, int height, const glm::vec4& color);
+   [[nodiscard]] std::shared_ptr<const Image> resize(int width, int height) const;
+   // Writes tightly packed bottom-up rows of 32-bit pixels in the channel order above, in the format that the
+   // extension of file_path names. The flags go to FreeImage_Save, e.g. PNG_Z_BEST_SPEED.
+   [[nodiscard]] static bool save(
+      const std::string& file_path,
+      const uint8_t* pixels,
+      int width,
+      int height,
+      int flags = 0
+   );
+
+   [[nodiscard]] int getWidth() const { return Width; }
+   [[nodiscard]] int getHeight() const { return Height; }
+   [[nodiscard]] int getChannelNum() const { return ChannelNum; }
+   [[nodiscard]] int getPitch() const { return Pitch; }
+   [[nodiscard]] bool isGrayscale() const { return ChannelNum == 1; }
+   [[nodiscard]] bool isBGR() const { return FI_RGBA_RED == 2; }
+   [[nodiscard]] const uint8_t* getBits() const { return Bits; }
+
+private:
+   FIBITMAP* Bitmap;
+   const uint8_t* Bits;
+   int Width;
+   int Height;
+   int ChannelNum;
+   int Pitch;
+
+   explicit Image(FIBITMAP* bitmap);
+};
\ No newline at end of file
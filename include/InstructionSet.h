@@ -0,0 +1,10 @@
+#pragma once
+
+#include "_Common.h"
+
+// The SIMD paths of the CPU-side builders and renderers. Each of them gives the same result on every path it has, so
+// the scalar path serves as their reference.
+enum class InstructionSet { Scalar = 0, SSE41, AVX2 };
+
+// The widest instruction set that the CPU and the operating system support, detected on the first call.
+[[nodiscard]] InstructionSet getSupportedInstructionSet();
@@ -1,14 +1,61 @@
 #pragma once
 
 #include "Shader.h"
+#include "Camera.h"
+#include "LightClusterBuilder.h"
 
+// The lights live in one shader storage block (std430, binding LightBinding) that every program reads, so a draw
+// costs the same for any number of lights. Every setter marks the fields it changes, and the block is patched at
+// most once per frame with only those byte ranges, so moving one light among thousands uploads 16 bytes.
 class LightGL final
 {
 public:
+   // Counts the uploads to the light block since the last reset, to measure what the dirty tracking saves.
+   struct UploadStats
+   {
+      int UpdateNum = 0; // calls to updateLightBuffer, one per frame
+      int CallNum = 0; // buffer writes issued to the driver
+      size_t ByteNum = 0;
+   };
+
+   // std430 layout of the block in BumpMapping.frag; vec3 followed by a float shares one 16-byte slot.
+   struct LightBlockHeader
+   {
+      glm::vec4 GlobalAmbient;
+      GLint UseLight;
+      GLint LightNum;
+      GLint Padding[2];
+   };
+
+   struct LightBlockElement
+   {
+      glm::vec4 Position;
+      glm::vec4 AmbientColor;
+      glm::vec4 DiffuseColor;
+      glm::vec4 SpecularColor;
+      glm::vec3 SpotlightDirection;
+      float SpotlightCutoffAngle;
+      float SpotlightFeather;
+      float FallOffRadius;
+      GLint LightSwitch;
+      GLint Padding;
+   };
+
+   inline static constexpr GLuint LightBinding = 0;
+   inline static constexpr GLuint ClusterBinding = 2;
+   inline static constexpr GLuint ClusterLightIndexBinding = 3;
+   // A point light is binned up to this many times its falloff radius, where the attenuation is down to 1/256. The
+   // clustered shader fades it out to zero there, so the cluster borders do not show.
+   inline static constexpr float LightRangeFactor = 16.0f;
+
    LightGL();
-   ~LightGL() = default;
+   ~LightGL();
+
+   LightGL(const LightGL&) = delete;
+   LightGL& operator=(const LightGL&) = delete;
 
    [[nodiscard]] bool isLightOn() const;
+   [[nodiscard]] bool hasActiveSpotlight() const;
    void toggleLightSwitch();
    void addLight(
       const glm::vec4& light_position,
@@ -20,18 +67,65 @@ public:
       float spotlight_feather = 0.0f,
       float falloff_radius = 1000.0f
    );
-   void setLightPosition(const glm::vec4& light_position, int index)
-   {
-      assert( 0 <= index && index < Positions.size() );
-      Positions[index] = light_position;
-   }
+   void setLightPosition(const glm::vec4& light_position, int index);
    void activateLight(const int& light_index);
    void deactivateLight(const int& light_index);
-   void transferUniformsToShader(const ShaderGL* shader);
+   // Uploads what changed since the last call and binds the block to LightBinding.
+   void updateLightBuffer();
+   // Bins the lights into the clusters of the camera frustum on the CPU, uploads the header and the light range of
+   // every cluster to ClusterBinding and the light lists to ClusterLightIndexBinding, and binds both.
+   void updateClusterBuffers(const CameraGL* camera, const glm::ivec2& viewport_size);
+   // One sphere per light in eye coordinates that bounds everything it lights; see LightClusterBuilder::build.
+   void getBoundingSpheres(std::vector<glm::vec4>& spheres_in_ec, const glm::mat4& view_matrix) const;
+   [[nodiscard]] const LightClusterBuilder& getClusters() const { return Clusters; }
    [[nodiscard]] int getTotalLightNum() const { return TotalLightNum; }
    [[nodiscard]] glm::vec4 getLightPosition(int light_index) { return Positions[light_index]; }
+   // Increases with every change, so a consumer can tell whether the lights moved since it last looked.
+   [[nodiscard]] uint64_t getVersion() const { return Version; }
+   [[nodiscard]] const UploadStats& getUploadStats() const { return Stats; }
+   [[nodiscard]] size_t getLightBlockSize() const
+   {
+      return sizeof( LightBlockHeader ) + sizeof( LightBlockElement ) * static_cast<size_t>(TotalLightNum);
+   }
+   void resetUploadStats() { Stats = UploadStats{}; }
+   // The block as the shaders read it, built from the current settings, for renderers on the CPU.
+   [[nodiscard]] LightBlockHeader getLightBlockHeader() const;
+   [[nodiscard]] LightBlockElement getLightBlockElement(int light_index) const;
 
 private:
+   // The groups of LightBlockElement members that are marked dirty together, in the order of their offsets.
+   enum LightField : uint8_t {
+      PositionField = 1u << 0,
+      ColorField = 1u << 1,
+      SpotlightField = 1u << 2,
+      FallOffField = 1u << 3,
+      SwitchField = 1u << 4,
+      AllFields = (1u << 5) - 1
+   };
+
+   // std430 layout of the header of the cluster block, followed by one uvec2 range per cluster.
+   struct ClusterBlockHeader
+   {
+      glm::ivec4 GridSize;
+      glm::vec4 Parameters; // tile width and height in pixels, and the scale and bias of the depth slices
+   };
+
+   bool HeaderChanged;
+   uint64_t Version;
+   uint64_t UploadedVersion;
+   UploadStats Stats;
+   std::vector<uint8_t> DirtyFields; // LightField bits per light
+   std::vector<int> DirtyLights; // every light with dirty fields, once
+   GLuint LightBuffer;
+   GLsizeiptr LightBufferSize;
+   std::vector<uint8_t> LightBlock;
+   LightClusterBuilder Clusters;
+   std::vector<glm::vec4> BoundingSpheres;
+   std::vector<uint8_t> ClusterBlock;
+   GLuint ClusterBuffer;
+   GLsizeiptr ClusterBufferSize;
+   GLuint ClusterLightIndexBuffer;
+   GLsizeiptr ClusterLightIndexBufferSize;
    bool TurnLightOn;
    int TotalLightNum;
    glm::vec4 GlobalAmbientColor;
@@ -44,4 +138,12 @@ private:
    std::vector<float> SpotlightCutoffAngles;
    std::vector<float> SpotlightFeathers;
    std::vector<float> FallOffRadii;
+
+   void markDirty(int light_index, uint8_t fields);
+   void writeLightBlockElement(int light_index);
+   // Appends the byte range of the given fields of a light in the block, merging it with the last range if they
+   // touch or are at most one element apart, since a few extra bytes cost less than another call.
+   static void addDirtyRange(std::vector<std::pair<GLintptr, GLintptr>>& ranges, int light_index, uint8_t fields);
+   // Rewrites the buffer, and reallocates it with some headroom if the data does not fit.
+   static void uploadBuffer(GLuint& buffer, GLsizeiptr& buffer_size, const void* data, GLsizeiptr size);
 };
\ No newline at end of file
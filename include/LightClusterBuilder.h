@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ThreadPool.h"
+#include "InstructionSet.h"
+
+// Bins light bounding spheres into the clusters of a perspective view frustum: GridSize.x by GridSize.y screen tiles,
+// each split into GridSize.z depth slices that grow exponentially from the near to the far plane. Every cluster tests
+// only the lights of its own slice, eight at a time with AVX2, and the clusters are spread over the pool. It needs no
+// GL context, and the lists come out in light order for any number of threads.
+class LightClusterBuilder final
+{
+public:
+   explicit LightClusterBuilder(const glm::ivec3& grid_size = glm::ivec3(16, 9, 24));
+
+   [[nodiscard]] const glm::ivec3& getGridSize() const { return GridSize; }
+   [[nodiscard]] int getClusterNum() const { return GridSize.x * GridSize.y * GridSize.z; }
+   [[nodiscard]] int getClusterIndex(int x, int y, int z) const { return (z * GridSize.y + y) * GridSize.x + x; }
+   // The depth slice of a positive view depth; slice = log(depth) * scale + bias, which the shader evaluates too.
+   [[nodiscard]] float getSliceScale() const { return SliceScale; }
+   [[nodiscard]] float getSliceBias() const { return SliceBias; }
+   // Per cluster, the offset of its first light in getLightIndices() and its light count.
+   [[nodiscard]] const std::vector<glm::uvec2>& getClusterRanges() const { return ClusterRanges; }
+   [[nodiscard]] const std::vector<uint32_t>& getLightIndices() const { return LightIndices; }
+
+   // Recomputes the view space bounds of every cluster. It returns early if nothing changed since the last call.
+   void setFrustum(const glm::mat4& projection, float near_plane, float far_plane);
+
+   // spheres_in_ec holds one sphere per light, the center in eye coordinates and the radius in w. A negative radius
+   // skips the light, and an infinite one puts it into every cluster.
+   void build(
+      const std::vector<glm::vec4>& spheres_in_ec,
+      InstructionSet instruction_set = getSupportedInstructionSet()
+   );
+
+private:
+   struct ClusterBounds
+   {
+      glm::vec3 Min;
+      glm::vec3 Max;
+   };
+
+   // The lights that overlap one depth slice, as structure of arrays padded to a multiple of 8 with spheres that
+   // never pass the test.
+   struct SliceLights
+   {
+      std::vector<float> X;
+      std::vector<float> Y;
+      std::vector<float> Z;
+      std::vector<float> SquaredRadius;
+      std::vector<uint32_t> Index;
+
+      void clear();
+      void add(const glm::vec4& sphere, uint32_t index);
+      void pad();
+   };
+
+   glm::ivec3 GridSize;
+   glm::mat4 Projection;
+   float NearPlane;
+   float FarPlane;
+   float SliceScale;
+   float SliceBias;
+   std::vector<ClusterBounds> Bounds;
+   std::vector<SliceLights> Slices;
+   std::vector<std::vector<uint32_t>> ClusterLights;
+   std::vector<glm::uvec2> ClusterRanges;
+   std::vector<uint32_t> LightIndices;
+
+   [[nodiscard]] float getSliceDepth(int slice) const;
+   [[nodiscard]] int getSlice(float depth) const;
+   static void testSpheres(
+      std::vector<uint32_t>& lights,
+      const ClusterBounds& bounds,
+      const SliceLights& slice,
+      InstructionSet instruction_set
+   );
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+// Builds complete mip chains on the CPU. Each level is reduced from the previous one in parallel row bands, and every
+// texel only depends on its own footprint, so the result is the same for any number of threads.
+class MipmapBuilder final
+{
+public:
+   MipmapBuilder() = delete;
+
+   // floor(log2(max(width, height))) + 1, i.e. down to a 1x1 level
+   [[nodiscard]] static int getLevelNum(int width, int height);
+   [[nodiscard]] static int getLevelSize(int size, int level) { return std::max( size >> level, 1 ); }
+
+   // 8-bit texels of channel_num channels. levels[0] is a tightly packed copy of the source and each following level
+   // is the rounded box filter of the previous one.
+   static void buildColor(
+      std::vector<std::vector<uint8_t>>& levels,
+      const uint8_t* texels,
+      int width,
+      int height,
+      int channel_num,
+      std::ptrdiff_t row_stride
+   );
+
+   // Packed RGB normals in [0, 1]. Every level averages the unit normals of level 0 under its footprint, stores the
+   // renormalized direction in normal_levels and the length of the average in length_levels. A short average means
+   // the normals below it disagree, which the shader turns into a Toksvig factor for the specular exponent.
+   static void buildNormal(
+      std::vector<std::vector<float>>& normal_levels,
+      std::vector<std::vector<uint8_t>>& length_levels,
+      const float* normal_map,
+      int width,
+      int height
+   );
+
+private:
+   // The source range [first, last) that the destination texel (or row) d of a reduced level covers.
+   static void getFootprint(int& first, int& last, int d, int source_size, int destination_size);
+   static int getBandHeight(int width, int height);
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Object.h"
+
+// Baked wall assets on disk, one file per key. A file holds the mip chains of the base texture, the normal map and the
+// normal lengths exactly as they are uploaded, so a hit only maps the file and skips decoding, normal map generation
+// and mip building entirely.
+class NormalMapCache final
+{
+public:
+   explicit NormalMapCache(std::string directory_path);
+
+   // Hashes the source bytes together with every parameter that changes the baked result, including the size the
+   // source is resampled to (0 for none). Returns 0 if the source cannot be read. Bump Version in the source file
+   // whenever the generator output changes.
+   [[nodiscard]] static uint64_t getKey(
+      const std::string& source_path,
+      const glm::ivec2& size,
+      NormalMapGenerator::Format format,
+      std::optional<BlockCompressor::Format> base_texture_compression
+   );
+
+   // The asset points into the mapped file, which stays mapped as long as asset.Storage is alive.
+   [[nodiscard]] bool load(ObjectGL::NormalMapAsset& asset, uint64_t key) const;
+   bool store(const ObjectGL::NormalMapAsset& asset, uint64_t key) const;
+
+private:
+   std::string DirectoryPath;
+
+   [[nodiscard]] std::string getFilePath(uint64_t key) const;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "BlockCompressor.h"
+#include "InstructionSet.h"
+
+class NormalMapGenerator final
+{
+public:
+   // Texel formats a normal map can be stored in. The two-channel formats only keep x and y, and z is rebuilt in the
+   // fragment shader from the unit length. BC5 is RG8 block-compressed to 1 byte per texel.
+   enum class Format { RGB32F = 0, RGB16F, RGB10A2, RG16, RG8, BC5 };
+
+   NormalMapGenerator() = delete;
+
+   [[nodiscard]] static int getBytesPerTexel(Format format);
+   [[nodiscard]] static bool isTwoChannel(Format format)
+   {
+      return format == Format::RG16 || format == Format::RG8 || format == Format::BC5;
+   }
+
+   // Streams over 8-bit pixels and writes (width x height) RGB float normals packed into [0, 1].
+   // The grayscale conversion, 5x5 gaussian blur (sigma = 1), 3x3 sobel and normal packing are fused into one pass
+   // that only keeps a few line buffers per band of rows. A negative row_stride walks the image upside down.
+   // The bands are band_height rows high, or sized for the thread pool if it is not positive; the result is the same
+   // either way.
+   static void generate(
+      float* normal_map,
+      const uint8_t* image,
+      int width,
+      int height,
+      int channel_num,
+      std::ptrdiff_t row_stride,
+      bool is_bgr,
+      InstructionSet instruction_set = getSupportedInstructionSet(),
+      int band_height = 0
+   );
+
+   // Converts packed RGB float normals to the tightly packed texels (or blocks) of the given format.
+   static void convert(std::vector<uint8_t>& texels, const float* normal_map, int width, int height, Format format);
+
+private:
+   struct LineBuffers
+   {
+      std::vector<float> Gray;
+      std::vector<float> HorizontalBlurred[5];
+      std::vector<float> Blurred[3];
+      int HorizontalBlurredRow[5];
+      int BlurredRow[3];
+
+      explicit LineBuffers(int width);
+   };
+
+   static int reflect101(int p, int length);
+   static void convertToGray(float* gray, const uint8_t* row, int width, int channel_num, bool is_bgr);
+   static void blurHorizontally(float* out, const float* gray, int width, InstructionSet instruction_set);
+   static void blurVertically(float* out, const float* const* rows, int width, InstructionSet instruction_set);
+   static void packNormals(float* out, const float* const* rows, int width, InstructionSet instruction_set);
+   static void generateBand(
+      float* normal_map,
+      const uint8_t* image,
+      int width,
+      int height,
+      int channel_num,
+      std::ptrdiff_t row_stride,
+      bool is_bgr,
+      InstructionSet instruction_set,
+      int first_row,
+      int last_row
+   );
+};
\ No newline at end of file
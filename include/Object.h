@@ -1,11 +1,50 @@
 #pragma once
 
 #include "Shader.h"
+#include "NormalMapGenerator.h"
+#include "MipmapBuilder.h"
+#include "Image.h"
+#include "TextureUploader.h"
 
 class ObjectGL
 {
 public:
-   enum LayoutLocation { VertexLoc = 0, NormalLoc, TextureLoc, TangentLoc };
+   enum LayoutLocation {
+      VertexLoc = 0, NormalLoc, TextureLoc, TangentLoc, InstanceWorldLoc, InstanceLayerLoc = InstanceWorldLoc + 4
+   };
+
+   // CPU-side inputs of a normal-mapped object. It needs no GL context, so it can be prepared on any thread.
+   // Every texture holds one pointer per mip level into Storage, which is either the baked buffers or a mapped cache
+   // file. Without compression, the base texture is tightly packed 32-bit texels. NormalLength keeps the length of the
+   // averaged normals per level in 8 bits, for the Toksvig factor of the specular exponent.
+   struct NormalMapAsset
+   {
+      int Width = 0;
+      int Height = 0;
+      int LevelNum = 0;
+      std::optional<BlockCompressor::Format> BaseTextureCompression;
+      bool IsBaseTextureBGR = false;
+      NormalMapGenerator::Format NormalMapFormat = NormalMapGenerator::Format::RG16;
+      std::vector<const uint8_t*> BaseTexture;
+      std::vector<const uint8_t*> NormalMap;
+      std::vector<const uint8_t*> NormalLength;
+      std::shared_ptr<const void> Storage;
+
+      [[nodiscard]] size_t getBaseTextureSize(int level) const;
+      [[nodiscard]] size_t getNormalMapSize(int level) const;
+      [[nodiscard]] size_t getNormalLengthSize(int level) const;
+   };
+
+   // The material as one std430 array element, for shaders that look materials up by index instead of uniforms.
+   struct MaterialBlock
+   {
+      glm::vec4 EmissionColor;
+      glm::vec4 AmbientColor;
+      glm::vec4 DiffuseColor;
+      glm::vec4 SpecularColor;
+      float SpecularExponent;
+      float Padding[3];
+   };
 
    ObjectGL();
    ~ObjectGL();
@@ -48,12 +87,67 @@ public:
       const std::string& texture_file_path,
       bool is_grayscale = false
    );
+   // The unit square of setSquareObjectForNormalMap as triangles, for consumers that draw it without GL.
+   static void getSquareObjectForNormalMap(
+      std::vector<glm::vec3>& vertices,
+      std::vector<glm::vec3>& normals,
+      std::vector<glm::vec2>& textures,
+      std::vector<glm::vec3>& tangents
+   );
+   // The squares below share one vertex buffer by default. An object whose vertices are going to be updated needs its
+   // own, so it turns the sharing off before it is set.
+   void setGeometrySharing(bool share_geometry) { ShareGeometry = share_geometry; }
    void setSquareObjectForNormalMap(GLenum draw_mode, const std::string& texture_file_path);
+   void setSquareObjectForNormalMap(GLenum draw_mode, const NormalMapAsset& asset);
+   // A square whose base texture, normal map and normal lengths are texture arrays of layer_num layers. Every layer
+   // must be set from an asset of the same size and formats, and each instance picks the layer it samples.
+   void setSquareObjectForNormalMapArray(
+      GLenum draw_mode,
+      int width,
+      int height,
+      int layer_num,
+      NormalMapGenerator::Format format,
+      std::optional<BlockCompressor::Format> base_texture_compression
+   );
+   bool setNormalMapArrayLayer(int layer, const NormalMapAsset& asset);
+   void setInstances(const std::vector<glm::mat4>& world_matrices, const std::vector<int>& layers);
+   [[nodiscard]] static bool prepareNormalMapAsset(
+      NormalMapAsset& asset,
+      const std::string& texture_file_path,
+      NormalMapGenerator::Format format = NormalMapGenerator::Format::RG16,
+      std::optional<BlockCompressor::Format> base_texture_compression = std::nullopt
+   );
+   [[nodiscard]] static bool prepareNormalMapAsset(
+      NormalMapAsset& asset,
+      std::shared_ptr<const Image> image,
+      NormalMapGenerator::Format format = NormalMapGenerator::Format::RG16,
+      std::optional<BlockCompressor::Format> base_texture_compression = std::nullopt
+   );
    int addTexture(const std::string& texture_file_path, bool is_grayscale = false);
+   int addTexture(const Image& image);
    void addTexture(int width, int height, bool is_grayscale = false);
    int addTexture(const uint8_t* image_buffer, int width, int height, bool is_grayscale = false);
    int addTexture(const float* image_buffer, int width, int height);
-   void transferUniformsToShader(const ShaderGL* shader);
+   int addTexture(
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      GLenum internal_format,
+      GLenum pixel_format
+   );
+   int addNormalMapTexture(
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      NormalMapGenerator::Format format
+   );
+   int addCompressedTexture(
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      BlockCompressor::Format format
+   );
+   [[nodiscard]] MaterialBlock getMaterialBlock() const;
    void updateDataBuffer(const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals);
    void updateDataBuffer(
       const std::vector<glm::vec3>& vertices,
@@ -62,11 +156,24 @@ public:
    );
    void replaceVertices(const std::vector<glm::vec3>& vertices, bool normals_exist, bool textures_exist);
    void replaceVertices(const std::vector<float>& vertices, bool normals_exist, bool textures_exist);
+   // Writes the vertices of the next frame straight into the vertex buffer. beginVertexUpdate() returns the
+   // interleaved floats of every vertex, which already hold the last update, and endVertexUpdate() hands the ones in
+   // [first_vertex, first_vertex + vertex_num) to the draws from then on. The buffer keeps the size it was set with.
+   [[nodiscard]] GLfloat* beginVertexUpdate();
+   void endVertexUpdate(int first_vertex, int vertex_num);
+   // The vertices an update can hold, or 0 if the vertices cannot be updated.
+   [[nodiscard]] int getVertexCapacity() const;
    [[nodiscard]] GLuint getVAO() const { return VAO; }
    [[nodiscard]] GLenum getDrawMode() const { return DrawMode; }
    [[nodiscard]] GLsizei getVertexNum() const { return VerticesCount; }
+   [[nodiscard]] GLsizei getVertexStride() const { return VertexStride; }
+   [[nodiscard]] GLsizei getInstanceNum() const { return InstancesCount; }
    [[nodiscard]] GLuint getTextureID(int index) const { return TextureID[index]; }
    [[nodiscard]] int getTextureNum() const { return static_cast<int>(TextureID.size()); }
+   [[nodiscard]] NormalMapGenerator::Format getNormalMapFormat() const { return NormalMapFormat; }
+   [[nodiscard]] static size_t getSharedGeometryNum() { return GeometryRegistry.size(); }
+   // Every texture upload goes through the uploader from then on, or directly from client memory with nullptr.
+   static void setTextureUploader(TextureUploaderGL* uploader);
 
    template<typename T>
    void addShaderStorageBufferObject(const std::string& name, GLuint binding_index, int data_size)
@@ -103,14 +210,53 @@ public:
    }
 
 private:
+   // The VAO and VBO of a mesh that never changes after it is set. Every object with identical vertex data refers to
+   // the same one, which is deleted with its last user.
+   struct SharedGeometry
+   {
+      GLuint VAO = 0;
+      GLuint VBO = 0;
+      std::string Key;
+
+      ~SharedGeometry();
+   };
+
+   // The vertex buffer of an object whose vertices are updated, split into RegionNum regions that take turns. The
+   // draws read from one region while the next is written, and a fence behind the draws of every region keeps it from
+   // being written again too early. Each region tracks the bytes it lags behind the latest one, and catches up on
+   // exactly those before its own update, so an update that touches a few vertices copies only those.
+   struct StreamedVertexBuffer
+   {
+      inline static constexpr int RegionNum = 3;
+
+      uint8_t* Mapped = nullptr; // mapped for as long as the buffer lives
+      GLsizeiptr RegionSize = 0;
+      int Current = 0; // the region the draws read from
+      int Next = -1; // the region being written between beginVertexUpdate() and endVertexUpdate()
+      std::array<GLsync, RegionNum> Fences{};
+      std::array<GLintptr, RegionNum> StaleBegin{};
+      std::array<GLintptr, RegionNum> StaleEnd{};
+   };
+
+   inline static std::unordered_map<std::string, std::weak_ptr<SharedGeometry>> GeometryRegistry;
+   inline static TextureUploaderGL* TextureUploader = nullptr;
+
    uint8_t* ImageBuffer;
    std::vector<GLfloat> DataBuffer; // 3 for vertex, 3 for normal, 2 for texture, and 3 for tangent
    GLuint VAO;
    GLuint VBO;
+   GLsizei VertexStride;
+   std::unique_ptr<StreamedVertexBuffer> Streamed; // set on the first update of the vertices
    GLenum DrawMode;
    std::vector<GLuint> TextureID;
    std::map<std::string, GLuint> CustomBuffers;
    GLsizei VerticesCount;
+   bool ShareGeometry;
+   std::shared_ptr<SharedGeometry> Geometry;
+   GLuint InstanceBuffer;
+   GLsizei InstancesCount;
+   NormalMapGenerator::Format NormalMapFormat;
+   NormalMapAsset TextureArrayLayout; // the size and formats every layer has to match, without texels
    glm::vec4 EmissionColor;
    glm::vec4 AmbientReflectionColor; // It is usually set to the same color with DiffuseReflectionColor.
                                      // Otherwise, it should be in balance with DiffuseReflectionColor.
@@ -118,20 +264,56 @@ private:
    glm::vec4 SpecularReflectionColor;
    float SpecularReflectionExponent;
 
-   [[nodiscard]] bool prepareTexture2DUsingFreeImage(const std::string& file_path, bool is_grayscale) const;
+   void prepareTexture2D(const Image& image) const;
+   GLuint prepareTextureStorage(GLenum internal_format, int width, int height, int level_num);
+   GLuint prepareTextureArrayStorage(GLenum internal_format, int width, int height, int level_num, int layer_num);
+   void prepareSquareObjectForNormalMap(GLenum draw_mode);
+   [[nodiscard]] static GLenum getCompressedInternalFormat(BlockCompressor::Format format);
+   static void getNormalMapTexelFormat(
+      GLenum& internal_format,
+      GLenum& pixel_format,
+      GLenum& type,
+      NormalMapGenerator::Format format
+   );
+   // Upload the levels into a 2D texture, or into a layer of an array texture if layer is not negative, through the
+   // uploader if there is one.
+   static void uploadTextureLevels(
+      GLuint texture_id,
+      int layer,
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      GLenum pixel_format,
+      GLenum type,
+      int alignment = 1
+   );
+   static void uploadCompressedTextureLevels(
+      GLuint texture_id,
+      int layer,
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      BlockCompressor::Format format
+   );
    void prepareTexture(bool normals_exist) const;
    void prepareTangent() const;
+   // Deletes the vertex array and the vertex buffer, unless they are shared, along with the fences and the mapping of
+   // a streamed buffer, so that the vertices can be set again.
+   void releaseVertexBuffer();
    void prepareVertexBuffer(int n_bytes_per_vertex);
+   void prepareVertexArray(int n_bytes_per_vertex);
+   void prepareVertexArrayForNormalMap();
+   void prepareStreamedVertexBuffer();
    void prepareNormal() const;
    static void getSquareObject(
       std::vector<glm::vec3>& vertices,
       std::vector<glm::vec3>& normals,
       std::vector<glm::vec2>& textures
    );
-   void calculateTangent(
+   static void calculateTangent(
       std::vector<glm::vec3>& tangents, 
       const std::vector<glm::vec3>& vertices, 
       const std::vector<glm::vec2>& textures
-   ) const;
-   void calculateNormalMap(cv::Mat& normal_map, const std::string& texture_file_path) const;
+   );
+   static void calculateNormalMap(std::vector<float>& normal_map, const Image& image);
 };
\ No newline at end of file
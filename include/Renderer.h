@@ -11,7 +11,12 @@
 
 #include "_Common.h"
 #include "Light.h"
-#include "Object.h"
+#include "GBuffer.h"
+#include "DrawQueue.h"
+#include "HeadlessContext.h"
+#include "SoftwareRenderer.h"
+#include "FrameCapture.h"
+#include "NormalMapCache.h"
 
 class RendererGL
 {
@@ -22,26 +27,121 @@ public:
    RendererGL& operator=(const RendererGL&&) = delete;
 
 
-   RendererGL();
-   ~RendererGL() = default;
+   // Renders a fixed number of frames into an offscreen framebuffer instead of a window, for benchmarks and batch runs
+   // on machines without a display or GPU, and reports the CPU and GPU time of every frame.
+   struct HeadlessSettings
+   {
+      int FrameNum = 300;
+      glm::ivec2 FrameSize = glm::ivec2(1920, 1080);
+      // One keyframe per line, "eye_x eye_y eye_z target_x target_y target_z", spread evenly over the frames.
+      // Without a path, the camera keeps its initial view.
+      std::string CameraPathFile;
+      std::string ImageDirectory; // every ImageInterval-th frame is written there, if it is not empty
+      int ImageInterval = 1;
+      FrameEncoder::Format ImageFormat = FrameEncoder::Format::PNG;
+      int ImageThreadNum = 2; // threads that encode the frames while the next ones render
+      std::string TimingFile; // the CPU and GPU time of every frame as CSV, if it is not empty
+      bool UseInstancing = true;
+      bool UseClusteredLights = false;
+      bool UseDeferredShading = false;
+      int RandomLightNum = 0;
+      glm::ivec2 WallGridSize = glm::ivec2(3, 3);
+      // Draws the walls with SoftwareRenderer instead, without creating any GL context. It reports the CPU time and
+      // the shaded pixels per second, and ignores the clustered, deferred and instancing options.
+      bool UseSoftwareRenderer = false;
+      // Draws every GL frame with SoftwareRenderer as well and fails the run if the PSNR of any frame against it is
+      // below MinSoftwarePSNR. The software frames use the same wall textures as the GL path, and the timings include
+      // the comparison.
+      bool CompareWithSoftwareRenderer = false;
+      // Shrinks the walls step by step and snaps them back to full size through updates of their vertices, the right
+      // edges on even frames and the top edges on odd ones. The comparison with SoftwareRenderer then only counts the
+      // frames in which every wall is at its full size.
+      bool AnimateWalls = false;
+   };
+   inline static constexpr double MinSoftwarePSNR = 48.0; // in dB over RGB
 
-   void play();
+   explicit RendererGL(std::optional<HeadlessSettings> headless = std::nullopt);
+   ~RendererGL();
+
+   // Returns false if no context could be created, or if a headless run could not start or failed its comparison with
+   // the software renderer.
+   bool play();
 
 private:
+   // Bits of the wall shader permutations, in the order of the feature names that initialize() passes to ShaderGL.
+   enum WallShaderFeature : uint32_t {
+      TextureFeature = 1u << 0,
+      BumpMappingFeature = 1u << 1,
+      LightFeature = 1u << 2,
+      TwoChannelNormalMapFeature = 1u << 3,
+      SpotlightFeature = 1u << 4,
+      ClusteredLightsFeature = 1u << 5,
+      InstancedFeature = 1u << 6,
+      GBufferPassFeature = 1u << 7
+   };
+   // The deferred geometry pass only compiles these features in, and the lighting pass only the others.
+   inline static constexpr uint32_t GeometryPassFeatures =
+      TextureFeature | BumpMappingFeature | TwoChannelNormalMapFeature;
+
+   // A wall object keeps the resolution of its source, while its layer of the instanced texture arrays is resampled to
+   // WallTextureSize. Both are the same asset if the source already has that size.
+   struct WallAsset
+   {
+      ObjectGL::NormalMapAsset Object;
+      ObjectGL::NormalMapAsset Layer;
+   };
+
+   inline static constexpr int WallAnimationPeriod = 60; // updates of an edge before it snaps back to full size
+   inline static constexpr float MaxWallShrink = 0.25f;
+   inline static constexpr GLuint WorldMatrixBinding = 1;
+   inline static constexpr GLuint DeferredMaterialBinding = 4;
    inline static RendererGL* Renderer = nullptr;
+   std::optional<HeadlessSettings> Headless;
+   std::unique_ptr<HeadlessContextGL> HeadlessContext; // declared early, so it outlives every GL object below
+   std::unique_ptr<TextureUploaderGL> TextureUploader; // null if the upload ring could not be mapped
+   bool IsInitialized; // false if no context could be created, in which case play() returns at once
    GLFWwindow* Window;
+   GLuint OutputFramebuffer; // 0 for the window, or the offscreen target of the headless mode
+   GLuint OutputRenderbuffers[2]; // color and depth of the offscreen target
    int FrameWidth;
    int FrameHeight;
    bool UseBumpMapping;
+   bool UseInstancing;
+   bool UseClusteredLights;
+   bool UseDeferredShading;
+   bool AnimateWalls;
+   uint32_t WallShaderFeatures; // the features of the current toggles, without the ones that depend on a wall
    float LightTheta;
+   int WallAnimationFrame;
+   glm::vec2 WallShrink; // how far the right and the top edges of the walls have moved in
+   int WallTextureSize;
+   glm::ivec2 WallGridSize; // columns and rows of wall tiles
+   std::vector<bool> WallLayerLoaded;
+   GLuint WallWorldMatrixBuffer; // the world matrix of every tile for the draws without instancing
+   glm::ivec2 WallWorldMatrixGridSize; // the grid that WallWorldMatrixBuffer holds the tiles of
+   GLuint DeferredMaterialBuffer; // the materials of the walls, the placeholder and the instanced walls, in this order
+   GLuint ScreenVAO; // empty, for the full screen triangle of the lighting pass
+   ShaderGL::UniformHandle MaterialIndexUniform;
+   std::vector<double> FrameTimes; // CPU time to upload and submit the recent frames, in milliseconds
+   NormalMapGenerator::Format NormalMapFormat;
+   std::optional<BlockCompressor::Format> BaseTextureCompression;
+   NormalMapCache WallAssetCache;
    glm::ivec2 ClickedPoint;
    std::unique_ptr<CameraGL> MainCamera;
    std::unique_ptr<ShaderGL> ObjectShader;
+   std::unique_ptr<ShaderGL> DeferredLightingShader;
+   std::unique_ptr<GBufferGL> GBuffer;
+   std::unique_ptr<DrawQueueGL> DrawQueue;
    std::vector<std::unique_ptr<ObjectGL>> WallObjects;
+   std::unique_ptr<ObjectGL> PlaceholderWall;
+   std::unique_ptr<ObjectGL> InstancedWalls;
+   std::vector<std::future<WallAsset>> WallAssets;
    std::unique_ptr<LightGL> Lights;
  
    void registerCallbacks() const;
-   void initialize();
+   [[nodiscard]] bool createWindow(bool visible);
+   [[nodiscard]] bool createHeadlessContext();
+   [[nodiscard]] bool initialize();
 
    void printOpenGLInformation() const;
 
@@ -61,7 +161,34 @@ private:
    static void reshapeWrapper(GLFWwindow* window, int width, int height);
 
    void setLights() const;
-   void setWallObject(int object_index);
-   void drawWallObject(const glm::mat4& to_world, int object_index);
+   void addRandomLights(int light_num) const;
+   void updateWallShaderFeatures();
+   void prewarmWallShaders() const;
+   [[nodiscard]] uint32_t getWallShaderFeatures(NormalMapGenerator::Format format) const;
+   void setPlaceholderWallObject() const;
+   void setInstancedWallObjects();
+   void requestWallObjects();
+   void setWallObject(int object_index, const ObjectGL::NormalMapAsset& asset);
+   void uploadLoadedWallObjects();
+   void updateWallGrid();
+   void updateWallVertices();
+   void drawWallObjects(bool geometry_pass);
+   void drawInstancedWallObjects(bool geometry_pass);
+   void updateDeferredMaterialBuffer();
+   void drawDeferred(const glm::ivec2& viewport_size);
+   [[nodiscard]] glm::ivec2 getFramebufferSize() const;
+   [[nodiscard]] glm::vec4 getAnimatedLightPosition() const;
    void render();
+   void advanceAnimation();
+   void prepareScene();
+   [[nodiscard]] static bool readCameraPath(
+      std::vector<std::pair<glm::vec3, glm::vec3>>& keyframes,
+      const std::string& file_path
+   );
+   void setCameraOnPath(const std::vector<std::pair<glm::vec3, glm::vec3>>& keyframes, float t) const;
+   [[nodiscard]] SoftwareRenderer::Features getSoftwareFeatures() const;
+   void setSoftwareScene(SoftwareRenderer& software_renderer, bool use_layer_assets);
+   [[nodiscard]] double compareWithSoftwareRenderer(SoftwareRenderer& software_renderer) const;
+   [[nodiscard]] bool playHeadless();
+   [[nodiscard]] bool playSoftware();
 };
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "LightClusterBuilder.h"
+#include "NormalMapGenerator.h"
+#include "Image.h"
+
+// Checks of the CPU halves of the asset and light pipelines that need no GL context. Each one prints what it measured
+// and returns false if a result falls outside its stated bound, so that a script can run it from the command line.
+class SelfCheck final
+{
+public:
+   // PSNR floors in dB for the sample walls: BC1 over RGB, BC7 over RGBA and BC5 over the RG of the normal map.
+   inline static constexpr double MinBC1PSNR = 27.0;
+   inline static constexpr double MinBC7PSNR = 34.0;
+   inline static constexpr double MinBC5PSNR = 35.0;
+
+   SelfCheck() = delete;
+
+   // Encodes every .jpg in the directory as the walls are encoded, decodes the blocks back and compares the PSNR
+   // against the floors above.
+   [[nodiscard]] static bool checkBlockCompression(const std::string& sample_directory_path);
+
+   // Bins random spheres, including skipped and infinite ones, into the clusters of a perspective frustum with the
+   // scalar and the AVX2 test. Both must give identical lists, and every point sampled inside a sphere must fall into a
+   // cluster that lists its light.
+   [[nodiscard]] static bool checkLightClusters();
+
+   // Generates normal maps of random images with every supported instruction set, in one band and in bands of a few
+   // rows, and requires all of them to match the scalar map of one band byte for byte.
+   [[nodiscard]] static bool checkNormalMaps();
+
+private:
+   inline static constexpr int ClusterCheckLightNum = 4000;
+   inline static constexpr int ClusterCheckSampleNum = 32; // points per light
+   // An odd width leaves a tail after the last full vector of every row, and the thin bands each start cold.
+   inline static constexpr int NormalMapCheckWidth = 301;
+   inline static constexpr int NormalMapCheckHeight = 203;
+   inline static constexpr int NormalMapCheckBandHeight = 3;
+
+   [[nodiscard]] static double getRoundTripPSNR(
+      const std::vector<uint8_t>& reference,
+      const uint8_t* texels,
+      int width,
+      int height,
+      int channel_num,
+      std::ptrdiff_t row_stride,
+      bool is_bgr,
+      BlockCompressor::Format format
+   );
+   [[nodiscard]] static bool containsLight(const LightClusterBuilder& builder, int cluster, uint32_t light_index);
+};
@@ -1,38 +1,32 @@
 ﻿#pragma once
 
 #include "_Common.h"
-#include "Camera.h"
 
 class ShaderGL
 {
 public:
-   struct LightLocationSet
-   {
-      GLint LightSwitch, LightPosition;
-      GLint LightAmbient, LightDiffuse, LightSpecular, LightFallOffRadius;
-      GLint SpotlightDirection, SpotlightCutoffAngle, SpotlightFeather;
-
-      LightLocationSet() : LightSwitch( 0 ), LightPosition( 0 ), LightAmbient( 0 ), LightDiffuse( 0 ),
-      LightSpecular( 0 ), LightFallOffRadius( 0 ), SpotlightDirection( 0 ), SpotlightCutoffAngle( 0 ),
-      SpotlightFeather( 0 ) {}
-   };
-
    struct LocationSet
    {
-      GLint World, View, Projection, ModelViewProjection;
       GLint MaterialEmission, MaterialAmbient, MaterialDiffuse, MaterialSpecular, MaterialSpecularExponent;
-      std::map<GLint, GLint> Texture; // <binding point, texture id>
-      GLint UseTexture, UseLight, LightNum, GlobalAmbient;
-      std::vector<LightLocationSet> Lights;
+      GLint Texture[3]; // the samplers of the texture units 0 to 2
 
-      LocationSet() : World( 0 ), View( 0 ), Projection( 0 ), ModelViewProjection( 0 ), MaterialEmission( 0 ),
-      MaterialAmbient( 0 ), MaterialDiffuse( 0 ), MaterialSpecular( 0 ), MaterialSpecularExponent( 0 ),
-      UseTexture( 0 ), UseLight( 0 ), LightNum( 0 ), GlobalAmbient( 0 ) {}
+      LocationSet() : MaterialEmission( 0 ), MaterialAmbient( 0 ), MaterialDiffuse( 0 ), MaterialSpecular( 0 ),
+      MaterialSpecularExponent( 0 ), Texture{ -1, -1, -1 } {}
    };
 
+   // A custom uniform resolved once by name. Setting it through its handle is an array index, and the permutations
+   // of a shader resolve the same names in the same order, so one handle is valid for all of them.
+   using UniformHandle = int;
+
    ShaderGL();
    virtual ~ShaderGL();
 
+   // Linked programs are kept on disk, keyed by their preprocessed sources and the driver, and setShader loads them
+   // back instead of compiling. Nothing is cached until a directory is set.
+   static void setProgramBinaryCacheDirectory(const std::string& directory_path);
+   [[nodiscard]] static int getProgramBinaryHitNum() { return ProgramBinaryHitNum; }
+   [[nodiscard]] static int getProgramBinaryMissNum() { return ProgramBinaryMissNum; }
+
    void setShader(
       const char* vertex_shader_path,
       const char* fragment_shader_path,
@@ -40,67 +34,54 @@ public:
       const char* tessellation_control_shader_path = nullptr,
       const char* tessellation_evaluation_shader_path = nullptr
    );
+   // Permutations compile the same sources with a #define for every feature bit that is set, where bit i defines
+   // feature_names[i]. Each one is a program of its own, compiled on its first request and cached by its bits.
+   void setShaderPermutations(
+      const char* vertex_shader_path,
+      const char* fragment_shader_path,
+      const std::vector<std::string>& feature_names
+   );
+   [[nodiscard]] ShaderGL* getPermutation(uint32_t features);
+   void prewarmPermutations(const std::vector<uint32_t>& feature_sets);
+   [[nodiscard]] size_t getPermutationNum() const { return Permutations.size(); }
    void setComputeShaders(const std::vector<const char*>& compute_shader_paths);
-   void setUniformLocations(int light_num);
-   void addUniformLocation(const std::string& name);
-   void addUniformLocationToComputeShader(const std::string& name, int shader_index);
-   void transferBasicTransformationUniforms(const glm::mat4& to_world, const CameraGL* camera, bool use_texture = false) const;
+   void setUniformLocations();
+   UniformHandle addUniformLocation(const std::string& name);
+   UniformHandle addUniformLocationToComputeShader(const std::string& name, int shader_index);
    [[nodiscard]] GLuint getShaderProgram() const { return ShaderProgram; }
-   [[nodiscard]] GLint getLocation(const std::string& name) const { return CustomLocations.find( name )->second; }
+   [[nodiscard]] GLint getLocation(UniformHandle handle) const { return CustomLocations[handle]; }
    [[nodiscard]] GLint getMaterialEmissionLocation() const { return Location.MaterialEmission; }
    [[nodiscard]] GLint getMaterialAmbientLocation() const { return Location.MaterialAmbient; }
    [[nodiscard]] GLint getMaterialDiffuseLocation() const { return Location.MaterialDiffuse; }
    [[nodiscard]] GLint getMaterialSpecularLocation() const { return Location.MaterialSpecular; }
    [[nodiscard]] GLint getMaterialSpecularExponentLocation() const { return Location.MaterialSpecularExponent; }
-   [[nodiscard]] GLint getLightAvailabilityLocation() const { return Location.UseLight; }
-   [[nodiscard]] GLint getLightNumLocation() const { return Location.LightNum; }
-   [[nodiscard]] GLint getGlobalAmbientLocation() const { return Location.GlobalAmbient; }
-   [[nodiscard]] GLint getLightSwitchLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightSwitch;
-   }
-   [[nodiscard]] GLint getLightPositionLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightPosition;
-   }
-   [[nodiscard]] GLint getLightAmbientLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightAmbient;
-   }
-   [[nodiscard]] GLint getLightDiffuseLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightDiffuse;
-   }
-   [[nodiscard]] GLint getLightSpecularLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightSpecular;
-   }
-   [[nodiscard]] GLint getLightSpotlightDirectionLocation(int light_index) const
-   {
-      return Location.Lights[light_index].SpotlightDirection;
-   }
-   [[nodiscard]] GLint getLightSpotlightCutoffAngleLocation(int light_index) const
-   {
-      return Location.Lights[light_index].SpotlightCutoffAngle;
-   }
-   [[nodiscard]] GLint getLightSpotlightFeatherLocation(int light_index) const
-   {
-      return Location.Lights[light_index].SpotlightFeather;
-   }
-   [[nodiscard]] GLint getLightFallOffRadiusLocation(int light_index) const
-   {
-      return Location.Lights[light_index].LightFallOffRadius;
-   }
 
 protected:
+   inline static constexpr int MaxIncludeDepth = 8;
+   inline static std::string ProgramBinaryCacheDirectory;
+   inline static int ProgramBinaryHitNum = 0;
+   inline static int ProgramBinaryMissNum = 0;
+
    GLuint ShaderProgram;
    LocationSet Location;
-   std::unordered_map<std::string, GLint> CustomLocations;
+   std::vector<GLint> CustomLocations;
+   std::unordered_map<std::string, UniformHandle> CustomHandles;
    std::vector<GLuint> ComputeShaderPrograms;
+   std::string Defines;
+   std::string PermutationVertexShaderPath;
+   std::string PermutationFragmentShaderPath;
+   std::vector<std::string> FeatureNames;
+   std::vector<std::string> PermutationUniformNames;
+   std::unordered_map<uint32_t, std::unique_ptr<ShaderGL>> Permutations;
 
-   static void readShaderFile(std::string& shader_contents, const char* shader_path);
+   static void readShaderFile(std::string& shader_contents, const char* shader_path, int include_depth = 0);
+   static void insertDefines(std::string& shader_contents, const std::string& defines);
    [[nodiscard]] static std::string getShaderTypeString(GLenum shader_type);
    [[nodiscard]] static bool checkCompileError(GLenum shader_type, GLuint shader);
-   [[nodiscard]] static GLuint getCompiledShader(GLenum shader_type, const char* shader_path);
-   void setBasicTransformationUniforms();
+   [[nodiscard]] static GLuint getCompiledShader(GLenum shader_type, const std::string& shader_contents);
+   [[nodiscard]] static uint64_t getProgramBinaryKey(const std::vector<std::pair<GLenum, std::string>>& sources);
+   [[nodiscard]] static std::string getProgramBinaryPath(uint64_t key);
+   [[nodiscard]] bool loadProgramBinary(uint64_t key);
+   void storeProgramBinary(uint64_t key) const;
+   [[nodiscard]] UniformHandle getOrAddUniformHandle(const std::string& name);
 };
\ No newline at end of file
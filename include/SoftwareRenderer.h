@@ -0,0 +1,268 @@
+#pragma once
+
+#include "Light.h"
+#include "Camera.h"
+#include "Object.h"
+#include "InstructionSet.h"
+
+// Draws normal-mapped meshes on the CPU the way BumpMapping.vert and BumpMapping.frag do without clustered lights: the
+// same vertex stage, tangent space normal mapping with the Toksvig factor, attenuation and feathered spotlights,
+// trilinear sampling with GL_REPEAT and a GL_LESS depth test. It needs no GL context, so it is both the reference the
+// GL output is compared with and a fallback renderer where there is no GPU.
+// The triangles are binned into TileSize x TileSize tiles that the pool renders in parallel. A tile first keeps the
+// nearest triangle of every pixel and then shades each pixel once, 4x2 pixels at a time. These are two 2x2 quads,
+// whose differences give the texture derivatives as on a GPU, and both passes run them 8 wide with AVX2.
+class SoftwareRenderer final
+{
+public:
+   inline static constexpr int TileSize = 64;
+
+   // The shader features that change the result. USE_SPOTLIGHT needs no switch, because a light with a cutoff angle of
+   // 180 degrees or more is lit the same with or without it.
+   struct Features
+   {
+      bool UseTexture = true;
+      bool UseBumpMapping = true;
+      bool UseLight = true;
+   };
+
+   struct FrameStats
+   {
+      int TriangleNum = 0; // after clipping to the near plane
+      size_t ShadedPixelNum = 0;
+      double Milliseconds = 0.0;
+   };
+
+   explicit SoftwareRenderer(const glm::ivec2& size);
+
+   [[nodiscard]] const glm::ivec2& getSize() const { return Size; }
+   // Tightly packed RGBA8 rows from the bottom up, as glReadPixels returns them.
+   [[nodiscard]] const std::vector<uint8_t>& getColor() const { return Color; }
+   [[nodiscard]] const FrameStats& getFrameStats() const { return Stats; }
+   void setSize(const glm::ivec2& size);
+   void setClearColor(const glm::vec4& clear_color) { ClearColor = clear_color; }
+
+   // A triangle list with the attributes of ObjectGL::getSquareObjectForNormalMap; returns the index to draw it with.
+   int addMesh(
+      const std::vector<glm::vec3>& vertices,
+      const std::vector<glm::vec3>& normals,
+      const std::vector<glm::vec2>& textures,
+      const std::vector<glm::vec3>& tangents
+   );
+   // Decodes every level of the asset into texels the tiles sample directly. It returns the index or -1.
+   int addTexture(const ObjectGL::NormalMapAsset& asset);
+   void clearDraws() { Draws.clear(); }
+   void draw(
+      int mesh,
+      int texture,
+      const glm::mat4& world_matrix,
+      const ObjectGL::MaterialBlock& material
+   );
+   // Renders every draw in order into the color buffer, which is cleared first.
+   void render(
+      const CameraGL& camera,
+      const LightGL& lights,
+      const Features& features,
+      InstructionSet instruction_set = getSupportedInstructionSet()
+   );
+
+private:
+   inline static constexpr int MaxVertexLights = 4;
+   inline static constexpr int BlockWidth = 4;
+   inline static constexpr int BlockHeight = 2;
+   inline static constexpr int LaneNum = BlockWidth * BlockHeight;
+
+   // The outputs of the vertex stage, as consecutive floats of a vertex.
+   enum Varying {
+      PositionVarying = 0,
+      TexCoordVarying = 3,
+      NormalVarying = 5,
+      TangentVarying = 8,
+      BinormalVarying = 11,
+      ViewVectorVarying = 14,
+      LightVectorVarying = 17, // the vectors to the first MaxVertexLights lights in tangent space
+      VaryingNum = LightVectorVarying + 3 * MaxVertexLights
+   };
+
+   struct Vertex
+   {
+      glm::vec3 Position;
+      glm::vec3 Normal;
+      glm::vec2 TexCoord;
+      glm::vec3 Tangent;
+   };
+
+   struct ClipVertex
+   {
+      glm::vec4 Position;
+      std::array<float, VaryingNum> Varyings;
+   };
+
+   // Every level of a texture is in one array, so any lane can fetch from any level with one offset.
+   struct TextureLevel
+   {
+      int Offset;
+      int Width;
+      int Height;
+   };
+
+   struct Texture
+   {
+      int Width = 0;
+      int Height = 0;
+      bool IsTwoChannel = false;
+      std::vector<TextureLevel> Levels;
+      std::vector<uint32_t> Color; // RGBA8
+      std::vector<uint32_t> NormalXY; // the packed x and y of the normal map in 16 bits each
+      std::vector<uint32_t> NormalZLength; // the packed z and the normal length in 16 bits each
+   };
+
+   struct Draw
+   {
+      int Mesh;
+      int Texture;
+      glm::mat4 WorldMatrix;
+      ObjectGL::MaterialBlock Material;
+   };
+
+   // A light that is switched on, with what the fragment shader derives from its settings.
+   struct ShadingLight
+   {
+      int Index; // in the light block, which decides whether its vector comes from the vertex stage
+      bool IsPointLight;
+      bool IsSpotlight;
+      glm::vec4 Position;
+      glm::vec4 AmbientColor;
+      glm::vec4 DiffuseColor;
+      glm::vec4 SpecularColor;
+      glm::vec3 SpotlightDirection;
+      float SquaredRadius;
+      float CutoffAngle;
+      float CosCutoffAngle;
+      float FeatherThreshold;
+   };
+
+   // The screen space setup of a triangle. A plane p is evaluated as p.x * x + p.y * y + p.z at pixel centers. The
+   // edges take window coordinates, so that two triangles evaluate a shared edge alike, and every other plane takes
+   // the offset from the first pixel of Bounds to keep the precision.
+   struct Triangle
+   {
+      int Draw;
+      glm::ivec4 Bounds; // the first and last pixel in x and y, on the screen
+      std::array<glm::vec3, 3> Edges; // inside where all are positive, or zero on a top-left edge
+      std::array<bool, 3> IsTopLeft;
+      glm::vec3 Depth;
+      glm::vec3 InverseW;
+      std::array<glm::vec3, VaryingNum> Varyings; // varying / w, to interpolate with perspective
+   };
+
+   // The depth, the nearest triangle and the color of one tile, laid out in blocks of BlockWidth x BlockHeight.
+   struct TileBuffers
+   {
+      std::vector<float> Depths;
+      std::vector<int> TriangleIDs;
+      std::vector<uint32_t> Colors;
+   };
+
+   glm::ivec2 Size;
+   glm::ivec2 TileGridSize;
+   glm::vec4 ClearColor;
+   FrameStats Stats;
+   std::vector<uint8_t> Color;
+   std::vector<std::vector<Vertex>> Meshes;
+   std::vector<Texture> Textures;
+   std::vector<Draw> Draws;
+   std::vector<std::vector<Triangle>> DrawTriangles;
+   std::vector<Triangle> Triangles;
+   std::vector<std::vector<int>> Bins; // the triangles of every tile in draw order
+   std::vector<TileBuffers> WorkerTileBuffers; // one set per worker of render(), kept over tiles and frames
+   glm::vec4 GlobalAmbient;
+   std::vector<ShadingLight> ShadingLights;
+   int VertexLightNum;
+   std::array<glm::vec4, MaxVertexLights> VertexLightPositions; // switched on or not, as the vertex shader reads them
+
+   void prepareLights(const LightGL& lights, const Features& features);
+   void processVertex(
+      ClipVertex& out,
+      const Vertex& vertex,
+      const Draw& draw,
+      const glm::mat4& view_projection,
+      const glm::vec3& eye_position
+   ) const;
+   void setupTriangle(
+      std::vector<Triangle>& triangles,
+      const std::array<const ClipVertex*, 3>& vertices,
+      int draw_index
+   ) const;
+   void processDraw(
+      std::vector<Triangle>& triangles,
+      int draw_index,
+      const glm::mat4& view_projection,
+      const glm::vec3& eye_position
+   ) const;
+   void binTriangles();
+   size_t renderTile(TileBuffers& buffers, int tile, const Features& features, InstructionSet instruction_set);
+   // lambda of the GL specification from the coarse derivatives of a quad, i.e. its lanes 0 to 3
+   [[nodiscard]] static float getLevelOfDetail(const Texture& texture, const float* u, const float* v);
+   static void getMipLevels(int& level, int& next_level, float& weight, const Texture& texture, float lod);
+   [[nodiscard]] static glm::vec4 sampleLevel(
+      const std::vector<uint32_t>& texels,
+      const TextureLevel& level,
+      bool is_16_bit,
+      const glm::vec2& tex_coord
+   );
+   [[nodiscard]] static glm::vec4 sample(
+      const Texture& texture,
+      const std::vector<uint32_t>& texels,
+      bool is_16_bit,
+      const glm::vec2& tex_coord,
+      float lod
+   );
+   [[nodiscard]] static float getSpotlightFactor(const ShadingLight& light, const glm::vec3& position_in_mc);
+   [[nodiscard]] glm::vec4 shadePixel(
+      const float* varyings,
+      float lod,
+      const Draw& draw,
+      const Features& features
+   ) const;
+   // A block is 4x2 pixels from (x, y) in the tile, whose buffers keep the 8 pixels of every block together.
+   static void rasterizeBlockScalar(
+      float* depths,
+      int* triangle_ids,
+      const Triangle& triangle,
+      int triangle_id,
+      const glm::ivec2& tile_origin,
+      int x,
+      int y
+   );
+   static void rasterizeBlockAVX2(
+      float* depths,
+      int* triangle_ids,
+      const Triangle& triangle,
+      int triangle_id,
+      const glm::ivec2& tile_origin,
+      int x,
+      int y
+   );
+   // Both return the number of pixels they shaded.
+   int shadeBlockScalar(
+      uint32_t* colors,
+      const int* triangle_ids,
+      const Triangle& triangle,
+      int triangle_id,
+      const glm::ivec2& tile_origin,
+      int x,
+      int y,
+      const Features& features
+   ) const;
+   int shadeBlockAVX2(
+      uint32_t* colors,
+      const int* triangle_ids,
+      const Triangle& triangle,
+      int triangle_id,
+      const glm::ivec2& tile_origin,
+      int x,
+      int y,
+      const Features& features
+   ) const;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "_Common.h"
+
+// Mirrors the GL state that draws change most often, the current program, vertex array, texture units and the
+// uniform values of every program, and only calls GL when a request differs from what is already set.
+// Deleting a bound object unbinds it behind the back of the cache, and a new object may get the same name, so
+// invalidate() must follow any deletion or recreation of programs, vertex arrays or textures that were used here.
+class StateCacheGL final
+{
+public:
+   inline static constexpr int TextureUnitNum = 4;
+
+   struct Counters
+   {
+      int IssuedCalls = 0; // state changes sent to the driver
+      int ElidedCalls = 0; // state changes skipped because the state was already set
+   };
+
+   StateCacheGL();
+
+   [[nodiscard]] const Counters& getCounters() const { return Stats; }
+   void resetCounters() { Stats = Counters{}; }
+   void invalidate();
+   void useProgram(GLuint program);
+   void bindVertexArray(GLuint vao);
+   void bindTextureUnit(int unit, GLuint texture);
+   // These set a uniform of the current program, and ignore locations the program does not have.
+   void setUniform(GLint location, int value);
+   void setUniform(GLint location, float value);
+   void setUniform(GLint location, const glm::vec4& value);
+
+private:
+   // The last value set per program and location, as raw bits, so that one map holds every type.
+   using UniformValue = std::array<uint32_t, 4>;
+
+   // No GL object has this name, so a binding that is unknown always differs from a request.
+   inline static constexpr GLuint UnknownName = std::numeric_limits<GLuint>::max();
+
+   GLuint Program;
+   GLuint VAO;
+   std::array<GLuint, TextureUnitNum> Textures;
+   std::unordered_map<uint64_t, UniformValue> UniformValues;
+   Counters Stats;
+
+   // Returns true if the uniform already holds the value, and records the value otherwise.
+   [[nodiscard]] bool isUniformSet(GLint location, const void* value, size_t size);
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "BlockCompressor.h"
+#include "MipmapBuilder.h"
+
+// Streams texels into textures through a ring of pixel unpack buffer memory that stays mapped for its whole life.
+// An upload copies its levels into the next free range of the ring and has the texture take them from there, so the
+// driver neither copies from client memory nor waits for the texture to be idle. A fence behind every upload guards
+// its range, and only an upload that comes around to a range still in flight waits for it.
+// Callers spread large uploads over frames: beginFrame() resets the bytes of the frame, and hasFrameBudget() tells
+// whether another upload still fits into the budget.
+class TextureUploaderGL final
+{
+public:
+   inline static constexpr GLsizeiptr DefaultRingSize = 64 * 1024 * 1024;
+   inline static constexpr size_t DefaultFrameBudget = 16 * 1024 * 1024;
+
+   struct UploadStats
+   {
+      size_t StagedBytes = 0; // copied through the ring
+      size_t DirectBytes = 0; // uploaded from client memory, because they did not fit into the ring
+      int FenceWaitNum = 0; // how often an upload had to wait for the GPU to release its range of the ring
+   };
+
+   TextureUploaderGL();
+   ~TextureUploaderGL();
+
+   TextureUploaderGL(const TextureUploaderGL&) = delete;
+   TextureUploaderGL& operator=(const TextureUploaderGL&) = delete;
+
+   // Allocates and maps the ring. Without it, every upload goes directly from client memory.
+   [[nodiscard]] bool create(GLsizeiptr ring_size = DefaultRingSize);
+   void setFrameBudget(size_t byte_num) { FrameBudget = byte_num; }
+   void beginFrame() { FrameBytes = 0; }
+   [[nodiscard]] bool hasFrameBudget() const { return FrameBytes < FrameBudget; }
+   [[nodiscard]] const UploadStats& getUploadStats() const { return Stats; }
+   // Uploads the mip levels from level 0 into the texture, or into its layer if layer is not negative. Rows are
+   // padded to the alignment as with GL_UNPACK_ALIGNMENT.
+   void upload(
+      GLuint texture_id,
+      int layer,
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      GLenum pixel_format,
+      GLenum type,
+      int alignment = 1
+   );
+   void uploadCompressed(
+      GLuint texture_id,
+      int layer,
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      GLenum internal_format,
+      BlockCompressor::Format format
+   );
+   // The same uploads straight from client memory, for when there is no uploader.
+   static void uploadFromClient(
+      GLuint texture_id,
+      int layer,
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      GLenum pixel_format,
+      GLenum type,
+      int alignment = 1
+   );
+   static void uploadCompressedFromClient(
+      GLuint texture_id,
+      int layer,
+      const std::vector<const uint8_t*>& levels,
+      int width,
+      int height,
+      GLenum internal_format,
+      BlockCompressor::Format format
+   );
+
+private:
+   // Every level starts at this alignment, which suits the texel size of every format the textures use.
+   inline static constexpr GLsizeiptr LevelAlignment = 16;
+
+   // A range of the ring that the GPU may still read from.
+   struct FencedRange
+   {
+      GLintptr Begin;
+      GLintptr End;
+      GLsync Fence;
+   };
+
+   GLuint Buffer;
+   uint8_t* MappedRing;
+   GLsizeiptr RingSize;
+   GLintptr Head; // where the next upload starts, unless it has to wrap around
+   std::deque<FencedRange> InFlight; // in the order the ranges were used, so the front is the oldest
+   size_t FrameBudget;
+   size_t FrameBytes;
+   UploadStats Stats;
+
+   [[nodiscard]] static size_t getTexelSize(GLenum pixel_format, GLenum type);
+   static void uploadLevel(
+      GLuint texture_id,
+      int level,
+      int layer,
+      int width,
+      int height,
+      GLenum pixel_format,
+      GLenum type,
+      const void* pixels
+   );
+   static void uploadCompressedLevel(
+      GLuint texture_id,
+      int level,
+      int layer,
+      int width,
+      int height,
+      GLenum internal_format,
+      GLsizei byte_num,
+      const void* pixels
+   );
+   // Makes room for byte_num bytes from Head, wrapping Head around first if they do not fit before the end. It waits
+   // for whatever is still in flight there, and returns false if they do not fit into the ring at all.
+   [[nodiscard]] bool reserve(GLsizeiptr byte_num);
+   // Copies the levels into the ring from Head and binds it for unpacking; offsets gets where each level went.
+   [[nodiscard]] bool stage(
+      std::vector<GLintptr>& offsets,
+      const std::vector<const uint8_t*>& levels,
+      const std::vector<size_t>& level_sizes
+   );
+   // Unbinds the ring and fences the range that the uploads since stage() read from.
+   void finishStaging(GLintptr begin);
+   // Drops the oldest range in flight once the GPU is done with it, and returns false if it is not and wait is false.
+   bool retireFront(bool wait);
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "_Common.h"
+
+class ThreadPool final
+{
+public:
+   explicit ThreadPool(int thread_num = 0);
+   ~ThreadPool();
+
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+
+   [[nodiscard]] static ThreadPool& getInstance();
+   [[nodiscard]] int getThreadNum() const { return static_cast<int>(Workers.size()); }
+
+   template<typename F>
+   auto submit(F&& task) -> std::future<decltype(task())>
+   {
+      using R = decltype(task());
+      auto packaged = std::make_shared<std::packaged_task<R()>>( std::forward<F>( task ) );
+      std::future<R> result = packaged->get_future();
+      {
+         std::lock_guard<std::mutex> lock( QueueMutex );
+         Tasks.emplace( [packaged]() { (*packaged)(); } );
+      }
+      Condition.notify_one();
+      return result;
+   }
+
+   // Runs task(first, last) over [begin, end) split into chunks of at most chunk_size.
+   // The calling thread takes chunks as well, so this can be called from inside a worker.
+   void parallelFor(int begin, int end, int chunk_size, const std::function<void(int, int)>& task);
+
+private:
+   bool Stop;
+   std::vector<std::thread> Workers;
+   std::queue<std::function<void()>> Tasks;
+   std::mutex QueueMutex;
+   std::condition_variable Condition;
+
+   void work();
+};
\ No newline at end of file
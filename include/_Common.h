@@ -7,21 +7,39 @@
 #include <gtc/type_ptr.hpp>
 #include <gtc/matrix_transform.hpp>
 #include <gtc/quaternion.hpp>
+#include <gtc/packing.hpp>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <gtx/quaternion.hpp>
 
-#include <opencv2/opencv.hpp>
 #include <FreeImage.h>
 #include <iostream>
 #include <iomanip>
 #include <vector>
+#include <array>
 #include <string>
+#include <string_view>
 #include <map>
+#include <optional>
+#include <memory>
 #include <unordered_map>
 #include <sstream>
 #include <fstream>
+#include <filesystem>
+#include <cstring>
 #include <chrono>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <queue>
+#include <deque>
+#include <random>
+#include <limits>
+#include <cmath>
 
 #include "ProjectPath.h"
 
@@ -30,4 +48,5 @@ using uint = unsigned int;
 
 constexpr uint OPENGL_COLOR_BUFFER_BIT = 0x00004000u;
 constexpr uint OPENGL_DEPTH_BUFFER_BIT = 0x00000100u;
-constexpr uint OPENGL_STENCIL_BUFFER_BIT = 0x00000400u;
\ No newline at end of file
+constexpr uint OPENGL_STENCIL_BUFFER_BIT = 0x00000400u;
+constexpr uint OPENGL_COMPRESSED_RGB_S3TC_DXT1 = 0x83F0u;
\ No newline at end of file
@@ -1,8 +1,86 @@
 #include "Renderer.h"
+#include "SelfCheck.h"
 
-int main()
+namespace
 {
-   RendererGL renderer;
-   renderer.play();
-   return 0;
-}
\ No newline at end of file
+   void printUsage(const char* program)
+   {
+      std::cout << "Usage: " << program << " [--headless [options]] [--check-compression] [--check-clusters]"
+         << " [--check-normal-maps]\n"
+         << "  --frames N             number of frames to render (300)\n"
+         << "  --size WxH             size of the offscreen framebuffer (1920x1080)\n"
+         << "  --camera-path FILE     keyframes of \"eye_x eye_y eye_z target_x target_y target_z\" per line\n"
+         << "  --images DIR           write frames as PNG into DIR\n"
+         << "  --image-interval N     write every N-th frame (1)\n"
+         << "  --image-format F       png, exr or raw RGBA rows from the bottom up (png)\n"
+         << "  --image-threads N      threads that encode the frames (2)\n"
+         << "  --timings FILE         write the CPU and GPU time of every frame as CSV\n"
+         << "  --grid CxR             columns and rows of the wall grid (3x3)\n"
+         << "  --random-lights N      add N small point lights and spotlights\n"
+         << "  --clustered            cull the lights per cluster\n"
+         << "  --deferred             shade through the G-buffer\n"
+         << "  --no-instancing        draw every wall tile on its own\n"
+         << "  --software             draw on the CPU without any GL context\n"
+         << "  --compare-software     draw every frame on the CPU as well and fail below a PSNR of 48 dB\n"
+         << "  --animate-walls        shrink the walls and snap them back by updating their vertices\n"
+         << "  --check-compression    round-trip the samples through BC1, BC7 and BC5 and check their PSNR\n"
+         << "  --check-clusters       compare the scalar and AVX2 light clusters and sample the lights against them\n"
+         << "  --check-normal-maps    compare the normal maps of every instruction set and band height byte for byte\n";
+   }
+
+   bool readSize(glm::ivec2& size, const std::string& text)
+   {
+      char separator = 0;
+      std::istringstream stream(text);
+      return stream >> size.x >> separator >> size.y && separator == 'x' && size.x > 0 && size.y > 0;
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   bool is_headless = false;
+   bool check_compression = false;
+   bool check_clusters = false;
+   bool check_normal_maps = false;
+   RendererGL::HeadlessSettings settings;
+   for (int i = 1; i < argc; ++i) {
+      const std::string option = argv[i];
+      const bool has_value = i + 1 < argc;
+      if (option == "--headless") is_headless = true;
+      else if (option == "--check-compression") check_compression = true;
+      else if (option == "--check-clusters") check_clusters = true;
+      else if (option == "--check-normal-maps") check_normal_maps = true;
+      else if (option == "--clustered") settings.UseClusteredLights = true;
+      else if (option == "--deferred") settings.UseDeferredShading = true;
+      else if (option == "--no-instancing") settings.UseInstancing = false;
+      else if (option == "--software") settings.UseSoftwareRenderer = true;
+      else if (option == "--compare-software") settings.CompareWithSoftwareRenderer = true;
+      else if (option == "--animate-walls") settings.AnimateWalls = true;
+      else if (option == "--frames" && has_value) settings.FrameNum = std::max( std::atoi( argv[++i] ), 0 );
+      else if (option == "--image-interval" && has_value) settings.ImageInterval = std::atoi( argv[++i] );
+      else if (option == "--random-lights" && has_value) settings.RandomLightNum = std::atoi( argv[++i] );
+      else if (option == "--camera-path" && has_value) settings.CameraPathFile = argv[++i];
+      else if (option == "--images" && has_value) settings.ImageDirectory = argv[++i];
+      else if (option == "--image-threads" && has_value) settings.ImageThreadNum = std::atoi( argv[++i] );
+      else if (option == "--image-format" && has_value && FrameEncoder::getFormat( argv[i + 1] )) {
+         settings.ImageFormat = *FrameEncoder::getFormat( argv[++i] );
+      }
+      else if (option == "--timings" && has_value) settings.TimingFile = argv[++i];
+      else if (option == "--size" && has_value && readSize( settings.FrameSize, argv[i + 1] )) ++i;
+      else if (option == "--grid" && has_value && readSize( settings.WallGridSize, argv[i + 1] )) ++i;
+      else {
+         printUsage( argv[0] );
+         return 1;
+      }
+   }
+   if (check_compression || check_clusters || check_normal_maps) {
+      bool passed = true;
+      if (check_compression) passed = SelfCheck::checkBlockCompression( std::string(CMAKE_SOURCE_DIR) + "/samples" );
+      if (check_clusters) passed = SelfCheck::checkLightClusters() && passed;
+      if (check_normal_maps) passed = SelfCheck::checkNormalMaps() && passed;
+      return passed ? 0 : 1;
+   }
+
+   RendererGL renderer(is_headless ? std::make_optional( settings ) : std::nullopt);
+   return renderer.play() ? 0 : 1;
+}
@@ -1,20 +1,6 @@
 #version 460
 
-#define MAX_LIGHTS 32
-
-struct LightInfo
-{
-   int LightSwitch;
-   vec4 Position;
-   vec4 AmbientColor;
-   vec4 DiffuseColor;
-   vec4 SpecularColor;
-   vec3 SpotlightDirection;
-   float SpotlightCutoffAngle;
-   float SpotlightFeather;
-   float FallOffRadius;
-};
-uniform LightInfo Lights[MAX_LIGHTS];
+#include "Lighting.glsl"
 
 struct MateralInfo {
    vec4 EmissionColor;
@@ -24,94 +10,143 @@ struct MateralInfo {
    float SpecularExponent;
 };
 uniform MateralInfo Material;
-
+#ifdef GBUFFER_PASS
+uniform int MaterialIndex; // the entry of this material in the MaterialBlock of DeferredLighting.frag
+#endif
+
+#ifdef INSTANCED
+layout (binding = 0) uniform sampler2DArray BaseTexture;
+layout (binding = 1) uniform sampler2DArray NormalMap;
+layout (binding = 2) uniform sampler2DArray NormalLengthMap;
+#else
 layout (binding = 0) uniform sampler2D BaseTexture;
 layout (binding = 1) uniform sampler2D NormalMap;
-uniform int UseTexture;
-uniform int UseBumpMapping;
-
-uniform int UseLight;
-uniform int LightNum;
-uniform vec4 GlobalAmbient;
-
-uniform mat4 WorldMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 ProjectionMatrix;
+layout (binding = 2) uniform sampler2D NormalLengthMap;
+#endif
 
 in vec3 position_in_mc;
 in vec2 tex_coord;
+#ifdef INSTANCED
+flat in int layer;
+#define WALL_TEX_COORD vec3(tex_coord, layer)
+#else
+#define WALL_TEX_COORD tex_coord
+#endif
+
+#ifdef USE_LIGHT
+const int MaxVertexLights = 4;
+in vec3 view_vector_in_tc;
+#ifdef USE_CLUSTERED_LIGHTS
+in float depth_in_ec;
+#else
+in vec3 light_vectors_in_tc[MaxVertexLights];
+#endif
+#endif
 
 in vec3 normal_in_mc;
 in vec3 tangent_in_mc;
 in vec3 binormal_in_mc;
 
+#ifdef GBUFFER_PASS
+// The G-buffer of GBufferGL: base color, octahedral world space normal, and the Toksvig factor next to the material
+// index. Everything the lighting pass needs besides the position, which it rebuilds from the depth.
+layout (location = 0) out vec4 albedo;
+layout (location = 1) out vec2 encoded_normal;
+layout (location = 2) out vec2 material;
+#else
 layout (location = 0) out vec4 final_color;
+#endif
 
-const float zero = 0.0f;
-const float one = 1.0f;
-const float half_pi = 1.57079632679489661923132169163975144f;
-mat3 tbn;
+// The features are compiled in as #defines by ShaderGL::getPermutation, so every permutation is free of the branches
+// on USE_TEXTURE, USE_BUMP_MAPPING, USE_LIGHT, TWO_CHANNEL_NORMAL_MAP, USE_SPOTLIGHT, USE_CLUSTERED_LIGHTS, INSTANCED
+// and GBUFFER_PASS. The geometry pass of the deferred path is GBUFFER_PASS without any of the lighting features.
+mat3 getTangentSpace()
+{
+   return mat3(normalize( tangent_in_mc ), normalize( binormal_in_mc ), normalize( normal_in_mc ));
+}
 
-bool IsPointLight(in vec4 light_position)
+vec3 getNormalInTangentSpace()
 {
-   return light_position.w != zero;
+#ifdef USE_BUMP_MAPPING
+   vec3 normal = texture( NormalMap, WALL_TEX_COORD ).xyz * 2.0f - one;
+#ifdef TWO_CHANNEL_NORMAL_MAP
+   normal.z = sqrt( max( one - dot( normal.xy, normal.xy ), zero ) );
+#endif
+   return normalize( normal );
+#else
+   return vec3(zero, zero, one);
+#endif
 }
 
-float getAttenuation(in vec3 light_vector, in int light_index)
+// Toksvig: the averaged normals of a minified level get shorter as they disagree, which widens the highlight.
+float getToksvigFactor()
 {
-   float squared_distance = dot( light_vector, light_vector );
-   float distance = sqrt( squared_distance );
-   float radius = Lights[light_index].FallOffRadius;
-   if (distance <= radius) return one;
+#ifdef USE_BUMP_MAPPING
+   float normal_length = max( texture( NormalLengthMap, WALL_TEX_COORD ).r, 1.0e-3f );
+   return normal_length / (normal_length + Material.SpecularExponent * (one - normal_length));
+#else
+   return one;
+#endif
+}
 
-   return clamp( radius * radius / squared_distance, zero, one );
+#ifdef GBUFFER_PASS
+// Folds the lower hemisphere over the diagonals of the upper one, so the unit sphere fits into [-1, 1]^2.
+vec2 encodeOctahedron(in vec3 normal)
+{
+   normal /= abs( normal.x ) + abs( normal.y ) + abs( normal.z );
+   if (normal.z >= zero) return normal.xy;
+
+   vec2 sign_not_zero = vec2(normal.x >= zero ? one : -one, normal.y >= zero ? one : -one);
+   return (one - abs( normal.yx )) * sign_not_zero;
 }
+#endif
 
-float getSpotlightFactor(in vec3 normalized_light_vector, in int light_index)
+#ifdef USE_LIGHT
+vec3 getLightVectorInTangentSpace(in vec4 light_position_in_mc, in mat3 tbn)
 {
-   if (Lights[light_index].SpotlightCutoffAngle >= 180.0f) return one;
-
-   vec4 direction_in_ec = transpose( inverse( ViewMatrix ) ) * vec4(Lights[light_index].SpotlightDirection, zero);
-   vec3 normalized_direction = normalize( direction_in_ec.xyz );
-   float factor = dot( -normalized_light_vector, normalized_direction );
-   float cutoff_angle = radians( clamp( Lights[light_index].SpotlightCutoffAngle, zero, 90.0f ) );
-   if (factor >= cos( cutoff_angle )) {
-      float normalized_angle = acos( factor ) * half_pi / cutoff_angle;
-      float threshold = half_pi * (one - Lights[light_index].SpotlightFeather);
-      return normalized_angle <= threshold ? one :
-         cos( half_pi * (normalized_angle - threshold) / (half_pi - threshold) );
-   }
-   return zero;
+   vec3 light_vector = IsPointLight( light_position_in_mc ) ?
+      light_position_in_mc.xyz - position_in_mc : light_position_in_mc.xyz;
+   return light_vector * tbn;
 }
 
 vec4 calculateLightingEquation()
 {
    vec4 color = Material.EmissionColor + GlobalAmbient * Material.AmbientColor;
    
-   tbn = mat3(tangent_in_mc, binormal_in_mc, normal_in_mc);
-   vec3 eye_position_in_mc = (inverse( ViewMatrix * WorldMatrix ) * vec4(zero, zero, zero, one)).xyz;
-   vec3 view_direction_in_tc = normalize( (eye_position_in_mc - position_in_mc) * tbn );
-
+   vec3 view_direction_in_tc = normalize( view_vector_in_tc );
+   vec3 normal_in_tc = getNormalInTangentSpace();
+   float specular_exponent = Material.SpecularExponent * getToksvigFactor();
+
+#ifdef USE_CLUSTERED_LIGHTS
+   mat3 tbn = getTangentSpace();
+   uvec2 light_range = getClusterLightRange( depth_in_ec );
+   for (uint n = 0u; n < light_range.y; ++n) {
+      int i = int(ClusterLightIndices[light_range.x + n]);
+#else
    for (int i = 0; i < LightNum; ++i) {
+#endif
       if (Lights[i].LightSwitch == 0) continue;
       
       vec4 light_position_in_mc = Lights[i].Position;
       
       float final_effect_factor = one;
-      vec3 light_vector = (light_position_in_mc.xyz - position_in_mc) * tbn;
+#ifdef USE_CLUSTERED_LIGHTS
+      vec3 light_vector = getLightVectorInTangentSpace( light_position_in_mc, tbn );
+#else
+      vec3 light_vector = i < MaxVertexLights ?
+         light_vectors_in_tc[i] : getLightVectorInTangentSpace( light_position_in_mc, getTangentSpace() );
+#endif
       if (IsPointLight( light_position_in_mc )) {
-         float attenuation = getAttenuation( light_vector, i );
-
-         light_vector = normalize( light_vector );
-         float spotlight_factor = getSpotlightFactor( light_vector, i );
-         final_effect_factor = attenuation * spotlight_factor;
+         final_effect_factor = getAttenuation( light_vector, i );
+#ifdef USE_SPOTLIGHT
+         final_effect_factor *= getSpotlightFactor( normalize( light_position_in_mc.xyz - position_in_mc ), i );
+#endif
       }
-      else light_vector = normalize( light_position_in_mc.xyz );
+      light_vector = normalize( light_vector );
    
       if (final_effect_factor <= zero) continue;
 
       vec4 local_color = Lights[i].AmbientColor * Material.AmbientColor;
-      vec3 normal_in_tc = UseBumpMapping == 0 ? vec3(zero, zero, one) : normalize( texture( NormalMap, tex_coord ).xyz * 2.0f - one );
 
       float diffuse_intensity = max( dot( normal_in_tc, light_vector ), zero );
       local_color += diffuse_intensity * Lights[i].DiffuseColor * Material.DiffuseColor;
@@ -119,21 +154,40 @@ vec4 calculateLightingEquation()
       vec3 halfway_vector = normalize( light_vector + view_direction_in_tc );
       float specular_intensity = max( dot( normal_in_tc, halfway_vector ), zero );
       local_color += 
-         pow( specular_intensity, Material.SpecularExponent ) * 
+         pow( specular_intensity, specular_exponent ) * 
          Lights[i].SpecularColor * Material.SpecularColor;
 
       color += local_color * final_effect_factor;
    }
    return color;
 }
+#endif
 
+#ifdef GBUFFER_PASS
 void main()
 {
-   if (UseTexture == 0) final_color = vec4(one);
-   else final_color = texture( BaseTexture, tex_coord );
-
-   if (UseLight != 0) {
-      final_color *= calculateLightingEquation();
-   }
-   else final_color *= Material.DiffuseColor;
-}
\ No newline at end of file
+#ifdef USE_TEXTURE
+   albedo = texture( BaseTexture, WALL_TEX_COORD );
+#else
+   albedo = vec4(one);
+#endif
+
+   encoded_normal = encodeOctahedron( getTangentSpace() * getNormalInTangentSpace() );
+   material = vec2(getToksvigFactor(), float(MaterialIndex) / 255.0f);
+}
+#else
+void main()
+{
+#ifdef USE_TEXTURE
+   final_color = texture( BaseTexture, WALL_TEX_COORD );
+#else
+   final_color = vec4(one);
+#endif
+
+#ifdef USE_LIGHT
+   final_color *= calculateLightingEquation();
+#else
+   final_color *= Material.DiffuseColor;
+#endif
+}
+#endif
@@ -1,30 +1,89 @@
 #version 460
 
-uniform mat4 WorldMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 ProjectionMatrix;
-uniform mat4 ModelViewProjectionMatrix;
+layout (std140, binding = 0) uniform CameraBlock
+{
+   mat4 ViewMatrix;
+   mat4 ProjectionMatrix;
+   mat4 ViewProjectionMatrix;
+   mat4 InverseViewMatrix;
+   mat4 InverseProjectionMatrix;
+};
+
+#ifdef USE_LIGHT
+#include "LightBlock.glsl"
+#endif
+
+#ifndef INSTANCED
+// One world matrix per tile, indexed by the base instance of its draw.
+layout (std430, binding = 1) readonly buffer WorldMatrixBlock
+{
+   mat4 WorldMatrices[];
+};
+#endif
 
 layout (location = 0) in vec3 v_position;
 layout (location = 1) in vec3 v_normal;
 layout (location = 2) in vec2 v_tex_coord;
-layout (location = 3) in vec3 v_tangent;  
+layout (location = 3) in vec3 v_tangent;
+#ifdef INSTANCED
+// The instances carry their own world matrix and the layer of their wall in the texture arrays.
+layout (location = 4) in mat4 i_world_matrix;
+layout (location = 8) in int i_layer;
+#endif
 
 out vec3 position_in_mc;
 out vec2 tex_coord;
+#ifdef INSTANCED
+flat out int layer;
+#endif
+
+// The view vector and the vectors to the first MaxVertexLights lights are moved into tangent space here, so the
+// fragment shader only transforms the vectors of any further lights. Clustered lights differ from fragment to
+// fragment, so they are all transformed there, and only the depth that selects the cluster is passed on.
+#ifdef USE_LIGHT
+const int MaxVertexLights = 4;
+out vec3 view_vector_in_tc;
+#ifdef USE_CLUSTERED_LIGHTS
+out float depth_in_ec;
+#else
+out vec3 light_vectors_in_tc[MaxVertexLights];
+#endif
+#endif
 
 out vec3 normal_in_mc;
 out vec3 tangent_in_mc;
 out vec3 binormal_in_mc;
 
 void main()
-{   
-   position_in_mc = (WorldMatrix * vec4(v_position, 1.0f)).xyz;
-   tex_coord = v_tex_coord;    
+{
+#ifdef INSTANCED
+   mat4 world_matrix = i_world_matrix;
+   layer = i_layer;
+#else
+   mat4 world_matrix = WorldMatrices[gl_BaseInstance];
+#endif
+   position_in_mc = (world_matrix * vec4(v_position, 1.0f)).xyz;
+   tex_coord = v_tex_coord;
+
+   normal_in_mc = normalize( mat3(world_matrix) * v_normal );
+   tangent_in_mc = normalize( mat3(world_matrix) * v_tangent );
+   binormal_in_mc = cross( normal_in_mc, tangent_in_mc );
 
-   normal_in_mc = normalize( v_normal );
-   tangent_in_mc = normalize( v_tangent );
-   binormal_in_mc = cross( v_normal, v_tangent );
+#ifdef USE_LIGHT
+   mat3 tbn = mat3(tangent_in_mc, binormal_in_mc, normal_in_mc);
+   vec3 eye_position_in_mc = InverseViewMatrix[3].xyz;
+   view_vector_in_tc = (eye_position_in_mc - position_in_mc) * tbn;
+#ifdef USE_CLUSTERED_LIGHTS
+   depth_in_ec = -(ViewMatrix * vec4(position_in_mc, 1.0f)).z;
+#else
+   for (int i = 0; i < min( LightNum, MaxVertexLights ); ++i) {
+      vec4 light_position_in_mc = Lights[i].Position;
+      vec3 light_vector = light_position_in_mc.w != 0.0f ?
+         light_position_in_mc.xyz - position_in_mc : light_position_in_mc.xyz;
+      light_vectors_in_tc[i] = light_vector * tbn;
+   }
+#endif
+#endif
    
-   gl_Position = ModelViewProjectionMatrix * vec4(v_position, 1.0f);
+   gl_Position = ViewProjectionMatrix * vec4(position_in_mc, 1.0f);
 }
\ No newline at end of file
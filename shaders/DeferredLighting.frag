@@ -0,0 +1,121 @@
+#version 460
+
+layout (std140, binding = 0) uniform CameraBlock
+{
+   mat4 ViewMatrix;
+   mat4 ProjectionMatrix;
+   mat4 ViewProjectionMatrix;
+   mat4 InverseViewMatrix;
+   mat4 InverseProjectionMatrix;
+};
+
+#include "Lighting.glsl"
+
+struct MateralInfo {
+   vec4 EmissionColor;
+   vec4 AmbientColor;
+   vec4 DiffuseColor;
+   vec4 SpecularColor;
+   float SpecularExponent;
+};
+// Filled by RendererGL, indexed by the material index that the geometry pass wrote.
+layout (std430, binding = 4) readonly buffer MaterialBlock
+{
+   MateralInfo Materials[];
+};
+
+layout (binding = 0) uniform sampler2D AlbedoBuffer;
+layout (binding = 1) uniform sampler2D NormalBuffer;
+layout (binding = 2) uniform sampler2D MaterialBuffer;
+layout (binding = 3) uniform sampler2D DepthBuffer;
+
+layout (location = 0) out vec4 final_color;
+
+// The same lighting as BumpMapping.frag, but in world space and once per pixel, so the cost only depends on the
+// pixels and the lights that reach them. The features are compiled in as #defines by ShaderGL::getPermutation,
+// and only USE_LIGHT, USE_SPOTLIGHT and USE_CLUSTERED_LIGHTS matter here.
+vec3 decodeOctahedron(in vec2 encoded)
+{
+   vec3 normal = vec3(encoded, one - abs( encoded.x ) - abs( encoded.y ));
+   if (normal.z < zero) {
+      vec2 sign_not_zero = vec2(normal.x >= zero ? one : -one, normal.y >= zero ? one : -one);
+      normal.xy = (one - abs( normal.yx )) * sign_not_zero;
+   }
+   return normalize( normal );
+}
+
+#ifdef USE_LIGHT
+vec4 calculateLightingEquation(
+   in vec3 position_in_ec,
+   in vec3 normal_in_wc,
+   in MateralInfo material,
+   in float specular_exponent
+)
+{
+   vec4 color = material.EmissionColor + GlobalAmbient * material.AmbientColor;
+
+   vec3 position_in_wc = (InverseViewMatrix * vec4(position_in_ec, one)).xyz;
+   vec3 view_direction_in_wc = normalize( InverseViewMatrix[3].xyz - position_in_wc );
+
+#ifdef USE_CLUSTERED_LIGHTS
+   uvec2 light_range = getClusterLightRange( -position_in_ec.z );
+   for (uint n = 0u; n < light_range.y; ++n) {
+      int i = int(ClusterLightIndices[light_range.x + n]);
+#else
+   for (int i = 0; i < LightNum; ++i) {
+#endif
+      if (Lights[i].LightSwitch == 0) continue;
+
+      vec4 light_position_in_wc = Lights[i].Position;
+
+      float final_effect_factor = one;
+      vec3 light_vector = IsPointLight( light_position_in_wc ) ?
+         light_position_in_wc.xyz - position_in_wc : light_position_in_wc.xyz;
+      if (IsPointLight( light_position_in_wc )) {
+         final_effect_factor = getAttenuation( light_vector, i );
+#ifdef USE_SPOTLIGHT
+         final_effect_factor *= getSpotlightFactor( normalize( light_vector ), i );
+#endif
+      }
+      light_vector = normalize( light_vector );
+
+      if (final_effect_factor <= zero) continue;
+
+      vec4 local_color = Lights[i].AmbientColor * material.AmbientColor;
+
+      float diffuse_intensity = max( dot( normal_in_wc, light_vector ), zero );
+      local_color += diffuse_intensity * Lights[i].DiffuseColor * material.DiffuseColor;
+
+      vec3 halfway_vector = normalize( light_vector + view_direction_in_wc );
+      float specular_intensity = max( dot( normal_in_wc, halfway_vector ), zero );
+      local_color +=
+         pow( specular_intensity, specular_exponent ) *
+         Lights[i].SpecularColor * material.SpecularColor;
+
+      color += local_color * final_effect_factor;
+   }
+   return color;
+}
+#endif
+
+void main()
+{
+   ivec2 pixel = ivec2(gl_FragCoord.xy);
+   float depth = texelFetch( DepthBuffer, pixel, 0 ).r;
+   if (depth >= one) discard;
+
+   vec2 packed_material = texelFetch( MaterialBuffer, pixel, 0 ).rg;
+   MateralInfo material = Materials[int(round( packed_material.g * 255.0f ))];
+   final_color = texelFetch( AlbedoBuffer, pixel, 0 );
+
+#ifdef USE_LIGHT
+   vec2 uv = (vec2(pixel) + 0.5f) / vec2(textureSize( DepthBuffer, 0 ));
+   vec4 position_in_ec = InverseProjectionMatrix * vec4(vec3(uv, depth) * 2.0f - one, one);
+   position_in_ec /= position_in_ec.w;
+   vec3 normal_in_wc = decodeOctahedron( texelFetch( NormalBuffer, pixel, 0 ).rg );
+   float specular_exponent = material.SpecularExponent * packed_material.r;
+   final_color *= calculateLightingEquation( position_in_ec.xyz, normal_in_wc, material, specular_exponent );
+#else
+   final_color *= material.DiffuseColor;
+#endif
+}
@@ -0,0 +1,9 @@
+#version 460
+
+// One triangle that covers the screen, without any vertex buffer: the vertices 0, 1 and 2 land at (-1, -1),
+// (3, -1) and (-1, 3), and the parts outside the viewport are clipped.
+void main()
+{
+   vec2 position = vec2(float((gl_VertexID & 1) << 2) - 1.0f, float((gl_VertexID & 2) << 1) - 1.0f);
+   gl_Position = vec4(position, 0.0f, 1.0f);
+}
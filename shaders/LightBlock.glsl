@@ -0,0 +1,20 @@
+// The lights as LightGL uploads them. Included by the shaders that read them, after their #version line.
+struct LightInfo
+{
+   vec4 Position;
+   vec4 AmbientColor;
+   vec4 DiffuseColor;
+   vec4 SpecularColor;
+   vec3 SpotlightDirection;
+   float SpotlightCutoffAngle;
+   float SpotlightFeather;
+   float FallOffRadius;
+   int LightSwitch;
+};
+layout (std430, binding = 0) readonly buffer LightBlock
+{
+   vec4 GlobalAmbient;
+   int UseLight;
+   int LightNum;
+   LightInfo Lights[];
+};
@@ -0,0 +1,77 @@
+// The light terms that the forward and the deferred shaders share. getAttenuation takes the light vector in any space
+// that keeps its length, the forward shader passes tangent space and the deferred one world space.
+#include "LightBlock.glsl"
+
+#ifdef USE_CLUSTERED_LIGHTS
+// Filled by LightGL::updateClusterBuffers: the lights of cluster c are
+// ClusterLightIndices[ClusterLightRanges[c].x] onwards, ClusterLightRanges[c].y of them.
+layout (std430, binding = 2) readonly buffer ClusterBlock
+{
+   ivec4 ClusterGridSize;
+   vec4 ClusterParameters; // tile width and height in pixels, and the scale and bias of the depth slices
+   uvec2 ClusterLightRanges[];
+};
+layout (std430, binding = 3) readonly buffer ClusterLightIndexBlock
+{
+   uint ClusterLightIndices[];
+};
+#endif
+
+const float zero = 0.0f;
+const float one = 1.0f;
+const float half_pi = 1.57079632679489661923132169163975144f;
+const float LightRangeFactor = 16.0f;
+
+#ifdef USE_LIGHT
+bool IsPointLight(in vec4 light_position)
+{
+   return light_position.w != zero;
+}
+
+float getAttenuation(in vec3 light_vector, in int light_index)
+{
+   float squared_distance = dot( light_vector, light_vector );
+   float squared_radius = Lights[light_index].FallOffRadius * Lights[light_index].FallOffRadius;
+#ifdef USE_CLUSTERED_LIGHTS
+   // Fades out to zero at the range the lights are binned with, so the cluster borders do not show.
+   float squared_range = squared_radius * LightRangeFactor * LightRangeFactor;
+   float fade = clamp( one - squared_distance * squared_distance / (squared_range * squared_range), zero, one );
+   float window = fade * fade;
+#else
+   float window = one;
+#endif
+   if (squared_distance <= squared_radius) return window;
+
+   return clamp( squared_radius / squared_distance, zero, one ) * window;
+}
+
+#ifdef USE_SPOTLIGHT
+// The spotlight directions are normalized on upload.
+float getSpotlightFactor(in vec3 normalized_light_vector_in_wc, in int light_index)
+{
+   if (Lights[light_index].SpotlightCutoffAngle >= 180.0f) return one;
+
+   float factor = dot( -normalized_light_vector_in_wc, Lights[light_index].SpotlightDirection );
+   float cutoff_angle = radians( clamp( Lights[light_index].SpotlightCutoffAngle, zero, 90.0f ) );
+   if (factor >= cos( cutoff_angle )) {
+      float normalized_angle = acos( factor ) * half_pi / cutoff_angle;
+      float threshold = half_pi * (one - Lights[light_index].SpotlightFeather);
+      return normalized_angle <= threshold ? one :
+         cos( half_pi * (normalized_angle - threshold) / (half_pi - threshold) );
+   }
+   return zero;
+}
+#endif
+
+#ifdef USE_CLUSTERED_LIGHTS
+uvec2 getClusterLightRange(in float depth_in_ec)
+{
+   ivec3 cluster;
+   cluster.xy = min( ivec2(gl_FragCoord.xy / ClusterParameters.xy), ClusterGridSize.xy - 1 );
+   cluster.z = clamp(
+      int(floor( log( depth_in_ec ) * ClusterParameters.z + ClusterParameters.w )), 0, ClusterGridSize.z - 1
+   );
+   return ClusterLightRanges[(cluster.z * ClusterGridSize.y + cluster.y) * ClusterGridSize.x + cluster.x];
+}
+#endif
+#endif
@@ -0,0 +1,528 @@
+#include "BlockCompressor.h"
+
+namespace
+{
+   constexpr int BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+   class BitWriter
+   {
+   public:
+      explicit BitWriter(uint8_t* data) : Data( data ), Position( 0 ) {}
+
+      void write(uint32_t value, int bit_num)
+      {
+         for (int i = 0; i < bit_num; ++i, ++Position) {
+            Data[Position >> 3] |= static_cast<uint8_t>(((value >> i) & 1u) << (Position & 7));
+         }
+      }
+
+   private:
+      uint8_t* Data;
+      int Position;
+   };
+
+   class BitReader
+   {
+   public:
+      explicit BitReader(const uint8_t* data) : Data( data ), Position( 0 ) {}
+
+      uint32_t read(int bit_num)
+      {
+         uint32_t value = 0;
+         for (int i = 0; i < bit_num; ++i, ++Position) {
+            value |= static_cast<uint32_t>((Data[Position >> 3] >> (Position & 7)) & 1u) << i;
+         }
+         return value;
+      }
+
+   private:
+      const uint8_t* Data;
+      int Position;
+   };
+
+   // Finds the line through the 16 points that best fits them, by power iteration on their covariance.
+   template<int N>
+   void getPrincipalAxis(float (&mean)[N], float (&axis)[N], const float (*points)[N])
+   {
+      for (int c = 0; c < N; ++c) {
+         mean[c] = 0.0f;
+         for (int i = 0; i < 16; ++i) mean[c] += points[i][c];
+         mean[c] /= 16.0f;
+      }
+
+      float covariance[N][N] = {};
+      for (int i = 0; i < 16; ++i) {
+         for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c) covariance[r][c] += (points[i][r] - mean[r]) * (points[i][c] - mean[c]);
+         }
+      }
+
+      for (int c = 0; c < N; ++c) axis[c] = 1.0f;
+      for (int iteration = 0; iteration < 8; ++iteration) {
+         float next[N] = {};
+         float length = 0.0f;
+         for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c) next[r] += covariance[r][c] * axis[c];
+            length = std::max( length, std::abs( next[r] ) );
+         }
+         if (length == 0.0f) break;
+         for (int c = 0; c < N; ++c) axis[c] = next[c] / length;
+      }
+   }
+
+   // Projects the points onto the principal axis and returns the two extreme points on it.
+   template<int N>
+   void getEndpoints(float (&low)[N], float (&high)[N], const float (*points)[N])
+   {
+      float mean[N], axis[N];
+      getPrincipalAxis( mean, axis, points );
+
+      float t_min = std::numeric_limits<float>::max(), t_max = -std::numeric_limits<float>::max();
+      float axis_length = 0.0f;
+      for (int c = 0; c < N; ++c) axis_length += axis[c] * axis[c];
+      for (int i = 0; i < 16; ++i) {
+         float t = 0.0f;
+         for (int c = 0; c < N; ++c) t += (points[i][c] - mean[c]) * axis[c];
+         t = axis_length > 0.0f ? t / axis_length : 0.0f;
+         t_min = std::min( t_min, t );
+         t_max = std::max( t_max, t );
+      }
+      for (int c = 0; c < N; ++c) {
+         low[c] = glm::clamp( mean[c] + t_min * axis[c], 0.0f, 255.0f );
+         high[c] = glm::clamp( mean[c] + t_max * axis[c], 0.0f, 255.0f );
+      }
+   }
+
+   // Solves the least squares endpoints a and b of points[i] ~ (1 - t[i]) * a + t[i] * b.
+   template<int N>
+   bool getLeastSquaresEndpoints(float (&a)[N], float (&b)[N], const float (*points)[N], const float* t)
+   {
+      float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+      float ax[N] = {}, bx[N] = {};
+      for (int i = 0; i < 16; ++i) {
+         const float s = 1.0f - t[i];
+         aa += s * s;
+         ab += s * t[i];
+         bb += t[i] * t[i];
+         for (int c = 0; c < N; ++c) {
+            ax[c] += s * points[i][c];
+            bx[c] += t[i] * points[i][c];
+         }
+      }
+      const float determinant = aa * bb - ab * ab;
+      if (std::abs( determinant ) < 1e-6f) return false;
+
+      for (int c = 0; c < N; ++c) {
+         a[c] = glm::clamp( (bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f );
+         b[c] = glm::clamp( (aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f );
+      }
+      return true;
+   }
+
+   inline uint16_t packRGB565(const float* color)
+   {
+      const auto r = static_cast<uint16_t>(std::lround( color[0] * 31.0f / 255.0f ));
+      const auto g = static_cast<uint16_t>(std::lround( color[1] * 63.0f / 255.0f ));
+      const auto b = static_cast<uint16_t>(std::lround( color[2] * 31.0f / 255.0f ));
+      return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+   }
+
+   inline void unpackRGB565(int* color, uint16_t packed)
+   {
+      const int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+      color[0] = (r << 3) | (r >> 2);
+      color[1] = (g << 2) | (g >> 4);
+      color[2] = (b << 3) | (b >> 2);
+   }
+
+   void getBC1Palette(int (*palette)[3], uint16_t color0, uint16_t color1)
+   {
+      unpackRGB565( palette[0], color0 );
+      unpackRGB565( palette[1], color1 );
+      for (int c = 0; c < 3; ++c) {
+         if (color0 > color1) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+         }
+         else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+         }
+      }
+   }
+
+   // Picks the nearest of the 4 palette colors for each texel and returns the total squared error.
+   int getBC1Indices(uint32_t& indices, const float (*points)[3], uint16_t color0, uint16_t color1)
+   {
+      int palette[4][3];
+      getBC1Palette( palette, color0, color1 );
+      indices = 0;
+      int total_error = 0;
+      for (int i = 0; i < 16; ++i) {
+         int best_error = std::numeric_limits<int>::max(), best_index = 0;
+         for (int k = 0; k < 4; ++k) {
+            int error = 0;
+            for (int c = 0; c < 3; ++c) {
+               const int d = static_cast<int>(points[i][c]) - palette[k][c];
+               error += d * d;
+            }
+            if (error < best_error) {
+               best_error = error;
+               best_index = k;
+            }
+         }
+         indices |= static_cast<uint32_t>(best_index) << (2 * i);
+         total_error += best_error;
+      }
+      return total_error;
+   }
+
+   inline int getBC4Value(int e0, int e1, int index)
+   {
+      if (index == 0) return e0;
+      if (index == 1) return e1;
+      if (e0 > e1) return ((8 - index) * e0 + (index - 1) * e1 + 3) / 7;
+      if (index == 6) return 0;
+      if (index == 7) return 255;
+      return ((6 - index) * e0 + (index - 1) * e1 + 2) / 5;
+   }
+
+   // Quantizes an endpoint to 7 bits per channel plus a shared p-bit and returns the p-bit that fits it best.
+   uint32_t quantizeBC7Endpoint(int (&quantized)[4], const float (&endpoint)[4])
+   {
+      float best_error = std::numeric_limits<float>::max();
+      uint32_t best_p = 0;
+      for (uint32_t p = 0; p < 2; ++p) {
+         int candidate[4];
+         float error = 0.0f;
+         for (int c = 0; c < 4; ++c) {
+            candidate[c] = glm::clamp( static_cast<int>(std::lround( (endpoint[c] - static_cast<float>(p)) * 0.5f )), 0, 127 );
+            const float d = static_cast<float>(candidate[c] * 2 + static_cast<int>(p)) - endpoint[c];
+            error += d * d;
+         }
+         if (error < best_error) {
+            best_error = error;
+            best_p = p;
+            std::copy( candidate, candidate + 4, quantized );
+         }
+      }
+      return best_p;
+   }
+
+   int getBC7Indices(int* indices, const float (*points)[4], const int (&low)[4], const int (&high)[4])
+   {
+      int palette[16][4];
+      for (int k = 0; k < 16; ++k) {
+         for (int c = 0; c < 4; ++c) {
+            palette[k][c] = ((64 - BC7Weights[k]) * low[c] + BC7Weights[k] * high[c] + 32) >> 6;
+         }
+      }
+      int total_error = 0;
+      for (int i = 0; i < 16; ++i) {
+         int best_error = std::numeric_limits<int>::max();
+         for (int k = 0; k < 16; ++k) {
+            int error = 0;
+            for (int c = 0; c < 4; ++c) {
+               const int d = static_cast<int>(points[i][c]) - palette[k][c];
+               error += d * d;
+            }
+            if (error < best_error) {
+               best_error = error;
+               indices[i] = k;
+            }
+         }
+         total_error += best_error;
+      }
+      return total_error;
+   }
+}
+
+size_t BlockCompressor::getCompressedSize(int width, int height, Format format)
+{
+   const size_t block_num = static_cast<size_t>((width + 3) / 4) * static_cast<size_t>((height + 3) / 4);
+   return block_num * getBytesPerBlock( format );
+}
+
+void BlockCompressor::encodeBC1(uint8_t* block, const uint8_t (*rgba)[4])
+{
+   float points[16][3];
+   for (int i = 0; i < 16; ++i) {
+      for (int c = 0; c < 3; ++c) points[i][c] = static_cast<float>(rgba[i][c]);
+   }
+
+   float low[3], high[3];
+   getEndpoints( low, high, points );
+   auto color0 = packRGB565( high );
+   auto color1 = packRGB565( low );
+   if (color0 < color1) std::swap( color0, color1 );
+
+   uint32_t indices = 0;
+   if (color0 != color1) {
+      int error = getBC1Indices( indices, points, color0, color1 );
+
+      // One least squares pass over the chosen indices usually pulls the endpoints closer to the texels.
+      constexpr float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+      float t[16];
+      for (int i = 0; i < 16; ++i) t[i] = weights[(indices >> (2 * i)) & 3u];
+      float a[3], b[3];
+      if (getLeastSquaresEndpoints( a, b, points, t )) {
+         auto refined0 = packRGB565( a );
+         auto refined1 = packRGB565( b );
+         if (refined0 < refined1) std::swap( refined0, refined1 );
+         uint32_t refined_indices = 0;
+         if (refined0 != refined1 && getBC1Indices( refined_indices, points, refined0, refined1 ) < error) {
+            color0 = refined0;
+            color1 = refined1;
+            indices = refined_indices;
+         }
+      }
+   }
+
+   block[0] = static_cast<uint8_t>(color0 & 0xFF);
+   block[1] = static_cast<uint8_t>(color0 >> 8);
+   block[2] = static_cast<uint8_t>(color1 & 0xFF);
+   block[3] = static_cast<uint8_t>(color1 >> 8);
+   for (int i = 0; i < 4; ++i) block[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+void BlockCompressor::encodeBC4(uint8_t* block, const uint8_t* values)
+{
+   const int e0 = *std::max_element( values, values + 16 );
+   const int e1 = *std::min_element( values, values + 16 );
+   block[0] = static_cast<uint8_t>(e0);
+   block[1] = static_cast<uint8_t>(e1);
+
+   uint64_t indices = 0;
+   if (e0 != e1) {
+      int palette[8];
+      for (int k = 0; k < 8; ++k) palette[k] = getBC4Value( e0, e1, k );
+      for (int i = 0; i < 16; ++i) {
+         int best_error = std::numeric_limits<int>::max(), best_index = 0;
+         for (int k = 0; k < 8; ++k) {
+            const int error = std::abs( values[i] - palette[k] );
+            if (error < best_error) {
+               best_error = error;
+               best_index = k;
+            }
+         }
+         indices |= static_cast<uint64_t>(best_index) << (3 * i);
+      }
+   }
+   for (int i = 0; i < 6; ++i) block[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+}
+
+void BlockCompressor::encodeBC7(uint8_t* block, const uint8_t (*rgba)[4])
+{
+   float points[16][4];
+   for (int i = 0; i < 16; ++i) {
+      for (int c = 0; c < 4; ++c) points[i][c] = static_cast<float>(rgba[i][c]);
+   }
+
+   float endpoints[2][4];
+   getEndpoints( endpoints[0], endpoints[1], points );
+
+   int quantized[2][4], indices[16];
+   uint32_t p[2];
+   const auto quantize = [&](const float (&a)[4], const float (&b)[4], int (&q)[2][4], uint32_t (&pb)[2], int* ids) {
+      pb[0] = quantizeBC7Endpoint( q[0], a );
+      pb[1] = quantizeBC7Endpoint( q[1], b );
+      int low[4], high[4];
+      for (int c = 0; c < 4; ++c) {
+         low[c] = q[0][c] * 2 + static_cast<int>(pb[0]);
+         high[c] = q[1][c] * 2 + static_cast<int>(pb[1]);
+      }
+      return getBC7Indices( ids, points, low, high );
+   };
+   const int error = quantize( endpoints[0], endpoints[1], quantized, p, indices );
+
+   float t[16];
+   for (int i = 0; i < 16; ++i) t[i] = static_cast<float>(BC7Weights[indices[i]]) / 64.0f;
+   float a[4], b[4];
+   if (getLeastSquaresEndpoints( a, b, points, t )) {
+      int refined_quantized[2][4], refined_indices[16];
+      uint32_t refined_p[2];
+      if (quantize( a, b, refined_quantized, refined_p, refined_indices ) < error) {
+         std::copy( &refined_quantized[0][0], &refined_quantized[0][0] + 8, &quantized[0][0] );
+         std::copy( refined_indices, refined_indices + 16, indices );
+         p[0] = refined_p[0];
+         p[1] = refined_p[1];
+      }
+   }
+
+   // The most significant bit of the first index is implied to be 0, so swap the endpoints if it is set.
+   if (indices[0] >= 8) {
+      for (int c = 0; c < 4; ++c) std::swap( quantized[0][c], quantized[1][c] );
+      std::swap( p[0], p[1] );
+      for (int& index : indices) index = 15 - index;
+   }
+
+   std::fill( block, block + 16, static_cast<uint8_t>(0) );
+   BitWriter writer( block );
+   writer.write( 1u << 6, 7 );
+   for (int c = 0; c < 4; ++c) {
+      writer.write( static_cast<uint32_t>(quantized[0][c]), 7 );
+      writer.write( static_cast<uint32_t>(quantized[1][c]), 7 );
+   }
+   writer.write( p[0], 1 );
+   writer.write( p[1], 1 );
+   for (int i = 0; i < 16; ++i) writer.write( static_cast<uint32_t>(indices[i]), i == 0 ? 3 : 4 );
+}
+
+void BlockCompressor::encode(
+   std::vector<uint8_t>& blocks,
+   const uint8_t* texels,
+   int width,
+   int height,
+   int channel_num,
+   std::ptrdiff_t row_stride,
+   bool is_bgr,
+   Format format
+)
+{
+   blocks.resize( getCompressedSize( width, height, format ) );
+   if (width <= 0 || height <= 0) return;
+
+   const int block_columns = (width + 3) / 4;
+   const int block_rows = (height + 3) / 4;
+   const int block_size = getBytesPerBlock( format );
+   const int r = channel_num >= 3 && is_bgr ? 2 : 0;
+   const int b = channel_num >= 3 && !is_bgr ? 2 : 0;
+   uint8_t* out = blocks.data();
+   ThreadPool& pool = ThreadPool::getInstance();
+   pool.parallelFor(
+      0, block_rows, std::max( 1, block_rows / (pool.getThreadNum() * 4) ),
+      [=](int first_row, int last_row) {
+         uint8_t rgba[16][4];
+         uint8_t channels[2][16];
+         for (int by = first_row; by < last_row; ++by) {
+            for (int bx = 0; bx < block_columns; ++bx) {
+               // Texels past the image edge repeat the last row and column.
+               for (int i = 0; i < 16; ++i) {
+                  const int x = std::min( bx * 4 + (i & 3), width - 1 );
+                  const int y = std::min( by * 4 + (i >> 2), height - 1 );
+                  const uint8_t* texel = texels + y * row_stride + x * channel_num;
+                  rgba[i][0] = texel[r];
+                  rgba[i][1] = channel_num >= 2 ? texel[1] : texel[0];
+                  rgba[i][2] = channel_num >= 3 ? texel[b] : (channel_num == 1 ? texel[0] : 0);
+                  rgba[i][3] = channel_num == 4 ? texel[3] : 255;
+                  channels[0][i] = rgba[i][0];
+                  channels[1][i] = rgba[i][1];
+               }
+
+               uint8_t* block = out + (static_cast<size_t>(by) * block_columns + bx) * block_size;
+               switch (format) {
+                  case Format::BC1: encodeBC1( block, rgba ); break;
+                  case Format::BC5:
+                     encodeBC4( block, channels[0] );
+                     encodeBC4( block + 8, channels[1] );
+                     break;
+                  case Format::BC7: encodeBC7( block, rgba ); break;
+               }
+            }
+         }
+      }
+   );
+}
+
+void BlockCompressor::decodeBC1(uint8_t (*rgba)[4], const uint8_t* block)
+{
+   const auto color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+   const auto color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+   int palette[4][3];
+   getBC1Palette( palette, color0, color1 );
+
+   const uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<uint32_t>(block[7]) << 24);
+   for (int i = 0; i < 16; ++i) {
+      const uint32_t index = (indices >> (2 * i)) & 3u;
+      for (int c = 0; c < 3; ++c) rgba[i][c] = static_cast<uint8_t>(palette[index][c]);
+      rgba[i][3] = color0 <= color1 && index == 3 ? 0 : 255;
+   }
+}
+
+void BlockCompressor::decodeBC4(uint8_t (*rgba)[4], const uint8_t* block, int channel)
+{
+   uint64_t indices = 0;
+   for (int i = 0; i < 6; ++i) indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+   for (int i = 0; i < 16; ++i) {
+      const auto index = static_cast<int>((indices >> (3 * i)) & 7u);
+      rgba[i][channel] = static_cast<uint8_t>(getBC4Value( block[0], block[1], index ));
+   }
+}
+
+void BlockCompressor::decodeBC7(uint8_t (*rgba)[4], const uint8_t* block)
+{
+   if ((block[0] & 0x7F) != 0x40) {
+      // Only mode 6 is ever encoded here, so other modes are shown as magenta.
+      for (int i = 0; i < 16; ++i) {
+         rgba[i][0] = 255; rgba[i][1] = 0; rgba[i][2] = 255; rgba[i][3] = 255;
+      }
+      return;
+   }
+
+   BitReader reader( block );
+   reader.read( 7 );
+   int endpoints[2][4];
+   for (int c = 0; c < 4; ++c) {
+      endpoints[0][c] = static_cast<int>(reader.read( 7 ));
+      endpoints[1][c] = static_cast<int>(reader.read( 7 ));
+   }
+   const auto p0 = static_cast<int>(reader.read( 1 ));
+   const auto p1 = static_cast<int>(reader.read( 1 ));
+   for (int c = 0; c < 4; ++c) {
+      endpoints[0][c] = endpoints[0][c] * 2 + p0;
+      endpoints[1][c] = endpoints[1][c] * 2 + p1;
+   }
+   for (int i = 0; i < 16; ++i) {
+      const int w = BC7Weights[reader.read( i == 0 ? 3 : 4 )];
+      for (int c = 0; c < 4; ++c) {
+         rgba[i][c] = static_cast<uint8_t>(((64 - w) * endpoints[0][c] + w * endpoints[1][c] + 32) >> 6);
+      }
+   }
+}
+
+void BlockCompressor::decode(std::vector<uint8_t>& texels, const uint8_t* blocks, int width, int height, Format format)
+{
+   texels.resize( static_cast<size_t>(width) * height * 4 );
+   const int block_columns = (width + 3) / 4;
+   const int block_rows = (height + 3) / 4;
+   const int block_size = getBytesPerBlock( format );
+   uint8_t* out = texels.data();
+   for (int by = 0; by < block_rows; ++by) {
+      for (int bx = 0; bx < block_columns; ++bx) {
+         const uint8_t* block = blocks + (static_cast<size_t>(by) * block_columns + bx) * block_size;
+         uint8_t rgba[16][4];
+         switch (format) {
+            case Format::BC1: decodeBC1( rgba, block ); break;
+            case Format::BC5:
+               for (auto& texel : rgba) {
+                  texel[2] = 0;
+                  texel[3] = 255;
+               }
+               decodeBC4( rgba, block, 0 );
+               decodeBC4( rgba, block + 8, 1 );
+               break;
+            case Format::BC7: decodeBC7( rgba, block ); break;
+         }
+         for (int i = 0; i < 16; ++i) {
+            const int x = bx * 4 + (i & 3);
+            const int y = by * 4 + (i >> 2);
+            if (x < width && y < height) std::copy( rgba[i], rgba[i] + 4, out + (static_cast<size_t>(y) * width + x) * 4 );
+         }
+      }
+   }
+}
+
+double BlockCompressor::getPSNR(const uint8_t* texels, const uint8_t* reference, int texel_num, int channel_num)
+{
+   double squared_error = 0.0;
+   for (int i = 0; i < texel_num; ++i) {
+      for (int c = 0; c < channel_num; ++c) {
+         const double d = static_cast<double>(texels[i * 4 + c]) - static_cast<double>(reference[i * 4 + c]);
+         squared_error += d * d;
+      }
+   }
+   if (squared_error == 0.0) return std::numeric_limits<double>::infinity();
+
+   const double mean_squared_error = squared_error / (static_cast<double>(texel_num) * channel_num);
+   return 10.0 * std::log10( 255.0 * 255.0 / mean_squared_error );
+}
\ No newline at end of file
@@ -20,10 +20,16 @@ CameraGL::CameraGL(
    IsMoving( false ), Width( 0 ), Height( 0 ), FOV( fov ), InitFOV( fov ), NearPlane( near_plane ), FarPlane( far_plane ),
    AspectRatio( 0.0f ), ZoomSensitivity( 1.0f ), MoveSensitivity( 0.05f ), RotationSensitivity( 0.005f ),  
    InitCamPos( cam_position ), InitRefPos( view_reference_position ), InitUpVec( view_up_vector ), CamPos( cam_position ),
-   ViewMatrix( lookAt( InitCamPos, InitRefPos, InitUpVec ) ), ProjectionMatrix(glm::mat4(1.0f) )
+   ViewMatrix( lookAt( InitCamPos, InitRefPos, InitUpVec ) ), ProjectionMatrix(glm::mat4(1.0f) ),
+   CameraBuffer( 0 )
 {
 }
 
+CameraGL::~CameraGL()
+{
+   if (CameraBuffer != 0) glDeleteBuffers( 1, &CameraBuffer );
+}
+
 void CameraGL::updateCamera()
 {
    const glm::mat4 inverse_view = inverse( ViewMatrix );
@@ -118,10 +124,33 @@ void CameraGL::resetCamera()
    ProjectionMatrix = glm::perspective( glm::radians( InitFOV ), AspectRatio, NearPlane, FarPlane );
 }
 
+void CameraGL::setView(
+   const glm::vec3& cam_position,
+   const glm::vec3& view_reference_position,
+   const glm::vec3& view_up_vector
+)
+{
+   CamPos = cam_position;
+   ViewMatrix = lookAt( cam_position, view_reference_position, view_up_vector );
+}
+
 void CameraGL::updateWindowSize(int width, int height)
 {
    Width = width;
    Height = height;
    AspectRatio = static_cast<float>(width) / static_cast<float>(height);
    ProjectionMatrix = glm::perspective( glm::radians( FOV ), AspectRatio, NearPlane, FarPlane );
+}
+
+void CameraGL::updateCameraBuffer()
+{
+   const CameraBlock block{
+      ViewMatrix, ProjectionMatrix, ProjectionMatrix * ViewMatrix, inverse( ViewMatrix ), inverse( ProjectionMatrix )
+   };
+   if (CameraBuffer == 0) {
+      glCreateBuffers( 1, &CameraBuffer );
+      glNamedBufferStorage( CameraBuffer, sizeof( CameraBlock ), &block, GL_DYNAMIC_STORAGE_BIT );
+   }
+   else glNamedBufferSubData( CameraBuffer, 0, sizeof( CameraBlock ), &block );
+   glBindBufferBase( GL_UNIFORM_BUFFER, CameraBinding, CameraBuffer );
 }
\ No newline at end of file
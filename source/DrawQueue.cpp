@@ -0,0 +1,69 @@
+#include "DrawQueue.h"
+
+DrawQueueGL::DrawCommand DrawQueueGL::getObjectDrawCommand(
+   const ShaderGL* shader,
+   const ObjectGL* object,
+   GLsizei instance_num,
+   GLuint base_instance
+)
+{
+   DrawCommand command;
+   command.Shader = shader;
+   command.VAO = object->getVAO();
+   const int texture_num = std::min( object->getTextureNum(), StateCacheGL::TextureUnitNum );
+   for (int unit = 0; unit < texture_num; ++unit) command.Textures[unit] = object->getTextureID( unit );
+   command.DrawMode = object->getDrawMode();
+   command.VertexNum = object->getVertexNum();
+   command.InstanceNum = instance_num;
+   command.BaseInstance = base_instance;
+   command.Material = object;
+   return command;
+}
+
+void DrawQueueGL::resetCounters()
+{
+   DrawNum = 0;
+   State.resetCounters();
+}
+
+void DrawQueueGL::flush()
+{
+   // The sort is stable, so draws with the same state keep the order they were submitted in.
+   Order.resize( Commands.size() );
+   for (uint32_t i = 0; i < Order.size(); ++i) Order[i] = i;
+   std::stable_sort(
+      Order.begin(), Order.end(), [this](uint32_t a, uint32_t b) {
+         const DrawCommand& lhs = Commands[a];
+         const DrawCommand& rhs = Commands[b];
+         const GLuint lhs_program = lhs.Shader->getShaderProgram();
+         const GLuint rhs_program = rhs.Shader->getShaderProgram();
+         if (lhs_program != rhs_program) return lhs_program < rhs_program;
+         if (lhs.Textures != rhs.Textures) return lhs.Textures < rhs.Textures;
+         return lhs.VAO < rhs.VAO;
+      }
+   );
+
+   for (const auto& index : Order) {
+      const DrawCommand& command = Commands[index];
+      const ShaderGL* shader = command.Shader;
+      State.useProgram( shader->getShaderProgram() );
+      for (int unit = 0; unit < StateCacheGL::TextureUnitNum; ++unit) {
+         State.bindTextureUnit( unit, command.Textures[unit] );
+      }
+      State.bindVertexArray( command.VAO );
+      if (command.Material != nullptr) {
+         const ObjectGL::MaterialBlock material = command.Material->getMaterialBlock();
+         State.setUniform( shader->getMaterialEmissionLocation(), material.EmissionColor );
+         State.setUniform( shader->getMaterialAmbientLocation(), material.AmbientColor );
+         State.setUniform( shader->getMaterialDiffuseLocation(), material.DiffuseColor );
+         State.setUniform( shader->getMaterialSpecularLocation(), material.SpecularColor );
+         State.setUniform( shader->getMaterialSpecularExponentLocation(), material.SpecularExponent );
+      }
+      State.setUniform( command.IntUniformLocation, command.IntUniformValue );
+      glDrawArraysInstancedBaseInstance(
+         command.DrawMode, 0, command.VertexNum, command.InstanceNum, command.BaseInstance
+      );
+      ++DrawNum;
+   }
+   Commands.clear();
+}
@@ -0,0 +1,114 @@
+#include "FrameCapture.h"
+
+FrameCaptureGL::FrameCaptureGL() : Size( 0, 0 ), NextSlot( 0 )
+{
+}
+
+FrameCaptureGL::~FrameCaptureGL()
+{
+   deleteSlots();
+}
+
+void FrameCaptureGL::deleteSlots()
+{
+   for (auto& slot : Slots) {
+      if (slot.Fence != nullptr) glDeleteSync( slot.Fence );
+      if (slot.Buffer != 0) {
+         glUnmapNamedBuffer( slot.Buffer );
+         glDeleteBuffers( 1, &slot.Buffer );
+      }
+      slot = Slot{};
+   }
+   NextSlot = 0;
+}
+
+bool FrameCaptureGL::start(
+   const glm::ivec2& size,
+   const std::string& directory,
+   FrameEncoder::Format format,
+   int thread_num
+)
+{
+   finish();
+   deleteSlots();
+   Size = size;
+   Stats = CaptureStats{};
+
+   // The client storage hint asks for the buffers in system memory, where mapping them for reading is cheapest.
+   const auto byte_num = static_cast<GLsizeiptr>(size.x) * size.y * 4;
+   const GLbitfield map_flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+   for (auto& slot : Slots) {
+      glCreateBuffers( 1, &slot.Buffer );
+      glNamedBufferStorage( slot.Buffer, byte_num, nullptr, map_flags | GL_CLIENT_STORAGE_BIT );
+      slot.Pixels = static_cast<const uint8_t*>(glMapNamedBufferRange( slot.Buffer, 0, byte_num, map_flags ));
+      if (slot.Pixels == nullptr) {
+         std::cerr << "Could not map a frame capture buffer of " << byte_num << " bytes\n";
+         deleteSlots();
+         return false;
+      }
+   }
+   if (!Encoder.start( directory, format, size, thread_num )) {
+      deleteSlots();
+      return false;
+   }
+   return true;
+}
+
+bool FrameCaptureGL::collect(Slot& slot, bool wait)
+{
+   if (slot.Fence == nullptr) return true;
+
+   const GLenum status = wait ?
+      glClientWaitSync( slot.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max() ) :
+      glClientWaitSync( slot.Fence, 0, 0 );
+   if (status == GL_TIMEOUT_EXPIRED) return false;
+   glDeleteSync( slot.Fence );
+   slot.Fence = nullptr;
+   if (status == GL_WAIT_FAILED) {
+      std::cerr << "Could not wait for the readback of frame " << slot.FrameIndex << "\n";
+      ++Stats.DroppedFrameNum;
+      return true;
+   }
+
+   std::vector<uint8_t> pixels = Encoder.acquireBuffer();
+   std::memcpy( pixels.data(), slot.Pixels, pixels.size() );
+   Encoder.submit( std::move( pixels ), slot.FrameIndex );
+   return true;
+}
+
+void FrameCaptureGL::capture(GLuint framebuffer, int frame_index)
+{
+   if (!Encoder.isStarted()) return;
+
+   const auto start = std::chrono::steady_clock::now();
+   // The slots went out in ring order, so the frames leave in order as well, starting with the oldest.
+   for (int i = 0; i < SlotNum; ++i) {
+      if (!collect( Slots[(NextSlot + i) % SlotNum], false )) break;
+   }
+   Slot& slot = Slots[NextSlot];
+   if (slot.Fence != nullptr) {
+      ++Stats.FenceWaitNum;
+      collect( slot, true );
+   }
+
+   glBindFramebuffer( GL_READ_FRAMEBUFFER, framebuffer );
+   if (framebuffer != 0) glNamedFramebufferReadBuffer( framebuffer, GL_COLOR_ATTACHMENT0 );
+   glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.Buffer );
+   glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+   glReadPixels( 0, 0, Size.x, Size.y, Encoder.isBGR() ? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+   glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+   slot.Fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+   // Without a swap to submit the frame, a fence that is only polled could otherwise stay in the command queue.
+   glFlush();
+   slot.FrameIndex = frame_index;
+   NextSlot = (NextSlot + 1) % SlotNum;
+
+   ++Stats.CapturedFrameNum;
+   Stats.Milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool FrameCaptureGL::finish()
+{
+   for (int i = 0; i < SlotNum; ++i) collect( Slots[(NextSlot + i) % SlotNum], true );
+   return Encoder.finish() && Stats.DroppedFrameNum == 0;
+}
@@ -0,0 +1,134 @@
+#include "FrameEncoder.h"
+
+FrameEncoder::FrameEncoder() :
+   Stop( false ), FrameFormat( Format::PNG ), Size( 0, 0 ), WrittenFrameNum( 0 ), FailedFrameNum( 0 ),
+   StallMilliseconds( 0.0 )
+{
+}
+
+FrameEncoder::~FrameEncoder()
+{
+   finish();
+}
+
+std::optional<FrameEncoder::Format> FrameEncoder::getFormat(const std::string& name)
+{
+   if (name == "png") return Format::PNG;
+   if (name == "exr") return Format::EXR;
+   if (name == "raw") return Format::Raw;
+   return std::nullopt;
+}
+
+bool FrameEncoder::start(const std::string& directory, Format format, const glm::ivec2& size, int thread_num)
+{
+   finish();
+
+   std::error_code error;
+   std::filesystem::create_directories( directory, error );
+   if (error) {
+      std::cerr << "Could not create the frame directory " << directory << ": " << error.message() << "\n";
+      return false;
+   }
+
+   FrameFormat = format;
+   Size = size;
+   Directory = directory;
+   WrittenFrameNum = 0;
+   FailedFrameNum = 0;
+   StallMilliseconds = 0.0;
+   thread_num = std::max( thread_num, 1 );
+   Workers.reserve( thread_num );
+   for (int i = 0; i < thread_num; ++i) Workers.emplace_back( &FrameEncoder::work, this );
+   return true;
+}
+
+bool FrameEncoder::finish()
+{
+   if (Workers.empty()) return FailedFrameNum == 0;
+
+   {
+      std::lock_guard<std::mutex> lock( QueueMutex );
+      Stop = true;
+   }
+   FrameCondition.notify_all();
+   for (auto& worker : Workers) worker.join();
+   Workers.clear();
+   Stop = false;
+   return FailedFrameNum == 0;
+}
+
+std::vector<uint8_t> FrameEncoder::acquireBuffer()
+{
+   std::vector<uint8_t> buffer;
+   {
+      std::lock_guard<std::mutex> lock( QueueMutex );
+      if (!FreeBuffers.empty()) {
+         buffer = std::move( FreeBuffers.back() );
+         FreeBuffers.pop_back();
+      }
+   }
+   buffer.resize( static_cast<size_t>(Size.x) * Size.y * 4 );
+   return buffer;
+}
+
+void FrameEncoder::submit(std::vector<uint8_t>&& pixels, int frame_index)
+{
+   if (Workers.empty()) return;
+
+   {
+      std::unique_lock<std::mutex> lock( QueueMutex );
+      if (static_cast<int>(Frames.size()) >= MaxQueuedFrameNum) {
+         const auto start = std::chrono::steady_clock::now();
+         SpaceCondition.wait( lock, [this]() { return static_cast<int>(Frames.size()) < MaxQueuedFrameNum; } );
+         StallMilliseconds +=
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      }
+      Frames.push( { frame_index, std::move( pixels ) } );
+   }
+   FrameCondition.notify_one();
+}
+
+void FrameEncoder::work()
+{
+   while (true) {
+      Frame frame;
+      {
+         std::unique_lock<std::mutex> lock( QueueMutex );
+         FrameCondition.wait( lock, [this]() { return Stop || !Frames.empty(); } );
+         if (Stop && Frames.empty()) return;
+         frame = std::move( Frames.front() );
+         Frames.pop();
+      }
+      SpaceCondition.notify_one();
+
+      const bool written = write( frame );
+      std::lock_guard<std::mutex> lock( QueueMutex );
+      if (written) ++WrittenFrameNum;
+      else ++FailedFrameNum;
+      FreeBuffers.emplace_back( std::move( frame.Pixels ) );
+   }
+}
+
+bool FrameEncoder::write(const Frame& frame) const
+{
+   std::ostringstream file_name;
+   file_name << "frame_" << std::setw( 5 ) << std::setfill( '0' ) << frame.Index;
+   if (FrameFormat == Format::PNG) file_name << ".png";
+   else if (FrameFormat == Format::EXR) file_name << ".exr";
+   else file_name << ".rgba";
+   const std::string file_path = (Directory / file_name.str()).string();
+
+   if (FrameFormat == Format::Raw) {
+      std::ofstream file(file_path, std::ios::binary);
+      const auto byte_num = static_cast<std::streamsize>(frame.Pixels.size());
+      file.write( reinterpret_cast<const char*>(frame.Pixels.data()), byte_num );
+      if (!file.good()) {
+         std::cerr << "Could not write the raw frame " << file_path << "\n";
+         return false;
+      }
+      return true;
+   }
+   // The fastest deflate level takes a fraction of the default's time for files only slightly larger.
+   const int flags = FrameFormat == Format::PNG ? PNG_Z_BEST_SPEED : 0;
+   return Image::save( file_path, frame.Pixels.data(), Size.x, Size.y, flags );
+}
@@ -0,0 +1,61 @@
+#include "GBuffer.h"
+
+GBufferGL::GBufferGL() : Size( 0, 0 ), Framebuffer( 0 ), Textures{ 0, 0, 0, 0 }
+{
+}
+
+GBufferGL::~GBufferGL()
+{
+   deleteTargets();
+}
+
+void GBufferGL::deleteTargets()
+{
+   if (Framebuffer != 0) glDeleteFramebuffers( 1, &Framebuffer );
+   for (auto& texture : Textures) {
+      if (texture != 0) glDeleteTextures( 1, &texture );
+      texture = 0;
+   }
+   Framebuffer = 0;
+   Size = glm::ivec2(0, 0);
+}
+
+bool GBufferGL::setSize(const glm::ivec2& size)
+{
+   if (size == Size && Framebuffer != 0) return true;
+
+   deleteTargets();
+   if (size.x <= 0 || size.y <= 0) return false;
+
+   Size = size;
+   const GLenum formats[TargetNum] = { GL_RGBA8, GL_RG16_SNORM, GL_RG8, GL_DEPTH_COMPONENT32F };
+   glCreateFramebuffers( 1, &Framebuffer );
+   glCreateTextures( GL_TEXTURE_2D, TargetNum, Textures );
+   for (int i = 0; i < TargetNum; ++i) {
+      glTextureStorage2D( Textures[i], 1, formats[i], Size.x, Size.y );
+      glTextureParameteri( Textures[i], GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+      glTextureParameteri( Textures[i], GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+      glTextureParameteri( Textures[i], GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+      glTextureParameteri( Textures[i], GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+      const GLenum attachment = i == DepthTarget ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + i;
+      glNamedFramebufferTexture( Framebuffer, attachment, Textures[i], 0 );
+   }
+   const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+   glNamedFramebufferDrawBuffers( Framebuffer, 3, draw_buffers );
+
+   if (glCheckNamedFramebufferStatus( Framebuffer, GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cerr << "Could not complete the G-buffer of " << Size.x << " x " << Size.y << "\n";
+      deleteTargets();
+      return false;
+   }
+   return true;
+}
+
+void GBufferGL::beginGeometryPass() const
+{
+   const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+   const GLfloat far_depth = 1.0f;
+   glBindFramebuffer( GL_FRAMEBUFFER, Framebuffer );
+   for (int i = 0; i < DepthTarget; ++i) glClearNamedFramebufferfv( Framebuffer, GL_COLOR, i, zero );
+   glClearNamedFramebufferfv( Framebuffer, GL_DEPTH, 0, &far_depth );
+}
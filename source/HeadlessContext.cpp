@@ -0,0 +1,140 @@
+#include "HeadlessContext.h"
+
+#ifdef USE_EGL
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace
+{
+   bool hasExtension(const char* extensions, const std::string& name)
+   {
+      if (extensions == nullptr) return false;
+      std::istringstream stream(extensions);
+      std::string extension;
+      while (stream >> extension) {
+         if (extension == name) return true;
+      }
+      return false;
+   }
+
+   EGLDisplay getDisplay()
+   {
+      // The client extensions can be queried without a display; an implementation without them fails the query.
+      const char* client_extensions = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+      if (hasExtension( client_extensions, "EGL_MESA_platform_surfaceless" )) {
+         const auto get_platform_display =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress( "eglGetPlatformDisplayEXT" ));
+         if (get_platform_display != nullptr) {
+            EGLDisplay display = get_platform_display( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr );
+            if (display != EGL_NO_DISPLAY) return display;
+         }
+      }
+      return eglGetDisplay( EGL_DEFAULT_DISPLAY );
+   }
+}
+#endif
+
+HeadlessContextGL::HeadlessContextGL() : Display( nullptr ), Surface( nullptr ), Context( nullptr )
+{
+}
+
+HeadlessContextGL::~HeadlessContextGL()
+{
+   destroy();
+}
+
+void HeadlessContextGL::destroy()
+{
+#ifdef USE_EGL
+   if (Display == nullptr) return;
+
+   eglMakeCurrent( Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+   if (Context != nullptr) eglDestroyContext( Display, Context );
+   if (Surface != nullptr) eglDestroySurface( Display, Surface );
+   eglTerminate( Display );
+#endif
+   Display = Surface = Context = nullptr;
+}
+
+bool HeadlessContextGL::create()
+{
+#ifdef USE_EGL
+   destroy();
+
+   EGLDisplay display = getDisplay();
+   EGLint major = 0, minor = 0;
+   if (display == EGL_NO_DISPLAY || eglInitialize( display, &major, &minor ) != EGL_TRUE) {
+      std::cerr << "Could not initialize an EGL display\n";
+      return false;
+   }
+   Display = display;
+   if (eglBindAPI( EGL_OPENGL_API ) != EGL_TRUE) {
+      std::cerr << "EGL " << major << "." << minor << " does not support desktop OpenGL\n";
+      destroy();
+      return false;
+   }
+
+   // The surfaceless platform has no pbuffer configs, so it needs a context without any config.
+   const char* extensions = eglQueryString( display, EGL_EXTENSIONS );
+   const bool surfaceless = hasExtension( extensions, "EGL_KHR_surfaceless_context" );
+   const EGLint config_attributes[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE
+   };
+   EGLConfig config = nullptr;
+   EGLint config_num = 0;
+   eglChooseConfig( display, config_attributes, &config, 1, &config_num );
+   if (config_num == 0) {
+      if (!surfaceless || !hasExtension( extensions, "EGL_KHR_no_config_context" )) {
+         std::cerr << "Could not find an EGL config for an offscreen OpenGL context\n";
+         destroy();
+         return false;
+      }
+      config = EGL_NO_CONFIG_KHR;
+   }
+
+   const EGLint context_attributes[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 4,
+      EGL_CONTEXT_MINOR_VERSION, 6,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE
+   };
+   Context = eglCreateContext( display, config, EGL_NO_CONTEXT, context_attributes );
+   if (Context == EGL_NO_CONTEXT) {
+      std::cerr << "Could not create an OpenGL 4.6 core context through EGL. Mesa llvmpipe stops at 4.5 unless "
+         "MESA_GL_VERSION_OVERRIDE=4.6 and MESA_GLSL_VERSION_OVERRIDE=460 are set.\n";
+      Context = nullptr;
+      destroy();
+      return false;
+   }
+
+   // Without surfaceless contexts, a context has to be made current with some surface, even if it never draws there.
+   if (!surfaceless) {
+      const EGLint surface_attributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+      Surface = eglCreatePbufferSurface( display, config, surface_attributes );
+      if (Surface == EGL_NO_SURFACE) {
+         std::cerr << "Could not create an EGL pbuffer\n";
+         Surface = nullptr;
+         destroy();
+         return false;
+      }
+   }
+   if (eglMakeCurrent( display, Surface, Surface, Context ) != EGL_TRUE) {
+      std::cerr << "Could not make the EGL context current\n";
+      destroy();
+      return false;
+   }
+
+   if (!gladLoadGLLoader( reinterpret_cast<GLADloadproc>(eglGetProcAddress) )) {
+      std::cerr << "Failed to initialize GLAD\n";
+      destroy();
+      return false;
+   }
+   return true;
+#else
+   std::cerr << "This build has no EGL, so it cannot create a headless context\n";
+   return false;
+#endif
+}
@@ -0,0 +1,88 @@
+#include "Image.h"
+
+Image::Image(FIBITMAP* bitmap) :
+   Bitmap( bitmap ), Bits( FreeImage_GetBits( bitmap ) ),
+   Width( static_cast<int>(FreeImage_GetWidth( bitmap )) ), Height( static_cast<int>(FreeImage_GetHeight( bitmap )) ),
+   ChannelNum( static_cast<int>(FreeImage_GetBPP( bitmap ) / 8) ), Pitch( static_cast<int>(FreeImage_GetPitch( bitmap )) )
+{
+}
+
+Image::~Image()
+{
+   if (Bitmap != nullptr) FreeImage_Unload( Bitmap );
+}
+
+std::shared_ptr<const Image> Image::load(const std::string& file_path, bool is_grayscale)
+{
+   const FREE_IMAGE_FORMAT format = FreeImage_GetFileType( file_path.c_str(), 0 );
+   FIBITMAP* bitmap = FreeImage_Load( format, file_path.c_str() );
+   if (!bitmap) {
+      std::cerr << "Could not read image file " << file_path.c_str() << "\n";
+      return nullptr;
+   }
+
+   const uint n_bits_per_pixel = FreeImage_GetBPP( bitmap );
+   const uint n_bits = is_grayscale ? 8 : 32;
+   if (n_bits_per_pixel != n_bits) {
+      FIBITMAP* converted = is_grayscale ? FreeImage_GetChannel( bitmap, FICC_RED ) : FreeImage_ConvertTo32Bits( bitmap );
+      FreeImage_Unload( bitmap );
+      if (!converted) {
+         std::cerr << "Could not convert image file " << file_path.c_str() << "\n";
+         return nullptr;
+      }
+      bitmap = converted;
+   }
+   return std::shared_ptr<const Image>(new Image(bitmap));
+}
+
+std::shared_ptr<const Image> Image::create(int width, int height, const glm::vec4& color)
+{
+   FIBITMAP* bitmap = FreeImage_Allocate( width, height, 32 );
+   if (!bitmap) return nullptr;
+
+   uint8_t pixel[4];
+   pixel[FI_RGBA_RED] = static_cast<uint8_t>(glm::clamp( color.r, 0.0f, 1.0f ) * 255.0f + 0.5f);
+   pixel[FI_RGBA_GREEN] = static_cast<uint8_t>(glm::clamp( color.g, 0.0f, 1.0f ) * 255.0f + 0.5f);
+   pixel[FI_RGBA_BLUE] = static_cast<uint8_t>(glm::clamp( color.b, 0.0f, 1.0f ) * 255.0f + 0.5f);
+   pixel[FI_RGBA_ALPHA] = static_cast<uint8_t>(glm::clamp( color.a, 0.0f, 1.0f ) * 255.0f + 0.5f);
+   for (int j = 0; j < height; ++j) {
+      uint8_t* row = FreeImage_GetScanLine( bitmap, j );
+      for (int i = 0; i < width; ++i) std::copy( pixel, pixel + 4, row + i * 4 );
+   }
+   return std::shared_ptr<const Image>(new Image(bitmap));
+}
+
+std::shared_ptr<const Image> Image::resize(int width, int height) const
+{
+   FIBITMAP* bitmap = FreeImage_Rescale( Bitmap, width, height, FILTER_CATMULLROM );
+   if (!bitmap) return nullptr;
+   return std::shared_ptr<const Image>(new Image(bitmap));
+}
+
+bool Image::save(const std::string& file_path, const uint8_t* pixels, int width, int height, int flags)
+{
+   const FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename( file_path.c_str() );
+   if (format == FIF_UNKNOWN) {
+      std::cerr << "Could not tell the image format of " << file_path.c_str() << "\n";
+      return false;
+   }
+
+   FIBITMAP* bitmap = FreeImage_ConvertFromRawBits(
+      const_cast<uint8_t*>(pixels), width, height, width * 4, 32,
+      FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE
+   );
+   if (!bitmap) return false;
+
+   // OpenEXR only takes floating-point pixels.
+   if (format == FIF_EXR) {
+      FIBITMAP* converted = FreeImage_ConvertToRGBAF( bitmap );
+      FreeImage_Unload( bitmap );
+      if (!converted) return false;
+      bitmap = converted;
+   }
+
+   const bool saved = FreeImage_Save( format, bitmap, file_path.c_str(), flags ) == TRUE;
+   FreeImage_Unload( bitmap );
+   if (!saved) std::cerr << "Could not write image file " << file_path.c_str() << "\n";
+   return saved;
+}
@@ -0,0 +1,30 @@
+#include "InstructionSet.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define USE_X86_SIMD
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#endif
+
+InstructionSet getSupportedInstructionSet()
+{
+   static const InstructionSet supported = []() {
+#if defined(USE_X86_SIMD) && defined(__GNUC__)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports( "avx2" )) return InstructionSet::AVX2;
+      if (__builtin_cpu_supports( "sse4.1" )) return InstructionSet::SSE41;
+#elif defined(USE_X86_SIMD) && defined(_MSC_VER)
+      int info[4];
+      __cpuid( info, 1 );
+      const bool sse41 = (info[2] & (1 << 19)) != 0;
+      const bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv( 0 ) & 6) == 6;
+      __cpuidex( info, 7, 0 );
+      if (os_saves_avx && (info[1] & (1 << 5)) != 0) return InstructionSet::AVX2;
+      if (sse41) return InstructionSet::SSE41;
+#endif
+      return InstructionSet::Scalar;
+   }();
+   return supported;
+}
@@ -1,8 +1,20 @@
 #include "Light.h"
 
 LightGL::LightGL() :
-   TurnLightOn( true ), GlobalAmbientColor( 0.2f, 0.2f, 0.2f, 1.0f ), TotalLightNum( 0 )
+   HeaderChanged( true ), Version( 1 ), UploadedVersion( 0 ), LightBuffer( 0 ), LightBufferSize( 0 ),
+   ClusterBuffer( 0 ), ClusterBufferSize( 0 ), ClusterLightIndexBuffer( 0 ), ClusterLightIndexBufferSize( 0 ),
+   TurnLightOn( true ), TotalLightNum( 0 ), GlobalAmbientColor( 0.2f, 0.2f, 0.2f, 1.0f )
 {
+   static_assert( sizeof( LightBlockHeader ) == 32, "The header must match the std430 block." );
+   static_assert( sizeof( LightBlockElement ) == 96, "A light must match the std430 array stride." );
+   static_assert( sizeof( ClusterBlockHeader ) == 32, "The cluster header must match the std430 block." );
+}
+
+LightGL::~LightGL()
+{
+   if (LightBuffer != 0) glDeleteBuffers( 1, &LightBuffer );
+   if (ClusterBuffer != 0) glDeleteBuffers( 1, &ClusterBuffer );
+   if (ClusterLightIndexBuffer != 0) glDeleteBuffers( 1, &ClusterLightIndexBuffer );
 }
 
 bool LightGL::isLightOn() const
@@ -10,9 +22,19 @@ bool LightGL::isLightOn() const
    return TurnLightOn;
 }
 
+bool LightGL::hasActiveSpotlight() const
+{
+   for (int i = 0; i < TotalLightNum; ++i) {
+      if (IsActivated[i] && SpotlightCutoffAngles[i] < 180.0f) return true;
+   }
+   return false;
+}
+
 void LightGL::toggleLightSwitch()
 {
    TurnLightOn = !TurnLightOn;
+   HeaderChanged = true;
+   ++Version;
 }
 
 void LightGL::addLight(
@@ -38,37 +60,213 @@ void LightGL::addLight(
    FallOffRadii.emplace_back( falloff_radius );
 
    IsActivated.emplace_back( true );
+   DirtyFields.emplace_back( 0 );
 
    TotalLightNum = static_cast<int>(Positions.size());
+   HeaderChanged = true;
+   markDirty( TotalLightNum - 1, AllFields );
+}
+
+void LightGL::markDirty(int light_index, uint8_t fields)
+{
+   if (DirtyFields[light_index] == 0) DirtyLights.emplace_back( light_index );
+   DirtyFields[light_index] |= fields;
+   ++Version;
+}
+
+void LightGL::setLightPosition(const glm::vec4& light_position, int index)
+{
+   assert( 0 <= index && index < TotalLightNum );
+   if (Positions[index] == light_position) return;
+   Positions[index] = light_position;
+   markDirty( index, PositionField );
 }
 
 void LightGL::activateLight(const int& light_index)
 {
-   if (light_index >= TotalLightNum) return;
+   if (light_index >= TotalLightNum || IsActivated[light_index]) return;
    IsActivated[light_index] = true;
+   markDirty( light_index, SwitchField );
 }
 
 void LightGL::deactivateLight(const int& light_index)
 {
-   if (light_index >= TotalLightNum) return;
+   if (light_index >= TotalLightNum || !IsActivated[light_index]) return;
    IsActivated[light_index] = false;
+   markDirty( light_index, SwitchField );
+}
+
+LightGL::LightBlockHeader LightGL::getLightBlockHeader() const
+{
+   LightBlockHeader header{};
+   header.GlobalAmbient = GlobalAmbientColor;
+   header.UseLight = TurnLightOn ? 1 : 0;
+   header.LightNum = TotalLightNum;
+   return header;
+}
+
+LightGL::LightBlockElement LightGL::getLightBlockElement(int light_index) const
+{
+   LightBlockElement light{};
+   light.Position = Positions[light_index];
+   light.AmbientColor = AmbientColors[light_index];
+   light.DiffuseColor = DiffuseColors[light_index];
+   light.SpecularColor = SpecularColors[light_index];
+   light.SpotlightDirection = glm::length( SpotlightDirections[light_index] ) > 0.0f ?
+      glm::normalize( SpotlightDirections[light_index] ) : SpotlightDirections[light_index];
+   light.SpotlightCutoffAngle = SpotlightCutoffAngles[light_index];
+   light.SpotlightFeather = SpotlightFeathers[light_index];
+   light.FallOffRadius = FallOffRadii[light_index];
+   light.LightSwitch = IsActivated[light_index] ? 1 : 0;
+   return light;
+}
+
+void LightGL::writeLightBlockElement(int light_index)
+{
+   const LightBlockElement light = getLightBlockElement( light_index );
+   std::memcpy(
+      LightBlock.data() + sizeof( LightBlockHeader ) + sizeof( LightBlockElement ) * light_index, &light,
+      sizeof( LightBlockElement )
+   );
 }
 
-void LightGL::transferUniformsToShader(const ShaderGL* shader)
+void LightGL::addDirtyRange(std::vector<std::pair<GLintptr, GLintptr>>& ranges, int light_index, uint8_t fields)
 {
-   glUniform1i( shader->getLightAvailabilityLocation(), TurnLightOn ? 1 : 0 );
-   glUniform1i( shader->getLightNumLocation(), static_cast<GLint>(TotalLightNum) );
-   glUniform4fv( shader->getGlobalAmbientLocation(), 1, &GlobalAmbientColor[0] );
+   // The offset where each LightField starts, and the end of the element.
+   static const GLintptr field_offsets[] = {
+      offsetof( LightBlockElement, Position ), offsetof( LightBlockElement, AmbientColor ),
+      offsetof( LightBlockElement, SpotlightDirection ), offsetof( LightBlockElement, FallOffRadius ),
+      offsetof( LightBlockElement, LightSwitch ), sizeof( LightBlockElement )
+   };
+   assert( fields != 0 );
 
+   int first = 0, last = 0;
+   while ((fields & (1u << first)) == 0) ++first;
+   for (int field = first; field < 5; ++field) {
+      if (fields & (1u << field)) last = field;
+   }
+   const auto element = static_cast<GLintptr>(sizeof( LightBlockHeader ) + sizeof( LightBlockElement ) * light_index);
+   const GLintptr begin = element + field_offsets[first];
+   const GLintptr end = element + field_offsets[last + 1];
+   if (!ranges.empty() && begin - ranges.back().second <= static_cast<GLintptr>(sizeof( LightBlockElement ))) {
+      ranges.back().second = std::max( ranges.back().second, end );
+   }
+   else ranges.emplace_back( begin, end );
+}
+
+void LightGL::updateLightBuffer()
+{
+   ++Stats.UpdateNum;
+   if (Version != UploadedVersion) {
+      const auto size =
+         static_cast<GLsizeiptr>(sizeof( LightBlockHeader ) + sizeof( LightBlockElement ) * TotalLightNum);
+      LightBlock.resize( size );
+      if (HeaderChanged) {
+         const LightBlockHeader header = getLightBlockHeader();
+         std::memcpy( LightBlock.data(), &header, sizeof( LightBlockHeader ) );
+      }
+      std::sort( DirtyLights.begin(), DirtyLights.end() );
+      for (const auto& light_index : DirtyLights) writeLightBlockElement( light_index );
+
+      if (size > LightBufferSize) {
+         // A reallocated buffer starts out empty, so the whole block goes up once.
+         uploadBuffer( LightBuffer, LightBufferSize, LightBlock.data(), size );
+         ++Stats.CallNum;
+         Stats.ByteNum += static_cast<size_t>(size);
+      }
+      else {
+         std::vector<std::pair<GLintptr, GLintptr>> ranges;
+         if (HeaderChanged) ranges.emplace_back( 0, static_cast<GLintptr>(sizeof( LightBlockHeader )) );
+         for (const auto& light_index : DirtyLights) addDirtyRange( ranges, light_index, DirtyFields[light_index] );
+         for (const auto& range : ranges) {
+            glNamedBufferSubData(
+               LightBuffer, range.first, range.second - range.first, LightBlock.data() + range.first
+            );
+            ++Stats.CallNum;
+            Stats.ByteNum += static_cast<size_t>(range.second - range.first);
+         }
+      }
+
+      for (const auto& light_index : DirtyLights) DirtyFields[light_index] = 0;
+      DirtyLights.clear();
+      HeaderChanged = false;
+      UploadedVersion = Version;
+   }
+   glBindBufferBase( GL_SHADER_STORAGE_BUFFER, LightBinding, LightBuffer );
+}
+
+void LightGL::uploadBuffer(GLuint& buffer, GLsizeiptr& buffer_size, const void* data, GLsizeiptr size)
+{
+   if (size > buffer_size) {
+      if (buffer != 0) glDeleteBuffers( 1, &buffer );
+      buffer_size = std::max( size, buffer_size + buffer_size / 2 );
+      glCreateBuffers( 1, &buffer );
+      glNamedBufferStorage( buffer, buffer_size, nullptr, GL_DYNAMIC_STORAGE_BIT );
+   }
+   glNamedBufferSubData( buffer, 0, size, data );
+}
+
+void LightGL::getBoundingSpheres(std::vector<glm::vec4>& spheres_in_ec, const glm::mat4& view_matrix) const
+{
+   spheres_in_ec.resize( TotalLightNum );
    for (int i = 0; i < TotalLightNum; ++i) {
-      glUniform1i( shader->getLightSwitchLocation( i ), IsActivated[0] ? 1 : 0 );
-      glUniform4fv( shader->getLightPositionLocation( i ), 1, &Positions[i][0] );
-      glUniform4fv( shader->getLightAmbientLocation( i ), 1, &AmbientColors[i][0] );
-      glUniform4fv( shader->getLightDiffuseLocation( i ), 1, &DiffuseColors[i][0] );
-      glUniform4fv( shader->getLightSpecularLocation( i ), 1, &SpecularColors[i][0] );
-      glUniform3fv( shader->getLightSpotlightDirectionLocation( i ), 1, &SpotlightDirections[i][0] );
-      glUniform1f( shader->getLightSpotlightCutoffAngleLocation( i ), SpotlightCutoffAngles[i] );
-      glUniform1f( shader->getLightSpotlightFeatherLocation( i ), SpotlightFeathers[i] );
-      glUniform1f( shader->getLightFallOffRadiusLocation( i ), FallOffRadii[i] );
+      if (!IsActivated[i]) {
+         spheres_in_ec[i] = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+         continue;
+      }
+      if (Positions[i].w == 0.0f) {
+         spheres_in_ec[i] = glm::vec4(0.0f, 0.0f, 0.0f, std::numeric_limits<float>::infinity());
+         continue;
+      }
+
+      const float range = FallOffRadii[i] * LightRangeFactor;
+      glm::vec3 center = glm::vec3(Positions[i]);
+      float radius = range;
+      if (SpotlightCutoffAngles[i] < 180.0f && glm::length( SpotlightDirections[i] ) > 0.0f) {
+         // The smallest sphere around the cone of the spotlight, which the shader clamps to 90 degrees.
+         const glm::vec3 direction = glm::normalize( SpotlightDirections[i] );
+         const float angle = glm::radians( std::clamp( SpotlightCutoffAngles[i], 0.0f, 90.0f ) );
+         if (angle > glm::quarter_pi<float>()) {
+            center += direction * range * std::cos( angle );
+            radius = range * std::sin( angle );
+         }
+         else {
+            radius = range / (2.0f * std::cos( angle ));
+            center += direction * radius;
+         }
+      }
+      spheres_in_ec[i] = glm::vec4(glm::vec3(view_matrix * glm::vec4(center, 1.0f)), radius);
    }
+}
+
+void LightGL::updateClusterBuffers(const CameraGL* camera, const glm::ivec2& viewport_size)
+{
+   Clusters.setFrustum( camera->getProjectionMatrix(), camera->getNearPlane(), camera->getFarPlane() );
+   getBoundingSpheres( BoundingSpheres, camera->getViewMatrix() );
+   Clusters.build( BoundingSpheres );
+
+   const glm::ivec3& grid_size = Clusters.getGridSize();
+   ClusterBlockHeader header{};
+   header.GridSize = glm::ivec4(grid_size, 0);
+   header.Parameters = glm::vec4(
+      glm::vec2(viewport_size) / glm::vec2(grid_size.x, grid_size.y), Clusters.getSliceScale(), Clusters.getSliceBias()
+   );
+   const std::vector<glm::uvec2>& ranges = Clusters.getClusterRanges();
+   ClusterBlock.resize( sizeof( ClusterBlockHeader ) + sizeof( glm::uvec2 ) * ranges.size() );
+   std::memcpy( ClusterBlock.data(), &header, sizeof( ClusterBlockHeader ) );
+   std::memcpy(
+      ClusterBlock.data() + sizeof( ClusterBlockHeader ), ranges.data(), sizeof( glm::uvec2 ) * ranges.size()
+   );
+   uploadBuffer( ClusterBuffer, ClusterBufferSize, ClusterBlock.data(), static_cast<GLsizeiptr>(ClusterBlock.size()) );
+
+   // An empty list still needs a buffer to bind.
+   const std::vector<uint32_t>& indices = Clusters.getLightIndices();
+   const uint32_t no_light = 0;
+   uploadBuffer(
+      ClusterLightIndexBuffer, ClusterLightIndexBufferSize, indices.empty() ? &no_light : indices.data(),
+      static_cast<GLsizeiptr>(sizeof( uint32_t ) * std::max( indices.size(), size_t{ 1 } ))
+   );
+
+   glBindBufferBase( GL_SHADER_STORAGE_BUFFER, ClusterBinding, ClusterBuffer );
+   glBindBufferBase( GL_SHADER_STORAGE_BUFFER, ClusterLightIndexBinding, ClusterLightIndexBuffer );
 }
\ No newline at end of file
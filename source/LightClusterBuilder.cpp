@@ -0,0 +1,229 @@
+#include "LightClusterBuilder.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(USE_X86_SIMD) && defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+   inline float getSquaredDistance(float x, float y, float z, const glm::vec3& min, const glm::vec3& max)
+   {
+      const float dx = std::max( std::max( min.x - x, x - max.x ), 0.0f );
+      const float dy = std::max( std::max( min.y - y, y - max.y ), 0.0f );
+      const float dz = std::max( std::max( min.z - z, z - max.z ), 0.0f );
+      return dx * dx + dy * dy + dz * dz;
+   }
+
+#ifdef USE_X86_SIMD
+   TARGET_AVX2 void testSpheresAVX2(
+      std::vector<uint32_t>& lights,
+      const glm::vec3& min,
+      const glm::vec3& max,
+      const float* xs,
+      const float* ys,
+      const float* zs,
+      const float* squared_radii,
+      const uint32_t* indices,
+      size_t count
+   )
+   {
+      const __m256 zero = _mm256_setzero_ps();
+      const __m256 min_x = _mm256_set1_ps( min.x ), min_y = _mm256_set1_ps( min.y ), min_z = _mm256_set1_ps( min.z );
+      const __m256 max_x = _mm256_set1_ps( max.x ), max_y = _mm256_set1_ps( max.y ), max_z = _mm256_set1_ps( max.z );
+      for (size_t i = 0; i < count; i += 8) {
+         const __m256 x = _mm256_loadu_ps( xs + i );
+         const __m256 y = _mm256_loadu_ps( ys + i );
+         const __m256 z = _mm256_loadu_ps( zs + i );
+         const __m256 dx = _mm256_max_ps( _mm256_max_ps( _mm256_sub_ps( min_x, x ), _mm256_sub_ps( x, max_x ) ), zero );
+         const __m256 dy = _mm256_max_ps( _mm256_max_ps( _mm256_sub_ps( min_y, y ), _mm256_sub_ps( y, max_y ) ), zero );
+         const __m256 dz = _mm256_max_ps( _mm256_max_ps( _mm256_sub_ps( min_z, z ), _mm256_sub_ps( z, max_z ) ), zero );
+         const __m256 squared_distance = _mm256_add_ps(
+            _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_mul_ps( dy, dy ) ), _mm256_mul_ps( dz, dz )
+         );
+         const int mask = _mm256_movemask_ps(
+            _mm256_cmp_ps( squared_distance, _mm256_loadu_ps( squared_radii + i ), _CMP_LE_OQ )
+         );
+         if (mask == 0) continue;
+
+         for (int lane = 0; lane < 8; ++lane) {
+            if (mask & (1 << lane)) lights.emplace_back( indices[i + lane] );
+         }
+      }
+   }
+#endif
+}
+
+LightClusterBuilder::LightClusterBuilder(const glm::ivec3& grid_size) :
+   GridSize( grid_size ), Projection( 0.0f ), NearPlane( 0.0f ), FarPlane( 0.0f ), SliceScale( 0.0f ),
+   SliceBias( 0.0f )
+{
+   assert( grid_size.x > 0 && grid_size.y > 0 && grid_size.z > 0 );
+
+   Bounds.resize( getClusterNum() );
+   Slices.resize( GridSize.z );
+   ClusterLights.resize( getClusterNum() );
+   ClusterRanges.resize( getClusterNum() );
+}
+
+void LightClusterBuilder::SliceLights::clear()
+{
+   X.clear();
+   Y.clear();
+   Z.clear();
+   SquaredRadius.clear();
+   Index.clear();
+}
+
+void LightClusterBuilder::SliceLights::add(const glm::vec4& sphere, uint32_t index)
+{
+   X.emplace_back( sphere.x );
+   Y.emplace_back( sphere.y );
+   Z.emplace_back( sphere.z );
+   SquaredRadius.emplace_back( sphere.w * sphere.w );
+   Index.emplace_back( index );
+}
+
+void LightClusterBuilder::SliceLights::pad()
+{
+   // A negative squared radius fails even inside a cluster, where the squared distance is 0.
+   while (Index.size() % 8 != 0) {
+      X.emplace_back( 0.0f );
+      Y.emplace_back( 0.0f );
+      Z.emplace_back( 0.0f );
+      SquaredRadius.emplace_back( -1.0f );
+      Index.emplace_back( 0 );
+   }
+}
+
+float LightClusterBuilder::getSliceDepth(int slice) const
+{
+   if (slice <= 0) return NearPlane;
+   if (slice >= GridSize.z) return FarPlane;
+   return NearPlane * std::pow( FarPlane / NearPlane, static_cast<float>(slice) / static_cast<float>(GridSize.z) );
+}
+
+int LightClusterBuilder::getSlice(float depth) const
+{
+   const auto slice = static_cast<int>(std::floor( std::log( std::max( depth, NearPlane ) ) * SliceScale + SliceBias ));
+   return std::clamp( slice, 0, GridSize.z - 1 );
+}
+
+void LightClusterBuilder::setFrustum(const glm::mat4& projection, float near_plane, float far_plane)
+{
+   assert( 0.0f < near_plane && near_plane < far_plane );
+
+   if (projection == Projection && near_plane == NearPlane && far_plane == FarPlane) return;
+
+   Projection = projection;
+   NearPlane = near_plane;
+   FarPlane = far_plane;
+   SliceScale = static_cast<float>(GridSize.z) / std::log( FarPlane / NearPlane );
+   SliceBias = -std::log( NearPlane ) * SliceScale;
+
+   // The rays through the tile corners are scaled to unit depth, so a corner at depth d is just ray * d.
+   const glm::mat4 inverse_projection = inverse( projection );
+   std::vector<glm::vec3> rays((GridSize.x + 1) * (GridSize.y + 1));
+   for (int y = 0; y <= GridSize.y; ++y) {
+      for (int x = 0; x <= GridSize.x; ++x) {
+         const glm::vec4 ndc(
+            2.0f * static_cast<float>(x) / static_cast<float>(GridSize.x) - 1.0f,
+            2.0f * static_cast<float>(y) / static_cast<float>(GridSize.y) - 1.0f,
+            -1.0f,
+            1.0f
+         );
+         glm::vec4 point = inverse_projection * ndc;
+         point /= point.w;
+         rays[y * (GridSize.x + 1) + x] = glm::vec3(point) / -point.z;
+      }
+   }
+
+   for (int z = 0; z < GridSize.z; ++z) {
+      const float near_depth = getSliceDepth( z );
+      const float far_depth = getSliceDepth( z + 1 );
+      for (int y = 0; y < GridSize.y; ++y) {
+         for (int x = 0; x < GridSize.x; ++x) {
+            ClusterBounds& bounds = Bounds[getClusterIndex( x, y, z )];
+            bounds.Min = glm::vec3(std::numeric_limits<float>::max());
+            bounds.Max = glm::vec3(std::numeric_limits<float>::lowest());
+            for (int corner = 0; corner < 4; ++corner) {
+               const glm::vec3& ray = rays[(y + (corner >> 1)) * (GridSize.x + 1) + x + (corner & 1)];
+               for (const float depth : { near_depth, far_depth }) {
+                  bounds.Min = glm::min( bounds.Min, ray * depth );
+                  bounds.Max = glm::max( bounds.Max, ray * depth );
+               }
+            }
+         }
+      }
+   }
+}
+
+void LightClusterBuilder::testSpheres(
+   std::vector<uint32_t>& lights,
+   const ClusterBounds& bounds,
+   const SliceLights& slice,
+   InstructionSet instruction_set
+)
+{
+#ifdef USE_X86_SIMD
+   if (instruction_set == InstructionSet::AVX2) {
+      testSpheresAVX2(
+         lights, bounds.Min, bounds.Max, slice.X.data(), slice.Y.data(), slice.Z.data(), slice.SquaredRadius.data(),
+         slice.Index.data(), slice.Index.size()
+      );
+      return;
+   }
+#endif
+   for (size_t i = 0; i < slice.Index.size(); ++i) {
+      const float squared_distance = getSquaredDistance( slice.X[i], slice.Y[i], slice.Z[i], bounds.Min, bounds.Max );
+      if (squared_distance <= slice.SquaredRadius[i]) lights.emplace_back( slice.Index[i] );
+   }
+}
+
+void LightClusterBuilder::build(const std::vector<glm::vec4>& spheres_in_ec, InstructionSet instruction_set)
+{
+   assert( NearPlane > 0.0f );
+
+   // Each light only goes to the slices its depth range overlaps, so a cluster never tests the lights of other slices.
+   for (auto& slice : Slices) slice.clear();
+   for (size_t i = 0; i < spheres_in_ec.size(); ++i) {
+      const glm::vec4& sphere = spheres_in_ec[i];
+      if (sphere.w < 0.0f) continue;
+
+      const float depth = -sphere.z;
+      if (depth + sphere.w < NearPlane || depth - sphere.w > FarPlane) continue;
+
+      const int first = std::isinf( sphere.w ) ? 0 : getSlice( depth - sphere.w );
+      const int last = std::isinf( sphere.w ) ? GridSize.z - 1 : getSlice( depth + sphere.w );
+      for (int z = first; z <= last; ++z) Slices[z].add( sphere, static_cast<uint32_t>(i) );
+   }
+   for (auto& slice : Slices) slice.pad();
+
+   ThreadPool::getInstance().parallelFor(
+      0, GridSize.z * GridSize.y, 4, [this, instruction_set](int first, int last) {
+         for (int row = first; row < last; ++row) {
+            const int z = row / GridSize.y;
+            const int y = row % GridSize.y;
+            for (int x = 0; x < GridSize.x; ++x) {
+               const int cluster = getClusterIndex( x, y, z );
+               ClusterLights[cluster].clear();
+               testSpheres( ClusterLights[cluster], Bounds[cluster], Slices[z], instruction_set );
+            }
+         }
+      }
+   );
+
+   LightIndices.clear();
+   for (int cluster = 0; cluster < getClusterNum(); ++cluster) {
+      ClusterRanges[cluster] = glm::uvec2(
+         static_cast<uint32_t>(LightIndices.size()), static_cast<uint32_t>(ClusterLights[cluster].size())
+      );
+      LightIndices.insert( LightIndices.end(), ClusterLights[cluster].begin(), ClusterLights[cluster].end() );
+   }
+}
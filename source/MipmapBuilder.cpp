@@ -0,0 +1,143 @@
+#include "MipmapBuilder.h"
+
+int MipmapBuilder::getLevelNum(int width, int height)
+{
+   int level_num = 1;
+   for (int size = std::max( width, height ); size > 1; size >>= 1) ++level_num;
+   return level_num;
+}
+
+void MipmapBuilder::getFootprint(int& first, int& last, int d, int source_size, int destination_size)
+{
+   // Every texel covers two source texels, except that the last one also takes the leftover texel of an odd size.
+   first = std::min( d * 2, source_size - 1 );
+   last = d == destination_size - 1 ? source_size : std::min( d * 2 + 2, source_size );
+}
+
+int MipmapBuilder::getBandHeight(int width, int height)
+{
+   return std::max( 1, std::min( height, (1 << 16) / std::max( width, 1 ) ) );
+}
+
+void MipmapBuilder::buildColor(
+   std::vector<std::vector<uint8_t>>& levels,
+   const uint8_t* texels,
+   int width,
+   int height,
+   int channel_num,
+   std::ptrdiff_t row_stride
+)
+{
+   const int level_num = getLevelNum( width, height );
+   levels.resize( level_num );
+
+   const size_t row_size = static_cast<size_t>(width) * channel_num;
+   levels[0].resize( row_size * height );
+   for (int y = 0; y < height; ++y) {
+      std::copy( texels + y * row_stride, texels + y * row_stride + row_size, levels[0].data() + y * row_size );
+   }
+
+   ThreadPool& pool = ThreadPool::getInstance();
+   for (int level = 1; level < level_num; ++level) {
+      const int source_width = getLevelSize( width, level - 1 );
+      const int source_height = getLevelSize( height, level - 1 );
+      const int level_width = getLevelSize( width, level );
+      const int level_height = getLevelSize( height, level );
+      levels[level].resize( static_cast<size_t>(level_width) * level_height * channel_num );
+
+      const uint8_t* source = levels[level - 1].data();
+      uint8_t* destination = levels[level].data();
+      pool.parallelFor(
+         0, level_height, getBandHeight( level_width, level_height ),
+         [=](int first_row, int last_row) {
+            uint32_t sum[4];
+            for (int y = first_row; y < last_row; ++y) {
+               int y0, y1;
+               getFootprint( y0, y1, y, source_height, level_height );
+               for (int x = 0; x < level_width; ++x) {
+                  int x0, x1;
+                  getFootprint( x0, x1, x, source_width, level_width );
+                  std::fill( sum, sum + 4, 0u );
+                  for (int j = y0; j < y1; ++j) {
+                     const uint8_t* row = source + static_cast<size_t>(j) * source_width * channel_num;
+                     for (int i = x0; i < x1; ++i) {
+                        for (int c = 0; c < channel_num; ++c) sum[c] += row[i * channel_num + c];
+                     }
+                  }
+                  const uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+                  uint8_t* out = destination + (static_cast<size_t>(y) * level_width + x) * channel_num;
+                  for (int c = 0; c < channel_num; ++c) out[c] = static_cast<uint8_t>((sum[c] + count / 2) / count);
+               }
+            }
+         }
+      );
+   }
+}
+
+void MipmapBuilder::buildNormal(
+   std::vector<std::vector<float>>& normal_levels,
+   std::vector<std::vector<uint8_t>>& length_levels,
+   const float* normal_map,
+   int width,
+   int height
+)
+{
+   const int level_num = getLevelNum( width, height );
+   normal_levels.resize( level_num );
+   length_levels.resize( level_num );
+
+   const size_t texel_num = static_cast<size_t>(width) * height;
+   normal_levels[0].assign( normal_map, normal_map + texel_num * 3 );
+   length_levels[0].assign( texel_num, 255 );
+
+   // The unnormalized averages of the previous level, so that a level averages level 0 rather than renormalized data.
+   std::vector<glm::vec3> averages(texel_num), reduced;
+   for (size_t i = 0; i < texel_num; ++i) {
+      averages[i] = glm::vec3(normal_map[3 * i], normal_map[3 * i + 1], normal_map[3 * i + 2]) * 2.0f - 1.0f;
+   }
+
+   ThreadPool& pool = ThreadPool::getInstance();
+   for (int level = 1; level < level_num; ++level) {
+      const int source_width = getLevelSize( width, level - 1 );
+      const int source_height = getLevelSize( height, level - 1 );
+      const int level_width = getLevelSize( width, level );
+      const int level_height = getLevelSize( height, level );
+      const size_t level_texel_num = static_cast<size_t>(level_width) * level_height;
+      reduced.resize( level_texel_num );
+      normal_levels[level].resize( level_texel_num * 3 );
+      length_levels[level].resize( level_texel_num );
+
+      const glm::vec3* source = averages.data();
+      glm::vec3* average = reduced.data();
+      float* normal = normal_levels[level].data();
+      uint8_t* length = length_levels[level].data();
+      pool.parallelFor(
+         0, level_height, getBandHeight( level_width, level_height ),
+         [=](int first_row, int last_row) {
+            for (int y = first_row; y < last_row; ++y) {
+               int y0, y1;
+               getFootprint( y0, y1, y, source_height, level_height );
+               for (int x = 0; x < level_width; ++x) {
+                  int x0, x1;
+                  getFootprint( x0, x1, x, source_width, level_width );
+                  glm::vec3 sum(0.0f);
+                  for (int j = y0; j < y1; ++j) {
+                     for (int i = x0; i < x1; ++i) sum += source[static_cast<size_t>(j) * source_width + i];
+                  }
+
+                  const size_t index = static_cast<size_t>(y) * level_width + x;
+                  const glm::vec3 mean = sum / static_cast<float>((x1 - x0) * (y1 - y0));
+                  const float mean_length = glm::length( mean );
+                  const glm::vec3 direction = mean_length > 0.0f ? mean / mean_length : glm::vec3(0.0f, 0.0f, 1.0f);
+                  average[index] = mean;
+                  normal[3 * index] = direction.x * 0.5f + 0.5f;
+                  normal[3 * index + 1] = direction.y * 0.5f + 0.5f;
+                  normal[3 * index + 2] = direction.z * 0.5f + 0.5f;
+                  length[index] = static_cast<uint8_t>(std::min( mean_length, 1.0f ) * 255.0f + 0.5f);
+               }
+            }
+         }
+      );
+      std::swap( averages, reduced );
+   }
+}
@@ -0,0 +1,297 @@
+#include "NormalMapCache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+   constexpr uint32_t Version = 2;
+   constexpr char Magic[4] = { 'N', 'M', 'A', 'C' };
+   constexpr uint64_t FNVOffsetBasis = 0xcbf29ce484222325ull;
+   constexpr uint64_t FNVPrime = 0x100000001b3ull;
+
+   struct FileHeader
+   {
+      char Magic[4];
+      uint32_t Version;
+      uint64_t Key;
+      int32_t Width;
+      int32_t Height;
+      int32_t NormalMapFormat;
+      int32_t BaseTextureCompression; // -1 if the base texture is not compressed
+      uint32_t IsBaseTextureBGR;
+      int32_t LevelNum;
+   };
+
+   // Followed by LevelNum of these, and then the texel data of every level aligned to 16 bytes.
+   struct LevelEntry
+   {
+      uint64_t BaseTextureOffset;
+      uint64_t BaseTextureSize;
+      uint64_t NormalMapOffset;
+      uint64_t NormalMapSize;
+      uint64_t NormalLengthOffset;
+      uint64_t NormalLengthSize;
+   };
+
+   bool isInFile(uint64_t offset, uint64_t size, uint64_t file_size)
+   {
+      return offset <= file_size && size <= file_size - offset;
+   }
+
+   uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+   {
+      const auto* bytes = static_cast<const uint8_t*>(data);
+      for (size_t i = 0; i < size; ++i) {
+         hash ^= bytes[i];
+         hash *= FNVPrime;
+      }
+      return hash;
+   }
+
+   uint64_t alignOffset(uint64_t offset) { return (offset + 15) & ~static_cast<uint64_t>(15); }
+
+   // A read-only view of a whole file that is unmapped when the last asset pointing into it is released.
+   class MappedFile final
+   {
+   public:
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      [[nodiscard]] static std::shared_ptr<const MappedFile> open(const std::string& file_path)
+      {
+         auto file = std::shared_ptr<MappedFile>(new MappedFile());
+#ifdef _WIN32
+         file->File = CreateFileA(
+            file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+         );
+         if (file->File == INVALID_HANDLE_VALUE) return nullptr;
+
+         LARGE_INTEGER size;
+         if (!GetFileSizeEx( file->File, &size ) || size.QuadPart == 0) return nullptr;
+
+         file->Mapping = CreateFileMappingA( file->File, nullptr, PAGE_READONLY, 0, 0, nullptr );
+         if (file->Mapping == nullptr) return nullptr;
+
+         file->Data = static_cast<const uint8_t*>(MapViewOfFile( file->Mapping, FILE_MAP_READ, 0, 0, 0 ));
+         if (file->Data == nullptr) return nullptr;
+         file->Size = static_cast<size_t>(size.QuadPart);
+#else
+         const int descriptor = ::open( file_path.c_str(), O_RDONLY );
+         if (descriptor < 0) return nullptr;
+
+         struct stat status{};
+         if (fstat( descriptor, &status ) != 0 || status.st_size <= 0) {
+            close( descriptor );
+            return nullptr;
+         }
+
+         void* data = mmap( nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0 );
+         close( descriptor );
+         if (data == MAP_FAILED) return nullptr;
+
+         file->Data = static_cast<const uint8_t*>(data);
+         file->Size = static_cast<size_t>(status.st_size);
+#endif
+         return file;
+      }
+
+      ~MappedFile()
+      {
+#ifdef _WIN32
+         if (Data != nullptr) UnmapViewOfFile( Data );
+         if (Mapping != nullptr) CloseHandle( Mapping );
+         if (File != INVALID_HANDLE_VALUE) CloseHandle( File );
+#else
+         if (Data != nullptr) munmap( const_cast<uint8_t*>(Data), Size );
+#endif
+      }
+
+      [[nodiscard]] const uint8_t* getData() const { return Data; }
+      [[nodiscard]] size_t getSize() const { return Size; }
+
+   private:
+#ifdef _WIN32
+      HANDLE File = INVALID_HANDLE_VALUE;
+      HANDLE Mapping = nullptr;
+#endif
+      const uint8_t* Data = nullptr;
+      size_t Size = 0;
+
+      MappedFile() = default;
+   };
+}
+
+NormalMapCache::NormalMapCache(std::string directory_path) : DirectoryPath( std::move( directory_path ) )
+{
+}
+
+uint64_t NormalMapCache::getKey(
+   const std::string& source_path,
+   const glm::ivec2& size,
+   NormalMapGenerator::Format format,
+   std::optional<BlockCompressor::Format> base_texture_compression
+)
+{
+   std::ifstream file( source_path, std::ios::binary );
+   if (!file.is_open()) return 0;
+
+   uint64_t hash = FNVOffsetBasis;
+   std::vector<char> buffer(1 << 16);
+   while (file) {
+      file.read( buffer.data(), static_cast<std::streamsize>(buffer.size()) );
+      hash = hashBytes( hash, buffer.data(), static_cast<size_t>(file.gcount()) );
+   }
+
+   const int32_t parameters[5] = {
+      static_cast<int32_t>(Version),
+      size.x,
+      size.y,
+      static_cast<int32_t>(format),
+      base_texture_compression ? static_cast<int32_t>(*base_texture_compression) : -1
+   };
+   hash = hashBytes( hash, parameters, sizeof( parameters ) );
+   return hash == 0 ? 1 : hash;
+}
+
+std::string NormalMapCache::getFilePath(uint64_t key) const
+{
+   std::ostringstream name;
+   name << DirectoryPath << "/" << std::hex << std::setw( 16 ) << std::setfill( '0' ) << key << ".nmc";
+   return name.str();
+}
+
+bool NormalMapCache::load(ObjectGL::NormalMapAsset& asset, uint64_t key) const
+{
+   if (key == 0) return false;
+
+   const std::shared_ptr<const MappedFile> file = MappedFile::open( getFilePath( key ) );
+   if (!file || file->getSize() < sizeof( FileHeader )) return false;
+
+   FileHeader header{};
+   std::memcpy( &header, file->getData(), sizeof( FileHeader ) );
+   if (std::memcmp( header.Magic, Magic, sizeof( Magic ) ) != 0 || header.Version != Version || header.Key != key) {
+      return false;
+   }
+   if (header.Width <= 0 || header.Height <= 0) return false;
+   if (header.LevelNum != MipmapBuilder::getLevelNum( header.Width, header.Height )) return false;
+   // The formats come from file bytes, so a value outside the enums is a corrupted file rather than a format.
+   if (header.NormalMapFormat < static_cast<int32_t>(NormalMapGenerator::Format::RGB32F) ||
+       header.NormalMapFormat > static_cast<int32_t>(NormalMapGenerator::Format::BC5)) return false;
+   if (header.BaseTextureCompression < -1 ||
+       header.BaseTextureCompression > static_cast<int32_t>(BlockCompressor::Format::BC7)) return false;
+
+   const uint64_t size = file->getSize();
+   const uint64_t table_size = sizeof( LevelEntry ) * header.LevelNum;
+   if (!isInFile( sizeof( FileHeader ), table_size, size )) return false;
+
+   ObjectGL::NormalMapAsset loaded;
+   loaded.Width = header.Width;
+   loaded.Height = header.Height;
+   loaded.LevelNum = header.LevelNum;
+   loaded.NormalMapFormat = static_cast<NormalMapGenerator::Format>(header.NormalMapFormat);
+   if (header.BaseTextureCompression >= 0) {
+      loaded.BaseTextureCompression = static_cast<BlockCompressor::Format>(header.BaseTextureCompression);
+   }
+   loaded.IsBaseTextureBGR = header.IsBaseTextureBGR != 0;
+
+   // A truncated or stale file is treated as a miss and gets rebaked.
+   for (int level = 0; level < header.LevelNum; ++level) {
+      LevelEntry entry{};
+      std::memcpy( &entry, file->getData() + sizeof( FileHeader ) + sizeof( LevelEntry ) * level, sizeof( LevelEntry ) );
+      if (entry.BaseTextureSize != loaded.getBaseTextureSize( level ) ||
+          entry.NormalMapSize != loaded.getNormalMapSize( level ) ||
+          entry.NormalLengthSize != loaded.getNormalLengthSize( level )) return false;
+      if (!isInFile( entry.BaseTextureOffset, entry.BaseTextureSize, size ) ||
+          !isInFile( entry.NormalMapOffset, entry.NormalMapSize, size ) ||
+          !isInFile( entry.NormalLengthOffset, entry.NormalLengthSize, size )) return false;
+
+      loaded.BaseTexture.emplace_back( file->getData() + entry.BaseTextureOffset );
+      loaded.NormalMap.emplace_back( file->getData() + entry.NormalMapOffset );
+      loaded.NormalLength.emplace_back( file->getData() + entry.NormalLengthOffset );
+   }
+   loaded.Storage = file;
+   asset = std::move( loaded );
+   return true;
+}
+
+bool NormalMapCache::store(const ObjectGL::NormalMapAsset& asset, uint64_t key) const
+{
+   if (key == 0 || asset.LevelNum <= 0) return false;
+
+   FileHeader header{};
+   std::memcpy( header.Magic, Magic, sizeof( Magic ) );
+   header.Version = Version;
+   header.Key = key;
+   header.Width = asset.Width;
+   header.Height = asset.Height;
+   header.NormalMapFormat = static_cast<int32_t>(asset.NormalMapFormat);
+   header.BaseTextureCompression =
+      asset.BaseTextureCompression ? static_cast<int32_t>(*asset.BaseTextureCompression) : -1;
+   header.IsBaseTextureBGR = asset.IsBaseTextureBGR ? 1 : 0;
+   header.LevelNum = asset.LevelNum;
+
+   std::vector<LevelEntry> entries(asset.LevelNum);
+   uint64_t offset = sizeof( FileHeader ) + sizeof( LevelEntry ) * entries.size();
+   for (int level = 0; level < asset.LevelNum; ++level) {
+      LevelEntry& entry = entries[level];
+      entry.BaseTextureSize = asset.getBaseTextureSize( level );
+      entry.NormalMapSize = asset.getNormalMapSize( level );
+      entry.NormalLengthSize = asset.getNormalLengthSize( level );
+      entry.BaseTextureOffset = alignOffset( offset );
+      entry.NormalMapOffset = alignOffset( entry.BaseTextureOffset + entry.BaseTextureSize );
+      entry.NormalLengthOffset = alignOffset( entry.NormalMapOffset + entry.NormalMapSize );
+      offset = entry.NormalLengthOffset + entry.NormalLengthSize;
+   }
+
+   std::error_code error;
+   std::filesystem::create_directories( DirectoryPath, error );
+
+   // Other jobs may bake the same key at the same time, so each writes its own file and renames it into place.
+   std::ostringstream temporary_name;
+   temporary_name << getFilePath( key ) << "." << std::this_thread::get_id() << ".tmp";
+   const std::string temporary_path = temporary_name.str();
+   {
+      std::ofstream file( temporary_path, std::ios::binary | std::ios::trunc );
+      if (!file.is_open()) {
+         std::cerr << "Could not write normal map cache file " << temporary_path.c_str() << "\n";
+         return false;
+      }
+
+      uint64_t position = 0;
+      const auto write = [&file, &position](uint64_t at, const void* data, uint64_t size) {
+         const char padding[16] = {};
+         file.write( padding, static_cast<std::streamsize>(at - position) );
+         file.write( static_cast<const char*>(data), static_cast<std::streamsize>(size) );
+         position = at + size;
+      };
+      write( 0, &header, sizeof( FileHeader ) );
+      write( position, entries.data(), sizeof( LevelEntry ) * entries.size() );
+      for (int level = 0; level < asset.LevelNum; ++level) {
+         const LevelEntry& entry = entries[level];
+         write( entry.BaseTextureOffset, asset.BaseTexture[level], entry.BaseTextureSize );
+         write( entry.NormalMapOffset, asset.NormalMap[level], entry.NormalMapSize );
+         write( entry.NormalLengthOffset, asset.NormalLength[level], entry.NormalLengthSize );
+      }
+      if (!file) {
+         file.close();
+         std::filesystem::remove( temporary_path, error );
+         return false;
+      }
+   }
+
+   std::filesystem::rename( temporary_path, getFilePath( key ), error );
+   if (error) {
+      std::filesystem::remove( temporary_path, error );
+      return false;
+   }
+   return true;
+}
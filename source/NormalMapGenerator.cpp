@@ -0,0 +1,383 @@
+#include "NormalMapGenerator.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(USE_X86_SIMD) && defined(__GNUC__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+   // normalized 5-tap gaussian weights of sigma = 1
+   constexpr float W0 = 0.402619947f;
+   constexpr float W1 = 0.244201342f;
+   constexpr float W2 = 0.054488685f;
+
+   // Every path evaluates the same operations in the same order without FMA, so they agree bit by bit.
+   inline float blurScalar(float a, float b, float c, float d, float e)
+   {
+      return a * W2 + b * W1 + c * W0 + d * W1 + e * W2;
+   }
+
+   inline void packNormalScalar(float* out, const float* up, const float* mid, const float* down, int x)
+   {
+      const float dx = (up[x + 1] - up[x - 1]) + (mid[x + 1] - mid[x - 1]) * 2.0f + (down[x + 1] - down[x - 1]);
+      const float dy = (down[x - 1] + down[x] * 2.0f + down[x + 1]) - (up[x - 1] + up[x] * 2.0f + up[x + 1]);
+      const float sx = dx / 255.0f;
+      const float sy = dy / 255.0f;
+      const float inv_length = 1.0f / std::sqrt( sx * sx + sy * sy + 1.0f );
+      out[0] = -sx * inv_length * 0.5f + 0.5f;
+      out[1] = -sy * inv_length * 0.5f + 0.5f;
+      out[2] = inv_length * 0.5f + 0.5f;
+   }
+
+#ifdef USE_X86_SIMD
+   TARGET_SSE41 int blurHorizontallySSE41(float* out, const float* gray, int width)
+   {
+      const __m128 w0 = _mm_set1_ps( W0 ), w1 = _mm_set1_ps( W1 ), w2 = _mm_set1_ps( W2 );
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+         __m128 sum = _mm_mul_ps( _mm_loadu_ps( gray + x - 2 ), w2 );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( gray + x - 1 ), w1 ) );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( gray + x ), w0 ) );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( gray + x + 1 ), w1 ) );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( gray + x + 2 ), w2 ) );
+         _mm_storeu_ps( out + x, sum );
+      }
+      return x;
+   }
+
+   TARGET_SSE41 int blurVerticallySSE41(float* out, const float* const* rows, int width)
+   {
+      const __m128 w0 = _mm_set1_ps( W0 ), w1 = _mm_set1_ps( W1 ), w2 = _mm_set1_ps( W2 );
+      const __m128 half = _mm_set1_ps( 0.5f );
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+         __m128 sum = _mm_mul_ps( _mm_loadu_ps( rows[0] + x ), w2 );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( rows[1] + x ), w1 ) );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( rows[2] + x ), w0 ) );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( rows[3] + x ), w1 ) );
+         sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( rows[4] + x ), w2 ) );
+         _mm_storeu_ps( out + x, _mm_floor_ps( _mm_add_ps( sum, half ) ) );
+      }
+      return x;
+   }
+
+   TARGET_SSE41 int packNormalsSSE41(float* out, const float* up, const float* mid, const float* down, int width)
+   {
+      const __m128 two = _mm_set1_ps( 2.0f ), one = _mm_set1_ps( 1.0f ), half = _mm_set1_ps( 0.5f );
+      const __m128 scale = _mm_set1_ps( 255.0f ), sign = _mm_set1_ps( -0.0f );
+      alignas(16) float normals[3][4];
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+         const __m128 up_left = _mm_loadu_ps( up + x - 1 ), up_right = _mm_loadu_ps( up + x + 1 );
+         const __m128 down_left = _mm_loadu_ps( down + x - 1 ), down_right = _mm_loadu_ps( down + x + 1 );
+         const __m128 dx = _mm_add_ps(
+            _mm_add_ps(
+               _mm_sub_ps( up_right, up_left ),
+               _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( mid + x + 1 ), _mm_loadu_ps( mid + x - 1 ) ), two )
+            ),
+            _mm_sub_ps( down_right, down_left )
+         );
+         const __m128 dy = _mm_sub_ps(
+            _mm_add_ps( _mm_add_ps( down_left, _mm_mul_ps( _mm_loadu_ps( down + x ), two ) ), down_right ),
+            _mm_add_ps( _mm_add_ps( up_left, _mm_mul_ps( _mm_loadu_ps( up + x ), two ) ), up_right )
+         );
+         const __m128 sx = _mm_div_ps( dx, scale );
+         const __m128 sy = _mm_div_ps( dy, scale );
+         const __m128 inv_length = _mm_div_ps(
+            one, _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, sx ), _mm_mul_ps( sy, sy ) ), one ) )
+         );
+         const __m128 nx = _mm_mul_ps( _mm_xor_ps( sx, sign ), inv_length );
+         const __m128 ny = _mm_mul_ps( _mm_xor_ps( sy, sign ), inv_length );
+         _mm_store_ps( normals[0], _mm_add_ps( _mm_mul_ps( nx, half ), half ) );
+         _mm_store_ps( normals[1], _mm_add_ps( _mm_mul_ps( ny, half ), half ) );
+         _mm_store_ps( normals[2], _mm_add_ps( _mm_mul_ps( inv_length, half ), half ) );
+         for (int i = 0; i < 4; ++i) {
+            out[3 * (x + i)] = normals[0][i];
+            out[3 * (x + i) + 1] = normals[1][i];
+            out[3 * (x + i) + 2] = normals[2][i];
+         }
+      }
+      return x;
+   }
+
+   TARGET_AVX2 int blurHorizontallyAVX2(float* out, const float* gray, int width)
+   {
+      const __m256 w0 = _mm256_set1_ps( W0 ), w1 = _mm256_set1_ps( W1 ), w2 = _mm256_set1_ps( W2 );
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+         __m256 sum = _mm256_mul_ps( _mm256_loadu_ps( gray + x - 2 ), w2 );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( gray + x - 1 ), w1 ) );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( gray + x ), w0 ) );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( gray + x + 1 ), w1 ) );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( gray + x + 2 ), w2 ) );
+         _mm256_storeu_ps( out + x, sum );
+      }
+      return x;
+   }
+
+   TARGET_AVX2 int blurVerticallyAVX2(float* out, const float* const* rows, int width)
+   {
+      const __m256 w0 = _mm256_set1_ps( W0 ), w1 = _mm256_set1_ps( W1 ), w2 = _mm256_set1_ps( W2 );
+      const __m256 half = _mm256_set1_ps( 0.5f );
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+         __m256 sum = _mm256_mul_ps( _mm256_loadu_ps( rows[0] + x ), w2 );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( rows[1] + x ), w1 ) );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( rows[2] + x ), w0 ) );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( rows[3] + x ), w1 ) );
+         sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( rows[4] + x ), w2 ) );
+         _mm256_storeu_ps( out + x, _mm256_floor_ps( _mm256_add_ps( sum, half ) ) );
+      }
+      return x;
+   }
+
+   TARGET_AVX2 int packNormalsAVX2(float* out, const float* up, const float* mid, const float* down, int width)
+   {
+      const __m256 two = _mm256_set1_ps( 2.0f ), one = _mm256_set1_ps( 1.0f ), half = _mm256_set1_ps( 0.5f );
+      const __m256 scale = _mm256_set1_ps( 255.0f ), sign = _mm256_set1_ps( -0.0f );
+      alignas(32) float normals[3][8];
+      int x = 0;
+      for (; x + 8 <= width; x += 8) {
+         const __m256 up_left = _mm256_loadu_ps( up + x - 1 ), up_right = _mm256_loadu_ps( up + x + 1 );
+         const __m256 down_left = _mm256_loadu_ps( down + x - 1 ), down_right = _mm256_loadu_ps( down + x + 1 );
+         const __m256 dx = _mm256_add_ps(
+            _mm256_add_ps(
+               _mm256_sub_ps( up_right, up_left ),
+               _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( mid + x + 1 ), _mm256_loadu_ps( mid + x - 1 ) ), two )
+            ),
+            _mm256_sub_ps( down_right, down_left )
+         );
+         const __m256 dy = _mm256_sub_ps(
+            _mm256_add_ps( _mm256_add_ps( down_left, _mm256_mul_ps( _mm256_loadu_ps( down + x ), two ) ), down_right ),
+            _mm256_add_ps( _mm256_add_ps( up_left, _mm256_mul_ps( _mm256_loadu_ps( up + x ), two ) ), up_right )
+         );
+         const __m256 sx = _mm256_div_ps( dx, scale );
+         const __m256 sy = _mm256_div_ps( dy, scale );
+         const __m256 inv_length = _mm256_div_ps(
+            one,
+            _mm256_sqrt_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( sx, sx ), _mm256_mul_ps( sy, sy ) ), one ) )
+         );
+         const __m256 nx = _mm256_mul_ps( _mm256_xor_ps( sx, sign ), inv_length );
+         const __m256 ny = _mm256_mul_ps( _mm256_xor_ps( sy, sign ), inv_length );
+         _mm256_store_ps( normals[0], _mm256_add_ps( _mm256_mul_ps( nx, half ), half ) );
+         _mm256_store_ps( normals[1], _mm256_add_ps( _mm256_mul_ps( ny, half ), half ) );
+         _mm256_store_ps( normals[2], _mm256_add_ps( _mm256_mul_ps( inv_length, half ), half ) );
+         for (int i = 0; i < 8; ++i) {
+            out[3 * (x + i)] = normals[0][i];
+            out[3 * (x + i) + 1] = normals[1][i];
+            out[3 * (x + i) + 2] = normals[2][i];
+         }
+      }
+      return x;
+   }
+#endif
+}
+
+NormalMapGenerator::LineBuffers::LineBuffers(int width) :
+   Gray( width + 4 ), HorizontalBlurredRow{ -1, -1, -1, -1, -1 }, BlurredRow{ -1, -1, -1 }
+{
+   for (auto& line : HorizontalBlurred) line.resize( width );
+   for (auto& line : Blurred) line.resize( width + 2 );
+}
+
+int NormalMapGenerator::getBytesPerTexel(Format format)
+{
+   switch (format) {
+      case Format::RGB32F: return 3 * static_cast<int>(sizeof( float ));
+      case Format::RGB16F: return 3 * static_cast<int>(sizeof( uint16_t ));
+      case Format::RGB10A2: return static_cast<int>(sizeof( uint32_t ));
+      case Format::RG16: return 2 * static_cast<int>(sizeof( uint16_t ));
+      case Format::RG8: return 2 * static_cast<int>(sizeof( uint8_t ));
+      case Format::BC5: return 1;
+      default: return 0;
+   }
+}
+
+void NormalMapGenerator::convert(std::vector<uint8_t>& texels, const float* normal_map, int width, int height, Format format)
+{
+   if (format == Format::BC5) {
+      std::vector<uint8_t> rg;
+      convert( rg, normal_map, width, height, Format::RG8 );
+      BlockCompressor::encode(
+         texels, rg.data(), width, height, 2, static_cast<std::ptrdiff_t>(width) * 2, false, BlockCompressor::Format::BC5
+      );
+      return;
+   }
+
+   const int texel_num = width * height;
+   texels.resize( static_cast<size_t>(texel_num) * getBytesPerTexel( format ) );
+   uint8_t* out = texels.data();
+   ThreadPool::getInstance().parallelFor(
+      0, texel_num, 1 << 16,
+      [out, normal_map, format](int first, int last) {
+         for (int i = first; i < last; ++i) {
+            const float* n = normal_map + 3 * i;
+            switch (format) {
+               case Format::RGB32F:
+                  std::copy( n, n + 3, reinterpret_cast<float*>(out) + 3 * i );
+                  break;
+               case Format::RGB16F: {
+                  auto* texel = reinterpret_cast<uint16_t*>(out) + 3 * i;
+                  for (int c = 0; c < 3; ++c) texel[c] = glm::packHalf1x16( n[c] );
+               } break;
+               case Format::RGB10A2:
+                  reinterpret_cast<uint32_t*>(out)[i] = glm::packUnorm3x10_1x2( glm::vec4(n[0], n[1], n[2], 1.0f) );
+                  break;
+               case Format::RG16: {
+                  auto* texel = reinterpret_cast<uint16_t*>(out) + 2 * i;
+                  texel[0] = glm::packUnorm1x16( n[0] );
+                  texel[1] = glm::packUnorm1x16( n[1] );
+               } break;
+               case Format::RG8:
+                  out[2 * i] = glm::packUnorm1x8( n[0] );
+                  out[2 * i + 1] = glm::packUnorm1x8( n[1] );
+                  break;
+               default:
+                  break;
+            }
+         }
+      }
+   );
+}
+
+int NormalMapGenerator::reflect101(int p, int length)
+{
+   if (length == 1) return 0;
+   while (p < 0 || p >= length) p = p < 0 ? -p : 2 * length - p - 2;
+   return p;
+}
+
+void NormalMapGenerator::convertToGray(float* gray, const uint8_t* row, int width, int channel_num, bool is_bgr)
+{
+   if (channel_num < 3) {
+      for (int x = 0; x < width; ++x) gray[x] = static_cast<float>(row[x * channel_num]);
+      return;
+   }
+
+   // the same fixed-point weights as BT.601 luma in 14 bits
+   const int r = is_bgr ? 2 : 0;
+   const int b = is_bgr ? 0 : 2;
+   for (int x = 0; x < width; ++x) {
+      const uint8_t* pixel = row + x * channel_num;
+      gray[x] = static_cast<float>((pixel[b] * 1868 + pixel[1] * 9617 + pixel[r] * 4899 + 8192) >> 14);
+   }
+}
+
+void NormalMapGenerator::blurHorizontally(float* out, const float* gray, int width, InstructionSet instruction_set)
+{
+   int x = 0;
+#ifdef USE_X86_SIMD
+   if (instruction_set == InstructionSet::AVX2) x = blurHorizontallyAVX2( out, gray, width );
+   else if (instruction_set == InstructionSet::SSE41) x = blurHorizontallySSE41( out, gray, width );
+#endif
+   for (; x < width; ++x) out[x] = blurScalar( gray[x - 2], gray[x - 1], gray[x], gray[x + 1], gray[x + 2] );
+}
+
+void NormalMapGenerator::blurVertically(float* out, const float* const* rows, int width, InstructionSet instruction_set)
+{
+   int x = 0;
+#ifdef USE_X86_SIMD
+   if (instruction_set == InstructionSet::AVX2) x = blurVerticallyAVX2( out, rows, width );
+   else if (instruction_set == InstructionSet::SSE41) x = blurVerticallySSE41( out, rows, width );
+#endif
+   for (; x < width; ++x) {
+      out[x] = std::floor( blurScalar( rows[0][x], rows[1][x], rows[2][x], rows[3][x], rows[4][x] ) + 0.5f );
+   }
+}
+
+void NormalMapGenerator::packNormals(float* out, const float* const* rows, int width, InstructionSet instruction_set)
+{
+   int x = 0;
+#ifdef USE_X86_SIMD
+   if (instruction_set == InstructionSet::AVX2) x = packNormalsAVX2( out, rows[0], rows[1], rows[2], width );
+   else if (instruction_set == InstructionSet::SSE41) x = packNormalsSSE41( out, rows[0], rows[1], rows[2], width );
+#endif
+   for (; x < width; ++x) packNormalScalar( out + 3 * x, rows[0], rows[1], rows[2], x );
+}
+
+void NormalMapGenerator::generateBand(
+   float* normal_map,
+   const uint8_t* image,
+   int width,
+   int height,
+   int channel_num,
+   std::ptrdiff_t row_stride,
+   bool is_bgr,
+   InstructionSet instruction_set,
+   int first_row,
+   int last_row
+)
+{
+   LineBuffers buffers( width );
+   float* gray = buffers.Gray.data() + 2;
+
+   // Rows needed at once always lie within 5 (or 3) consecutive rows, so a row index modulo the ring size never
+   // evicts a line that is still in use.
+   const auto get_horizontal_blurred = [&](int y) -> const float* {
+      const int slot = y % 5;
+      if (buffers.HorizontalBlurredRow[slot] != y) {
+         convertToGray( gray, image + y * row_stride, width, channel_num, is_bgr );
+         gray[-2] = gray[reflect101( -2, width )];
+         gray[-1] = gray[reflect101( -1, width )];
+         gray[width] = gray[reflect101( width, width )];
+         gray[width + 1] = gray[reflect101( width + 1, width )];
+         blurHorizontally( buffers.HorizontalBlurred[slot].data(), gray, width, instruction_set );
+         buffers.HorizontalBlurredRow[slot] = y;
+      }
+      return buffers.HorizontalBlurred[slot].data();
+   };
+   const auto get_blurred = [&](int y) -> const float* {
+      const int slot = y % 3;
+      float* blurred = buffers.Blurred[slot].data() + 1;
+      if (buffers.BlurredRow[slot] != y) {
+         const float* rows[5];
+         for (int k = 0; k < 5; ++k) rows[k] = get_horizontal_blurred( reflect101( y + k - 2, height ) );
+         blurVertically( blurred, rows, width, instruction_set );
+         blurred[-1] = blurred[reflect101( -1, width )];
+         blurred[width] = blurred[reflect101( width, width )];
+         buffers.BlurredRow[slot] = y;
+      }
+      return blurred;
+   };
+
+   for (int j = first_row; j < last_row; ++j) {
+      const float* rows[3];
+      for (int k = 0; k < 3; ++k) rows[k] = get_blurred( reflect101( j + k - 1, height ) );
+      packNormals( normal_map + static_cast<std::ptrdiff_t>(j) * width * 3, rows, width, instruction_set );
+   }
+}
+
+void NormalMapGenerator::generate(
+   float* normal_map,
+   const uint8_t* image,
+   int width,
+   int height,
+   int channel_num,
+   std::ptrdiff_t row_stride,
+   bool is_bgr,
+   InstructionSet instruction_set,
+   int band_height
+)
+{
+   if (width <= 0 || height <= 0) return;
+
+   ThreadPool& pool = ThreadPool::getInstance();
+   if (band_height <= 0) band_height = std::max( 64, height / (pool.getThreadNum() * 4) );
+   pool.parallelFor(
+      0, height, band_height,
+      [=](int first_row, int last_row) {
+         generateBand(
+            normal_map, image, width, height, channel_num, row_stride, is_bgr, instruction_set, first_row, last_row
+         );
+      }
+   );
+}
\ No newline at end of file
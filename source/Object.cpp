@@ -1,9 +1,9 @@
 #include "Object.h"
 
-#include "opencv2/core/matx.hpp"
-
 ObjectGL::ObjectGL() :
-   ImageBuffer( nullptr ), VAO( 0 ), VBO( 0 ), DrawMode( 0 ), VerticesCount( 0 ),
+   ImageBuffer( nullptr ), VAO( 0 ), VBO( 0 ), VertexStride( 0 ), DrawMode( 0 ), VerticesCount( 0 ),
+   ShareGeometry( true ), InstanceBuffer( 0 ), InstancesCount( 0 ),
+   NormalMapFormat( NormalMapGenerator::Format::RGB32F ),
    EmissionColor( 0.0f, 0.0f, 0.0f, 1.0f ),
    AmbientReflectionColor( 0.2f, 0.2f, 0.2f, 1.0f ),
    DiffuseReflectionColor( 0.8f, 0.8f, 0.8f, 1.0f ),
@@ -13,10 +13,8 @@ ObjectGL::ObjectGL() :
 
 ObjectGL::~ObjectGL()
 {
-   if (VAO != 0) {
-      glDeleteVertexArrays( 1, &VAO );
-      glDeleteBuffers( 1, &VBO );
-   }
+   releaseVertexBuffer();
+   if (InstanceBuffer != 0) glDeleteBuffers( 1, &InstanceBuffer );
    for (const auto& texture_id : TextureID) {
       if (texture_id != 0) glDeleteTextures( 1, &texture_id );
    }
@@ -26,6 +24,14 @@ ObjectGL::~ObjectGL()
    delete [] ImageBuffer;
 }
 
+ObjectGL::SharedGeometry::~SharedGeometry()
+{
+   glDeleteVertexArrays( 1, &VAO );
+   glDeleteBuffers( 1, &VBO );
+   const auto it = GeometryRegistry.find( Key );
+   if (it != GeometryRegistry.end() && it->second.expired()) GeometryRegistry.erase( it );
+}
+
 void ObjectGL::setEmissionColor(const glm::vec4& emission_color)
 {
    EmissionColor = emission_color;
@@ -51,44 +57,149 @@ void ObjectGL::setSpecularReflectionExponent(const float& specular_reflection_ex
    SpecularReflectionExponent = specular_reflection_exponent;
 }
 
-bool ObjectGL::prepareTexture2DUsingFreeImage(const std::string& file_path, bool is_grayscale) const
+void ObjectGL::prepareTexture2D(const Image& image) const
 {
-   const FREE_IMAGE_FORMAT format = FreeImage_GetFileType( file_path.c_str(), 0 );
-   FIBITMAP* texture = FreeImage_Load( format, file_path.c_str() );
-   if (!texture) return false;
+   const bool is_grayscale = image.isGrayscale();
+   const GLsizei width = image.getWidth();
+   const GLsizei height = image.getHeight();
+   glTextureStorage2D(
+      TextureID.back(), MipmapBuilder::getLevelNum( width, height ), is_grayscale ? GL_R8 : GL_RGBA8, width, height
+   );
+   // FreeImage pads its rows to 4 bytes.
+   uploadTextureLevels(
+      TextureID.back(), -1, { image.getBits() }, width, height,
+      is_grayscale ? GL_RED : (image.isBGR() ? GL_BGRA : GL_RGBA), GL_UNSIGNED_BYTE, 4
+   );
+}
 
-   FIBITMAP* texture_converted;
-   const uint n_bits_per_pixel = FreeImage_GetBPP( texture );
-   const uint n_bits = is_grayscale ? 8 : 32;
-   if (is_grayscale) {
-      texture_converted = n_bits_per_pixel == n_bits ? texture : FreeImage_GetChannel( texture, FICC_RED );
+GLuint ObjectGL::prepareTextureStorage(GLenum internal_format, int width, int height, int level_num)
+{
+   GLuint texture_id = 0;
+   glCreateTextures( GL_TEXTURE_2D, 1, &texture_id );
+   glTextureStorage2D( texture_id, level_num, internal_format, width, height );
+   glTextureParameteri( texture_id, GL_TEXTURE_MAX_LEVEL, level_num - 1 );
+   glTextureParameteri( texture_id, GL_TEXTURE_MIN_FILTER, level_num > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+   glTextureParameteri( texture_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_S, GL_REPEAT );
+   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_T, GL_REPEAT );
+   TextureID.emplace_back( texture_id );
+   return texture_id;
+}
+
+GLuint ObjectGL::prepareTextureArrayStorage(
+   GLenum internal_format,
+   int width,
+   int height,
+   int level_num,
+   int layer_num
+)
+{
+   GLuint texture_id = 0;
+   glCreateTextures( GL_TEXTURE_2D_ARRAY, 1, &texture_id );
+   glTextureStorage3D( texture_id, level_num, internal_format, width, height, layer_num );
+   glTextureParameteri( texture_id, GL_TEXTURE_MAX_LEVEL, level_num - 1 );
+   glTextureParameteri( texture_id, GL_TEXTURE_MIN_FILTER, level_num > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+   glTextureParameteri( texture_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_S, GL_REPEAT );
+   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_T, GL_REPEAT );
+   TextureID.emplace_back( texture_id );
+   return texture_id;
+}
+
+GLenum ObjectGL::getCompressedInternalFormat(BlockCompressor::Format format)
+{
+   switch (format) {
+      case BlockCompressor::Format::BC1: return OPENGL_COMPRESSED_RGB_S3TC_DXT1;
+      case BlockCompressor::Format::BC5: return GL_COMPRESSED_RG_RGTC2;
+      default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
    }
-   else {
-      texture_converted = n_bits_per_pixel == n_bits ? texture : FreeImage_ConvertTo32Bits( texture );
+}
+
+void ObjectGL::getNormalMapTexelFormat(
+   GLenum& internal_format,
+   GLenum& pixel_format,
+   GLenum& type,
+   NormalMapGenerator::Format format
+)
+{
+   switch (format) {
+      case NormalMapGenerator::Format::RGB16F:
+         internal_format = GL_RGB16F; pixel_format = GL_RGB; type = GL_HALF_FLOAT;
+         break;
+      case NormalMapGenerator::Format::RGB10A2:
+         internal_format = GL_RGB10_A2; pixel_format = GL_RGBA; type = GL_UNSIGNED_INT_2_10_10_10_REV;
+         break;
+      case NormalMapGenerator::Format::RG16:
+         internal_format = GL_RG16; pixel_format = GL_RG; type = GL_UNSIGNED_SHORT;
+         break;
+      case NormalMapGenerator::Format::RG8:
+         internal_format = GL_RG8; pixel_format = GL_RG; type = GL_UNSIGNED_BYTE;
+         break;
+      default:
+         internal_format = GL_RGB32F; pixel_format = GL_RGB; type = GL_FLOAT;
+         break;
    }
+}
 
-   const GLsizei width = FreeImage_GetWidth( texture_converted );
-   const GLsizei height = FreeImage_GetHeight( texture_converted );
-   GLvoid* data = FreeImage_GetBits( texture_converted );
-   glTextureStorage2D( TextureID.back(), 1, is_grayscale ? GL_R8 : GL_RGBA8, width, height );
-   glTextureSubImage2D( TextureID.back(), 0, 0, 0, width, height, is_grayscale ? GL_RED : GL_BGRA, GL_UNSIGNED_BYTE, data );
+void ObjectGL::setTextureUploader(TextureUploaderGL* uploader)
+{
+   TextureUploader = uploader;
+}
 
-   FreeImage_Unload( texture_converted );
-   if (n_bits_per_pixel != n_bits) FreeImage_Unload( texture );
-   return true;
+void ObjectGL::uploadTextureLevels(
+   GLuint texture_id,
+   int layer,
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   GLenum pixel_format,
+   GLenum type,
+   int alignment
+)
+{
+   if (TextureUploader != nullptr) {
+      TextureUploader->upload( texture_id, layer, levels, width, height, pixel_format, type, alignment );
+   }
+   else {
+      TextureUploaderGL::uploadFromClient(
+         texture_id, layer, levels, width, height, pixel_format, type, alignment
+      );
+   }
+}
+
+void ObjectGL::uploadCompressedTextureLevels(
+   GLuint texture_id,
+   int layer,
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   BlockCompressor::Format format
+)
+{
+   const GLenum internal_format = getCompressedInternalFormat( format );
+   if (TextureUploader != nullptr) {
+      TextureUploader->uploadCompressed( texture_id, layer, levels, width, height, internal_format, format );
+   }
+   else {
+      TextureUploaderGL::uploadCompressedFromClient(
+         texture_id, layer, levels, width, height, internal_format, format
+      );
+   }
 }
 
 int ObjectGL::addTexture(const std::string& texture_file_path, bool is_grayscale)
+{
+   const std::shared_ptr<const Image> image = Image::load( texture_file_path, is_grayscale );
+   if (!image) return -1;
+   return addTexture( *image );
+}
+
+int ObjectGL::addTexture(const Image& image)
 {
    GLuint texture_id = 0;
    glCreateTextures( GL_TEXTURE_2D, 1, &texture_id );
    TextureID.emplace_back( texture_id );
-   if (!prepareTexture2DUsingFreeImage( texture_file_path, is_grayscale )) {
-      glDeleteTextures( 1, &texture_id );
-      TextureID.erase( TextureID.end() - 1 );
-      std::cerr << "Could not read image file " << texture_file_path.c_str() << "\n";
-      return -1;
-   }
+   prepareTexture2D( image );
 
    glTextureParameteri( texture_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
    glTextureParameteri( texture_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
@@ -100,52 +211,79 @@ int ObjectGL::addTexture(const std::string& texture_file_path, bool is_grayscale
 
 void ObjectGL::addTexture(int width, int height, bool is_grayscale)
 {
-   GLuint texture_id = 0;
-   glCreateTextures( GL_TEXTURE_2D, 1, &texture_id );
-   glTextureStorage2D(
-      texture_id,
-      1,
-      is_grayscale ? GL_R8 : GL_RGBA8,
-      width,
-      height
-   );
-   glTextureParameteri( texture_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-   glTextureParameteri( texture_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_S, GL_REPEAT );
-   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_T, GL_REPEAT );
-   glGenerateTextureMipmap( texture_id );
-   TextureID.emplace_back( texture_id );
+   prepareTextureStorage( is_grayscale ? GL_R8 : GL_RGBA8, width, height, MipmapBuilder::getLevelNum( width, height ) );
 }
 
 int ObjectGL::addTexture(const uint8_t* image_buffer, int width, int height, bool is_grayscale)
 {
    addTexture( width, height, is_grayscale );
-   glTextureSubImage2D(
-      TextureID.back(),
-      0,
-      0,
-      0,
+   uploadTextureLevels(
+      TextureID.back(), -1, { image_buffer }, width, height,
+      is_grayscale ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE, 4
+   );
+   glGenerateTextureMipmap( TextureID.back() );
+   return static_cast<int>(TextureID.size() - 1);
+}
+
+int ObjectGL::addTexture(const float* image_buffer, int width, int height)
+{
+   return addNormalMapTexture(
+      { reinterpret_cast<const uint8_t*>(image_buffer) },
       width,
       height,
-      is_grayscale ? GL_RED : GL_RGBA,
-      GL_UNSIGNED_BYTE,
-      image_buffer
+      NormalMapGenerator::Format::RGB32F
    );
+}
+
+int ObjectGL::addTexture(
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   GLenum internal_format,
+   GLenum pixel_format
+)
+{
+   const GLuint texture_id =
+      prepareTextureStorage( internal_format, width, height, static_cast<int>(levels.size()) );
+
+   // The levels are tightly packed, and rows of the small or single-channel levels may not be 4-byte aligned.
+   uploadTextureLevels( texture_id, -1, levels, width, height, pixel_format, GL_UNSIGNED_BYTE );
    return static_cast<int>(TextureID.size() - 1);
 }
 
-int ObjectGL::addTexture(const float* image_buffer, int width, int height)
+int ObjectGL::addCompressedTexture(
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   BlockCompressor::Format format
+)
 {
-   GLuint texture_id = 0;
-   glCreateTextures( GL_TEXTURE_2D, 1, &texture_id );
-   glTextureStorage2D( texture_id, 1, GL_RGB32F, width, height );
-   glTextureSubImage2D( texture_id, 0, 0, 0, width, height, GL_RGB, GL_FLOAT, image_buffer );
+   const GLuint texture_id = prepareTextureStorage(
+      getCompressedInternalFormat( format ), width, height, static_cast<int>(levels.size())
+   );
+   uploadCompressedTextureLevels( texture_id, -1, levels, width, height, format );
+   return static_cast<int>(TextureID.size() - 1);
+}
 
-   glTextureParameteri( texture_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-   glTextureParameteri( texture_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_S, GL_REPEAT );
-   glTextureParameteri( texture_id, GL_TEXTURE_WRAP_T, GL_REPEAT );
-   TextureID.emplace_back( texture_id );
+int ObjectGL::addNormalMapTexture(
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   NormalMapGenerator::Format format
+)
+{
+   NormalMapFormat = format;
+   if (format == NormalMapGenerator::Format::BC5) {
+      return addCompressedTexture( levels, width, height, BlockCompressor::Format::BC5 );
+   }
+
+   GLenum internal_format, pixel_format, type;
+   getNormalMapTexelFormat( internal_format, pixel_format, type, format );
+   const GLuint texture_id =
+      prepareTextureStorage( internal_format, width, height, static_cast<int>(levels.size()) );
+
+   // The texels are tightly packed, so rows of the 2 and 6 byte formats may not be 4-byte aligned.
+   uploadTextureLevels( texture_id, -1, levels, width, height, pixel_format, type );
    return static_cast<int>(TextureID.size() - 1);
 }
 
@@ -171,11 +309,38 @@ void ObjectGL::prepareNormal() const
    glVertexArrayAttribBinding( VAO, NormalLoc, 0 );
 }
 
+void ObjectGL::releaseVertexBuffer()
+{
+   if (VAO != 0) {
+      if (!Geometry || VAO != Geometry->VAO) glDeleteVertexArrays( 1, &VAO );
+      if (!Geometry) {
+         if (Streamed) {
+            for (const auto& fence : Streamed->Fences) {
+               if (fence != nullptr) glDeleteSync( fence );
+            }
+            glUnmapNamedBuffer( VBO );
+         }
+         glDeleteBuffers( 1, &VBO );
+      }
+   }
+   VAO = 0;
+   VBO = 0;
+   VertexStride = 0;
+   Streamed.reset();
+   Geometry.reset();
+}
+
 void ObjectGL::prepareVertexBuffer(int n_bytes_per_vertex)
 {
+   releaseVertexBuffer();
    glCreateBuffers( 1, &VBO );
    glNamedBufferStorage( VBO, sizeof( GLfloat ) * DataBuffer.size(), DataBuffer.data(), GL_DYNAMIC_STORAGE_BIT );
+   prepareVertexArray( n_bytes_per_vertex );
+}
 
+void ObjectGL::prepareVertexArray(int n_bytes_per_vertex)
+{
+   VertexStride = n_bytes_per_vertex;
    glCreateVertexArrays( 1, &VAO );
    glVertexArrayVertexBuffer( VAO, 0, VBO, 0, n_bytes_per_vertex );
    glVertexArrayAttribFormat( VAO, VertexLoc, 3, GL_FLOAT, GL_FALSE, 0 );
@@ -346,7 +511,7 @@ void ObjectGL::calculateTangent(
    std::vector<glm::vec3>& tangents, 
    const std::vector<glm::vec3>& vertices, 
    const std::vector<glm::vec2>& textures
-) const
+)
 {
    for (size_t i = 0; i < vertices.size(); i += 3) {
       const glm::vec3 edge1 = vertices[i + 1] - vertices[i];
@@ -361,96 +526,466 @@ void ObjectGL::calculateTangent(
    }
 }
 
-void ObjectGL::calculateNormalMap(cv::Mat& normal_map, const std::string& texture_file_path) const
+void ObjectGL::calculateNormalMap(std::vector<float>& normal_map, const Image& image)
+{
+   normal_map.resize( static_cast<size_t>(image.getWidth()) * image.getHeight() * 3 );
+   NormalMapGenerator::generate(
+      normal_map.data(),
+      image.getBits(),
+      image.getWidth(),
+      image.getHeight(),
+      image.getChannelNum(),
+      image.getPitch(),
+      image.isBGR()
+   );
+}
+
+bool ObjectGL::prepareNormalMapAsset(
+   NormalMapAsset& asset,
+   const std::string& texture_file_path,
+   NormalMapGenerator::Format format,
+   std::optional<BlockCompressor::Format> base_texture_compression
+)
 {
-   const cv::Mat image = cv::imread( texture_file_path );
-   cv::Mat gray_image;
-   cv::cvtColor( image, gray_image, cv::COLOR_BGR2GRAY );
+   // The base texture and the normal map are both derived from this single decoded image.
+   return prepareNormalMapAsset( asset, Image::load( texture_file_path ), format, base_texture_compression );
+}
 
-   cv::Mat blurred;
-   cv::GaussianBlur( gray_image, blurred, cv::Size(5, 5), 1.0 );
-   blurred.convertTo( blurred, CV_32FC1 );
-   cv::flip( blurred, blurred, 0 );
+bool ObjectGL::prepareNormalMapAsset(
+   NormalMapAsset& asset,
+   std::shared_ptr<const Image> image,
+   NormalMapGenerator::Format format,
+   std::optional<BlockCompressor::Format> base_texture_compression
+)
+{
+   if (!image || image->isGrayscale()) return false;
 
-   cv::Mat dx, dy;
-   cv::Sobel( blurred, dx, CV_32FC1, 1, 0 );
-   cv::Sobel( blurred, dy, CV_32FC1, 0, 1 );
+   struct BakedAsset
+   {
+      std::vector<std::vector<uint8_t>> BaseTexture;
+      std::vector<std::vector<uint8_t>> NormalMap;
+      std::vector<std::vector<uint8_t>> NormalLength;
+   };
+   auto baked = std::make_shared<BakedAsset>();
 
-   normal_map.create( image.size(), CV_32FC3 );
-   for (int j = 0; j < normal_map.rows; ++j) {
-      const auto* dx_ptr = dx.ptr<float>(j);
-      const auto* dy_ptr = dy.ptr<float>(j);
-      auto* normal_ptr = normal_map.ptr<cv::Vec3f>(j);
-      for (int i = 0; i < normal_map.cols; ++i) {
-         const glm::vec3 x(1.0f, 0.0f, dx_ptr[i] / 255.0f);
-         const glm::vec3 y(0.0f, 1.0f, dy_ptr[i] / 255.0f);
-         const glm::vec3 n = normalize( cross( x, y ) ) * 0.5f + 0.5f;
-         normal_ptr[i] = cv::Vec3f(n.x, n.y, n.z);
+   const int width = image->getWidth();
+   const int height = image->getHeight();
+   const int level_num = MipmapBuilder::getLevelNum( width, height );
+   MipmapBuilder::buildColor(
+      baked->BaseTexture, image->getBits(), width, height, image->getChannelNum(), image->getPitch()
+   );
+   if (base_texture_compression) {
+      for (int level = 0; level < level_num; ++level) {
+         const int level_width = MipmapBuilder::getLevelSize( width, level );
+         std::vector<uint8_t> texels = std::move( baked->BaseTexture[level] );
+         BlockCompressor::encode(
+            baked->BaseTexture[level],
+            texels.data(),
+            level_width,
+            MipmapBuilder::getLevelSize( height, level ),
+            4,
+            static_cast<std::ptrdiff_t>(level_width) * 4,
+            image->isBGR(),
+            *base_texture_compression
+         );
       }
    }
+
+   std::vector<float> normal_map;
+   std::vector<std::vector<float>> normal_levels;
+   calculateNormalMap( normal_map, *image );
+   MipmapBuilder::buildNormal( normal_levels, baked->NormalLength, normal_map.data(), width, height );
+   baked->NormalMap.resize( level_num );
+   for (int level = 0; level < level_num; ++level) {
+      NormalMapGenerator::convert(
+         baked->NormalMap[level],
+         normal_levels[level].data(),
+         MipmapBuilder::getLevelSize( width, level ),
+         MipmapBuilder::getLevelSize( height, level ),
+         format
+      );
+   }
+
+   asset.Width = width;
+   asset.Height = height;
+   asset.LevelNum = level_num;
+   asset.BaseTextureCompression = base_texture_compression;
+   asset.IsBaseTextureBGR = image->isBGR();
+   asset.NormalMapFormat = format;
+   asset.BaseTexture.clear();
+   asset.NormalMap.clear();
+   asset.NormalLength.clear();
+   for (int level = 0; level < level_num; ++level) {
+      asset.BaseTexture.emplace_back( baked->BaseTexture[level].data() );
+      asset.NormalMap.emplace_back( baked->NormalMap[level].data() );
+      asset.NormalLength.emplace_back( baked->NormalLength[level].data() );
+   }
+   asset.Storage = std::move( baked );
+   return true;
 }
 
-void ObjectGL::setSquareObjectForNormalMap(GLenum draw_mode, const std::string& texture_file_path)
+size_t ObjectGL::NormalMapAsset::getBaseTextureSize(int level) const
 {
-   std::vector<glm::vec3> square_vertices, square_normals;
-   std::vector<glm::vec2> square_textures;
-   getSquareObject( square_vertices, square_normals, square_textures );
+   const int level_width = MipmapBuilder::getLevelSize( Width, level );
+   const int level_height = MipmapBuilder::getLevelSize( Height, level );
+   if (BaseTextureCompression) {
+      return BlockCompressor::getCompressedSize( level_width, level_height, *BaseTextureCompression );
+   }
+   return static_cast<size_t>(level_width) * level_height * 4;
+}
 
-   std::vector<glm::vec3> tangents;
-   calculateTangent( tangents, square_vertices, square_textures );
+size_t ObjectGL::NormalMapAsset::getNormalMapSize(int level) const
+{
+   const int level_width = MipmapBuilder::getLevelSize( Width, level );
+   const int level_height = MipmapBuilder::getLevelSize( Height, level );
+   if (NormalMapFormat == NormalMapGenerator::Format::BC5) {
+      return BlockCompressor::getCompressedSize( level_width, level_height, BlockCompressor::Format::BC5 );
+   }
+   return static_cast<size_t>(level_width) * level_height * NormalMapGenerator::getBytesPerTexel( NormalMapFormat );
+}
 
-   cv::Mat normal_map;
-   calculateNormalMap( normal_map, texture_file_path );
+size_t ObjectGL::NormalMapAsset::getNormalLengthSize(int level) const
+{
+   return static_cast<size_t>(MipmapBuilder::getLevelSize( Width, level )) * MipmapBuilder::getLevelSize( Height, level );
+}
 
-   DrawMode = draw_mode;
-   for (size_t i = 0; i < square_vertices.size(); ++i) {
-      DataBuffer.push_back( square_vertices[i].x );
-      DataBuffer.push_back( square_vertices[i].y );
-      DataBuffer.push_back( square_vertices[i].z );
-      DataBuffer.push_back( square_normals[i].x );
-      DataBuffer.push_back( square_normals[i].y );
-      DataBuffer.push_back( square_normals[i].z );
-      DataBuffer.push_back( square_textures[i].x );
-      DataBuffer.push_back( square_textures[i].y );
-      DataBuffer.push_back( tangents[i].x );
-      DataBuffer.push_back( tangents[i].y );
-      DataBuffer.push_back( tangents[i].z );
-      VerticesCount++;
-   }
+void ObjectGL::setSquareObjectForNormalMap(GLenum draw_mode, const std::string& texture_file_path)
+{
+   NormalMapAsset asset;
+   if (prepareNormalMapAsset( asset, texture_file_path )) setSquareObjectForNormalMap( draw_mode, asset );
+}
+
+void ObjectGL::prepareVertexArrayForNormalMap()
+{
    const int n_bytes_per_vertex = 11 * sizeof(GLfloat);
-   prepareVertexBuffer( n_bytes_per_vertex );
+   prepareVertexArray( n_bytes_per_vertex );
    prepareNormal();
    prepareTexture( true );
-   addTexture( texture_file_path );
    prepareTangent();
-   addTexture( reinterpret_cast<float*>(normal_map.data), normal_map.cols, normal_map.rows );
 }
 
-void ObjectGL::transferUniformsToShader(const ShaderGL* shader)
+void ObjectGL::getSquareObjectForNormalMap(
+   std::vector<glm::vec3>& vertices,
+   std::vector<glm::vec3>& normals,
+   std::vector<glm::vec2>& textures,
+   std::vector<glm::vec3>& tangents
+)
 {
-   glUniform4fv( shader->getMaterialEmissionLocation(), 1, &EmissionColor[0] );
-   glUniform4fv( shader->getMaterialAmbientLocation(), 1, &AmbientReflectionColor[0] );
-   glUniform4fv( shader->getMaterialDiffuseLocation(), 1, &DiffuseReflectionColor[0] );
-   glUniform4fv( shader->getMaterialSpecularLocation(), 1, &SpecularReflectionColor[0] );
-   glUniform1f( shader->getMaterialSpecularExponentLocation(), SpecularReflectionExponent );
+   getSquareObject( vertices, normals, textures );
+   tangents.clear();
+   calculateTangent( tangents, vertices, textures );
 }
 
-void ObjectGL::updateDataBuffer(const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals)
+void ObjectGL::prepareSquareObjectForNormalMap(GLenum draw_mode)
 {
-   assert( VBO != 0 );
+   std::vector<glm::vec3> square_vertices, square_normals, tangents;
+   std::vector<glm::vec2> square_textures;
+   getSquareObjectForNormalMap( square_vertices, square_normals, square_textures, tangents );
 
+   releaseVertexBuffer();
+   DrawMode = draw_mode;
    VerticesCount = 0;
-   DataBuffer.clear();
-   for (size_t i = 0; i < vertices.size(); ++i) {
-      DataBuffer.push_back( vertices[i].x );
-      DataBuffer.push_back( vertices[i].y );
-      DataBuffer.push_back( vertices[i].z );
-      DataBuffer.push_back( normals[i].x );
-      DataBuffer.push_back( normals[i].y );
-      DataBuffer.push_back( normals[i].z );
+   std::vector<GLfloat> data;
+   for (size_t i = 0; i < square_vertices.size(); ++i) {
+      data.push_back( square_vertices[i].x );
+      data.push_back( square_vertices[i].y );
+      data.push_back( square_vertices[i].z );
+      data.push_back( square_normals[i].x );
+      data.push_back( square_normals[i].y );
+      data.push_back( square_normals[i].z );
+      data.push_back( square_textures[i].x );
+      data.push_back( square_textures[i].y );
+      data.push_back( tangents[i].x );
+      data.push_back( tangents[i].y );
+      data.push_back( tangents[i].z );
       VerticesCount++;
    }
-   glNamedBufferSubData( VBO, 0, sizeof( GLfloat ) * DataBuffer.size(), DataBuffer.data() );
+
+   if (!ShareGeometry) {
+      DataBuffer = std::move( data );
+      glCreateBuffers( 1, &VBO );
+      glNamedBufferStorage( VBO, sizeof( GLfloat ) * DataBuffer.size(), DataBuffer.data(), GL_DYNAMIC_STORAGE_BIT );
+      prepareVertexArrayForNormalMap();
+      return;
+   }
+
+   // The square never changes, so it is shared with every other object of the same vertex data and layout.
+   std::string key = "NormalMap:";
+   key.append( reinterpret_cast<const char*>(data.data()), sizeof( GLfloat ) * data.size() );
+   const auto it = GeometryRegistry.find( key );
+   if (it != GeometryRegistry.end()) Geometry = it->second.lock();
+   if (!Geometry) {
+      Geometry = std::make_shared<SharedGeometry>();
+      glCreateBuffers( 1, &Geometry->VBO );
+      glNamedBufferStorage( Geometry->VBO, sizeof( GLfloat ) * data.size(), data.data(), 0 );
+      VBO = Geometry->VBO;
+      prepareVertexArrayForNormalMap();
+      Geometry->VAO = VAO;
+      Geometry->Key = key;
+      GeometryRegistry[key] = Geometry;
+   }
+   VAO = Geometry->VAO;
+   VBO = Geometry->VBO;
+}
+
+void ObjectGL::setSquareObjectForNormalMap(GLenum draw_mode, const NormalMapAsset& asset)
+{
+   prepareSquareObjectForNormalMap( draw_mode );
+   if (asset.BaseTextureCompression) {
+      addCompressedTexture( asset.BaseTexture, asset.Width, asset.Height, *asset.BaseTextureCompression );
+   }
+   else addTexture( asset.BaseTexture, asset.Width, asset.Height, GL_RGBA8, asset.IsBaseTextureBGR ? GL_BGRA : GL_RGBA );
+   addNormalMapTexture( asset.NormalMap, asset.Width, asset.Height, asset.NormalMapFormat );
+   addTexture( asset.NormalLength, asset.Width, asset.Height, GL_R8, GL_RED );
+}
+
+void ObjectGL::setSquareObjectForNormalMapArray(
+   GLenum draw_mode,
+   int width,
+   int height,
+   int layer_num,
+   NormalMapGenerator::Format format,
+   std::optional<BlockCompressor::Format> base_texture_compression
+)
+{
+   prepareSquareObjectForNormalMap( draw_mode );
+
+   TextureArrayLayout = NormalMapAsset{};
+   TextureArrayLayout.Width = width;
+   TextureArrayLayout.Height = height;
+   TextureArrayLayout.LevelNum = MipmapBuilder::getLevelNum( width, height );
+   TextureArrayLayout.BaseTextureCompression = base_texture_compression;
+   TextureArrayLayout.NormalMapFormat = format;
+   NormalMapFormat = format;
+
+   const int level_num = TextureArrayLayout.LevelNum;
+   prepareTextureArrayStorage(
+      base_texture_compression ? getCompressedInternalFormat( *base_texture_compression ) : GL_RGBA8,
+      width, height, level_num, layer_num
+   );
+
+   GLenum internal_format, pixel_format, type;
+   if (format == NormalMapGenerator::Format::BC5) {
+      internal_format = getCompressedInternalFormat( BlockCompressor::Format::BC5 );
+   }
+   else getNormalMapTexelFormat( internal_format, pixel_format, type, format );
+   prepareTextureArrayStorage( internal_format, width, height, level_num, layer_num );
+   prepareTextureArrayStorage( GL_R8, width, height, level_num, layer_num );
+}
+
+bool ObjectGL::setNormalMapArrayLayer(int layer, const NormalMapAsset& asset)
+{
+   if (TextureID.size() < 3 || asset.Width != TextureArrayLayout.Width || asset.Height != TextureArrayLayout.Height ||
+       asset.LevelNum != TextureArrayLayout.LevelNum ||
+       asset.BaseTextureCompression != TextureArrayLayout.BaseTextureCompression ||
+       asset.NormalMapFormat != TextureArrayLayout.NormalMapFormat) {
+      std::cerr << "The asset does not match the layout of the texture array\n";
+      return false;
+   }
+
+   if (asset.BaseTextureCompression) {
+      uploadCompressedTextureLevels(
+         TextureID[0], layer, asset.BaseTexture, asset.Width, asset.Height, *asset.BaseTextureCompression
+      );
+   }
+   else {
+      uploadTextureLevels(
+         TextureID[0], layer, asset.BaseTexture, asset.Width, asset.Height,
+         asset.IsBaseTextureBGR ? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE
+      );
+   }
+
+   if (asset.NormalMapFormat == NormalMapGenerator::Format::BC5) {
+      uploadCompressedTextureLevels(
+         TextureID[1], layer, asset.NormalMap, asset.Width, asset.Height, BlockCompressor::Format::BC5
+      );
+   }
+   else {
+      GLenum internal_format, pixel_format, type;
+      getNormalMapTexelFormat( internal_format, pixel_format, type, asset.NormalMapFormat );
+      uploadTextureLevels( TextureID[1], layer, asset.NormalMap, asset.Width, asset.Height, pixel_format, type );
+   }
+
+   uploadTextureLevels(
+      TextureID[2], layer, asset.NormalLength, asset.Width, asset.Height, GL_RED, GL_UNSIGNED_BYTE
+   );
+   return true;
+}
+
+void ObjectGL::setInstances(const std::vector<glm::mat4>& world_matrices, const std::vector<int>& layers)
+{
+   assert( VAO != 0 && world_matrices.size() == layers.size() );
+
+   // The instance attributes belong to this object alone, so it gets its own VAO over the shared vertex buffer.
+   if (Geometry && VAO == Geometry->VAO) prepareVertexArrayForNormalMap();
+
+   struct InstanceData
+   {
+      glm::mat4 WorldMatrix;
+      GLint Layer;
+   };
+   std::vector<InstanceData> instances(world_matrices.size());
+   for (size_t i = 0; i < instances.size(); ++i) {
+      instances[i].WorldMatrix = world_matrices[i];
+      instances[i].Layer = layers[i];
+   }
+
+   // The storage is immutable, so a grid of a different size gets a new buffer.
+   if (InstanceBuffer != 0) glDeleteBuffers( 1, &InstanceBuffer );
+   InstanceBuffer = 0;
+   InstancesCount = static_cast<GLsizei>(instances.size());
+   if (instances.empty()) return;
+
+   glCreateBuffers( 1, &InstanceBuffer );
+   glNamedBufferStorage( InstanceBuffer, sizeof( InstanceData ) * instances.size(), instances.data(), 0 );
+
+   glVertexArrayVertexBuffer( VAO, 1, InstanceBuffer, 0, sizeof( InstanceData ) );
+   glVertexArrayBindingDivisor( VAO, 1, 1 );
+   for (int column = 0; column < 4; ++column) {
+      glVertexArrayAttribFormat(
+         VAO, InstanceWorldLoc + column, 4, GL_FLOAT, GL_FALSE,
+         static_cast<GLuint>(offsetof( InstanceData, WorldMatrix ) + sizeof( glm::vec4 ) * column)
+      );
+      glVertexArrayAttribBinding( VAO, InstanceWorldLoc + column, 1 );
+      glEnableVertexArrayAttrib( VAO, InstanceWorldLoc + column );
+   }
+   glVertexArrayAttribIFormat( VAO, InstanceLayerLoc, 1, GL_INT, offsetof( InstanceData, Layer ) );
+   glVertexArrayAttribBinding( VAO, InstanceLayerLoc, 1 );
+   glEnableVertexArrayAttrib( VAO, InstanceLayerLoc );
+}
+
+ObjectGL::MaterialBlock ObjectGL::getMaterialBlock() const
+{
+   return MaterialBlock{
+      EmissionColor, AmbientReflectionColor, DiffuseReflectionColor, SpecularReflectionColor,
+      SpecularReflectionExponent, { 0.0f, 0.0f, 0.0f }
+   };
+}
+
+void ObjectGL::prepareStreamedVertexBuffer()
+{
+   Streamed = std::make_unique<StreamedVertexBuffer>();
+   StreamedVertexBuffer& streamed = *Streamed;
+   const auto byte_num = static_cast<GLsizeiptr>(sizeof( GLfloat ) * DataBuffer.size());
+   streamed.RegionSize = (byte_num + 255) / 256 * 256; // every region starts on a 256-byte boundary
+
+   // Catching up reads the latest region back, so the buffer stays in system memory where that is cheap.
+   const GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+   GLuint buffer = 0;
+   glCreateBuffers( 1, &buffer );
+   glNamedBufferStorage(
+      buffer, streamed.RegionSize * StreamedVertexBuffer::RegionNum, nullptr, map_flags | GL_CLIENT_STORAGE_BIT
+   );
+   streamed.Mapped = static_cast<uint8_t*>(glMapNamedBufferRange(
+      buffer, 0, streamed.RegionSize * StreamedVertexBuffer::RegionNum, map_flags
+   ));
+   if (streamed.Mapped == nullptr) {
+      std::cerr << "Could not map a vertex buffer of " << streamed.RegionSize << " bytes per region\n";
+      glDeleteBuffers( 1, &buffer );
+      Streamed.reset();
+      return;
+   }
+   // Each region starts out with the vertices set so far.
+   for (int region = 0; region < StreamedVertexBuffer::RegionNum; ++region) {
+      std::memcpy( streamed.Mapped + region * streamed.RegionSize, DataBuffer.data(), byte_num );
+   }
+
+   glDeleteBuffers( 1, &VBO );
+   VBO = buffer;
+   glVertexArrayVertexBuffer( VAO, 0, VBO, 0, VertexStride );
+   // From now on, the regions hold the vertices.
+   DataBuffer.clear();
+   DataBuffer.shrink_to_fit();
+}
+
+int ObjectGL::getVertexCapacity() const
+{
+   // Shared vertices are never updated, and an object without vertices has no stride yet.
+   if (Geometry || VertexStride == 0) return 0;
+   if (Streamed) return static_cast<int>(Streamed->RegionSize / VertexStride);
+   return static_cast<int>(sizeof( GLfloat ) * DataBuffer.size() / VertexStride);
+}
+
+GLfloat* ObjectGL::beginVertexUpdate()
+{
+   assert( VBO != 0 && !Geometry );
+
+   if (!Streamed) {
+      prepareStreamedVertexBuffer();
+      if (!Streamed) return nullptr;
+   }
+   StreamedVertexBuffer& streamed = *Streamed;
+   assert( streamed.Next < 0 );
+
+   const int next = (streamed.Current + 1) % StreamedVertexBuffer::RegionNum;
+   GLsync& fence = streamed.Fences[next];
+   if (fence != nullptr) {
+      if (glClientWaitSync( fence, 0, 0 ) == GL_TIMEOUT_EXPIRED) {
+         glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max() );
+      }
+      glDeleteSync( fence );
+      fence = nullptr;
+   }
+
+   uint8_t* region = streamed.Mapped + next * streamed.RegionSize;
+   if (streamed.StaleBegin[next] < streamed.StaleEnd[next]) {
+      std::memcpy(
+         region + streamed.StaleBegin[next],
+         streamed.Mapped + streamed.Current * streamed.RegionSize + streamed.StaleBegin[next],
+         streamed.StaleEnd[next] - streamed.StaleBegin[next]
+      );
+   }
+   streamed.StaleBegin[next] = streamed.StaleEnd[next] = 0;
+   streamed.Next = next;
+   return reinterpret_cast<GLfloat*>(region);
+}
+
+void ObjectGL::endVertexUpdate(int first_vertex, int vertex_num)
+{
+   if (!Streamed) return;
+
+   StreamedVertexBuffer& streamed = *Streamed;
+   assert( streamed.Next >= 0 && (first_vertex + vertex_num) * VertexStride <= streamed.RegionSize );
+
+   // Every other region now lags behind by the vertices written.
+   const auto begin = static_cast<GLintptr>(first_vertex) * VertexStride;
+   const auto end = static_cast<GLintptr>(first_vertex + vertex_num) * VertexStride;
+   for (int region = 0; region < StreamedVertexBuffer::RegionNum; ++region) {
+      if (region == streamed.Next || vertex_num <= 0) continue;
+      if (streamed.StaleBegin[region] < streamed.StaleEnd[region]) {
+         streamed.StaleBegin[region] = std::min( streamed.StaleBegin[region], begin );
+         streamed.StaleEnd[region] = std::max( streamed.StaleEnd[region], end );
+      }
+      else {
+         streamed.StaleBegin[region] = begin;
+         streamed.StaleEnd[region] = end;
+      }
+   }
+
+   // The draws so far read from the current region, and the later ones from the new one.
+   streamed.Fences[streamed.Current] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+   streamed.Current = streamed.Next;
+   streamed.Next = -1;
+   glVertexArrayVertexBuffer( VAO, 0, VBO, streamed.Current * streamed.RegionSize, VertexStride );
+}
+
+void ObjectGL::updateDataBuffer(const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals)
+{
+   assert( VBO != 0 && !Geometry && static_cast<int>(vertices.size()) <= getVertexCapacity() );
+
+   GLfloat* data = beginVertexUpdate();
+   if (data == nullptr) return;
+
+   for (size_t i = 0; i < vertices.size(); ++i, data += 6) {
+      data[0] = vertices[i].x;
+      data[1] = vertices[i].y;
+      data[2] = vertices[i].z;
+      data[3] = normals[i].x;
+      data[4] = normals[i].y;
+      data[5] = normals[i].z;
+   }
+   VerticesCount = static_cast<GLsizei>(vertices.size());
+   endVertexUpdate( 0, VerticesCount );
 }
 
 void ObjectGL::updateDataBuffer(
@@ -459,22 +994,23 @@ void ObjectGL::updateDataBuffer(
    const std::vector<glm::vec2>& textures
 )
 {
-   assert( VBO != 0 );
+   assert( VBO != 0 && !Geometry && static_cast<int>(vertices.size()) <= getVertexCapacity() );
 
-   VerticesCount = 0;
-   DataBuffer.clear();
-   for (size_t i = 0; i < vertices.size(); ++i) {
-      DataBuffer.push_back( vertices[i].x );
-      DataBuffer.push_back( vertices[i].y );
-      DataBuffer.push_back( vertices[i].z );
-      DataBuffer.push_back( normals[i].x );
-      DataBuffer.push_back( normals[i].y );
-      DataBuffer.push_back( normals[i].z );
-      DataBuffer.push_back( textures[i].x );
-      DataBuffer.push_back( textures[i].y );
-      VerticesCount++;
+   GLfloat* data = beginVertexUpdate();
+   if (data == nullptr) return;
+
+   for (size_t i = 0; i < vertices.size(); ++i, data += 8) {
+      data[0] = vertices[i].x;
+      data[1] = vertices[i].y;
+      data[2] = vertices[i].z;
+      data[3] = normals[i].x;
+      data[4] = normals[i].y;
+      data[5] = normals[i].z;
+      data[6] = textures[i].x;
+      data[7] = textures[i].y;
    }
-   glNamedBufferSubData( VBO, 0, sizeof( GLfloat ) * DataBuffer.size(), DataBuffer.data() );
+   VerticesCount = static_cast<GLsizei>(vertices.size());
+   endVertexUpdate( 0, VerticesCount );
 }
 
 void ObjectGL::replaceVertices(
@@ -483,19 +1019,22 @@ void ObjectGL::replaceVertices(
    bool textures_exist
 )
 {
-   assert( VBO != 0 );
+   assert( VBO != 0 && !Geometry && static_cast<int>(vertices.size()) <= getVertexCapacity() );
 
-   VerticesCount = 0;
    int step = 3;
    if (normals_exist) step += 3;
    if (textures_exist) step += 2;
+   GLfloat* data = beginVertexUpdate();
+   if (data == nullptr) return;
+
+   // Only the positions change; the other attributes are already in the region.
    for (size_t i = 0; i < vertices.size(); ++i) {
-      DataBuffer[i * step] = vertices[i].x;
-      DataBuffer[i * step + 1] = vertices[i].y;
-      DataBuffer[i * step + 2] = vertices[i].z;
-      VerticesCount++;
+      data[i * step] = vertices[i].x;
+      data[i * step + 1] = vertices[i].y;
+      data[i * step + 2] = vertices[i].z;
    }
-   glNamedBufferSubData( VBO, 0, sizeof( GLfloat ) * VerticesCount * step, DataBuffer.data() );
+   VerticesCount = static_cast<GLsizei>(vertices.size());
+   endVertexUpdate( 0, VerticesCount );
 }
 
 void ObjectGL::replaceVertices(
@@ -504,17 +1043,19 @@ void ObjectGL::replaceVertices(
    bool textures_exist
 )
 {
-   assert( VBO != 0 );
+   assert( VBO != 0 && !Geometry && static_cast<int>(vertices.size() / 3) <= getVertexCapacity() );
 
-   VerticesCount = 0;
    int step = 3;
    if (normals_exist) step += 3;
    if (textures_exist) step += 2;
+   GLfloat* data = beginVertexUpdate();
+   if (data == nullptr) return;
+
    for (size_t i = 0, j = 0; i < vertices.size(); i += 3, ++j) {
-      DataBuffer[j * step] = vertices[i];
-      DataBuffer[j * step + 1] = vertices[i + 1];
-      DataBuffer[j * step + 2] = vertices[i + 2];
-      VerticesCount++;
+      data[j * step] = vertices[i];
+      data[j * step + 1] = vertices[i + 1];
+      data[j * step + 2] = vertices[i + 2];
    }
-   glNamedBufferSubData( VBO, 0, sizeof( GLfloat ) * VerticesCount * step, DataBuffer.data() );
+   VerticesCount = static_cast<GLsizei>(vertices.size() / 3);
+   endVertexUpdate( 0, VerticesCount );
 }
\ No newline at end of file
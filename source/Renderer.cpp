@@ -1,9 +1,21 @@
 #include "Renderer.h"
 
-RendererGL::RendererGL() : 
-   Window( nullptr ), FrameWidth( 1920 ), FrameHeight( 1080 ), UseBumpMapping( true ), LightTheta( 0.0f ),
+RendererGL::RendererGL(std::optional<HeadlessSettings> headless) :
+   Headless( std::move( headless ) ), IsInitialized( false ), Window( nullptr ), OutputFramebuffer( 0 ),
+   OutputRenderbuffers{ 0, 0 },
+   FrameWidth( Headless ? Headless->FrameSize.x : 1920 ), FrameHeight( Headless ? Headless->FrameSize.y : 1080 ),
+   UseBumpMapping( true ), UseInstancing( true ), UseClusteredLights( false ), UseDeferredShading( false ),
+   AnimateWalls( false ), WallShaderFeatures( 0 ), LightTheta( 0.0f ), WallAnimationFrame( 0 ), WallShrink( 0.0f ),
+   WallTextureSize( 1024 ), WallGridSize( 3, 3 ), WallWorldMatrixBuffer( 0 ), WallWorldMatrixGridSize( 0, 0 ),
+   DeferredMaterialBuffer( 0 ), ScreenVAO( 0 ), MaterialIndexUniform( -1 ),
+   NormalMapFormat( NormalMapGenerator::Format::BC5 ), BaseTextureCompression( BlockCompressor::Format::BC7 ),
+   WallAssetCache( std::string(CMAKE_SOURCE_DIR) + "/cache" ),
    ClickedPoint( -1, -1 ), MainCamera( std::make_unique<CameraGL>() ),
-   ObjectShader( std::make_unique<ShaderGL>() ), Lights( std::make_unique<LightGL>() )
+   ObjectShader( std::make_unique<ShaderGL>() ),
+   DeferredLightingShader( std::make_unique<ShaderGL>() ), GBuffer( std::make_unique<GBufferGL>() ),
+   DrawQueue( std::make_unique<DrawQueueGL>() ),
+   PlaceholderWall( std::make_unique<ObjectGL>() ), InstancedWalls( std::make_unique<ObjectGL>() ),
+   Lights( std::make_unique<LightGL>() )
 {
    Renderer = this;
 
@@ -12,8 +24,18 @@ RendererGL::RendererGL() :
       wall = std::make_unique<ObjectGL>();
    }
 
-   initialize();
-   printOpenGLInformation();
+   IsInitialized = initialize();
+   if (IsInitialized && (!Headless || !Headless->UseSoftwareRenderer)) printOpenGLInformation();
+}
+
+RendererGL::~RendererGL()
+{
+   ObjectGL::setTextureUploader( nullptr );
+   if (WallWorldMatrixBuffer != 0) glDeleteBuffers( 1, &WallWorldMatrixBuffer );
+   if (DeferredMaterialBuffer != 0) glDeleteBuffers( 1, &DeferredMaterialBuffer );
+   if (ScreenVAO != 0) glDeleteVertexArrays( 1, &ScreenVAO );
+   if (OutputFramebuffer != 0) glDeleteFramebuffers( 1, &OutputFramebuffer );
+   if (OutputRenderbuffers[0] != 0) glDeleteRenderbuffers( 2, OutputRenderbuffers );
 }
 
 void RendererGL::printOpenGLInformation() const
@@ -26,37 +48,100 @@ void RendererGL::printOpenGLInformation() const
    std::cout << "****************************************************************\n\n";
 }
 
-void RendererGL::initialize()
+bool RendererGL::createWindow(bool visible)
 {
    if (!glfwInit()) {
       std::cout << "Cannot Initialize OpenGL...\n";
-      return;
+      return false;
    }
    glfwWindowHint( GLFW_CONTEXT_VERSION_MAJOR, 4 );
    glfwWindowHint( GLFW_CONTEXT_VERSION_MINOR, 6 );
    glfwWindowHint( GLFW_DOUBLEBUFFER, GLFW_TRUE );
    glfwWindowHint( GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE );
+   glfwWindowHint( GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE );
 
    Window = glfwCreateWindow( FrameWidth, FrameHeight, "Main Camera", nullptr, nullptr );
+   if (Window == nullptr) {
+      std::cout << "Cannot Create a Window...\n";
+      return false;
+   }
    glfwMakeContextCurrent( Window );
 
    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
       std::cout << "Failed to initialize GLAD" << std::endl;
-      return;
+      return false;
    }
-   
-   registerCallbacks();
-   
+   return true;
+}
+
+bool RendererGL::createHeadlessContext()
+{
+   // Without EGL, a hidden window still works on machines that have a display.
+   HeadlessContext = std::make_unique<HeadlessContextGL>();
+   if (!HeadlessContext->create()) {
+      HeadlessContext.reset();
+      std::cout << "Falling back to a hidden window...\n";
+      if (!createWindow( false )) return false;
+   }
+
+   glCreateRenderbuffers( 2, OutputRenderbuffers );
+   glNamedRenderbufferStorage( OutputRenderbuffers[0], GL_RGBA8, FrameWidth, FrameHeight );
+   glNamedRenderbufferStorage( OutputRenderbuffers[1], GL_DEPTH_COMPONENT32F, FrameWidth, FrameHeight );
+   glCreateFramebuffers( 1, &OutputFramebuffer );
+   glNamedFramebufferRenderbuffer( OutputFramebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, OutputRenderbuffers[0] );
+   glNamedFramebufferRenderbuffer( OutputFramebuffer, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, OutputRenderbuffers[1] );
+   if (glCheckNamedFramebufferStatus( OutputFramebuffer, GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cerr << "Could not complete the offscreen framebuffer of " << FrameWidth << " x " << FrameHeight << "\n";
+      return false;
+   }
+   glViewport( 0, 0, FrameWidth, FrameHeight );
+   return true;
+}
+
+bool RendererGL::initialize()
+{
+   if (Headless && Headless->UseSoftwareRenderer) {
+      MainCamera->updateWindowSize( FrameWidth, FrameHeight );
+      return true;
+   }
+
+   if (Headless) {
+      if (!createHeadlessContext()) return false;
+   }
+   else {
+      if (!createWindow( true )) return false;
+      registerCallbacks();
+   }
+
    glEnable( GL_DEPTH_TEST );
    glClearColor( 0.1f, 0.1f, 0.1f, 1.0f );
 
+   TextureUploader = std::make_unique<TextureUploaderGL>();
+   if (!TextureUploader->create()) TextureUploader.reset();
+   ObjectGL::setTextureUploader( TextureUploader.get() );
+
    MainCamera->updateWindowSize( FrameWidth, FrameHeight );
 
    const std::string shader_directory_path = std::string(CMAKE_SOURCE_DIR) + "/shaders";
-   ObjectShader->setShader(
+   ShaderGL::setProgramBinaryCacheDirectory( std::string(CMAKE_SOURCE_DIR) + "/cache" );
+   const std::vector<std::string> wall_shader_feature_names = {
+      "USE_TEXTURE", "USE_BUMP_MAPPING", "USE_LIGHT", "TWO_CHANNEL_NORMAL_MAP", "USE_SPOTLIGHT", "USE_CLUSTERED_LIGHTS",
+      "INSTANCED", "GBUFFER_PASS"
+   };
+   ObjectShader->setShaderPermutations(
       std::string(shader_directory_path + "/BumpMapping.vert").c_str(),
-      std::string(shader_directory_path + "/BumpMapping.frag").c_str()
+      std::string(shader_directory_path + "/BumpMapping.frag").c_str(),
+      wall_shader_feature_names
    );
+   DeferredLightingShader->setShaderPermutations(
+      std::string(shader_directory_path + "/DeferredLighting.vert").c_str(),
+      std::string(shader_directory_path + "/DeferredLighting.frag").c_str(),
+      wall_shader_feature_names
+   );
+   // Only the GBUFFER_PASS permutations have it, the others resolve it to -1.
+   MaterialIndexUniform = ObjectShader->addUniformLocation( "MaterialIndex" );
+   glCreateVertexArrays( 1, &ScreenVAO );
+   return true;
 }
 
 void RendererGL::error(int error, const char* description) const
@@ -107,12 +192,66 @@ void RendererGL::keyboard(GLFWwindow* window, int key, int scancode, int action,
          break;
       case GLFW_KEY_L:
          Lights->toggleLightSwitch();
+         updateWallShaderFeatures();
          std::cout << "Light Turned " << (Lights->isLightOn() ? "On!\n" : "Off!\n");
          break;
       case GLFW_KEY_B:
          UseBumpMapping = !UseBumpMapping;
+         updateWallShaderFeatures();
          std::cout << "Bump Mapping Turned " << (UseBumpMapping ? "On!\n" : "Off!\n");
          break;
+      case GLFW_KEY_C:
+         UseClusteredLights = !UseClusteredLights;
+         updateWallShaderFeatures();
+         FrameTimes.clear();
+         std::cout << "Clustered Lights Turned " << (UseClusteredLights ? "On!\n" : "Off!\n");
+         break;
+      case GLFW_KEY_G:
+         UseDeferredShading = !UseDeferredShading;
+         FrameTimes.clear();
+         std::cout << "Deferred Shading Turned " << (UseDeferredShading ? "On!\n" : "Off!\n");
+         break;
+      case GLFW_KEY_K:
+         addRandomLights( 1024 );
+         FrameTimes.clear();
+         std::cout << "Lights: " << Lights->getTotalLightNum() << "\n";
+         break;
+      case GLFW_KEY_N:
+         UseInstancing = !UseInstancing;
+         FrameTimes.clear();
+         std::cout << "Instancing Turned " << (UseInstancing ? "On!\n" : "Off!\n");
+         break;
+      case GLFW_KEY_EQUAL:
+      case GLFW_KEY_MINUS:
+         WallGridSize = key == GLFW_KEY_EQUAL ?
+            glm::min( WallGridSize * 2, glm::ivec2(384) ) : glm::max( WallGridSize / 2, glm::ivec2(1) );
+         updateWallGrid();
+         FrameTimes.clear();
+         std::cout << "Wall Grid: " << WallGridSize.x << " x " << WallGridSize.y << " ("
+            << WallGridSize.x * WallGridSize.y << " tiles)\n";
+         break;
+      case GLFW_KEY_F: {
+         if (FrameTimes.empty()) break;
+         double sum = 0.0;
+         for (const auto& frame_time : FrameTimes) sum += frame_time;
+         std::cout << "Average CPU Frame Time: " << sum / static_cast<double>(FrameTimes.size()) << " ms over "
+            << FrameTimes.size() << " frames (" << WallGridSize.x * WallGridSize.y << " tiles, instancing "
+            << (UseInstancing ? "on" : "off") << ")\n";
+
+         // Since the last report; only the lights that changed are uploaded, mostly the one that circles the walls.
+         const LightGL::UploadStats& stats = Lights->getUploadStats();
+         if (stats.UpdateNum > 0) {
+            std::cout << "Light Buffer Uploads: " << static_cast<double>(stats.CallNum) / stats.UpdateNum
+               << " calls and " << static_cast<double>(stats.ByteNum) / stats.UpdateNum << " bytes per frame ("
+               << Lights->getLightBlockSize() << " bytes for the whole block)\n";
+         }
+         Lights->resetUploadStats();
+
+         const StateCacheGL::Counters& counters = DrawQueue->getStateCache().getCounters();
+         std::cout << "Draw Submission: " << DrawQueue->getDrawNum() << " draws, " << counters.IssuedCalls
+            << " state calls issued and " << counters.ElidedCalls << " elided since the last report\n";
+         DrawQueue->resetCounters();
+      } break;
       case GLFW_KEY_P: {
          const glm::vec3 pos = MainCamera->getCameraPosition();
          std::cout << "Camera Position: " << pos.x << ", " << pos.y << ", " << pos.z << "\n";
@@ -233,84 +372,759 @@ void RendererGL::setLights() const
    );  
 }
 
-void RendererGL::setWallObject(int object_index)
+void RendererGL::addRandomLights(int light_num) const
+{
+   // Small colored point lights and spotlights scattered just above the current wall grid.
+   std::mt19937 generator(static_cast<uint32_t>(Lights->getTotalLightNum()));
+   std::uniform_real_distribution<float> x(0.0f, static_cast<float>(WallGridSize.x));
+   std::uniform_real_distribution<float> y(0.0f, static_cast<float>(WallGridSize.y));
+   std::uniform_real_distribution<float> z(0.05f, 0.3f);
+   std::uniform_real_distribution<float> intensity(0.2f, 1.0f);
+   for (int i = 0; i < light_num; ++i) {
+      const glm::vec4 position(x( generator ), y( generator ), z( generator ), 1.0f);
+      const glm::vec4 color(intensity( generator ), intensity( generator ), intensity( generator ), 1.0f);
+      const bool is_spotlight = i % 4 == 0;
+      Lights->addLight(
+         position,
+         glm::vec4(0.0f, 0.0f, 0.0f, 1.0f),
+         color,
+         color,
+         glm::vec3(0.0f, 0.0f, -1.0f),
+         is_spotlight ? 40.0f : 180.0f,
+         0.2f,
+         0.05f
+      );
+   }
+}
+
+void RendererGL::updateWallShaderFeatures()
 {
+   WallShaderFeatures = TextureFeature;
+   if (UseBumpMapping) WallShaderFeatures |= BumpMappingFeature;
+   if (Lights->isLightOn()) {
+      WallShaderFeatures |= LightFeature;
+      if (Lights->hasActiveSpotlight()) WallShaderFeatures |= SpotlightFeature;
+      if (UseClusteredLights) WallShaderFeatures |= ClusteredLightsFeature;
+   }
+}
+
+uint32_t RendererGL::getWallShaderFeatures(NormalMapGenerator::Format format) const
+{
+   return NormalMapGenerator::isTwoChannel( format ) ?
+      WallShaderFeatures | TwoChannelNormalMapFeature : WallShaderFeatures;
+}
+
+void RendererGL::prewarmWallShaders() const
+{
+   // Every combination the B, L and C toggles can reach, so that toggling never waits for a compilation.
+   const auto start = std::chrono::steady_clock::now();
+   uint32_t base_features = TextureFeature;
+   if (NormalMapGenerator::isTwoChannel( NormalMapFormat )) base_features |= TwoChannelNormalMapFeature;
+   std::vector<uint32_t> feature_sets;
+   for (const uint32_t bump_mapping : { 0u, static_cast<uint32_t>(BumpMappingFeature) }) {
+      feature_sets.emplace_back( base_features | bump_mapping );
+      uint32_t light = LightFeature;
+      if (Lights->hasActiveSpotlight()) light |= SpotlightFeature;
+      feature_sets.emplace_back( base_features | bump_mapping | light );
+      feature_sets.emplace_back( base_features | bump_mapping | light | ClusteredLightsFeature );
+   }
+   std::vector<uint32_t> object_feature_sets;
+   std::vector<uint32_t> lighting_pass_feature_sets;
+   const auto addUnique = [](std::vector<uint32_t>& sets, uint32_t features) {
+      if (std::find( sets.begin(), sets.end(), features ) == sets.end()) sets.emplace_back( features );
+   };
+   for (const auto& features : feature_sets) {
+      for (const uint32_t instanced : { 0u, static_cast<uint32_t>(InstancedFeature) }) {
+         addUnique( object_feature_sets, features | instanced );
+         addUnique( object_feature_sets, (features & GeometryPassFeatures) | instanced | GBufferPassFeature );
+      }
+      addUnique( lighting_pass_feature_sets, features & ~GeometryPassFeatures );
+   }
+   ObjectShader->prewarmPermutations( object_feature_sets );
+   DeferredLightingShader->prewarmPermutations( lighting_pass_feature_sets );
+   std::cout << "Wall Shaders Prewarmed: "
+      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms ("
+      << ShaderGL::getProgramBinaryHitNum() << " program binary hits, "
+      << ShaderGL::getProgramBinaryMissNum() << " misses)\n";
+}
+
+void RendererGL::setPlaceholderWallObject() const
+{
+   ObjectGL::NormalMapAsset asset;
+   const bool prepared = ObjectGL::prepareNormalMapAsset(
+      asset, Image::create( 1, 1, glm::vec4(0.5f, 0.5f, 0.5f, 1.0f) ), NormalMapFormat
+   );
+   if (!prepared) return;
+   PlaceholderWall->setSquareObjectForNormalMap( GL_TRIANGLES, asset );
+   PlaceholderWall->setDiffuseReflectionColor( { 1.0f, 1.0f, 1.0f, 1.0f } );
+}
+
+void RendererGL::setInstancedWallObjects()
+{
+   // One layer per wall and a last one for the placeholder, which stands in for walls that are not loaded yet.
+   const int layer_num = static_cast<int>(WallObjects.size()) + 1;
+   InstancedWalls->setSquareObjectForNormalMapArray(
+      GL_TRIANGLES, WallTextureSize, WallTextureSize, layer_num, NormalMapFormat, BaseTextureCompression
+   );
+   InstancedWalls->setDiffuseReflectionColor( { 1.0f, 1.0f, 1.0f, 1.0f } );
+   WallLayerLoaded.assign( layer_num, false );
+}
+
+void RendererGL::requestWallObjects()
+{
+   // Decoding and normal map generation run on the pool; only the GL uploads are left to this thread.
+   // Walls whose source and parameters are unchanged since the last run are mapped from the cache instead.
+   // Only the layers of the instanced texture arrays are resampled, as they all need the same size.
    const std::string sample_directory_path = std::string(CMAKE_SOURCE_DIR) + "/samples/";
-   const std::string texture_path = sample_directory_path + std::to_string( object_index ) + ".jpg";
-   WallObjects[object_index]->setSquareObjectForNormalMap( GL_TRIANGLES, texture_path );
+   WallAssets.clear();
+   WallAssets.resize( WallObjects.size() + 1 );
+   for (size_t i = 0; i < WallObjects.size(); ++i) {
+      const std::string texture_path = sample_directory_path + std::to_string( i ) + ".jpg";
+      WallAssets[i] = ThreadPool::getInstance().submit(
+         [texture_path, size = WallTextureSize, format = NormalMapFormat, compression = BaseTextureCompression,
+          cache = WallAssetCache]() {
+            WallAsset wall;
+            std::shared_ptr<const Image> image;
+            const uint64_t object_key = NormalMapCache::getKey( texture_path, glm::ivec2(0), format, compression );
+            if (!cache.load( wall.Object, object_key )) {
+               image = Image::load( texture_path );
+               if (!ObjectGL::prepareNormalMapAsset( wall.Object, image, format, compression )) return WallAsset{};
+               cache.store( wall.Object, object_key );
+            }
+            if (wall.Object.Width == size && wall.Object.Height == size) {
+               wall.Layer = wall.Object;
+               return wall;
+            }
+
+            const uint64_t layer_key = NormalMapCache::getKey( texture_path, glm::ivec2(size), format, compression );
+            if (cache.load( wall.Layer, layer_key )) return wall;
+
+            if (!image) image = Image::load( texture_path );
+            if (image) image = image->resize( size, size );
+            if (ObjectGL::prepareNormalMapAsset( wall.Layer, image, format, compression )) {
+               cache.store( wall.Layer, layer_key );
+            }
+            return wall;
+         }
+      );
+   }
+   // The placeholder is no wall object, but the software renderer draws it from the same member as the walls.
+   WallAssets.back() = ThreadPool::getInstance().submit(
+      [size = WallTextureSize, format = NormalMapFormat, compression = BaseTextureCompression]() {
+         WallAsset placeholder;
+         const bool prepared = ObjectGL::prepareNormalMapAsset(
+            placeholder.Layer, Image::create( size, size, glm::vec4(0.5f, 0.5f, 0.5f, 1.0f) ), format, compression
+         );
+         if (!prepared) return WallAsset{};
+
+         placeholder.Object = placeholder.Layer;
+         return placeholder;
+      }
+   );
+}
+
+void RendererGL::setWallObject(int object_index, const ObjectGL::NormalMapAsset& asset)
+{
+   WallObjects[object_index]->setSquareObjectForNormalMap( GL_TRIANGLES, asset );
    WallObjects[object_index]->setDiffuseReflectionColor( { 1.0f, 1.0f, 1.0f, 1.0f } );
 }
 
-void RendererGL::drawWallObject(const glm::mat4& to_world, int object_index)
+void RendererGL::uploadLoadedWallObjects()
 {
-   glUseProgram( ObjectShader->getShaderProgram() );
+   bool grid_changed = false;
+   for (size_t i = 0; i < WallAssets.size(); ++i) {
+      std::future<WallAsset>& pending = WallAssets[i];
+      if (!pending.valid() || pending.wait_for( std::chrono::seconds(0) ) != std::future_status::ready) continue;
+      // The rest waits for the next frame once this one has uploaded its share, so a burst of loaded walls does not
+      // stall a single frame. The first wall of a frame always goes.
+      if (TextureUploader && !TextureUploader->hasFrameBudget()) break;
 
-   ObjectShader->transferBasicTransformationUniforms( to_world, MainCamera.get(), true );
-   glUniform1i( ObjectShader->getLocation( "UseBumpMapping" ), UseBumpMapping ? 1 : 0 );
+      const WallAsset wall = pending.get();
+      if (!wall.Object.Storage) continue;
 
-   WallObjects[object_index]->transferUniformsToShader( ObjectShader.get() );
-   Lights->transferUniformsToShader( ObjectShader.get() );
+      // Replacing the objects of a wall frees names the state cache may still hold as bound.
+      DrawQueue->invalidate();
+      if (i < WallObjects.size()) setWallObject( static_cast<int>(i), wall.Object );
+      if (wall.Layer.Storage && InstancedWalls->setNormalMapArrayLayer( static_cast<int>(i), wall.Layer )) {
+         WallLayerLoaded[i] = true;
+         grid_changed = true;
+      }
+   }
+   if (grid_changed) updateWallGrid();
+}
+
+void RendererGL::updateWallGrid()
+{
+   const auto wall_num = static_cast<int>(WallObjects.size());
+   const int placeholder_layer = wall_num;
+   const auto tile_num = static_cast<size_t>(WallGridSize.x) * WallGridSize.y;
+   // The tiles only move when the grid is resized, while a loaded layer merely changes the instances.
+   const bool is_resized = WallGridSize != WallWorldMatrixGridSize;
+   std::vector<glm::mat4> tile_matrices;
+   std::vector<glm::mat4> world_matrices;
+   std::vector<int> layers;
+   if (is_resized) tile_matrices.reserve( tile_num );
+   world_matrices.reserve( tile_num );
+   layers.reserve( tile_num );
+   for (int column = 0; column < WallGridSize.x; ++column) {
+      for (int row = 0; row < WallGridSize.y; ++row) {
+         const glm::mat4 to_world =
+            translate( glm::mat4(1.0f), glm::vec3(static_cast<float>(column), static_cast<float>(row), 0.0f) );
+         if (is_resized) tile_matrices.emplace_back( to_world );
+
+         int layer = (column * WallGridSize.y + row) % wall_num;
+         if (!WallLayerLoaded[layer]) layer = placeholder_layer;
+         if (!WallLayerLoaded[layer]) continue;
+
+         world_matrices.emplace_back( to_world );
+         layers.emplace_back( layer );
+      }
+   }
+   InstancedWalls->setInstances( world_matrices, layers );
+   if (!is_resized) return;
 
-   glBindTextureUnit( 0, WallObjects[object_index]->getTextureID( 0 ) );
-   glBindTextureUnit( 1, WallObjects[object_index]->getTextureID( 1 ) );
-   glBindVertexArray( WallObjects[object_index]->getVAO() );
-   glDrawArrays( WallObjects[object_index]->getDrawMode(), 0, WallObjects[object_index]->getVertexNum() );
+   // The draws without instancing read their world matrix from this buffer at their base instance.
+   WallWorldMatrixGridSize = WallGridSize;
+   if (WallWorldMatrixBuffer != 0) glDeleteBuffers( 1, &WallWorldMatrixBuffer );
+   glCreateBuffers( 1, &WallWorldMatrixBuffer );
+   glNamedBufferStorage(
+      WallWorldMatrixBuffer, sizeof( glm::mat4 ) * tile_matrices.size(), tile_matrices.data(), 0
+   );
 }
 
-void RendererGL::render()
+void RendererGL::updateWallVertices()
 {
-   glClear( OPENGL_COLOR_BUFFER_BIT | OPENGL_DEPTH_BUFFER_BIT );
+   // Each frame moves one edge, so the other one reaches the regions of the vertex buffers through their catch-up.
+   const int axis = WallAnimationFrame % 2;
+   const int step = (WallAnimationFrame / 2) % WallAnimationPeriod;
+   WallShrink[axis] = MaxWallShrink * static_cast<float>(step) / static_cast<float>(WallAnimationPeriod);
+
+   std::vector<glm::vec3> vertices, normals, tangents;
+   std::vector<glm::vec2> textures;
+   ObjectGL::getSquareObjectForNormalMap( vertices, normals, textures, tangents );
+   std::vector<ObjectGL*> walls = { PlaceholderWall.get(), InstancedWalls.get() };
+   for (const auto& wall : WallObjects) walls.emplace_back( wall.get() );
+   for (ObjectGL* wall : walls) {
+      if (wall->getVAO() == 0) continue;
+
+      GLfloat* data = wall->beginVertexUpdate();
+      if (data == nullptr) continue;
+
+      const int float_num = wall->getVertexStride() / static_cast<int>(sizeof( GLfloat ));
+      int first = -1, last = -1;
+      for (int i = 0; i < static_cast<int>(vertices.size()); ++i) {
+         if (vertices[i][axis] != 1.0f) continue;
+
+         data[i * float_num + axis] = 1.0f - WallShrink[axis];
+         if (first < 0) first = i;
+         last = i;
+      }
+      wall->endVertexUpdate( first, last - first + 1 );
+   }
+}
+
+void RendererGL::drawWallObjects(bool geometry_pass)
+{
+   glBindBufferBase( GL_SHADER_STORAGE_BUFFER, WorldMatrixBinding, WallWorldMatrixBuffer );
+
+   // The same layout as the instances: column by column from the bottom row, cycling through the walls.
+   const auto wall_num = static_cast<int>(WallObjects.size());
+   const int tile_num = WallGridSize.x * WallGridSize.y;
+   for (int tile = 0; tile < tile_num; ++tile) {
+      // A wall keeps the placeholder material until its own asset is uploaded.
+      const int object_index = tile % wall_num;
+      const bool is_loaded = WallObjects[object_index]->getVAO() != 0;
+      ObjectGL* wall = is_loaded ? WallObjects[object_index].get() : PlaceholderWall.get();
+      if (wall->getVAO() == 0) continue;
+
+      const uint32_t features = getWallShaderFeatures( wall->getNormalMapFormat() );
+      ShaderGL* shader = ObjectShader->getPermutation(
+         geometry_pass ? (features & GeometryPassFeatures) | GBufferPassFeature : features
+      );
+      DrawQueueGL::DrawCommand command =
+         DrawQueueGL::getObjectDrawCommand( shader, wall, 1, static_cast<GLuint>(tile) );
+      if (geometry_pass) {
+         command.IntUniformLocation = shader->getLocation( MaterialIndexUniform );
+         command.IntUniformValue = is_loaded ? object_index : wall_num;
+      }
+      DrawQueue->submit( command );
+   }
+   // The queue groups the tiles by wall, so each wall binds its textures once however large the grid is.
+   DrawQueue->flush();
+}
+
+void RendererGL::drawInstancedWallObjects(bool geometry_pass)
+{
+   if (InstancedWalls->getInstanceNum() == 0) return;
+
+   const uint32_t features = getWallShaderFeatures( InstancedWalls->getNormalMapFormat() );
+   ShaderGL* shader = ObjectShader->getPermutation(
+      geometry_pass ? (features & GeometryPassFeatures) | GBufferPassFeature | InstancedFeature :
+      features | InstancedFeature
+   );
+   DrawQueueGL::DrawCommand command =
+      DrawQueueGL::getObjectDrawCommand( shader, InstancedWalls.get(), InstancedWalls->getInstanceNum() );
+   if (geometry_pass) {
+      command.IntUniformLocation = shader->getLocation( MaterialIndexUniform );
+      command.IntUniformValue = static_cast<GLint>(WallObjects.size()) + 1;
+   }
+   DrawQueue->submit( command );
+   DrawQueue->flush();
+}
+
+void RendererGL::updateDeferredMaterialBuffer()
+{
+   std::vector<ObjectGL::MaterialBlock> materials;
+   materials.reserve( WallObjects.size() + 2 );
+   for (const auto& wall : WallObjects) materials.emplace_back( wall->getMaterialBlock() );
+   materials.emplace_back( PlaceholderWall->getMaterialBlock() );
+   materials.emplace_back( InstancedWalls->getMaterialBlock() );
+   // The geometry pass writes the indices in 8 bits, so any further material would saturate to the last entry.
+   assert( materials.size() <= static_cast<size_t>(GBufferGL::MaxMaterialNum) );
+
+   const auto size = static_cast<GLsizeiptr>(sizeof( ObjectGL::MaterialBlock ) * materials.size());
+   if (DeferredMaterialBuffer == 0) {
+      glCreateBuffers( 1, &DeferredMaterialBuffer );
+      glNamedBufferStorage( DeferredMaterialBuffer, size, materials.data(), GL_DYNAMIC_STORAGE_BIT );
+   }
+   else glNamedBufferSubData( DeferredMaterialBuffer, 0, size, materials.data() );
+   glBindBufferBase( GL_SHADER_STORAGE_BUFFER, DeferredMaterialBinding, DeferredMaterialBuffer );
+}
 
+void RendererGL::drawDeferred(const glm::ivec2& viewport_size)
+{
+   // Reallocated targets may reuse the names of the old ones, which the state cache would take as still bound.
+   const bool resized = GBuffer->getSize() != viewport_size;
+   if (!GBuffer->setSize( viewport_size )) return;
+   if (resized) DrawQueue->invalidate();
+
+   GBuffer->beginGeometryPass();
+   if (UseInstancing) drawInstancedWallObjects( true );
+   else drawWallObjects( true );
+
+   // One full screen triangle shades every covered pixel once with the lights of its cluster, or with all lights
+   // without clustering, so the cost no longer grows with the number of objects.
+   glBindFramebuffer( GL_FRAMEBUFFER, OutputFramebuffer );
+   updateDeferredMaterialBuffer();
+   DrawQueueGL::DrawCommand command;
+   command.Shader = DeferredLightingShader->getPermutation( WallShaderFeatures & ~GeometryPassFeatures );
+   command.VAO = ScreenVAO;
+   for (int target = 0; target < GBufferGL::TargetNum; ++target) {
+      command.Textures[target] = GBuffer->getTexture( static_cast<GBufferGL::Target>(target) );
+   }
+   command.VertexNum = 3;
+   glDisable( GL_DEPTH_TEST );
+   DrawQueue->submit( command );
+   DrawQueue->flush();
+   glEnable( GL_DEPTH_TEST );
+}
+
+glm::ivec2 RendererGL::getFramebufferSize() const
+{
+   if (Headless) return { FrameWidth, FrameHeight };
+
+   glm::ivec2 size;
+   glfwGetFramebufferSize( Window, &size.x, &size.y );
+   return size;
+}
+
+glm::vec4 RendererGL::getAnimatedLightPosition() const
+{
    const float light_x = 1.25f * cosf( LightTheta ) + 1.5f;
    const float light_y = 1.25f * sinf( LightTheta ) + 1.5f;
-   Lights->setLightPosition( glm::vec4(light_x, light_y, 0.2f, 1.0f), 0 );
+   return { light_x, light_y, 0.2f, 1.0f };
+}
+
+void RendererGL::render()
+{
+   glBindFramebuffer( GL_FRAMEBUFFER, OutputFramebuffer );
+   glClear( OPENGL_COLOR_BUFFER_BIT | OPENGL_DEPTH_BUFFER_BIT );
+
+   Lights->setLightPosition( getAnimatedLightPosition(), 0 );
+   Lights->updateLightBuffer();
+   if (AnimateWalls) updateWallVertices();
+
+   MainCamera->updateCameraBuffer();
+   const glm::ivec2 viewport_size = getFramebufferSize();
+   if (WallShaderFeatures & ClusteredLightsFeature) Lights->updateClusterBuffers( MainCamera.get(), viewport_size );
+
+   if (UseDeferredShading) drawDeferred( viewport_size );
+   else if (UseInstancing) drawInstancedWallObjects( false );
+   else drawWallObjects( false );
+}
+
+void RendererGL::advanceAnimation()
+{
+   LightTheta += 0.05f;
+   if (LightTheta >= 360.0f) LightTheta -= 360.0f;
+   if (AnimateWalls) ++WallAnimationFrame;
+}
+
+void RendererGL::prepareScene()
+{
+   setLights();
+   setPlaceholderWallObject();
+   setInstancedWallObjects();
+   updateWallGrid();
+   requestWallObjects();
+   updateWallShaderFeatures();
+   prewarmWallShaders();
+}
 
-   const glm::mat4 to_up = translate( glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-   glm::mat4 to_world_3rd_row = glm::mat4(1.0f);
-   glm::mat4 to_world_2nd_row = to_up;
-   glm::mat4 to_world_1st_row = to_world_2nd_row * to_up;
+bool RendererGL::readCameraPath(std::vector<std::pair<glm::vec3, glm::vec3>>& keyframes, const std::string& file_path)
+{
+   std::ifstream file(file_path);
+   if (!file.is_open()) {
+      std::cerr << "Could not open the camera path " << file_path << "\n";
+      return false;
+   }
 
-   drawWallObject( to_world_3rd_row, 0 );
-   drawWallObject( to_world_2nd_row, 1 );
-   drawWallObject( to_world_1st_row, 2 );
+   keyframes.clear();
+   std::string line;
+   while (std::getline( file, line )) {
+      if (line.empty() || line[0] == '#') continue;
 
-   const glm::mat4 to_right = translate(glm:: mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f) );
-   to_world_3rd_row *= to_right;
-   to_world_2nd_row *= to_right;
-   to_world_1st_row *= to_right;
+      std::istringstream stream(line);
+      glm::vec3 position, target;
+      if (!(stream >> position.x >> position.y >> position.z >> target.x >> target.y >> target.z)) {
+         std::cerr << "Could not read the camera keyframe \"" << line << "\" in " << file_path << "\n";
+         return false;
+      }
+      keyframes.emplace_back( position, target );
+   }
+   if (keyframes.empty()) std::cerr << "The camera path " << file_path << " has no keyframes\n";
+   return !keyframes.empty();
+}
 
-   drawWallObject( to_world_3rd_row, 3 );
-   drawWallObject( to_world_2nd_row, 4 );
-   drawWallObject( to_world_1st_row, 5 );
+void RendererGL::setCameraOnPath(const std::vector<std::pair<glm::vec3, glm::vec3>>& keyframes, float t) const
+{
+   const float position = std::clamp( t, 0.0f, 1.0f ) * static_cast<float>(keyframes.size() - 1);
+   const auto index = std::min( static_cast<size_t>(position), keyframes.size() - 1 );
+   const size_t next = std::min( index + 1, keyframes.size() - 1 );
+   const float weight = position - static_cast<float>(index);
+   MainCamera->setView(
+      glm::mix( keyframes[index].first, keyframes[next].first, weight ),
+      glm::mix( keyframes[index].second, keyframes[next].second, weight ),
+      glm::vec3(0.0f, 1.0f, 0.0f)
+   );
+}
 
-   to_world_3rd_row *= to_right;
-   to_world_2nd_row *= to_right;
-   to_world_1st_row *= to_right;
+SoftwareRenderer::Features RendererGL::getSoftwareFeatures() const
+{
+   SoftwareRenderer::Features features;
+   features.UseBumpMapping = UseBumpMapping;
+   features.UseLight = Lights->isLightOn();
+   return features;
+}
 
-   drawWallObject( to_world_3rd_row, 6 );
-   drawWallObject( to_world_2nd_row, 7 );
-   drawWallObject( to_world_1st_row, 8 );
+void RendererGL::setSoftwareScene(SoftwareRenderer& software_renderer, bool use_layer_assets)
+{
+   // The walls get the same meshes, textures and materials as their GL draws, and a wall whose asset could not be
+   // prepared shows the placeholder as it does there. The materials are only read from the GL objects.
+   software_renderer.setClearColor( glm::vec4(0.1f, 0.1f, 0.1f, 1.0f) );
+   std::vector<glm::vec3> vertices, normals, tangents;
+   std::vector<glm::vec2> textures;
+   ObjectGL::getSquareObjectForNormalMap( vertices, normals, textures, tangents );
+   const int mesh = software_renderer.addMesh( vertices, normals, textures, tangents );
+   std::vector<int> wall_textures;
+   for (auto& asset : WallAssets) {
+      const WallAsset loaded = asset.get();
+      const ObjectGL::NormalMapAsset& wall = use_layer_assets ? loaded.Layer : loaded.Object;
+      wall_textures.emplace_back( wall.Storage ? software_renderer.addTexture( wall ) : -1 );
+   }
+   const int placeholder_texture = wall_textures.back();
+   const auto wall_num = static_cast<int>(WallObjects.size());
+   for (int column = 0; column < WallGridSize.x; ++column) {
+      for (int row = 0; row < WallGridSize.y; ++row) {
+         const int object_index = (column * WallGridSize.y + row) % wall_num;
+         const int texture = wall_textures[object_index] >= 0 ? wall_textures[object_index] : placeholder_texture;
+         if (texture < 0) continue;
+
+         // The instanced draw has one material, and the others use the wall or, until it is loaded, the placeholder.
+         const ObjectGL* wall = WallObjects[object_index].get();
+         if (use_layer_assets) wall = InstancedWalls.get();
+         else if (wall->getVAO() == 0) wall = PlaceholderWall.get();
+         const glm::mat4 to_world =
+            translate( glm::mat4(1.0f), glm::vec3(static_cast<float>(column), static_cast<float>(row), 0.0f) );
+         software_renderer.draw( mesh, texture, to_world, wall->getMaterialBlock() );
+      }
+   }
+}
 
-   glBindVertexArray( 0 );
-   glUseProgram( 0 );
+double RendererGL::compareWithSoftwareRenderer(SoftwareRenderer& software_renderer) const
+{
+   // render() has placed the light of this frame already.
+   software_renderer.render( *MainCamera, *Lights, getSoftwareFeatures() );
+
+   std::vector<uint8_t> pixels(static_cast<size_t>(FrameWidth) * FrameHeight * 4);
+   glBindFramebuffer( GL_READ_FRAMEBUFFER, OutputFramebuffer );
+   glNamedFramebufferReadBuffer( OutputFramebuffer, GL_COLOR_ATTACHMENT0 );
+   glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+   glReadPixels( 0, 0, FrameWidth, FrameHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data() );
+   return BlockCompressor::getPSNR( pixels.data(), software_renderer.getColor().data(), FrameWidth * FrameHeight, 3 );
 }
 
-void RendererGL::play()
+bool RendererGL::playHeadless()
 {
-   if (glfwWindowShouldClose( Window )) initialize();
+   const HeadlessSettings& settings = *Headless;
+   if (settings.UseSoftwareRenderer) return playSoftware();
+
+   UseInstancing = settings.UseInstancing;
+   UseClusteredLights = settings.UseClusteredLights;
+   UseDeferredShading = settings.UseDeferredShading;
+   WallGridSize = settings.WallGridSize;
+   AnimateWalls = settings.AnimateWalls;
+   if (AnimateWalls) {
+      PlaceholderWall->setGeometrySharing( false );
+      InstancedWalls->setGeometrySharing( false );
+      for (auto& wall : WallObjects) wall->setGeometrySharing( false );
+   }
+   prepareScene();
+   if (settings.RandomLightNum > 0) {
+      addRandomLights( settings.RandomLightNum );
+      updateWallShaderFeatures();
+   }
 
+   std::vector<std::pair<glm::vec3, glm::vec3>> camera_path;
+   if (!settings.CameraPathFile.empty() && !readCameraPath( camera_path, settings.CameraPathFile )) return false;
+   FrameCaptureGL capture;
+   if (!settings.ImageDirectory.empty() && settings.ImageInterval > 0) {
+      const bool started = capture.start(
+         { FrameWidth, FrameHeight }, settings.ImageDirectory, settings.ImageFormat, settings.ImageThreadNum
+      );
+      if (!started) return false;
+   }
+
+   // Every wall is loaded before the first frame, so that each run renders the same images.
+   for (auto& asset : WallAssets) {
+      if (asset.valid()) asset.wait();
+   }
+   const auto has_pending_asset = [this]() {
+      return std::any_of(
+         WallAssets.begin(), WallAssets.end(), [](const auto& asset) { return asset.valid(); }
+      );
+   };
+   while (has_pending_asset()) {
+      if (TextureUploader) TextureUploader->beginFrame();
+      uploadLoadedWallObjects();
+   }
+   if (TextureUploader) {
+      const TextureUploaderGL::UploadStats& stats = TextureUploader->getUploadStats();
+      std::cout << "Texture Upload: " << static_cast<double>(stats.StagedBytes) / (1024.0 * 1024.0)
+         << " MiB through the upload ring, " << static_cast<double>(stats.DirectBytes) / (1024.0 * 1024.0)
+         << " MiB from client memory, " << stats.FenceWaitNum << " fence waits\n";
+   }
+
+   // The uploads consumed the assets, so the software renderer maps them from the cache once more.
+   std::unique_ptr<SoftwareRenderer> reference;
+   double min_psnr = std::numeric_limits<double>::infinity();
+   int compared_frame_num = 0;
+   if (settings.CompareWithSoftwareRenderer) {
+      requestWallObjects();
+      reference = std::make_unique<SoftwareRenderer>( glm::ivec2(FrameWidth, FrameHeight) );
+      setSoftwareScene( *reference, UseInstancing );
+   }
+
+   // The GPU time of a frame is read one frame later, when its query has most likely finished.
+   GLuint queries[2];
+   glCreateQueries( GL_TIME_ELAPSED, 2, queries );
+   std::vector<double> cpu_times(settings.FrameNum, 0.0);
+   std::vector<double> gpu_times(settings.FrameNum, 0.0);
+   const auto read_gpu_time = [&](int frame) {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v( queries[frame % 2], GL_QUERY_RESULT, &nanoseconds );
+      gpu_times[frame] = static_cast<double>(nanoseconds) * 1.0e-6;
+   };
+
+   glFinish();
+   const auto start = std::chrono::steady_clock::now();
+   for (int frame = 0; frame < settings.FrameNum; ++frame) {
+      if (!camera_path.empty()) {
+         const float t =
+            settings.FrameNum > 1 ? static_cast<float>(frame) / static_cast<float>(settings.FrameNum - 1) : 0.0f;
+         setCameraOnPath( camera_path, t );
+      }
+
+      const auto frame_start = std::chrono::steady_clock::now();
+      glBeginQuery( GL_TIME_ELAPSED, queries[frame % 2] );
+      render();
+      glEndQuery( GL_TIME_ELAPSED );
+      cpu_times[frame] =
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+      if (frame > 0) read_gpu_time( frame - 1 );
+
+      if (settings.ImageInterval > 0 && frame % settings.ImageInterval == 0) {
+         capture.capture( OutputFramebuffer, frame );
+      }
+      if (reference && WallShrink == glm::vec2(0.0f)) {
+         min_psnr = std::min( min_psnr, compareWithSoftwareRenderer( *reference ) );
+         ++compared_frame_num;
+      }
+      advanceAnimation();
+   }
+   if (settings.FrameNum > 0) read_gpu_time( settings.FrameNum - 1 );
+   glFinish();
+   const double total_time =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   glDeleteQueries( 2, queries );
+
+   // The frames still in flight or queued are written after the timed run, and reported on their own.
+   bool passed = true;
+   if (capture.getEncoder().isStarted()) {
+      const auto finish_start = std::chrono::steady_clock::now();
+      passed = capture.finish();
+      const FrameCaptureGL::CaptureStats& stats = capture.getStats();
+      std::cout << "Frame Capture: " << capture.getEncoder().getWrittenFrameNum() << " of " << stats.CapturedFrameNum
+         << " frames written, " << stats.DroppedFrameNum << " dropped, "
+         << stats.Milliseconds / std::max( stats.CapturedFrameNum, 1 ) << " ms per capture on the render thread, "
+         << stats.FenceWaitNum << " fence waits, "
+         << capture.getEncoder().getStallMilliseconds() << " ms waiting for the encoder, "
+         << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - finish_start).count()
+         << " ms to write the rest\n";
+   }
+
+   double cpu_sum = 0.0, gpu_sum = 0.0;
+   for (int frame = 0; frame < settings.FrameNum; ++frame) {
+      cpu_sum += cpu_times[frame];
+      gpu_sum += gpu_times[frame];
+   }
+   const double frame_num = std::max( settings.FrameNum, 1 );
+   std::cout << "Headless Run: " << settings.FrameNum << " frames of " << FrameWidth << " x " << FrameHeight
+      << ", average CPU time " << cpu_sum / frame_num << " ms, average GPU time " << gpu_sum / frame_num << " ms, "
+      << settings.FrameNum * 1000.0 / std::max( total_time, 1.0e-3 ) << " frames per second overall\n";
+   if (reference) {
+      const bool compared = min_psnr >= MinSoftwarePSNR;
+      std::cout << "Software Comparison: lowest PSNR " << min_psnr << " dB over " << compared_frame_num
+         << " frames, floor " << MinSoftwarePSNR << " dB, " << (compared ? "passed" : "FAILED") << "\n";
+      passed = passed && compared;
+   }
+
+   if (!settings.TimingFile.empty()) {
+      std::ofstream file(settings.TimingFile);
+      if (!file.is_open()) {
+         std::cerr << "Could not write the timings to " << settings.TimingFile << "\n";
+         return false;
+      }
+      file << "frame,cpu_ms,gpu_ms\n";
+      for (int frame = 0; frame < settings.FrameNum; ++frame) {
+         file << frame << "," << cpu_times[frame] << "," << gpu_times[frame] << "\n";
+      }
+   }
+   return passed;
+}
+
+bool RendererGL::playSoftware()
+{
+   const HeadlessSettings& settings = *Headless;
+   WallGridSize = settings.WallGridSize;
    setLights();
-   for (int i = 0; i < 9; ++i) setWallObject( i );
-   ObjectShader->setUniformLocations( Lights->getTotalLightNum() );
-   ObjectShader->addUniformLocation( "UseBumpMapping" );
+   if (settings.RandomLightNum > 0) addRandomLights( settings.RandomLightNum );
+   requestWallObjects();
+
+   std::vector<std::pair<glm::vec3, glm::vec3>> camera_path;
+   if (!settings.CameraPathFile.empty() && !readCameraPath( camera_path, settings.CameraPathFile )) return false;
+   FrameEncoder encoder;
+   if (!settings.ImageDirectory.empty() && settings.ImageInterval > 0) {
+      const bool started = encoder.start(
+         settings.ImageDirectory, settings.ImageFormat, { FrameWidth, FrameHeight }, settings.ImageThreadNum
+      );
+      if (!started) return false;
+   }
+
+   // Without a context no wall object is ever set, so every tile takes the material of the placeholder, which gets
+   // the one setPlaceholderWallObject() would give it.
+   PlaceholderWall->setDiffuseReflectionColor( { 1.0f, 1.0f, 1.0f, 1.0f } );
+   SoftwareRenderer software_renderer({ FrameWidth, FrameHeight });
+   setSoftwareScene( software_renderer, false );
+
+   const SoftwareRenderer::Features features = getSoftwareFeatures();
+   std::vector<double> cpu_times(settings.FrameNum, 0.0);
+   std::vector<size_t> pixel_nums(settings.FrameNum, 0);
+   const auto start = std::chrono::steady_clock::now();
+   for (int frame = 0; frame < settings.FrameNum; ++frame) {
+      if (!camera_path.empty()) {
+         const float t =
+            settings.FrameNum > 1 ? static_cast<float>(frame) / static_cast<float>(settings.FrameNum - 1) : 0.0f;
+         setCameraOnPath( camera_path, t );
+      }
+
+      Lights->setLightPosition( getAnimatedLightPosition(), 0 );
+      software_renderer.render( *MainCamera, *Lights, features );
+      cpu_times[frame] = software_renderer.getFrameStats().Milliseconds;
+      pixel_nums[frame] = software_renderer.getFrameStats().ShadedPixelNum;
+
+      if (encoder.isStarted() && frame % settings.ImageInterval == 0) {
+         std::vector<uint8_t> pixels = encoder.acquireBuffer();
+         const std::vector<uint8_t>& color = software_renderer.getColor();
+         std::copy( color.begin(), color.end(), pixels.begin() );
+         if (encoder.isBGR()) {
+            for (size_t i = 0; i < pixels.size(); i += 4) std::swap( pixels[i], pixels[i + 2] );
+         }
+         encoder.submit( std::move( pixels ), frame );
+      }
+      advanceAnimation();
+   }
+   const double total_time =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+   double cpu_sum = 0.0, pixel_sum = 0.0;
+   for (int frame = 0; frame < settings.FrameNum; ++frame) {
+      cpu_sum += cpu_times[frame];
+      pixel_sum += static_cast<double>(pixel_nums[frame]);
+   }
+   const double frame_num = std::max( settings.FrameNum, 1 );
+   std::cout << "Software Run: " << settings.FrameNum << " frames of " << FrameWidth << " x " << FrameHeight
+      << " on " << ThreadPool::getInstance().getThreadNum() << " threads, average CPU time " << cpu_sum / frame_num
+      << " ms, " << pixel_sum * 1.0e-3 / std::max( cpu_sum, 1.0e-3 ) << " million shaded pixels per second, "
+      << settings.FrameNum * 1000.0 / std::max( total_time, 1.0e-3 ) << " frames per second overall\n";
+   bool written = true;
+   if (encoder.isStarted()) {
+      written = encoder.finish();
+      std::cout << "Frame Capture: " << encoder.getWrittenFrameNum() << " frames written, "
+         << encoder.getStallMilliseconds() << " ms waiting for the encoder\n";
+   }
+
+   if (!settings.TimingFile.empty()) {
+      std::ofstream file(settings.TimingFile);
+      if (!file.is_open()) {
+         std::cerr << "Could not write the timings to " << settings.TimingFile << "\n";
+         return false;
+      }
+      file << "frame,cpu_ms,shaded_pixels\n";
+      for (int frame = 0; frame < settings.FrameNum; ++frame) {
+         file << frame << "," << cpu_times[frame] << "," << pixel_nums[frame] << "\n";
+      }
+   }
+   return written;
+}
+
+bool RendererGL::play()
+{
+   // Without a context, nothing below may touch GL.
+   if (!IsInitialized) return false;
+   if (Headless) return playHeadless();
+
+   if (glfwWindowShouldClose( Window )) {
+      IsInitialized = initialize();
+      if (!IsInitialized) return false;
+   }
+
+   prepareScene();
 
    while (!glfwWindowShouldClose( Window )) {
+      const auto frame_start = std::chrono::steady_clock::now();
+      if (TextureUploader) TextureUploader->beginFrame();
+      uploadLoadedWallObjects();
       render();
+      FrameTimes.emplace_back(
+         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count()
+      );
+      if (FrameTimes.size() > 240) FrameTimes.erase( FrameTimes.begin() );
 
-      LightTheta += 0.05f;
-      if (LightTheta >= 360.0f) LightTheta -= 360.0f;
+      advanceAnimation();
       glfwSwapBuffers( Window );
       glfwPollEvents();
    }
    glfwDestroyWindow( Window );
+   return true;
 }
\ No newline at end of file
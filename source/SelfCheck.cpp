@@ -0,0 +1,251 @@
+#include "SelfCheck.h"
+
+double SelfCheck::getRoundTripPSNR(
+   const std::vector<uint8_t>& reference,
+   const uint8_t* texels,
+   int width,
+   int height,
+   int channel_num,
+   std::ptrdiff_t row_stride,
+   bool is_bgr,
+   BlockCompressor::Format format
+)
+{
+   std::vector<uint8_t> blocks, decoded;
+   BlockCompressor::encode( blocks, texels, width, height, channel_num, row_stride, is_bgr, format );
+   BlockCompressor::decode( decoded, blocks.data(), width, height, format );
+   int compared_channel_num = 4;
+   if (format == BlockCompressor::Format::BC1) compared_channel_num = 3;
+   else if (format == BlockCompressor::Format::BC5) compared_channel_num = 2;
+   return BlockCompressor::getPSNR( decoded.data(), reference.data(), width * height, compared_channel_num );
+}
+
+bool SelfCheck::checkBlockCompression(const std::string& sample_directory_path)
+{
+   std::vector<std::filesystem::path> sample_paths;
+   std::error_code error;
+   for (const auto& entry : std::filesystem::directory_iterator( sample_directory_path, error )) {
+      if (entry.path().extension() == ".jpg") sample_paths.emplace_back( entry.path() );
+   }
+   if (sample_paths.empty()) {
+      std::cerr << "No samples to compress in " << sample_directory_path << "\n";
+      return false;
+   }
+   std::sort( sample_paths.begin(), sample_paths.end() );
+
+   bool passed = true;
+   for (const auto& sample_path : sample_paths) {
+      const std::shared_ptr<const Image> image = Image::load( sample_path.string() );
+      if (!image || image->isGrayscale()) {
+         passed = false;
+         continue;
+      }
+
+      // The references are tightly packed RGBA in the row order of the image, as the blocks decode.
+      const int width = image->getWidth();
+      const int height = image->getHeight();
+      const int channel_num = image->getChannelNum();
+      const int red = image->isBGR() ? 2 : 0;
+      std::vector<uint8_t> color(static_cast<size_t>(width) * height * 4);
+      for (int y = 0; y < height; ++y) {
+         const uint8_t* row = image->getBits() + static_cast<std::ptrdiff_t>(y) * image->getPitch();
+         for (int x = 0; x < width; ++x) {
+            uint8_t* texel = &color[(static_cast<size_t>(y) * width + x) * 4];
+            texel[0] = row[x * channel_num + red];
+            texel[1] = row[x * channel_num + 1];
+            texel[2] = row[x * channel_num + 2 - red];
+            texel[3] = channel_num == 4 ? row[x * channel_num + 3] : 255;
+         }
+      }
+      const double bc1 = getRoundTripPSNR(
+         color, image->getBits(), width, height, channel_num, image->getPitch(), image->isBGR(),
+         BlockCompressor::Format::BC1
+      );
+      const double bc7 = getRoundTripPSNR(
+         color, image->getBits(), width, height, channel_num, image->getPitch(), image->isBGR(),
+         BlockCompressor::Format::BC7
+      );
+
+      std::vector<float> normal_map(static_cast<size_t>(width) * height * 3);
+      NormalMapGenerator::generate(
+         normal_map.data(), image->getBits(), width, height, channel_num, image->getPitch(), image->isBGR()
+      );
+      std::vector<uint8_t> rg;
+      NormalMapGenerator::convert( rg, normal_map.data(), width, height, NormalMapGenerator::Format::RG8 );
+      std::vector<uint8_t> normals(static_cast<size_t>(width) * height * 4, 0);
+      for (size_t i = 0; i < rg.size() / 2; ++i) {
+         normals[i * 4] = rg[i * 2];
+         normals[i * 4 + 1] = rg[i * 2 + 1];
+      }
+      const double bc5 = getRoundTripPSNR(
+         normals, rg.data(), width, height, 2, static_cast<std::ptrdiff_t>(width) * 2, false,
+         BlockCompressor::Format::BC5
+      );
+
+      const bool sample_passed = bc1 >= MinBC1PSNR && bc7 >= MinBC7PSNR && bc5 >= MinBC5PSNR;
+      std::cout << "Block Compression: " << sample_path.filename().string() << " (" << width << " x " << height
+         << "), BC1 " << bc1 << " dB, BC7 " << bc7 << " dB, BC5 " << bc5 << " dB"
+         << (sample_passed ? "\n" : " below the floor\n");
+      passed = passed && sample_passed;
+   }
+   std::cout << "Block Compression: " << (passed ? "passed" : "FAILED") << " (floors BC1 " << MinBC1PSNR
+      << " dB, BC7 " << MinBC7PSNR << " dB, BC5 " << MinBC5PSNR << " dB)\n";
+   return passed;
+}
+
+bool SelfCheck::containsLight(const LightClusterBuilder& builder, int cluster, uint32_t light_index)
+{
+   const glm::uvec2& range = builder.getClusterRanges()[cluster];
+   const auto first = builder.getLightIndices().begin() + range.x;
+   return std::find( first, first + range.y, light_index ) != first + range.y;
+}
+
+bool SelfCheck::checkLightClusters()
+{
+   constexpr float near_plane = 1.0f;
+   constexpr float far_plane = 1000.0f;
+   const float tan_half_fov = std::tan( glm::radians( 30.0f ) );
+   const float aspect_ratio = 16.0f / 9.0f;
+   const glm::mat4 projection = glm::perspective( glm::radians( 60.0f ), aspect_ratio, near_plane, far_plane );
+
+   // Some of the spheres reach past the frustum on every side, and every 97th is skipped and every 499th infinite.
+   std::mt19937 generator(17);
+   std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+   std::uniform_real_distribution<float> lateral(-1.2f, 1.2f);
+   std::vector<glm::vec4> spheres_in_ec(ClusterCheckLightNum);
+   for (int i = 0; i < ClusterCheckLightNum; ++i) {
+      const float depth = 0.5f + unit( generator ) * far_plane * 1.05f;
+      spheres_in_ec[i] = glm::vec4(
+         lateral( generator ) * depth * tan_half_fov * aspect_ratio,
+         lateral( generator ) * depth * tan_half_fov,
+         -depth,
+         0.05f + unit( generator ) * unit( generator ) * 20.0f
+      );
+      if (i % 97 == 0) spheres_in_ec[i].w = -1.0f;
+      else if (i % 499 == 0) spheres_in_ec[i].w = std::numeric_limits<float>::infinity();
+   }
+
+   LightClusterBuilder builder;
+   builder.setFrustum( projection, near_plane, far_plane );
+   const auto getBuildTime = [&builder, &spheres_in_ec](InstructionSet instruction_set) {
+      const auto start = std::chrono::steady_clock::now();
+      builder.build( spheres_in_ec, instruction_set );
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   };
+
+   bool passed = true;
+   const double scalar_time = getBuildTime( InstructionSet::Scalar );
+   const std::vector<glm::uvec2> scalar_ranges = builder.getClusterRanges();
+   const std::vector<uint32_t> scalar_indices = builder.getLightIndices();
+   if (getSupportedInstructionSet() == InstructionSet::AVX2) {
+      const double avx2_time = getBuildTime( InstructionSet::AVX2 );
+      const bool identical = builder.getClusterRanges() == scalar_ranges && builder.getLightIndices() == scalar_indices;
+      std::cout << "Light Clusters: scalar " << scalar_time << " ms, AVX2 " << avx2_time << " ms, "
+         << (identical ? "identical lists\n" : "the lists differ\n");
+      passed = identical;
+   }
+   else std::cout << "Light Clusters: scalar " << scalar_time << " ms, AVX2 not supported\n";
+
+   // Points in a sphere find their cluster the way the fragment shader does, from the tile and the depth slice.
+   const glm::ivec3& grid_size = builder.getGridSize();
+   int sampled_point_num = 0, missed_point_num = 0, misplaced_light_num = 0;
+   for (int i = 0; i < ClusterCheckLightNum; ++i) {
+      const glm::vec4& sphere = spheres_in_ec[i];
+      const auto light_index = static_cast<uint32_t>(i);
+      if (sphere.w < 0.0f || std::isinf( sphere.w )) {
+         for (int cluster = 0; cluster < builder.getClusterNum(); ++cluster) {
+            if (containsLight( builder, cluster, light_index ) != (sphere.w > 0.0f)) {
+               ++misplaced_light_num;
+               break;
+            }
+         }
+         continue;
+      }
+
+      for (int n = 0; n < ClusterCheckSampleNum; ++n) {
+         const glm::vec3 direction(unit( generator ) - 0.5f, unit( generator ) - 0.5f, unit( generator ) - 0.5f);
+         if (dot( direction, direction ) < 1.0e-6f) continue;
+
+         const glm::vec3 point =
+            glm::vec3(sphere) + normalize( direction ) * sphere.w * std::cbrt( unit( generator ) ) * 0.999f;
+         const float depth = -point.z;
+         if (depth < near_plane || depth >= far_plane) continue;
+
+         const glm::vec4 clip = projection * glm::vec4(point, 1.0f);
+         const glm::vec2 ndc = glm::vec2(clip) / clip.w;
+         if (std::abs( ndc.x ) >= 1.0f || std::abs( ndc.y ) >= 1.0f) continue;
+
+         const glm::ivec2 tile = glm::min(
+            glm::ivec2((ndc * 0.5f + 0.5f) * glm::vec2(grid_size.x, grid_size.y)), glm::ivec2(grid_size) - 1
+         );
+         const int z = std::clamp(
+            static_cast<int>(std::floor( std::log( depth ) * builder.getSliceScale() + builder.getSliceBias() )),
+            0, grid_size.z - 1
+         );
+         ++sampled_point_num;
+         if (!containsLight( builder, builder.getClusterIndex( tile.x, tile.y, z ), light_index )) ++missed_point_num;
+      }
+   }
+   passed = passed && missed_point_num == 0 && misplaced_light_num == 0;
+   std::cout << "Light Clusters: " << ClusterCheckLightNum << " lights, " << builder.getLightIndices().size()
+      << " cluster entries, " << missed_point_num << " of " << sampled_point_num << " sampled points missed, "
+      << misplaced_light_num << " skipped or infinite lights misplaced\n";
+   std::cout << "Light Clusters: " << (passed ? "passed" : "FAILED") << "\n";
+   return passed;
+}
+
+bool SelfCheck::checkNormalMaps()
+{
+   std::vector<std::pair<InstructionSet, std::string>> instruction_sets = { { InstructionSet::Scalar, "scalar" } };
+   const InstructionSet supported = getSupportedInstructionSet();
+   if (supported >= InstructionSet::SSE41) instruction_sets.emplace_back( InstructionSet::SSE41, "SSE4.1" );
+   if (supported >= InstructionSet::AVX2) instruction_sets.emplace_back( InstructionSet::AVX2, "AVX2" );
+
+   // RGB rows padded to 4 bytes from the top, and BGRA rows walked from the bottom.
+   struct Layout
+   {
+      int ChannelNum;
+      bool IsBGR;
+      bool IsUpsideDown;
+   };
+   const std::array<Layout, 2> layouts = { Layout{ 3, false, false }, Layout{ 4, true, true } };
+
+   std::mt19937 generator(23);
+   std::uniform_int_distribution<int> byte(0, 255);
+   const int width = NormalMapCheckWidth;
+   const int height = NormalMapCheckHeight;
+   const size_t texel_num = static_cast<size_t>(width) * height;
+   bool passed = true;
+   for (const auto& layout : layouts) {
+      const auto pitch = static_cast<std::ptrdiff_t>((width * layout.ChannelNum + 3) / 4 * 4);
+      std::vector<uint8_t> image(static_cast<size_t>(pitch) * height);
+      for (auto& value : image) value = static_cast<uint8_t>(byte( generator ));
+      const uint8_t* first_row = layout.IsUpsideDown ? image.data() + pitch * (height - 1) : image.data();
+      const std::ptrdiff_t row_stride = layout.IsUpsideDown ? -pitch : pitch;
+
+      std::vector<float> reference(texel_num * 3);
+      NormalMapGenerator::generate(
+         reference.data(), first_row, width, height, layout.ChannelNum, row_stride, layout.IsBGR,
+         InstructionSet::Scalar, height
+      );
+      std::cout << "Normal Maps: " << layout.ChannelNum << " channels" << (layout.IsBGR ? " BGR" : "")
+         << (layout.IsUpsideDown ? " from the bottom" : "");
+      for (const auto& instruction_set : instruction_sets) {
+         for (const int band_height : { height, NormalMapCheckBandHeight }) {
+            std::vector<float> normal_map(texel_num * 3, -1.0f);
+            NormalMapGenerator::generate(
+               normal_map.data(), first_row, width, height, layout.ChannelNum, row_stride, layout.IsBGR,
+               instruction_set.first, band_height
+            );
+            const bool identical =
+               std::memcmp( normal_map.data(), reference.data(), sizeof( float ) * normal_map.size() ) == 0;
+            std::cout << ", " << instruction_set.second << " in " << (height + band_height - 1) / band_height
+               << (band_height == height ? " band " : " bands ") << (identical ? "identical" : "DIFFERS");
+            passed = passed && identical;
+         }
+      }
+      std::cout << "\n";
+   }
+   std::cout << "Normal Maps: " << (passed ? "passed" : "FAILED") << " (" << width << " x " << height << ")\n";
+   return passed;
+}
@@ -1,5 +1,33 @@
 #include "Shader.h"
 
+namespace
+{
+   constexpr uint32_t ProgramBinaryVersion = 1;
+   constexpr char ProgramBinaryMagic[4] = { 'G', 'L', 'P', 'B' };
+   constexpr uint64_t FNVOffsetBasis = 0xcbf29ce484222325ull;
+   constexpr uint64_t FNVPrime = 0x100000001b3ull;
+
+   // Followed by BinarySize bytes of the binary that glGetProgramBinary returned.
+   struct ProgramBinaryHeader
+   {
+      char Magic[4];
+      uint32_t Version;
+      uint64_t Key;
+      uint32_t BinaryFormat;
+      uint32_t BinarySize;
+   };
+
+   uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+   {
+      const auto* bytes = static_cast<const uint8_t*>(data);
+      for (size_t i = 0; i < size; ++i) {
+         hash ^= bytes[i];
+         hash *= FNVPrime;
+      }
+      return hash;
+   }
+}
+
 ShaderGL::ShaderGL() : ShaderProgram( 0 )
 {
 }
@@ -9,7 +37,7 @@ ShaderGL::~ShaderGL()
    if (ShaderProgram != 0) glDeleteProgram( ShaderProgram );
 }
 
-void ShaderGL::readShaderFile(std::string& shader_contents, const char* shader_path)
+void ShaderGL::readShaderFile(std::string& shader_contents, const char* shader_path, int include_depth)
 {
    std::ifstream file( shader_path, std::ios::in );
    if (!file.is_open()) {
@@ -17,14 +45,45 @@ void ShaderGL::readShaderFile(std::string& shader_contents, const char* shader_p
       return;
    }
 
+   // A line of #include "name" is replaced by the file of that name next to this one, before the defines are inserted,
+   // so the included chunks see the defines of the permutation too.
+   const std::filesystem::path directory_path = std::filesystem::path(shader_path).parent_path();
    std::string line;
-   while (!file.eof()) {
-      getline( file, line );
-      shader_contents.append( line + "\n" );
+   while (std::getline( file, line )) {
+      const size_t directive = line.find_first_not_of( " \t" );
+      if (directive == std::string::npos || line.compare( directive, 8, "#include" ) != 0) {
+         shader_contents.append( line ).append( "\n" );
+         continue;
+      }
+
+      const size_t name_begin = line.find( '"', directive + 8 );
+      const size_t name_end = name_begin == std::string::npos ? std::string::npos : line.find( '"', name_begin + 1 );
+      if (name_end == std::string::npos) {
+         std::cerr << "Malformed #include in " << shader_path << ": " << line << "\n";
+         continue;
+      }
+      if (include_depth >= MaxIncludeDepth) {
+         std::cerr << "Shader includes nest deeper than " << MaxIncludeDepth << " in " << shader_path << "\n";
+         continue;
+      }
+      const std::string include_path =
+         (directory_path / line.substr( name_begin + 1, name_end - name_begin - 1 )).string();
+      readShaderFile( shader_contents, include_path.c_str(), include_depth + 1 );
    }
    file.close();
 }
 
+void ShaderGL::insertDefines(std::string& shader_contents, const std::string& defines)
+{
+   if (defines.empty()) return;
+
+   // The defines have to follow the #version line, which must come first.
+   const size_t version = shader_contents.find( "#version" );
+   const size_t line_end = version == std::string::npos ? std::string::npos : shader_contents.find( '\n', version );
+   if (line_end == std::string::npos) shader_contents.insert( 0, defines );
+   else shader_contents.insert( line_end + 1, defines );
+}
+
 std::string ShaderGL::getShaderTypeString(GLenum shader_type)
 {
    switch (shader_type) {
@@ -54,13 +113,8 @@ bool ShaderGL::checkCompileError(GLenum shader_type, GLuint shader)
    return compiled == GL_TRUE;
 }
 
-GLuint ShaderGL::getCompiledShader(GLenum shader_type, const char* shader_path)
+GLuint ShaderGL::getCompiledShader(GLenum shader_type, const std::string& shader_contents)
 {
-   if (shader_path == nullptr) return 0;
-
-   std::string shader_contents;
-   readShaderFile( shader_contents, shader_path );
-
    const GLuint shader = glCreateShader( shader_type );
    const char* shader_source = shader_contents.c_str();
    glShaderSource( shader, 1, &shader_source, nullptr );
@@ -72,6 +126,105 @@ GLuint ShaderGL::getCompiledShader(GLenum shader_type, const char* shader_path)
    return shader;
 }
 
+void ShaderGL::setProgramBinaryCacheDirectory(const std::string& directory_path)
+{
+   ProgramBinaryCacheDirectory = directory_path;
+}
+
+uint64_t ShaderGL::getProgramBinaryKey(const std::vector<std::pair<GLenum, std::string>>& sources)
+{
+   if (ProgramBinaryCacheDirectory.empty()) return 0;
+
+   GLint binary_format_num = 0;
+   glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &binary_format_num );
+   if (binary_format_num <= 0) return 0;
+
+   // A binary only fits the driver that produced it, so the driver strings are part of the key.
+   uint64_t hash = hashBytes( FNVOffsetBasis, &ProgramBinaryVersion, sizeof( ProgramBinaryVersion ) );
+   for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+      const auto* value = reinterpret_cast<const char*>(glGetString( name ));
+      if (value != nullptr) hash = hashBytes( hash, value, std::strlen( value ) + 1 );
+   }
+   for (const auto& source : sources) {
+      hash = hashBytes( hash, &source.first, sizeof( source.first ) );
+      hash = hashBytes( hash, source.second.data(), source.second.size() );
+   }
+   return hash == 0 ? 1 : hash;
+}
+
+std::string ShaderGL::getProgramBinaryPath(uint64_t key)
+{
+   std::ostringstream name;
+   name << ProgramBinaryCacheDirectory << "/" << std::hex << std::setw( 16 ) << std::setfill( '0' ) << key << ".glp";
+   return name.str();
+}
+
+bool ShaderGL::loadProgramBinary(uint64_t key)
+{
+   std::ifstream file( getProgramBinaryPath( key ), std::ios::binary );
+   if (!file.is_open()) return false;
+
+   ProgramBinaryHeader header{};
+   file.read( reinterpret_cast<char*>(&header), sizeof( ProgramBinaryHeader ) );
+   if (!file || std::memcmp( header.Magic, ProgramBinaryMagic, sizeof( ProgramBinaryMagic ) ) != 0 ||
+       header.Version != ProgramBinaryVersion || header.Key != key || header.BinarySize == 0) return false;
+
+   std::vector<char> binary(header.BinarySize);
+   file.read( binary.data(), static_cast<std::streamsize>(binary.size()) );
+   if (!file) return false;
+
+   // The driver may still reject a binary, e.g. after an update that kept its version string.
+   glProgramBinary( ShaderProgram, header.BinaryFormat, binary.data(), static_cast<GLsizei>(binary.size()) );
+   GLint linked = GL_FALSE;
+   glGetProgramiv( ShaderProgram, GL_LINK_STATUS, &linked );
+   if (linked == GL_TRUE) return true;
+
+   glDeleteProgram( ShaderProgram );
+   ShaderProgram = glCreateProgram();
+   return false;
+}
+
+void ShaderGL::storeProgramBinary(uint64_t key) const
+{
+   GLint linked = GL_FALSE;
+   glGetProgramiv( ShaderProgram, GL_LINK_STATUS, &linked );
+   GLint length = 0;
+   glGetProgramiv( ShaderProgram, GL_PROGRAM_BINARY_LENGTH, &length );
+   if (linked == GL_FALSE || length <= 0) return;
+
+   ProgramBinaryHeader header{};
+   std::memcpy( header.Magic, ProgramBinaryMagic, sizeof( ProgramBinaryMagic ) );
+   header.Version = ProgramBinaryVersion;
+   header.Key = key;
+   std::vector<char> binary(length);
+   GLenum binary_format = 0;
+   glGetProgramBinary( ShaderProgram, length, &length, &binary_format, binary.data() );
+   header.BinaryFormat = binary_format;
+   header.BinarySize = static_cast<uint32_t>(length);
+
+   std::error_code error;
+   std::filesystem::create_directories( ProgramBinaryCacheDirectory, error );
+
+   const std::string file_path = getProgramBinaryPath( key );
+   const std::string temporary_path = file_path + ".tmp";
+   {
+      std::ofstream file( temporary_path, std::ios::binary | std::ios::trunc );
+      if (!file.is_open()) {
+         std::cerr << "Could not write program binary file " << temporary_path.c_str() << "\n";
+         return;
+      }
+      file.write( reinterpret_cast<const char*>(&header), sizeof( ProgramBinaryHeader ) );
+      file.write( binary.data(), static_cast<std::streamsize>(header.BinarySize) );
+      if (!file) {
+         file.close();
+         std::filesystem::remove( temporary_path, error );
+         return;
+      }
+   }
+   std::filesystem::rename( temporary_path, file_path, error );
+   if (error) std::filesystem::remove( temporary_path, error );
+}
+
 void ShaderGL::setShader(
    const char* vertex_shader_path,
    const char* fragment_shader_path,
@@ -80,23 +233,91 @@ void ShaderGL::setShader(
    const char* tessellation_evaluation_shader_path
 )
 {
-   const GLuint vertex_shader = getCompiledShader( GL_VERTEX_SHADER, vertex_shader_path );
-   const GLuint fragment_shader = getCompiledShader( GL_FRAGMENT_SHADER, fragment_shader_path );
-   const GLuint geometry_shader = getCompiledShader( GL_GEOMETRY_SHADER, geometry_shader_path );
-   const GLuint tessellation_control_shader = getCompiledShader( GL_TESS_CONTROL_SHADER, tessellation_control_shader_path );
-   const GLuint tessellation_evaluation_shader = getCompiledShader( GL_TESS_EVALUATION_SHADER, tessellation_evaluation_shader_path );
+   // Every stage is read and preprocessed first, because the final sources are what the binary is keyed by.
+   const std::pair<GLenum, const char*> stages[] = {
+      { GL_VERTEX_SHADER, vertex_shader_path },
+      { GL_FRAGMENT_SHADER, fragment_shader_path },
+      { GL_GEOMETRY_SHADER, geometry_shader_path },
+      { GL_TESS_CONTROL_SHADER, tessellation_control_shader_path },
+      { GL_TESS_EVALUATION_SHADER, tessellation_evaluation_shader_path }
+   };
+   std::vector<std::pair<GLenum, std::string>> sources;
+   for (const auto& stage : stages) {
+      if (stage.second == nullptr) continue;
+
+      std::string shader_contents;
+      readShaderFile( shader_contents, stage.second );
+      insertDefines( shader_contents, Defines );
+      sources.emplace_back( stage.first, std::move( shader_contents ) );
+   }
+
+   if (ShaderProgram != 0) glDeleteProgram( ShaderProgram );
    ShaderProgram = glCreateProgram();
-   glAttachShader( ShaderProgram, vertex_shader );
-   glAttachShader( ShaderProgram, fragment_shader );
-   if (geometry_shader != 0) glAttachShader( ShaderProgram, geometry_shader );
-   if (tessellation_control_shader != 0) glAttachShader( ShaderProgram, tessellation_control_shader );
-   if (tessellation_evaluation_shader != 0) glAttachShader( ShaderProgram, tessellation_evaluation_shader );
+   const uint64_t key = getProgramBinaryKey( sources );
+   if (key != 0) {
+      if (loadProgramBinary( key )) {
+         ++ProgramBinaryHitNum;
+         return;
+      }
+      ++ProgramBinaryMissNum;
+      glProgramParameteri( ShaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+   }
+
+   std::vector<GLuint> shaders;
+   for (const auto& source : sources) {
+      const GLuint shader = getCompiledShader( source.first, source.second );
+      if (shader == 0) continue;
+
+      glAttachShader( ShaderProgram, shader );
+      shaders.emplace_back( shader );
+   }
    glLinkProgram( ShaderProgram );
-   glDeleteShader( vertex_shader );
-   glDeleteShader( fragment_shader );
-   if (geometry_shader != 0) glDeleteShader( geometry_shader );
-   if (tessellation_control_shader != 0) glDeleteShader( tessellation_control_shader );
-   if (tessellation_evaluation_shader != 0) glDeleteShader( tessellation_evaluation_shader );
+   for (const auto& shader : shaders) glDeleteShader( shader );
+   if (key != 0) storeProgramBinary( key );
+}
+
+void ShaderGL::setShaderPermutations(
+   const char* vertex_shader_path,
+   const char* fragment_shader_path,
+   const std::vector<std::string>& feature_names
+)
+{
+   assert( feature_names.size() <= 32 );
+
+   PermutationVertexShaderPath = vertex_shader_path;
+   PermutationFragmentShaderPath = fragment_shader_path;
+   FeatureNames = feature_names;
+   Permutations.clear();
+}
+
+ShaderGL* ShaderGL::getPermutation(uint32_t features)
+{
+   const auto it = Permutations.find( features );
+   if (it != Permutations.end()) return it->second.get();
+
+   auto permutation = std::make_unique<ShaderGL>();
+   for (size_t i = 0; i < FeatureNames.size(); ++i) {
+      if (features & (1u << i)) permutation->Defines += "#define " + FeatureNames[i] + "\n";
+   }
+   permutation->setShader( PermutationVertexShaderPath.c_str(), PermutationFragmentShaderPath.c_str() );
+   permutation->setUniformLocations();
+   for (const auto& name : PermutationUniformNames) permutation->addUniformLocation( name );
+
+   ShaderGL* shader = permutation.get();
+   Permutations.emplace( features, std::move( permutation ) );
+   return shader;
+}
+
+void ShaderGL::prewarmPermutations(const std::vector<uint32_t>& feature_sets)
+{
+   for (const auto& features : feature_sets) {
+      const ShaderGL* permutation = getPermutation( features );
+
+      // Querying the link status makes the driver finish linking now, instead of stalling the first draw.
+      GLint linked = GL_FALSE;
+      glGetProgramiv( permutation->getShaderProgram(), GL_LINK_STATUS, &linked );
+      if (linked == GL_FALSE) std::cerr << "Could not link the shader permutation " << features << "\n";
+   }
 }
 
 void ShaderGL::setComputeShaders(const std::vector<const char*>& compute_shader_paths)
@@ -104,7 +325,9 @@ void ShaderGL::setComputeShaders(const std::vector<const char*>& compute_shader_
    ComputeShaderPrograms.clear();
    ComputeShaderPrograms.resize( compute_shader_paths.size() );
    for (size_t i = 0; i < ComputeShaderPrograms.size(); ++i) {
-      const GLuint compute_shader = getCompiledShader( GL_COMPUTE_SHADER, compute_shader_paths[i] );
+      std::string shader_contents;
+      readShaderFile( shader_contents, compute_shader_paths[i] );
+      const GLuint compute_shader = getCompiledShader( GL_COMPUTE_SHADER, shader_contents );
       ComputeShaderPrograms[i] = glCreateProgram();
       glAttachShader( ComputeShaderPrograms[i], compute_shader );
       glLinkProgram( ComputeShaderPrograms[i] );
@@ -112,18 +335,8 @@ void ShaderGL::setComputeShaders(const std::vector<const char*>& compute_shader_
    }
 }
 
-void ShaderGL::setBasicTransformationUniforms()
+void ShaderGL::setUniformLocations()
 {
-   Location.World = glGetUniformLocation( ShaderProgram, "WorldMatrix" );
-   Location.View = glGetUniformLocation( ShaderProgram, "ViewMatrix" );
-   Location.Projection = glGetUniformLocation( ShaderProgram, "ProjectionMatrix" );
-   Location.ModelViewProjection = glGetUniformLocation( ShaderProgram, "ModelViewProjectionMatrix" );
-}
-
-void ShaderGL::setUniformLocations(int light_num)
-{
-   setBasicTransformationUniforms();
-
    Location.MaterialEmission = glGetUniformLocation( ShaderProgram, "Material.EmissionColor" );
    Location.MaterialAmbient = glGetUniformLocation( ShaderProgram, "Material.AmbientColor" );
    Location.MaterialDiffuse = glGetUniformLocation( ShaderProgram, "Material.DiffuseColor" );
@@ -132,48 +345,42 @@ void ShaderGL::setUniformLocations(int light_num)
 
    Location.Texture[0] = glGetUniformLocation( ShaderProgram, "BaseTexture" );
    Location.Texture[1] = glGetUniformLocation( ShaderProgram, "NormalMap" );
-   Location.UseTexture = glGetUniformLocation( ShaderProgram, "UseTexture" );
+   Location.Texture[2] = glGetUniformLocation( ShaderProgram, "NormalLengthMap" );
 
-   Location.UseLight = glGetUniformLocation( ShaderProgram, "UseLight" );
-   Location.LightNum = glGetUniformLocation( ShaderProgram, "LightNum" );
-   Location.GlobalAmbient = glGetUniformLocation( ShaderProgram, "GlobalAmbient" );
-
-   Location.Lights.resize( light_num );
-   for (int i = 0; i < light_num; ++i) {
-      Location.Lights[i].LightSwitch = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].LightSwitch").c_str() );
-      Location.Lights[i].LightPosition = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].Position").c_str() );
-      Location.Lights[i].LightAmbient = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].AmbientColor").c_str() );
-      Location.Lights[i].LightDiffuse = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].DiffuseColor").c_str() );
-      Location.Lights[i].LightSpecular = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpecularColor").c_str() );
-      Location.Lights[i].SpotlightDirection = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpotlightDirection").c_str() );
-      Location.Lights[i].SpotlightCutoffAngle = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpotlightCutoffAngle").c_str() );
-      Location.Lights[i].SpotlightFeather = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].SpotlightFeather").c_str() );
-      Location.Lights[i].LightFallOffRadius = glGetUniformLocation( ShaderProgram, std::string("Lights[" + std::to_string( i ) + "].FallOffRadius").c_str() );
+   // The texture units never change, so they are set once here instead of with every draw.
+   for (GLint unit = 0; unit < 3; ++unit) {
+      glProgramUniform1i( ShaderProgram, Location.Texture[unit], unit );
    }
 }
 
-void ShaderGL::addUniformLocation(const std::string& name)
+ShaderGL::UniformHandle ShaderGL::getOrAddUniformHandle(const std::string& name)
 {
-   CustomLocations[name] = glGetUniformLocation( ShaderProgram, name.c_str() );
-}
+   const auto it = CustomHandles.find( name );
+   if (it != CustomHandles.end()) return it->second;
 
-void ShaderGL::addUniformLocationToComputeShader(const std::string& name, int shader_index)
-{
-   CustomLocations[name] = glGetUniformLocation( ComputeShaderPrograms[shader_index], name.c_str() );
+   const auto handle = static_cast<UniformHandle>(CustomLocations.size());
+   CustomLocations.emplace_back( -1 );
+   CustomHandles.emplace( name, handle );
+   return handle;
 }
 
-void ShaderGL::transferBasicTransformationUniforms(const glm::mat4& to_world, const CameraGL* camera, bool use_texture) const
+ShaderGL::UniformHandle ShaderGL::addUniformLocation(const std::string& name)
 {
-   const glm::mat4 view = camera->getViewMatrix();
-   const glm::mat4 projection = camera->getProjectionMatrix();
-   const glm::mat4 model_view_projection = projection * view * to_world;
-   glUniformMatrix4fv( Location.World, 1, GL_FALSE, &to_world[0][0] );
-   glUniformMatrix4fv( Location.View, 1, GL_FALSE, &view[0][0] );
-   glUniformMatrix4fv( Location.Projection, 1, GL_FALSE, &projection[0][0] );
-   glUniformMatrix4fv( Location.ModelViewProjection, 1, GL_FALSE, &model_view_projection[0][0] );
+   const bool is_new = CustomHandles.find( name ) == CustomHandles.end();
+   const UniformHandle handle = getOrAddUniformHandle( name );
+   if (ShaderProgram != 0) CustomLocations[handle] = glGetUniformLocation( ShaderProgram, name.c_str() );
 
-   for (const auto& texture : Location.Texture) {
-      glUniform1i( texture.second, texture.first );
+   // Permutations compiled later look the name up as well.
+   if (is_new && !FeatureNames.empty()) {
+      PermutationUniformNames.emplace_back( name );
+      for (auto& permutation : Permutations) permutation.second->addUniformLocation( name );
    }
-   glUniform1i( Location.UseTexture, use_texture ? 1 : 0 );
+   return handle;
+}
+
+ShaderGL::UniformHandle ShaderGL::addUniformLocationToComputeShader(const std::string& name, int shader_index)
+{
+   const UniformHandle handle = getOrAddUniformHandle( name );
+   CustomLocations[handle] = glGetUniformLocation( ComputeShaderPrograms[shader_index], name.c_str() );
+   return handle;
 }
\ No newline at end of file
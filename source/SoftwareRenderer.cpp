@@ -0,0 +1,1314 @@
+#include "SoftwareRenderer.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(USE_X86_SIMD) && defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+   constexpr float HalfPi = 1.57079632679489661923f;
+
+   // The pixel of every lane in a block: two 2x2 quads side by side, each from the bottom left to the top right.
+   constexpr int LaneX[8] = { 0, 1, 0, 1, 2, 3, 2, 3 };
+   constexpr int LaneY[8] = { 0, 0, 1, 1, 0, 0, 1, 1 };
+
+   // The tile buffers keep the 8 pixels of a 4x2 block together, so both passes load and store them in one go.
+   inline int getBlockOffset(int x, int y)
+   {
+      return ((y / 2) * (SoftwareRenderer::TileSize / 4) + x / 4) * 8;
+   }
+
+   inline int getLane(int x, int y)
+   {
+      return (x & 2) * 2 + (y & 1) * 2 + (x & 1);
+   }
+
+   inline float evaluatePlane(const glm::vec3& plane, float x, float y)
+   {
+      return plane.x * x + plane.y * y + plane.z;
+   }
+
+   // v * m in GLSL, where t, b and n are the columns of m
+   inline glm::vec3 toTangentSpace(const glm::vec3& v, const glm::vec3& t, const glm::vec3& b, const glm::vec3& n)
+   {
+      return { dot( v, t ), dot( v, b ), dot( v, n ) };
+   }
+
+   inline uint32_t packColor(const glm::vec4& color)
+   {
+      uint32_t texel = 0;
+      for (int c = 0; c < 4; ++c) {
+         texel |= static_cast<uint32_t>(std::clamp( color[c], 0.0f, 1.0f ) * 255.0f + 0.5f) << (8 * c);
+      }
+      return texel;
+   }
+
+   inline uint32_t readTexel(const uint8_t* texels, size_t byte_offset)
+   {
+      uint32_t texel;
+      std::memcpy( &texel, texels + byte_offset, sizeof( texel ) );
+      return texel;
+   }
+
+#ifdef USE_X86_SIMD
+   struct Vec3x8
+   {
+      __m256 X;
+      __m256 Y;
+      __m256 Z;
+   };
+
+   // The levels that the four lanes of a quad sample, and the weight of the second one.
+   struct QuadLevels
+   {
+      int Offset[2];
+      int Width[2];
+      int Height[2];
+      float Weight;
+   };
+
+   TARGET_AVX2 inline __m256 evaluatePlaneAVX2(const glm::vec3& plane, __m256 x, __m256 y)
+   {
+      return _mm256_add_ps(
+         _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( plane.x ), x ), _mm256_mul_ps( _mm256_set1_ps( plane.y ), y ) ),
+         _mm256_set1_ps( plane.z )
+      );
+   }
+
+   TARGET_AVX2 inline Vec3x8 interpolateAVX2(const glm::vec3* planes, __m256 x, __m256 y, __m256 w)
+   {
+      return {
+         _mm256_mul_ps( evaluatePlaneAVX2( planes[0], x, y ), w ),
+         _mm256_mul_ps( evaluatePlaneAVX2( planes[1], x, y ), w ),
+         _mm256_mul_ps( evaluatePlaneAVX2( planes[2], x, y ), w )
+      };
+   }
+
+   TARGET_AVX2 inline Vec3x8 broadcastAVX2(const glm::vec3& v)
+   {
+      return { _mm256_set1_ps( v.x ), _mm256_set1_ps( v.y ), _mm256_set1_ps( v.z ) };
+   }
+
+   TARGET_AVX2 inline Vec3x8 addAVX2(const Vec3x8& a, const Vec3x8& b)
+   {
+      return { _mm256_add_ps( a.X, b.X ), _mm256_add_ps( a.Y, b.Y ), _mm256_add_ps( a.Z, b.Z ) };
+   }
+
+   TARGET_AVX2 inline Vec3x8 subtractAVX2(const Vec3x8& a, const Vec3x8& b)
+   {
+      return { _mm256_sub_ps( a.X, b.X ), _mm256_sub_ps( a.Y, b.Y ), _mm256_sub_ps( a.Z, b.Z ) };
+   }
+
+   TARGET_AVX2 inline __m256 dotAVX2(const Vec3x8& a, const Vec3x8& b)
+   {
+      return _mm256_add_ps(
+         _mm256_add_ps( _mm256_mul_ps( a.X, b.X ), _mm256_mul_ps( a.Y, b.Y ) ), _mm256_mul_ps( a.Z, b.Z )
+      );
+   }
+
+   TARGET_AVX2 inline Vec3x8 normalizeAVX2(const Vec3x8& v)
+   {
+      const __m256 inverse_length = _mm256_div_ps( _mm256_set1_ps( 1.0f ), _mm256_sqrt_ps( dotAVX2( v, v ) ) );
+      return { _mm256_mul_ps( v.X, inverse_length ), _mm256_mul_ps( v.Y, inverse_length ),
+               _mm256_mul_ps( v.Z, inverse_length ) };
+   }
+
+   TARGET_AVX2 inline Vec3x8 toTangentSpaceAVX2(const Vec3x8& v, const Vec3x8& t, const Vec3x8& b, const Vec3x8& n)
+   {
+      return { dotAVX2( v, t ), dotAVX2( v, b ), dotAVX2( v, n ) };
+   }
+
+   // x = m * 2^e with m in [sqrt(2) / 2, sqrt(2)), and log2(m) = 2 / ln(2) * atanh(s) for s = (m - 1) / (m + 1), whose
+   // odd series is accurate to about 1e-7 here. x must be positive and normal.
+   TARGET_AVX2 inline __m256 log2AVX2(__m256 x)
+   {
+      const __m256i bits = _mm256_castps_si256( x );
+      __m256 exponent = _mm256_cvtepi32_ps(
+         _mm256_sub_epi32( _mm256_srli_epi32( bits, 23 ), _mm256_set1_epi32( 127 ) )
+      );
+      __m256 m = _mm256_castsi256_ps(
+         _mm256_or_si256( _mm256_and_si256( bits, _mm256_set1_epi32( 0x007FFFFF ) ), _mm256_set1_epi32( 0x3F800000 ) )
+      );
+      const __m256 is_large = _mm256_cmp_ps( m, _mm256_set1_ps( 1.41421356f ), _CMP_GT_OQ );
+      m = _mm256_blendv_ps( m, _mm256_mul_ps( m, _mm256_set1_ps( 0.5f ) ), is_large );
+      exponent = _mm256_add_ps( exponent, _mm256_and_ps( is_large, _mm256_set1_ps( 1.0f ) ) );
+
+      const __m256 one = _mm256_set1_ps( 1.0f );
+      const __m256 s = _mm256_div_ps( _mm256_sub_ps( m, one ), _mm256_add_ps( m, one ) );
+      const __m256 s2 = _mm256_mul_ps( s, s );
+      __m256 series = _mm256_set1_ps( 1.0f / 9.0f );
+      series = _mm256_add_ps( _mm256_mul_ps( series, s2 ), _mm256_set1_ps( 1.0f / 7.0f ) );
+      series = _mm256_add_ps( _mm256_mul_ps( series, s2 ), _mm256_set1_ps( 1.0f / 5.0f ) );
+      series = _mm256_add_ps( _mm256_mul_ps( series, s2 ), _mm256_set1_ps( 1.0f / 3.0f ) );
+      series = _mm256_add_ps( _mm256_mul_ps( series, s2 ), one );
+      return _mm256_add_ps(
+         exponent, _mm256_mul_ps( _mm256_mul_ps( series, s ), _mm256_set1_ps( 2.88539008f ) )
+      );
+   }
+
+   // 2^x = 2^i * 2^f with i = round(x) and f in [-0.5, 0.5], where the Taylor series of 2^f to the 6th power is
+   // accurate to about 2e-7.
+   TARGET_AVX2 inline __m256 exp2AVX2(__m256 x)
+   {
+      x = _mm256_min_ps( _mm256_max_ps( x, _mm256_set1_ps( -126.0f ) ), _mm256_set1_ps( 126.0f ) );
+      const __m256 i = _mm256_round_ps( x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC );
+      const __m256 f = _mm256_sub_ps( x, i );
+      __m256 p = _mm256_set1_ps( 1.5403530e-4f );
+      p = _mm256_add_ps( _mm256_mul_ps( p, f ), _mm256_set1_ps( 1.3333558e-3f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, f ), _mm256_set1_ps( 9.6181291e-3f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, f ), _mm256_set1_ps( 5.5504109e-2f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, f ), _mm256_set1_ps( 2.4022651e-1f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, f ), _mm256_set1_ps( 6.9314718e-1f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, f ), _mm256_set1_ps( 1.0f ) );
+      const __m256i scale = _mm256_slli_epi32(
+         _mm256_add_epi32( _mm256_cvtps_epi32( i ), _mm256_set1_epi32( 127 ) ), 23
+      );
+      return _mm256_mul_ps( p, _mm256_castsi256_ps( scale ) );
+   }
+
+   // pow(x, y) for x >= 0 and y > 0, which is 0 at x = 0
+   TARGET_AVX2 inline __m256 powAVX2(__m256 x, __m256 y)
+   {
+      const __m256 is_positive = _mm256_cmp_ps( x, _mm256_set1_ps( std::numeric_limits<float>::min() ), _CMP_GE_OQ );
+      const __m256 safe_x = _mm256_max_ps( x, _mm256_set1_ps( std::numeric_limits<float>::min() ) );
+      return _mm256_and_ps( is_positive, exp2AVX2( _mm256_mul_ps( y, log2AVX2( safe_x ) ) ) );
+   }
+
+   // acos(x) for x in [0, 1] from Abramowitz and Stegun 4.4.46, accurate to about 2e-8 before rounding
+   TARGET_AVX2 inline __m256 acosAVX2(__m256 x)
+   {
+      x = _mm256_min_ps( _mm256_max_ps( x, _mm256_setzero_ps() ), _mm256_set1_ps( 1.0f ) );
+      __m256 p = _mm256_set1_ps( -0.0012624911f );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x ), _mm256_set1_ps( 0.0066700901f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x ), _mm256_set1_ps( -0.0170881256f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x ), _mm256_set1_ps( 0.0308918810f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x ), _mm256_set1_ps( -0.0501743046f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x ), _mm256_set1_ps( 0.0889789874f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x ), _mm256_set1_ps( -0.2145988016f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x ), _mm256_set1_ps( 1.5707963050f ) );
+      return _mm256_mul_ps( _mm256_sqrt_ps( _mm256_sub_ps( _mm256_set1_ps( 1.0f ), x ) ), p );
+   }
+
+   // cos(x) for x in [0, pi / 2] from its Taylor series to the 10th power, accurate to about 5e-7
+   TARGET_AVX2 inline __m256 cosAVX2(__m256 x)
+   {
+      const __m256 x2 = _mm256_mul_ps( x, x );
+      __m256 p = _mm256_set1_ps( -1.0f / 3628800.0f );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x2 ), _mm256_set1_ps( 1.0f / 40320.0f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x2 ), _mm256_set1_ps( -1.0f / 720.0f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x2 ), _mm256_set1_ps( 1.0f / 24.0f ) );
+      p = _mm256_add_ps( _mm256_mul_ps( p, x2 ), _mm256_set1_ps( -0.5f ) );
+      return _mm256_add_ps( _mm256_mul_ps( p, x2 ), _mm256_set1_ps( 1.0f ) );
+   }
+
+   // The texel index of a coordinate wrapped into [0, size) for GL_REPEAT. Helper lanes outside the triangle may have
+   // no finite coordinates at all, and rounding may wrap a huge one onto the size itself, so those lanes get 0 instead
+   // of an index that the gathers would read out of bounds with.
+   TARGET_AVX2 inline __m256i getWrappedIndexAVX2(__m256 coordinate, __m256 size)
+   {
+      const __m256 wrapped =
+         _mm256_sub_ps( coordinate, _mm256_mul_ps( size, _mm256_floor_ps( _mm256_div_ps( coordinate, size ) ) ) );
+      const __m256 in_range = _mm256_and_ps(
+         _mm256_cmp_ps( wrapped, _mm256_setzero_ps(), _CMP_GE_OQ ), _mm256_cmp_ps( wrapped, size, _CMP_LT_OQ )
+      );
+      return _mm256_cvttps_epi32( _mm256_and_ps( wrapped, in_range ) );
+   }
+
+   // GL_LINEAR with GL_REPEAT from the level of every lane, in the same order of operations as sampleLevel. The
+   // channels are either 4 x 8 bits or 2 x 16 bits of a texel.
+   TARGET_AVX2 void sampleLevelsAVX2(
+      __m256* channels,
+      const uint32_t* texels,
+      __m256i offset,
+      __m256i width,
+      __m256i height,
+      __m256 u,
+      __m256 v,
+      bool is_16_bit
+   )
+   {
+      const __m256 half = _mm256_set1_ps( 0.5f );
+      const __m256 width_f = _mm256_cvtepi32_ps( width );
+      const __m256 height_f = _mm256_cvtepi32_ps( height );
+      const __m256 su = _mm256_sub_ps( _mm256_mul_ps( u, width_f ), half );
+      const __m256 sv = _mm256_sub_ps( _mm256_mul_ps( v, height_f ), half );
+      const __m256 fx = _mm256_floor_ps( su );
+      const __m256 fy = _mm256_floor_ps( sv );
+      const __m256 ax = _mm256_sub_ps( su, fx );
+      const __m256 ay = _mm256_sub_ps( sv, fy );
+      const __m256i x0 = getWrappedIndexAVX2( fx, width_f );
+      const __m256i y0 = getWrappedIndexAVX2( fy, height_f );
+      __m256i x1 = _mm256_add_epi32( x0, _mm256_set1_epi32( 1 ) );
+      __m256i y1 = _mm256_add_epi32( y0, _mm256_set1_epi32( 1 ) );
+      x1 = _mm256_andnot_si256( _mm256_cmpeq_epi32( x1, width ), x1 );
+      y1 = _mm256_andnot_si256( _mm256_cmpeq_epi32( y1, height ), y1 );
+      const __m256i row0 = _mm256_add_epi32( offset, _mm256_mullo_epi32( y0, width ) );
+      const __m256i row1 = _mm256_add_epi32( offset, _mm256_mullo_epi32( y1, width ) );
+      const auto* base = reinterpret_cast<const int*>(texels);
+      const __m256i t00 = _mm256_i32gather_epi32( base, _mm256_add_epi32( row0, x0 ), 4 );
+      const __m256i t10 = _mm256_i32gather_epi32( base, _mm256_add_epi32( row0, x1 ), 4 );
+      const __m256i t01 = _mm256_i32gather_epi32( base, _mm256_add_epi32( row1, x0 ), 4 );
+      const __m256i t11 = _mm256_i32gather_epi32( base, _mm256_add_epi32( row1, x1 ), 4 );
+
+      const int channel_num = is_16_bit ? 2 : 4;
+      const int bits = is_16_bit ? 16 : 8;
+      const __m256i mask = _mm256_set1_epi32( is_16_bit ? 0xFFFF : 0xFF );
+      const __m256 scale = _mm256_set1_ps( is_16_bit ? 1.0f / 65535.0f : 1.0f / 255.0f );
+      for (int c = 0; c < channel_num; ++c) {
+         const __m128i shift = _mm_cvtsi32_si128( bits * c );
+         const __m256 c00 = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srl_epi32( t00, shift ), mask ) );
+         const __m256 c10 = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srl_epi32( t10, shift ), mask ) );
+         const __m256 c01 = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srl_epi32( t01, shift ), mask ) );
+         const __m256 c11 = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srl_epi32( t11, shift ), mask ) );
+         const __m256 bottom = _mm256_add_ps( c00, _mm256_mul_ps( _mm256_sub_ps( c10, c00 ), ax ) );
+         const __m256 top = _mm256_add_ps( c01, _mm256_mul_ps( _mm256_sub_ps( c11, c01 ), ax ) );
+         const __m256 texel = _mm256_add_ps( bottom, _mm256_mul_ps( _mm256_sub_ps( top, bottom ), ay ) );
+         channels[c] = _mm256_mul_ps( texel, scale );
+      }
+   }
+
+   // GL_LINEAR_MIPMAP_LINEAR, where the first four lanes take the levels of the first quad and the others those of
+   // the second one.
+   TARGET_AVX2 void sampleAVX2(
+      __m256* channels,
+      const uint32_t* texels,
+      const QuadLevels* quads,
+      bool is_16_bit,
+      __m256 u,
+      __m256 v
+   )
+   {
+      const int channel_num = is_16_bit ? 2 : 4;
+      __m256 first[4];
+      sampleLevelsAVX2(
+         first, texels,
+         _mm256_setr_epi32(
+            quads[0].Offset[0], quads[0].Offset[0], quads[0].Offset[0], quads[0].Offset[0],
+            quads[1].Offset[0], quads[1].Offset[0], quads[1].Offset[0], quads[1].Offset[0]
+         ),
+         _mm256_setr_epi32(
+            quads[0].Width[0], quads[0].Width[0], quads[0].Width[0], quads[0].Width[0],
+            quads[1].Width[0], quads[1].Width[0], quads[1].Width[0], quads[1].Width[0]
+         ),
+         _mm256_setr_epi32(
+            quads[0].Height[0], quads[0].Height[0], quads[0].Height[0], quads[0].Height[0],
+            quads[1].Height[0], quads[1].Height[0], quads[1].Height[0], quads[1].Height[0]
+         ),
+         u, v, is_16_bit
+      );
+      if (quads[0].Weight == 0.0f && quads[1].Weight == 0.0f) {
+         for (int c = 0; c < channel_num; ++c) channels[c] = first[c];
+         return;
+      }
+
+      __m256 second[4];
+      sampleLevelsAVX2(
+         second, texels,
+         _mm256_setr_epi32(
+            quads[0].Offset[1], quads[0].Offset[1], quads[0].Offset[1], quads[0].Offset[1],
+            quads[1].Offset[1], quads[1].Offset[1], quads[1].Offset[1], quads[1].Offset[1]
+         ),
+         _mm256_setr_epi32(
+            quads[0].Width[1], quads[0].Width[1], quads[0].Width[1], quads[0].Width[1],
+            quads[1].Width[1], quads[1].Width[1], quads[1].Width[1], quads[1].Width[1]
+         ),
+         _mm256_setr_epi32(
+            quads[0].Height[1], quads[0].Height[1], quads[0].Height[1], quads[0].Height[1],
+            quads[1].Height[1], quads[1].Height[1], quads[1].Height[1], quads[1].Height[1]
+         ),
+         u, v, is_16_bit
+      );
+      const __m256 weight = _mm256_setr_ps(
+         quads[0].Weight, quads[0].Weight, quads[0].Weight, quads[0].Weight,
+         quads[1].Weight, quads[1].Weight, quads[1].Weight, quads[1].Weight
+      );
+      for (int c = 0; c < channel_num; ++c) {
+         channels[c] = _mm256_add_ps( first[c], _mm256_mul_ps( _mm256_sub_ps( second[c], first[c] ), weight ) );
+      }
+   }
+#endif
+}
+
+SoftwareRenderer::SoftwareRenderer(const glm::ivec2& size) :
+   Size( 0, 0 ), TileGridSize( 0, 0 ), ClearColor( 0.0f ), GlobalAmbient( 0.0f ), VertexLightNum( 0 ),
+   VertexLightPositions{}
+{
+   setSize( size );
+}
+
+void SoftwareRenderer::setSize(const glm::ivec2& size)
+{
+   Size = glm::max( size, glm::ivec2(1) );
+   TileGridSize = (Size + TileSize - 1) / TileSize;
+   Color.assign( static_cast<size_t>(Size.x) * Size.y * 4, 0 );
+   Bins.assign( static_cast<size_t>(TileGridSize.x) * TileGridSize.y, {} );
+}
+
+int SoftwareRenderer::addMesh(
+   const std::vector<glm::vec3>& vertices,
+   const std::vector<glm::vec3>& normals,
+   const std::vector<glm::vec2>& textures,
+   const std::vector<glm::vec3>& tangents
+)
+{
+   assert( normals.size() == vertices.size() && textures.size() == vertices.size() );
+   assert( tangents.size() == vertices.size() );
+
+   std::vector<Vertex> mesh(vertices.size());
+   for (size_t i = 0; i < vertices.size(); ++i) mesh[i] = { vertices[i], normals[i], textures[i], tangents[i] };
+   Meshes.emplace_back( std::move( mesh ) );
+   return static_cast<int>(Meshes.size()) - 1;
+}
+
+int SoftwareRenderer::addTexture(const ObjectGL::NormalMapAsset& asset)
+{
+   if (asset.LevelNum <= 0 || static_cast<int>(asset.BaseTexture.size()) != asset.LevelNum ||
+       static_cast<int>(asset.NormalMap.size()) != asset.LevelNum ||
+       static_cast<int>(asset.NormalLength.size()) != asset.LevelNum) {
+      std::cerr << "Could not add a texture without all of its levels\n";
+      return -1;
+   }
+
+   Texture texture;
+   texture.Width = asset.Width;
+   texture.Height = asset.Height;
+   texture.IsTwoChannel = NormalMapGenerator::isTwoChannel( asset.NormalMapFormat );
+   int texel_num = 0;
+   for (int level = 0; level < asset.LevelNum; ++level) {
+      const int width = MipmapBuilder::getLevelSize( asset.Width, level );
+      const int height = MipmapBuilder::getLevelSize( asset.Height, level );
+      texture.Levels.push_back( { texel_num, width, height } );
+      texel_num += width * height;
+   }
+   texture.Color.resize( texel_num );
+   texture.NormalXY.resize( texel_num );
+   texture.NormalZLength.resize( texel_num );
+
+   // Every format ends up as the texel values a GPU filters: RGBA8 colors and 16-bit unsigned normalized normals.
+   ThreadPool::getInstance().parallelFor(
+      0, asset.LevelNum, 1, [&texture, &asset](int first, int last) {
+         std::vector<uint8_t> decoded;
+         for (int level = first; level < last; ++level) {
+            const TextureLevel& info = texture.Levels[level];
+            const int level_texel_num = info.Width * info.Height;
+
+            const uint8_t* colors = asset.BaseTexture[level];
+            bool is_bgr = asset.IsBaseTextureBGR;
+            if (asset.BaseTextureCompression) {
+               BlockCompressor::decode( decoded, colors, info.Width, info.Height, *asset.BaseTextureCompression );
+               colors = decoded.data();
+               is_bgr = false;
+            }
+            uint32_t* color = texture.Color.data() + info.Offset;
+            for (int i = 0; i < level_texel_num; ++i) {
+               const uint8_t* texel = colors + 4 * static_cast<size_t>(i);
+               color[i] = static_cast<uint32_t>(texel[is_bgr ? 2 : 0]) | static_cast<uint32_t>(texel[1]) << 8 |
+                  static_cast<uint32_t>(texel[is_bgr ? 0 : 2]) << 16 | static_cast<uint32_t>(texel[3]) << 24;
+            }
+
+            const uint8_t* normals = asset.NormalMap[level];
+            if (asset.NormalMapFormat == NormalMapGenerator::Format::BC5) {
+               BlockCompressor::decode( decoded, normals, info.Width, info.Height, BlockCompressor::Format::BC5 );
+               normals = decoded.data();
+            }
+            uint32_t* normal_xy = texture.NormalXY.data() + info.Offset;
+            uint32_t* normal_z_length = texture.NormalZLength.data() + info.Offset;
+            for (int i = 0; i < level_texel_num; ++i) {
+               const auto index = static_cast<size_t>(i);
+               uint32_t x = 0, y = 0, z = 0;
+               switch (asset.NormalMapFormat) {
+                  case NormalMapGenerator::Format::RGB32F: {
+                     float n[3];
+                     std::memcpy( n, normals + index * sizeof( n ), sizeof( n ) );
+                     x = glm::packUnorm1x16( n[0] );
+                     y = glm::packUnorm1x16( n[1] );
+                     z = glm::packUnorm1x16( n[2] );
+                  } break;
+                  case NormalMapGenerator::Format::RGB16F: {
+                     uint16_t n[3];
+                     std::memcpy( n, normals + index * sizeof( n ), sizeof( n ) );
+                     x = glm::packUnorm1x16( glm::unpackHalf1x16( n[0] ) );
+                     y = glm::packUnorm1x16( glm::unpackHalf1x16( n[1] ) );
+                     z = glm::packUnorm1x16( glm::unpackHalf1x16( n[2] ) );
+                  } break;
+                  case NormalMapGenerator::Format::RGB10A2: {
+                     const glm::vec4 n = glm::unpackUnorm3x10_1x2( readTexel( normals, index * 4 ) );
+                     x = glm::packUnorm1x16( n.x );
+                     y = glm::packUnorm1x16( n.y );
+                     z = glm::packUnorm1x16( n.z );
+                  } break;
+                  case NormalMapGenerator::Format::RG16: {
+                     const uint32_t n = readTexel( normals, index * 4 );
+                     x = n & 0xFFFFu;
+                     y = n >> 16;
+                  } break;
+                  case NormalMapGenerator::Format::RG8:
+                     x = normals[index * 2] * 257u;
+                     y = normals[index * 2 + 1] * 257u;
+                     break;
+                  case NormalMapGenerator::Format::BC5:
+                     x = normals[index * 4] * 257u;
+                     y = normals[index * 4 + 1] * 257u;
+                     break;
+               }
+               normal_xy[i] = x | y << 16;
+               normal_z_length[i] = z | static_cast<uint32_t>(asset.NormalLength[level][index] * 257u) << 16;
+            }
+         }
+      }
+   );
+   Textures.emplace_back( std::move( texture ) );
+   return static_cast<int>(Textures.size()) - 1;
+}
+
+void SoftwareRenderer::draw(
+   int mesh,
+   int texture,
+   const glm::mat4& world_matrix,
+   const ObjectGL::MaterialBlock& material
+)
+{
+   assert( 0 <= mesh && mesh < static_cast<int>(Meshes.size()) );
+   assert( 0 <= texture && texture < static_cast<int>(Textures.size()) );
+   Draws.push_back( { mesh, texture, world_matrix, material } );
+}
+
+void SoftwareRenderer::prepareLights(const LightGL& lights, const Features& features)
+{
+   const LightGL::LightBlockHeader header = lights.getLightBlockHeader();
+   GlobalAmbient = header.GlobalAmbient;
+   ShadingLights.clear();
+   VertexLightNum = features.UseLight ? std::min( header.LightNum, MaxVertexLights ) : 0;
+   if (!features.UseLight) return;
+
+   for (int i = 0; i < header.LightNum; ++i) {
+      const LightGL::LightBlockElement element = lights.getLightBlockElement( i );
+      if (i < MaxVertexLights) VertexLightPositions[i] = element.Position;
+      if (element.LightSwitch == 0) continue;
+
+      ShadingLight light{};
+      light.Index = i;
+      light.IsPointLight = element.Position.w != 0.0f;
+      light.IsSpotlight = element.SpotlightCutoffAngle < 180.0f;
+      light.Position = element.Position;
+      light.AmbientColor = element.AmbientColor;
+      light.DiffuseColor = element.DiffuseColor;
+      light.SpecularColor = element.SpecularColor;
+      light.SpotlightDirection = element.SpotlightDirection;
+      light.SquaredRadius = element.FallOffRadius * element.FallOffRadius;
+      light.CutoffAngle = glm::radians( std::clamp( element.SpotlightCutoffAngle, 0.0f, 90.0f ) );
+      light.CosCutoffAngle = std::cos( light.CutoffAngle );
+      light.FeatherThreshold = HalfPi * (1.0f - element.SpotlightFeather);
+      ShadingLights.emplace_back( light );
+   }
+}
+
+void SoftwareRenderer::processVertex(
+   ClipVertex& out,
+   const Vertex& vertex,
+   const Draw& draw,
+   const glm::mat4& view_projection,
+   const glm::vec3& eye_position
+) const
+{
+   const glm::mat3 world_matrix(draw.WorldMatrix);
+   const glm::vec3 position_in_mc = glm::vec3(draw.WorldMatrix * glm::vec4(vertex.Position, 1.0f));
+   const glm::vec3 normal_in_mc = normalize( world_matrix * vertex.Normal );
+   const glm::vec3 tangent_in_mc = normalize( world_matrix * vertex.Tangent );
+   const glm::vec3 binormal_in_mc = cross( normal_in_mc, tangent_in_mc );
+
+   float* varyings = out.Varyings.data();
+   std::fill( out.Varyings.begin(), out.Varyings.end(), 0.0f );
+   std::copy( &position_in_mc[0], &position_in_mc[0] + 3, varyings + PositionVarying );
+   std::copy( &vertex.TexCoord[0], &vertex.TexCoord[0] + 2, varyings + TexCoordVarying );
+   std::copy( &normal_in_mc[0], &normal_in_mc[0] + 3, varyings + NormalVarying );
+   std::copy( &tangent_in_mc[0], &tangent_in_mc[0] + 3, varyings + TangentVarying );
+   std::copy( &binormal_in_mc[0], &binormal_in_mc[0] + 3, varyings + BinormalVarying );
+
+   const glm::vec3 view_vector_in_tc =
+      toTangentSpace( eye_position - position_in_mc, tangent_in_mc, binormal_in_mc, normal_in_mc );
+   std::copy( &view_vector_in_tc[0], &view_vector_in_tc[0] + 3, varyings + ViewVectorVarying );
+   for (int i = 0; i < VertexLightNum; ++i) {
+      const glm::vec4& light_position_in_mc = VertexLightPositions[i];
+      const glm::vec3 light_vector = light_position_in_mc.w != 0.0f ?
+         glm::vec3(light_position_in_mc) - position_in_mc : glm::vec3(light_position_in_mc);
+      const glm::vec3 light_vector_in_tc = toTangentSpace( light_vector, tangent_in_mc, binormal_in_mc, normal_in_mc );
+      std::copy( &light_vector_in_tc[0], &light_vector_in_tc[0] + 3, varyings + LightVectorVarying + 3 * i );
+   }
+
+   out.Position = view_projection * glm::vec4(position_in_mc, 1.0f);
+}
+
+void SoftwareRenderer::setupTriangle(
+   std::vector<Triangle>& triangles,
+   const std::array<const ClipVertex*, 3>& vertices,
+   int draw_index
+) const
+{
+   // The setup runs in double, so that far away vertices of clipped triangles keep their precision.
+   double x[3], y[3], z[3], inverse_w[3];
+   for (int i = 0; i < 3; ++i) {
+      const glm::vec4& position = vertices[i]->Position;
+      inverse_w[i] = 1.0 / static_cast<double>(position.w);
+      x[i] = (static_cast<double>(position.x) * inverse_w[i] * 0.5 + 0.5) * Size.x;
+      y[i] = (static_cast<double>(position.y) * inverse_w[i] * 0.5 + 0.5) * Size.y;
+      z[i] = static_cast<double>(position.z) * inverse_w[i] * 0.5 + 0.5;
+   }
+
+   // The edge opposite to vertex i is positive at vertex i. The products of a shared edge only swap their order, so
+   // its two triangles get exactly negated edges and every pixel center on it goes to one of them.
+   double a[3], b[3], c[3];
+   for (int i = 0; i < 3; ++i) {
+      const int j = (i + 1) % 3;
+      const int k = (i + 2) % 3;
+      a[i] = y[j] - y[k];
+      b[i] = x[k] - x[j];
+      c[i] = x[j] * y[k] - x[k] * y[j];
+   }
+   double area = a[0] * x[0] + b[0] * y[0] + c[0];
+   if (area == 0.0 || !std::isfinite( area )) return;
+   if (area < 0.0) {
+      for (int i = 0; i < 3; ++i) {
+         a[i] = -a[i];
+         b[i] = -b[i];
+         c[i] = -c[i];
+      }
+      area = -area;
+   }
+
+   const double first_x = std::max( std::ceil( std::min( { x[0], x[1], x[2] } ) - 0.5 ), 0.0 );
+   const double first_y = std::max( std::ceil( std::min( { y[0], y[1], y[2] } ) - 0.5 ), 0.0 );
+   const double last_x = std::min( std::floor( std::max( { x[0], x[1], x[2] } ) - 0.5 ), Size.x - 1.0 );
+   const double last_y = std::min( std::floor( std::max( { y[0], y[1], y[2] } ) - 0.5 ), Size.y - 1.0 );
+   if (first_x > last_x || first_y > last_y) return;
+
+   Triangle triangle;
+   triangle.Draw = draw_index;
+   triangle.Bounds = glm::ivec4(
+      static_cast<int>(first_x), static_cast<int>(first_y), static_cast<int>(last_x), static_cast<int>(last_y)
+   );
+   double barycentric[3];
+   for (int i = 0; i < 3; ++i) {
+      triangle.Edges[i] = glm::vec3(a[i], b[i], c[i]);
+      // A pixel center on an edge belongs to the triangle on its left or below it.
+      triangle.IsTopLeft[i] = a[i] > 0.0 || (a[i] == 0.0 && b[i] < 0.0);
+      barycentric[i] = (a[i] * (first_x + 0.5) + b[i] * (first_y + 0.5) + c[i]) / area;
+   }
+   const auto get_plane = [&](const double* values) {
+      glm::dvec3 plane(0.0);
+      for (int i = 0; i < 3; ++i) plane += values[i] * glm::dvec3(a[i] / area, b[i] / area, barycentric[i]);
+      return glm::vec3(plane);
+   };
+   triangle.Depth = get_plane( z );
+   triangle.InverseW = get_plane( inverse_w );
+   for (int k = 0; k < VaryingNum; ++k) {
+      double values[3];
+      for (int i = 0; i < 3; ++i) values[i] = static_cast<double>(vertices[i]->Varyings[k]) * inverse_w[i];
+      triangle.Varyings[k] = get_plane( values );
+   }
+   triangles.emplace_back( triangle );
+}
+
+void SoftwareRenderer::processDraw(
+   std::vector<Triangle>& triangles,
+   int draw_index,
+   const glm::mat4& view_projection,
+   const glm::vec3& eye_position
+) const
+{
+   const Draw& draw = Draws[draw_index];
+   const std::vector<Vertex>& mesh = Meshes[draw.Mesh];
+   std::vector<ClipVertex> vertices(mesh.size());
+   for (size_t i = 0; i < mesh.size(); ++i) processVertex( vertices[i], mesh[i], draw, view_projection, eye_position );
+
+   triangles.clear();
+   for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+      // Only the near plane is clipped, where z = -w; the screen bounds and the depth test take care of the others.
+      const ClipVertex* corners[3] = { &vertices[i], &vertices[i + 1], &vertices[i + 2] };
+      float distances[3];
+      int inside_num = 0;
+      for (int j = 0; j < 3; ++j) {
+         distances[j] = corners[j]->Position.z + corners[j]->Position.w;
+         if (distances[j] >= 0.0f) ++inside_num;
+      }
+      if (inside_num == 0) continue;
+      if (inside_num == 3) {
+         setupTriangle( triangles, { corners[0], corners[1], corners[2] }, draw_index );
+         continue;
+      }
+
+      // Cutting the triangle leaves a triangle or a quad, which is drawn as a fan.
+      std::array<ClipVertex, 4> polygon;
+      int corner_num = 0;
+      for (int j = 0; j < 3; ++j) {
+         const int k = (j + 1) % 3;
+         if (distances[j] >= 0.0f) polygon[corner_num++] = *corners[j];
+         if ((distances[j] >= 0.0f) == (distances[k] >= 0.0f)) continue;
+
+         // Always from the inside to the outside, so an edge that two triangles share is cut at the same point.
+         const int inside = distances[j] >= 0.0f ? j : k;
+         const int outside = inside == j ? k : j;
+         const float t = distances[inside] / (distances[inside] - distances[outside]);
+         ClipVertex& cut = polygon[corner_num++];
+         cut.Position = corners[inside]->Position + (corners[outside]->Position - corners[inside]->Position) * t;
+         for (int v = 0; v < VaryingNum; ++v) {
+            cut.Varyings[v] = corners[inside]->Varyings[v] +
+               (corners[outside]->Varyings[v] - corners[inside]->Varyings[v]) * t;
+         }
+      }
+      for (int j = 1; j + 1 < corner_num; ++j) {
+         setupTriangle( triangles, { &polygon[0], &polygon[j], &polygon[j + 1] }, draw_index );
+      }
+   }
+}
+
+void SoftwareRenderer::binTriangles()
+{
+   for (auto& bin : Bins) bin.clear();
+   for (int i = 0; i < static_cast<int>(Triangles.size()); ++i) {
+      const glm::ivec4& bounds = Triangles[i].Bounds;
+      for (int tile_y = bounds.y / TileSize; tile_y <= bounds.w / TileSize; ++tile_y) {
+         for (int tile_x = bounds.x / TileSize; tile_x <= bounds.z / TileSize; ++tile_x) {
+            Bins[tile_y * TileGridSize.x + tile_x].emplace_back( i );
+         }
+      }
+   }
+}
+
+float SoftwareRenderer::getLevelOfDetail(const Texture& texture, const float* u, const float* v)
+{
+   const auto width = static_cast<float>(texture.Width);
+   const auto height = static_cast<float>(texture.Height);
+   const float du_dx = (u[1] - u[0]) * width;
+   const float dv_dx = (v[1] - v[0]) * height;
+   const float du_dy = (u[2] - u[0]) * width;
+   const float dv_dy = (v[2] - v[0]) * height;
+   const float rho = std::max(
+      std::sqrt( du_dx * du_dx + dv_dx * dv_dx ), std::sqrt( du_dy * du_dy + dv_dy * dv_dy )
+   );
+   return std::log2( rho );
+}
+
+void SoftwareRenderer::getMipLevels(int& level, int& next_level, float& weight, const Texture& texture, float lod)
+{
+   // GL_LINEAR when magnified and GL_LINEAR_MIPMAP_LINEAR when minified, as ObjectGL sets up its textures
+   const int last_level = static_cast<int>(texture.Levels.size()) - 1;
+   if (!(lod > 0.0f)) {
+      level = next_level = 0;
+      weight = 0.0f;
+      return;
+   }
+   const float d = std::min( lod, static_cast<float>(last_level) );
+   level = static_cast<int>(d);
+   next_level = std::min( level + 1, last_level );
+   weight = d - static_cast<float>(level);
+}
+
+glm::vec4 SoftwareRenderer::sampleLevel(
+   const std::vector<uint32_t>& texels,
+   const TextureLevel& level,
+   bool is_16_bit,
+   const glm::vec2& tex_coord
+)
+{
+   const auto width = static_cast<float>(level.Width);
+   const auto height = static_cast<float>(level.Height);
+   const float u = tex_coord.x * width - 0.5f;
+   const float v = tex_coord.y * height - 0.5f;
+   const float fx = std::floor( u );
+   const float fy = std::floor( v );
+   const float ax = u - fx;
+   const float ay = v - fy;
+   // The same fallback to the first texel as getWrappedIndexAVX2 for coordinates that are not finite or do not wrap
+   // into the level.
+   const float wrapped_x = fx - width * std::floor( fx / width );
+   const float wrapped_y = fy - height * std::floor( fy / height );
+   const int x0 = wrapped_x >= 0.0f && wrapped_x < width ? static_cast<int>(wrapped_x) : 0;
+   const int y0 = wrapped_y >= 0.0f && wrapped_y < height ? static_cast<int>(wrapped_y) : 0;
+   const int x1 = x0 + 1 == level.Width ? 0 : x0 + 1;
+   const int y1 = y0 + 1 == level.Height ? 0 : y0 + 1;
+   const uint32_t* row0 = texels.data() + level.Offset + y0 * level.Width;
+   const uint32_t* row1 = texels.data() + level.Offset + y1 * level.Width;
+
+   const int channel_num = is_16_bit ? 2 : 4;
+   const int bits = is_16_bit ? 16 : 8;
+   const uint32_t mask = is_16_bit ? 0xFFFFu : 0xFFu;
+   const float scale = is_16_bit ? 1.0f / 65535.0f : 1.0f / 255.0f;
+   glm::vec4 channels(0.0f);
+   for (int c = 0; c < channel_num; ++c) {
+      const auto c00 = static_cast<float>((row0[x0] >> (bits * c)) & mask);
+      const auto c10 = static_cast<float>((row0[x1] >> (bits * c)) & mask);
+      const auto c01 = static_cast<float>((row1[x0] >> (bits * c)) & mask);
+      const auto c11 = static_cast<float>((row1[x1] >> (bits * c)) & mask);
+      const float bottom = c00 + (c10 - c00) * ax;
+      const float top = c01 + (c11 - c01) * ax;
+      channels[c] = (bottom + (top - bottom) * ay) * scale;
+   }
+   return channels;
+}
+
+glm::vec4 SoftwareRenderer::sample(
+   const Texture& texture,
+   const std::vector<uint32_t>& texels,
+   bool is_16_bit,
+   const glm::vec2& tex_coord,
+   float lod
+)
+{
+   int level, next_level;
+   float weight;
+   getMipLevels( level, next_level, weight, texture, lod );
+   const glm::vec4 first = sampleLevel( texels, texture.Levels[level], is_16_bit, tex_coord );
+   if (weight == 0.0f) return first;
+
+   const glm::vec4 second = sampleLevel( texels, texture.Levels[next_level], is_16_bit, tex_coord );
+   return first + (second - first) * weight;
+}
+
+float SoftwareRenderer::getSpotlightFactor(const ShadingLight& light, const glm::vec3& position_in_mc)
+{
+   const glm::vec3 normalized_light_vector = normalize( glm::vec3(light.Position) - position_in_mc );
+   const float factor = dot( -normalized_light_vector, light.SpotlightDirection );
+   if (factor < light.CosCutoffAngle) return 0.0f;
+
+   const float normalized_angle = std::acos( std::min( factor, 1.0f ) ) * HalfPi / light.CutoffAngle;
+   return normalized_angle <= light.FeatherThreshold ? 1.0f :
+      std::cos( HalfPi * (normalized_angle - light.FeatherThreshold) / (HalfPi - light.FeatherThreshold) );
+}
+
+glm::vec4 SoftwareRenderer::shadePixel(
+   const float* varyings,
+   float lod,
+   const Draw& draw,
+   const Features& features
+) const
+{
+   const Texture& texture = Textures[draw.Texture];
+   const ObjectGL::MaterialBlock& material = draw.Material;
+   const glm::vec2 tex_coord(varyings[TexCoordVarying], varyings[TexCoordVarying + 1]);
+   const glm::vec4 final_color = features.UseTexture ?
+      sample( texture, texture.Color, false, tex_coord, lod ) : glm::vec4(1.0f);
+   if (!features.UseLight) return final_color * material.DiffuseColor;
+
+   const auto get_vector = [varyings](int varying) {
+      return glm::vec3(varyings[varying], varyings[varying + 1], varyings[varying + 2]);
+   };
+   const glm::vec3 position_in_mc = get_vector( PositionVarying );
+   const glm::vec3 view_direction_in_tc = normalize( get_vector( ViewVectorVarying ) );
+   glm::vec3 normal_in_tc(0.0f, 0.0f, 1.0f);
+   float specular_exponent = material.SpecularExponent;
+   if (features.UseBumpMapping) {
+      const glm::vec4 normal_xy = sample( texture, texture.NormalXY, true, tex_coord, lod );
+      const glm::vec4 normal_z_length = sample( texture, texture.NormalZLength, true, tex_coord, lod );
+      glm::vec3 normal(normal_xy.x * 2.0f - 1.0f, normal_xy.y * 2.0f - 1.0f, normal_z_length.x * 2.0f - 1.0f);
+      if (texture.IsTwoChannel) {
+         normal.z = std::sqrt( std::max( 1.0f - (normal.x * normal.x + normal.y * normal.y), 0.0f ) );
+      }
+      normal_in_tc = normalize( normal );
+
+      const float normal_length = std::max( normal_z_length.y, 1.0e-3f );
+      const float toksvig_factor =
+         normal_length / (normal_length + material.SpecularExponent * (1.0f - normal_length));
+      specular_exponent = material.SpecularExponent * toksvig_factor;
+   }
+
+   // The tangent space of the fragment, for the lights the vertex stage passes no vector for.
+   const glm::vec3 tangent_in_mc = normalize( get_vector( TangentVarying ) );
+   const glm::vec3 binormal_in_mc = normalize( get_vector( BinormalVarying ) );
+   const glm::vec3 normal_in_mc = normalize( get_vector( NormalVarying ) );
+   glm::vec4 color = material.EmissionColor + GlobalAmbient * material.AmbientColor;
+   for (const auto& light : ShadingLights) {
+      glm::vec3 light_vector;
+      if (light.Index < MaxVertexLights) light_vector = get_vector( LightVectorVarying + 3 * light.Index );
+      else {
+         light_vector = toTangentSpace(
+            light.IsPointLight ? glm::vec3(light.Position) - position_in_mc : glm::vec3(light.Position),
+            tangent_in_mc, binormal_in_mc, normal_in_mc
+         );
+      }
+
+      float final_effect_factor = 1.0f;
+      if (light.IsPointLight) {
+         const float squared_distance = dot( light_vector, light_vector );
+         final_effect_factor = squared_distance <= light.SquaredRadius ?
+            1.0f : std::clamp( light.SquaredRadius / squared_distance, 0.0f, 1.0f );
+         if (light.IsSpotlight) final_effect_factor *= getSpotlightFactor( light, position_in_mc );
+      }
+      light_vector = normalize( light_vector );
+      if (final_effect_factor <= 0.0f) continue;
+
+      glm::vec4 local_color = light.AmbientColor * material.AmbientColor;
+      const float diffuse_intensity = std::max( dot( normal_in_tc, light_vector ), 0.0f );
+      local_color += diffuse_intensity * light.DiffuseColor * material.DiffuseColor;
+      const glm::vec3 halfway_vector = normalize( light_vector + view_direction_in_tc );
+      const float specular_intensity = std::max( dot( normal_in_tc, halfway_vector ), 0.0f );
+      local_color += std::pow( specular_intensity, specular_exponent ) * light.SpecularColor * material.SpecularColor;
+      color += local_color * final_effect_factor;
+   }
+   return final_color * color;
+}
+
+void SoftwareRenderer::rasterizeBlockScalar(
+   float* depths,
+   int* triangle_ids,
+   const Triangle& triangle,
+   int triangle_id,
+   const glm::ivec2& tile_origin,
+   int x,
+   int y
+)
+{
+   const int block = getBlockOffset( x, y );
+   for (int lane = 0; lane < LaneNum; ++lane) {
+      const int pixel_x = tile_origin.x + x + LaneX[lane];
+      const int pixel_y = tile_origin.y + y + LaneY[lane];
+      if (pixel_x < triangle.Bounds.x || pixel_x > triangle.Bounds.z) continue;
+      if (pixel_y < triangle.Bounds.y || pixel_y > triangle.Bounds.w) continue;
+
+      bool inside = true;
+      for (int e = 0; e < 3; ++e) {
+         const float distance =
+            evaluatePlane( triangle.Edges[e], static_cast<float>(pixel_x) + 0.5f, static_cast<float>(pixel_y) + 0.5f );
+         inside = inside && (distance > 0.0f || (distance == 0.0f && triangle.IsTopLeft[e]));
+      }
+      if (!inside) continue;
+
+      const float depth = evaluatePlane(
+         triangle.Depth,
+         static_cast<float>(pixel_x - triangle.Bounds.x),
+         static_cast<float>(pixel_y - triangle.Bounds.y)
+      );
+      if (depth < depths[block + lane]) {
+         depths[block + lane] = depth;
+         triangle_ids[block + lane] = triangle_id;
+      }
+   }
+}
+
+int SoftwareRenderer::shadeBlockScalar(
+   uint32_t* colors,
+   const int* triangle_ids,
+   const Triangle& triangle,
+   int triangle_id,
+   const glm::ivec2& tile_origin,
+   int x,
+   int y,
+   const Features& features
+) const
+{
+   const int block = getBlockOffset( x, y );
+   int covered_num = 0;
+   for (int lane = 0; lane < LaneNum; ++lane) {
+      if (triangle_ids[block + lane] == triangle_id) ++covered_num;
+   }
+   if (covered_num == 0) return 0;
+
+   // Every lane is interpolated, also where another triangle is nearer, since a quad needs all four for derivatives.
+   std::array<std::array<float, VaryingNum>, LaneNum> varyings{};
+   float u[LaneNum], v[LaneNum];
+   for (int lane = 0; lane < LaneNum; ++lane) {
+      const auto px = static_cast<float>(tile_origin.x + x + LaneX[lane] - triangle.Bounds.x);
+      const auto py = static_cast<float>(tile_origin.y + y + LaneY[lane] - triangle.Bounds.y);
+      const float w = 1.0f / evaluatePlane( triangle.InverseW, px, py );
+      for (int k = 0; k < VaryingNum; ++k) varyings[lane][k] = evaluatePlane( triangle.Varyings[k], px, py ) * w;
+      u[lane] = varyings[lane][TexCoordVarying];
+      v[lane] = varyings[lane][TexCoordVarying + 1];
+   }
+
+   const Draw& draw = Draws[triangle.Draw];
+   const Texture& texture = Textures[draw.Texture];
+   const float lods[2] = { getLevelOfDetail( texture, u, v ), getLevelOfDetail( texture, u + 4, v + 4 ) };
+   for (int lane = 0; lane < LaneNum; ++lane) {
+      if (triangle_ids[block + lane] != triangle_id) continue;
+      colors[block + lane] = packColor( shadePixel( varyings[lane].data(), lods[lane / 4], draw, features ) );
+   }
+   return covered_num;
+}
+
+#ifdef USE_X86_SIMD
+TARGET_AVX2 void SoftwareRenderer::rasterizeBlockAVX2(
+   float* depths,
+   int* triangle_ids,
+   const Triangle& triangle,
+   int triangle_id,
+   const glm::ivec2& tile_origin,
+   int x,
+   int y
+)
+{
+   const int block = getBlockOffset( x, y );
+   const __m256 lane_x = _mm256_setr_ps( 0.0f, 1.0f, 0.0f, 1.0f, 2.0f, 3.0f, 2.0f, 3.0f );
+   const __m256 lane_y = _mm256_setr_ps( 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f );
+   const __m256 pixel_x = _mm256_add_ps( _mm256_set1_ps( static_cast<float>(tile_origin.x + x) ), lane_x );
+   const __m256 pixel_y = _mm256_add_ps( _mm256_set1_ps( static_cast<float>(tile_origin.y + y) ), lane_y );
+   __m256 inside = _mm256_and_ps(
+      _mm256_and_ps(
+         _mm256_cmp_ps( pixel_x, _mm256_set1_ps( static_cast<float>(triangle.Bounds.x) ), _CMP_GE_OQ ),
+         _mm256_cmp_ps( pixel_x, _mm256_set1_ps( static_cast<float>(triangle.Bounds.z) ), _CMP_LE_OQ )
+      ),
+      _mm256_and_ps(
+         _mm256_cmp_ps( pixel_y, _mm256_set1_ps( static_cast<float>(triangle.Bounds.y) ), _CMP_GE_OQ ),
+         _mm256_cmp_ps( pixel_y, _mm256_set1_ps( static_cast<float>(triangle.Bounds.w) ), _CMP_LE_OQ )
+      )
+   );
+
+   const __m256 zero = _mm256_setzero_ps();
+   const __m256 center_x = _mm256_add_ps( pixel_x, _mm256_set1_ps( 0.5f ) );
+   const __m256 center_y = _mm256_add_ps( pixel_y, _mm256_set1_ps( 0.5f ) );
+   for (int e = 0; e < 3; ++e) {
+      const __m256 distance = evaluatePlaneAVX2( triangle.Edges[e], center_x, center_y );
+      inside = _mm256_and_ps(
+         inside,
+         triangle.IsTopLeft[e] ?
+            _mm256_cmp_ps( distance, zero, _CMP_GE_OQ ) : _mm256_cmp_ps( distance, zero, _CMP_GT_OQ )
+      );
+   }
+   if (_mm256_movemask_ps( inside ) == 0) return;
+
+   const __m256 depth = evaluatePlaneAVX2(
+      triangle.Depth,
+      _mm256_add_ps( _mm256_set1_ps( static_cast<float>(tile_origin.x + x - triangle.Bounds.x) ), lane_x ),
+      _mm256_add_ps( _mm256_set1_ps( static_cast<float>(tile_origin.y + y - triangle.Bounds.y) ), lane_y )
+   );
+   const __m256 stored_depth = _mm256_loadu_ps( depths + block );
+   const __m256 pass = _mm256_and_ps( inside, _mm256_cmp_ps( depth, stored_depth, _CMP_LT_OQ ) );
+   if (_mm256_movemask_ps( pass ) == 0) return;
+
+   auto* ids = reinterpret_cast<__m256i*>(triangle_ids + block);
+   _mm256_storeu_ps( depths + block, _mm256_blendv_ps( stored_depth, depth, pass ) );
+   _mm256_storeu_si256(
+      ids,
+      _mm256_blendv_epi8( _mm256_loadu_si256( ids ), _mm256_set1_epi32( triangle_id ), _mm256_castps_si256( pass ) )
+   );
+}
+
+TARGET_AVX2 int SoftwareRenderer::shadeBlockAVX2(
+   uint32_t* colors,
+   const int* triangle_ids,
+   const Triangle& triangle,
+   int triangle_id,
+   const glm::ivec2& tile_origin,
+   int x,
+   int y,
+   const Features& features
+) const
+{
+   const int block = getBlockOffset( x, y );
+   const __m256 covered = _mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(
+         _mm256_loadu_si256( reinterpret_cast<const __m256i*>(triangle_ids + block) ), _mm256_set1_epi32( triangle_id )
+      )
+   );
+   const int covered_mask = _mm256_movemask_ps( covered );
+   if (covered_mask == 0) return 0;
+
+   const __m256 zero = _mm256_setzero_ps();
+   const __m256 one = _mm256_set1_ps( 1.0f );
+   const __m256 two = _mm256_set1_ps( 2.0f );
+   const __m256 px = _mm256_add_ps(
+      _mm256_set1_ps( static_cast<float>(tile_origin.x + x - triangle.Bounds.x) ),
+      _mm256_setr_ps( 0.0f, 1.0f, 0.0f, 1.0f, 2.0f, 3.0f, 2.0f, 3.0f )
+   );
+   const __m256 py = _mm256_add_ps(
+      _mm256_set1_ps( static_cast<float>(tile_origin.y + y - triangle.Bounds.y) ),
+      _mm256_setr_ps( 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f )
+   );
+   const __m256 w = _mm256_div_ps( one, evaluatePlaneAVX2( triangle.InverseW, px, py ) );
+   const glm::vec3* planes = triangle.Varyings.data();
+   const __m256 u = _mm256_mul_ps( evaluatePlaneAVX2( planes[TexCoordVarying], px, py ), w );
+   const __m256 v = _mm256_mul_ps( evaluatePlaneAVX2( planes[TexCoordVarying + 1], px, py ), w );
+
+   const Draw& draw = Draws[triangle.Draw];
+   const Texture& texture = Textures[draw.Texture];
+   const ObjectGL::MaterialBlock& material = draw.Material;
+   alignas(32) float us[LaneNum], vs[LaneNum];
+   _mm256_store_ps( us, u );
+   _mm256_store_ps( vs, v );
+   QuadLevels quads[2];
+   for (int q = 0; q < 2; ++q) {
+      int levels[2];
+      const float lod = getLevelOfDetail( texture, us + 4 * q, vs + 4 * q );
+      getMipLevels( levels[0], levels[1], quads[q].Weight, texture, lod );
+      for (int i = 0; i < 2; ++i) {
+         quads[q].Offset[i] = texture.Levels[levels[i]].Offset;
+         quads[q].Width[i] = texture.Levels[levels[i]].Width;
+         quads[q].Height[i] = texture.Levels[levels[i]].Height;
+      }
+   }
+
+   __m256 final_color[4] = { one, one, one, one };
+   if (features.UseTexture) sampleAVX2( final_color, texture.Color.data(), quads, false, u, v );
+
+   if (!features.UseLight) {
+      for (int c = 0; c < 4; ++c) {
+         final_color[c] = _mm256_mul_ps( final_color[c], _mm256_set1_ps( material.DiffuseColor[c] ) );
+      }
+   }
+   else {
+      const Vec3x8 position_in_mc = interpolateAVX2( planes + PositionVarying, px, py, w );
+      const Vec3x8 view_direction_in_tc = normalizeAVX2( interpolateAVX2( planes + ViewVectorVarying, px, py, w ) );
+      Vec3x8 normal_in_tc = { zero, zero, one };
+      __m256 specular_exponent = _mm256_set1_ps( material.SpecularExponent );
+      if (features.UseBumpMapping) {
+         __m256 normal_xy[4], normal_z_length[4];
+         sampleAVX2( normal_xy, texture.NormalXY.data(), quads, true, u, v );
+         sampleAVX2( normal_z_length, texture.NormalZLength.data(), quads, true, u, v );
+         Vec3x8 normal = {
+            _mm256_sub_ps( _mm256_mul_ps( normal_xy[0], two ), one ),
+            _mm256_sub_ps( _mm256_mul_ps( normal_xy[1], two ), one ),
+            _mm256_sub_ps( _mm256_mul_ps( normal_z_length[0], two ), one )
+         };
+         if (texture.IsTwoChannel) {
+            const __m256 squared_xy =
+               _mm256_add_ps( _mm256_mul_ps( normal.X, normal.X ), _mm256_mul_ps( normal.Y, normal.Y ) );
+            normal.Z = _mm256_sqrt_ps( _mm256_max_ps( _mm256_sub_ps( one, squared_xy ), zero ) );
+         }
+         normal_in_tc = normalizeAVX2( normal );
+
+         const __m256 normal_length = _mm256_max_ps( normal_z_length[1], _mm256_set1_ps( 1.0e-3f ) );
+         const __m256 toksvig_factor = _mm256_div_ps(
+            normal_length,
+            _mm256_add_ps( normal_length, _mm256_mul_ps( specular_exponent, _mm256_sub_ps( one, normal_length ) ) )
+         );
+         specular_exponent = _mm256_mul_ps( specular_exponent, toksvig_factor );
+      }
+
+      bool has_tangent_space = false;
+      Vec3x8 tangent_in_mc{}, binormal_in_mc{}, normal_in_mc{};
+      __m256 color[4];
+      for (int c = 0; c < 4; ++c) {
+         color[c] = _mm256_set1_ps( material.EmissionColor[c] + GlobalAmbient[c] * material.AmbientColor[c] );
+      }
+      for (const auto& light : ShadingLights) {
+         Vec3x8 light_vector;
+         if (light.Index < MaxVertexLights) {
+            light_vector = interpolateAVX2( planes + LightVectorVarying + 3 * light.Index, px, py, w );
+         }
+         else {
+            if (!has_tangent_space) {
+               tangent_in_mc = normalizeAVX2( interpolateAVX2( planes + TangentVarying, px, py, w ) );
+               binormal_in_mc = normalizeAVX2( interpolateAVX2( planes + BinormalVarying, px, py, w ) );
+               normal_in_mc = normalizeAVX2( interpolateAVX2( planes + NormalVarying, px, py, w ) );
+               has_tangent_space = true;
+            }
+            const Vec3x8 light_position = broadcastAVX2( glm::vec3(light.Position) );
+            light_vector = toTangentSpaceAVX2(
+               light.IsPointLight ? subtractAVX2( light_position, position_in_mc ) : light_position,
+               tangent_in_mc, binormal_in_mc, normal_in_mc
+            );
+         }
+
+         __m256 final_effect_factor = one;
+         if (light.IsPointLight) {
+            const __m256 squared_distance = dotAVX2( light_vector, light_vector );
+            const __m256 squared_radius = _mm256_set1_ps( light.SquaredRadius );
+            final_effect_factor = _mm256_blendv_ps(
+               _mm256_min_ps( _mm256_max_ps( _mm256_div_ps( squared_radius, squared_distance ), zero ), one ),
+               one,
+               _mm256_cmp_ps( squared_distance, squared_radius, _CMP_LE_OQ )
+            );
+            if (light.IsSpotlight) {
+               const Vec3x8 normalized_light_vector = normalizeAVX2(
+                  subtractAVX2( broadcastAVX2( glm::vec3(light.Position) ), position_in_mc )
+               );
+               const __m256 factor = _mm256_sub_ps(
+                  zero, dotAVX2( normalized_light_vector, broadcastAVX2( light.SpotlightDirection ) )
+               );
+               const __m256 normalized_angle = _mm256_div_ps(
+                  _mm256_mul_ps( acosAVX2( factor ), _mm256_set1_ps( HalfPi ) ), _mm256_set1_ps( light.CutoffAngle )
+               );
+               const __m256 threshold = _mm256_set1_ps( light.FeatherThreshold );
+               const __m256 feathered = cosAVX2(
+                  _mm256_div_ps(
+                     _mm256_mul_ps( _mm256_set1_ps( HalfPi ), _mm256_sub_ps( normalized_angle, threshold ) ),
+                     _mm256_set1_ps( HalfPi - light.FeatherThreshold )
+                  )
+               );
+               __m256 spotlight_factor =
+                  _mm256_blendv_ps( feathered, one, _mm256_cmp_ps( normalized_angle, threshold, _CMP_LE_OQ ) );
+               spotlight_factor = _mm256_and_ps(
+                  spotlight_factor, _mm256_cmp_ps( factor, _mm256_set1_ps( light.CosCutoffAngle ), _CMP_GE_OQ )
+               );
+               final_effect_factor = _mm256_mul_ps( final_effect_factor, spotlight_factor );
+            }
+         }
+         const __m256 is_lit = _mm256_and_ps( covered, _mm256_cmp_ps( final_effect_factor, zero, _CMP_GT_OQ ) );
+         if (_mm256_movemask_ps( is_lit ) == 0) continue;
+         light_vector = normalizeAVX2( light_vector );
+
+         const __m256 diffuse_intensity = _mm256_max_ps( dotAVX2( normal_in_tc, light_vector ), zero );
+         const Vec3x8 halfway_vector = normalizeAVX2( addAVX2( light_vector, view_direction_in_tc ) );
+         const __m256 specular_intensity = _mm256_max_ps( dotAVX2( normal_in_tc, halfway_vector ), zero );
+         const __m256 specular = powAVX2( specular_intensity, specular_exponent );
+         for (int c = 0; c < 4; ++c) {
+            __m256 local_color = _mm256_set1_ps( light.AmbientColor[c] * material.AmbientColor[c] );
+            local_color = _mm256_add_ps(
+               local_color,
+               _mm256_mul_ps( diffuse_intensity, _mm256_set1_ps( light.DiffuseColor[c] * material.DiffuseColor[c] ) )
+            );
+            local_color = _mm256_add_ps(
+               local_color,
+               _mm256_mul_ps( specular, _mm256_set1_ps( light.SpecularColor[c] * material.SpecularColor[c] ) )
+            );
+            local_color = _mm256_and_ps( is_lit, _mm256_mul_ps( local_color, final_effect_factor ) );
+            color[c] = _mm256_add_ps( color[c], local_color );
+         }
+      }
+      for (int c = 0; c < 4; ++c) final_color[c] = _mm256_mul_ps( final_color[c], color[c] );
+   }
+
+   __m256i channels[4];
+   for (int c = 0; c < 4; ++c) {
+      const __m256 clamped = _mm256_min_ps( _mm256_max_ps( final_color[c], zero ), one );
+      channels[c] = _mm256_cvttps_epi32(
+         _mm256_add_ps( _mm256_mul_ps( clamped, _mm256_set1_ps( 255.0f ) ), _mm256_set1_ps( 0.5f ) )
+      );
+   }
+   const __m256i packed = _mm256_or_si256(
+      _mm256_or_si256( channels[0], _mm256_slli_epi32( channels[1], 8 ) ),
+      _mm256_or_si256( _mm256_slli_epi32( channels[2], 16 ), _mm256_slli_epi32( channels[3], 24 ) )
+   );
+   _mm256_maskstore_epi32( reinterpret_cast<int*>(colors + block), _mm256_castps_si256( covered ), packed );
+
+   int covered_num = 0;
+   for (int lane = 0; lane < LaneNum; ++lane) {
+      if (covered_mask & (1 << lane)) ++covered_num;
+   }
+   return covered_num;
+}
+#endif
+
+size_t SoftwareRenderer::renderTile(
+   TileBuffers& buffers,
+   int tile,
+   const Features& features,
+   InstructionSet instruction_set
+)
+{
+   const glm::ivec2 tile_origin(tile % TileGridSize.x * TileSize, tile / TileGridSize.x * TileSize);
+   const glm::ivec2 tile_extent = glm::min( glm::ivec2(TileSize), Size - tile_origin );
+   // Only the first tile of a worker allocates, the others refill the same buffers.
+   buffers.Depths.assign( TileSize * TileSize, 1.0f );
+   buffers.TriangleIDs.assign( TileSize * TileSize, -1 );
+   buffers.Colors.assign( TileSize * TileSize, packColor( ClearColor ) );
+   float* depths = buffers.Depths.data();
+   int* triangle_ids = buffers.TriangleIDs.data();
+   uint32_t* colors = buffers.Colors.data();
+#ifdef USE_X86_SIMD
+   const bool use_avx2 = instruction_set == InstructionSet::AVX2;
+#else
+   static_cast<void>(instruction_set);
+#endif
+
+   // The blocks of the tile that the bounds of a triangle overlap.
+   const auto get_blocks = [&](const Triangle& triangle) {
+      return glm::ivec4(
+         (std::max( triangle.Bounds.x, tile_origin.x ) - tile_origin.x) / BlockWidth * BlockWidth,
+         (std::max( triangle.Bounds.y, tile_origin.y ) - tile_origin.y) / BlockHeight * BlockHeight,
+         std::min( triangle.Bounds.z, tile_origin.x + tile_extent.x - 1 ) - tile_origin.x,
+         std::min( triangle.Bounds.w, tile_origin.y + tile_extent.y - 1 ) - tile_origin.y
+      );
+   };
+
+   // The first pass keeps the nearest triangle of every pixel, so the second one shades each pixel only once.
+   for (const int triangle_id : Bins[tile]) {
+      const Triangle& triangle = Triangles[triangle_id];
+      const glm::ivec4 blocks = get_blocks( triangle );
+      for (int y = blocks.y; y <= blocks.w; y += BlockHeight) {
+         for (int x = blocks.x; x <= blocks.z; x += BlockWidth) {
+#ifdef USE_X86_SIMD
+            if (use_avx2) {
+               rasterizeBlockAVX2( depths, triangle_ids, triangle, triangle_id, tile_origin, x, y );
+               continue;
+            }
+#endif
+            rasterizeBlockScalar( depths, triangle_ids, triangle, triangle_id, tile_origin, x, y );
+         }
+      }
+   }
+
+   size_t shaded_pixel_num = 0;
+   for (const int triangle_id : Bins[tile]) {
+      const Triangle& triangle = Triangles[triangle_id];
+      const glm::ivec4 blocks = get_blocks( triangle );
+      for (int y = blocks.y; y <= blocks.w; y += BlockHeight) {
+         for (int x = blocks.x; x <= blocks.z; x += BlockWidth) {
+#ifdef USE_X86_SIMD
+            if (use_avx2) {
+               shaded_pixel_num += shadeBlockAVX2(
+                  colors, triangle_ids, triangle, triangle_id, tile_origin, x, y, features
+               );
+               continue;
+            }
+#endif
+            shaded_pixel_num += shadeBlockScalar(
+               colors, triangle_ids, triangle, triangle_id, tile_origin, x, y, features
+            );
+         }
+      }
+   }
+
+   for (int y = 0; y < tile_extent.y; ++y) {
+      uint8_t* row = Color.data() + ((static_cast<size_t>(tile_origin.y) + y) * Size.x + tile_origin.x) * 4;
+      for (int x = 0; x < tile_extent.x; ++x) {
+         const uint32_t color = colors[getBlockOffset( x, y ) + getLane( x, y )];
+         std::memcpy( row + static_cast<size_t>(x) * 4, &color, sizeof( color ) );
+      }
+   }
+   return shaded_pixel_num;
+}
+
+void SoftwareRenderer::render(
+   const CameraGL& camera,
+   const LightGL& lights,
+   const Features& features,
+   InstructionSet instruction_set
+)
+{
+   const auto start = std::chrono::steady_clock::now();
+   prepareLights( lights, features );
+   const glm::mat4 view_projection = camera.getProjectionMatrix() * camera.getViewMatrix();
+   const glm::vec3 eye_position = glm::vec3(inverse( camera.getViewMatrix() )[3]);
+
+   // Every draw is transformed, clipped and set up on its own, and the triangles are joined in draw order, so the
+   // bins and with them the depth ties come out the same for any number of threads.
+   const auto draw_num = static_cast<int>(Draws.size());
+   DrawTriangles.resize( Draws.size() );
+   ThreadPool::getInstance().parallelFor(
+      0, draw_num, 16, [this, &view_projection, &eye_position](int first, int last) {
+         for (int i = first; i < last; ++i) processDraw( DrawTriangles[i], i, view_projection, eye_position );
+      }
+   );
+   Triangles.clear();
+   for (const auto& triangles : DrawTriangles) Triangles.insert( Triangles.end(), triangles.begin(), triangles.end() );
+   binTriangles();
+
+   // Each worker owns one set of tile buffers and takes the tiles one by one, so the tiles still balance over the pool.
+   const int tile_num = TileGridSize.x * TileGridSize.y;
+   const int worker_num = std::min( ThreadPool::getInstance().getThreadNum() + 1, tile_num );
+   if (static_cast<int>(WorkerTileBuffers.size()) < worker_num) WorkerTileBuffers.resize( worker_num );
+   std::atomic<int> next_tile{ 0 };
+   std::atomic<size_t> shaded_pixel_num{ 0 };
+   ThreadPool::getInstance().parallelFor(
+      0, worker_num, 1, [&](int first, int last) {
+         for (int worker = first; worker < last; ++worker) {
+            size_t pixel_num = 0;
+            for (int tile = next_tile++; tile < tile_num; tile = next_tile++) {
+               pixel_num += renderTile( WorkerTileBuffers[worker], tile, features, instruction_set );
+            }
+            shaded_pixel_num += pixel_num;
+         }
+      }
+   );
+
+   Stats.TriangleNum = static_cast<int>(Triangles.size());
+   Stats.ShadedPixelNum = shaded_pixel_num;
+   Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,84 @@
+#include "StateCache.h"
+
+StateCacheGL::StateCacheGL() : Program( UnknownName ), VAO( UnknownName ), Textures{}
+{
+   invalidate();
+}
+
+void StateCacheGL::invalidate()
+{
+   Program = UnknownName;
+   VAO = UnknownName;
+   Textures.fill( UnknownName );
+   UniformValues.clear();
+}
+
+void StateCacheGL::useProgram(GLuint program)
+{
+   if (Program == program) {
+      ++Stats.ElidedCalls;
+      return;
+   }
+   Program = program;
+   glUseProgram( program );
+   ++Stats.IssuedCalls;
+}
+
+void StateCacheGL::bindVertexArray(GLuint vao)
+{
+   if (VAO == vao) {
+      ++Stats.ElidedCalls;
+      return;
+   }
+   VAO = vao;
+   glBindVertexArray( vao );
+   ++Stats.IssuedCalls;
+}
+
+void StateCacheGL::bindTextureUnit(int unit, GLuint texture)
+{
+   assert( 0 <= unit && unit < TextureUnitNum );
+
+   if (Textures[unit] == texture) {
+      ++Stats.ElidedCalls;
+      return;
+   }
+   Textures[unit] = texture;
+   glBindTextureUnit( static_cast<GLuint>(unit), texture );
+   ++Stats.IssuedCalls;
+}
+
+bool StateCacheGL::isUniformSet(GLint location, const void* value, size_t size)
+{
+   assert( Program != UnknownName && size <= sizeof( UniformValue ) );
+
+   UniformValue bits{};
+   std::memcpy( bits.data(), value, size );
+   const uint64_t key = static_cast<uint64_t>(Program) << 32 | static_cast<uint32_t>(location);
+   const auto it = UniformValues.find( key );
+   if (it != UniformValues.end() && it->second == bits) {
+      ++Stats.ElidedCalls;
+      return true;
+   }
+   UniformValues[key] = bits;
+   ++Stats.IssuedCalls;
+   return false;
+}
+
+void StateCacheGL::setUniform(GLint location, int value)
+{
+   if (location < 0 || isUniformSet( location, &value, sizeof( value ) )) return;
+   glUniform1i( location, value );
+}
+
+void StateCacheGL::setUniform(GLint location, float value)
+{
+   if (location < 0 || isUniformSet( location, &value, sizeof( value ) )) return;
+   glUniform1f( location, value );
+}
+
+void StateCacheGL::setUniform(GLint location, const glm::vec4& value)
+{
+   if (location < 0 || isUniformSet( location, &value, sizeof( value ) )) return;
+   glUniform4fv( location, 1, &value[0] );
+}
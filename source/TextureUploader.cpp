@@ -0,0 +1,273 @@
+#include "TextureUploader.h"
+
+namespace
+{
+   GLsizeiptr alignUp(GLsizeiptr size, GLsizeiptr alignment)
+   {
+      return (size + alignment - 1) / alignment * alignment;
+   }
+}
+
+TextureUploaderGL::TextureUploaderGL() :
+   Buffer( 0 ), MappedRing( nullptr ), RingSize( 0 ), Head( 0 ), FrameBudget( DefaultFrameBudget ), FrameBytes( 0 )
+{
+}
+
+TextureUploaderGL::~TextureUploaderGL()
+{
+   for (const auto& range : InFlight) glDeleteSync( range.Fence );
+   if (Buffer != 0) {
+      glUnmapNamedBuffer( Buffer );
+      glDeleteBuffers( 1, &Buffer );
+   }
+}
+
+bool TextureUploaderGL::create(GLsizeiptr ring_size)
+{
+   assert( Buffer == 0 );
+
+   const GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+   glCreateBuffers( 1, &Buffer );
+   glNamedBufferStorage( Buffer, ring_size, nullptr, map_flags );
+   MappedRing = static_cast<uint8_t*>(glMapNamedBufferRange( Buffer, 0, ring_size, map_flags ));
+   if (MappedRing == nullptr) {
+      std::cerr << "Could not map a texture upload ring of " << ring_size << " bytes\n";
+      glDeleteBuffers( 1, &Buffer );
+      Buffer = 0;
+      return false;
+   }
+   RingSize = ring_size;
+   Head = 0;
+   return true;
+}
+
+size_t TextureUploaderGL::getTexelSize(GLenum pixel_format, GLenum type)
+{
+   size_t channel_num = 4;
+   if (pixel_format == GL_RED) channel_num = 1;
+   else if (pixel_format == GL_RG) channel_num = 2;
+   else if (pixel_format == GL_RGB) channel_num = 3;
+
+   switch (type) {
+      case GL_UNSIGNED_INT_2_10_10_10_REV: return 4;
+      case GL_UNSIGNED_SHORT:
+      case GL_HALF_FLOAT: return channel_num * 2;
+      case GL_FLOAT: return channel_num * 4;
+      default: return channel_num;
+   }
+}
+
+void TextureUploaderGL::uploadLevel(
+   GLuint texture_id,
+   int level,
+   int layer,
+   int width,
+   int height,
+   GLenum pixel_format,
+   GLenum type,
+   const void* pixels
+)
+{
+   if (layer < 0) glTextureSubImage2D( texture_id, level, 0, 0, width, height, pixel_format, type, pixels );
+   else glTextureSubImage3D( texture_id, level, 0, 0, layer, width, height, 1, pixel_format, type, pixels );
+}
+
+void TextureUploaderGL::uploadCompressedLevel(
+   GLuint texture_id,
+   int level,
+   int layer,
+   int width,
+   int height,
+   GLenum internal_format,
+   GLsizei byte_num,
+   const void* pixels
+)
+{
+   if (layer < 0) {
+      glCompressedTextureSubImage2D( texture_id, level, 0, 0, width, height, internal_format, byte_num, pixels );
+   }
+   else {
+      glCompressedTextureSubImage3D(
+         texture_id, level, 0, 0, layer, width, height, 1, internal_format, byte_num, pixels
+      );
+   }
+}
+
+void TextureUploaderGL::uploadFromClient(
+   GLuint texture_id,
+   int layer,
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   GLenum pixel_format,
+   GLenum type,
+   int alignment
+)
+{
+   glPixelStorei( GL_UNPACK_ALIGNMENT, alignment );
+   for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+      uploadLevel(
+         texture_id, level, layer,
+         MipmapBuilder::getLevelSize( width, level ), MipmapBuilder::getLevelSize( height, level ),
+         pixel_format, type, levels[level]
+      );
+   }
+   glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+}
+
+void TextureUploaderGL::uploadCompressedFromClient(
+   GLuint texture_id,
+   int layer,
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   GLenum internal_format,
+   BlockCompressor::Format format
+)
+{
+   for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+      const int level_width = MipmapBuilder::getLevelSize( width, level );
+      const int level_height = MipmapBuilder::getLevelSize( height, level );
+      uploadCompressedLevel(
+         texture_id, level, layer, level_width, level_height, internal_format,
+         static_cast<GLsizei>(BlockCompressor::getCompressedSize( level_width, level_height, format )), levels[level]
+      );
+   }
+}
+
+bool TextureUploaderGL::retireFront(bool wait)
+{
+   const GLsync fence = InFlight.front().Fence;
+   if (glClientWaitSync( fence, 0, 0 ) == GL_TIMEOUT_EXPIRED) {
+      if (!wait) return false;
+
+      ++Stats.FenceWaitNum;
+      glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max() );
+   }
+   glDeleteSync( fence );
+   InFlight.pop_front();
+   return true;
+}
+
+bool TextureUploaderGL::reserve(GLsizeiptr byte_num)
+{
+   if (Buffer == 0 || byte_num > RingSize) return false;
+
+   while (!InFlight.empty() && retireFront( false )) {}
+
+   // What is left from the last pass around the ring lies from Head to the end, oldest first, and is skipped.
+   if (Head + byte_num > RingSize) {
+      while (!InFlight.empty() && InFlight.front().Begin >= Head) retireFront( true );
+      Head = 0;
+   }
+   while (!InFlight.empty() && InFlight.front().Begin >= Head && InFlight.front().Begin < Head + byte_num) {
+      retireFront( true );
+   }
+   return true;
+}
+
+bool TextureUploaderGL::stage(
+   std::vector<GLintptr>& offsets,
+   const std::vector<const uint8_t*>& levels,
+   const std::vector<size_t>& level_sizes
+)
+{
+   GLsizeiptr byte_num = 0;
+   for (const auto& size : level_sizes) byte_num += alignUp( static_cast<GLsizeiptr>(size), LevelAlignment );
+   FrameBytes += static_cast<size_t>(byte_num);
+   if (!reserve( byte_num )) {
+      Stats.DirectBytes += static_cast<size_t>(byte_num);
+      return false;
+   }
+
+   offsets.resize( levels.size() );
+   GLintptr offset = Head;
+   for (size_t level = 0; level < levels.size(); ++level) {
+      std::memcpy( MappedRing + offset, levels[level], level_sizes[level] );
+      offsets[level] = offset;
+      offset += alignUp( static_cast<GLsizeiptr>(level_sizes[level]), LevelAlignment );
+   }
+   Head = offset;
+   Stats.StagedBytes += static_cast<size_t>(byte_num);
+   glBindBuffer( GL_PIXEL_UNPACK_BUFFER, Buffer );
+   return true;
+}
+
+void TextureUploaderGL::finishStaging(GLintptr begin)
+{
+   glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+   InFlight.push_back( { begin, Head, glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 ) } );
+}
+
+void TextureUploaderGL::upload(
+   GLuint texture_id,
+   int layer,
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   GLenum pixel_format,
+   GLenum type,
+   int alignment
+)
+{
+   const size_t texel_size = getTexelSize( pixel_format, type );
+   std::vector<size_t> level_sizes(levels.size());
+   for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+      const auto row_size = static_cast<GLsizeiptr>(MipmapBuilder::getLevelSize( width, level ) * texel_size);
+      level_sizes[level] =
+         static_cast<size_t>(alignUp( row_size, alignment )) * MipmapBuilder::getLevelSize( height, level );
+   }
+
+   std::vector<GLintptr> offsets;
+   const GLintptr begin = Head;
+   if (!stage( offsets, levels, level_sizes )) {
+      uploadFromClient( texture_id, layer, levels, width, height, pixel_format, type, alignment );
+      return;
+   }
+
+   // With the ring bound, the pointers are offsets into it.
+   glPixelStorei( GL_UNPACK_ALIGNMENT, alignment );
+   for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+      uploadLevel(
+         texture_id, level, layer,
+         MipmapBuilder::getLevelSize( width, level ), MipmapBuilder::getLevelSize( height, level ),
+         pixel_format, type, reinterpret_cast<const void*>(offsets[level])
+      );
+   }
+   glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+   finishStaging( offsets.empty() ? begin : offsets.front() );
+}
+
+void TextureUploaderGL::uploadCompressed(
+   GLuint texture_id,
+   int layer,
+   const std::vector<const uint8_t*>& levels,
+   int width,
+   int height,
+   GLenum internal_format,
+   BlockCompressor::Format format
+)
+{
+   std::vector<size_t> level_sizes(levels.size());
+   for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+      level_sizes[level] = BlockCompressor::getCompressedSize(
+         MipmapBuilder::getLevelSize( width, level ), MipmapBuilder::getLevelSize( height, level ), format
+      );
+   }
+
+   std::vector<GLintptr> offsets;
+   const GLintptr begin = Head;
+   if (!stage( offsets, levels, level_sizes )) {
+      uploadCompressedFromClient( texture_id, layer, levels, width, height, internal_format, format );
+      return;
+   }
+
+   for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+      uploadCompressedLevel(
+         texture_id, level, layer,
+         MipmapBuilder::getLevelSize( width, level ), MipmapBuilder::getLevelSize( height, level ), internal_format,
+         static_cast<GLsizei>(level_sizes[level]), reinterpret_cast<const void*>(offsets[level])
+      );
+   }
+   finishStaging( offsets.empty() ? begin : offsets.front() );
+}
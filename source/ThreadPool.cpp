@@ -0,0 +1,80 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int thread_num) : Stop( false )
+{
+   if (thread_num <= 0) thread_num = std::max( static_cast<int>(std::thread::hardware_concurrency()), 1 );
+   Workers.reserve( thread_num );
+   for (int i = 0; i < thread_num; ++i) Workers.emplace_back( &ThreadPool::work, this );
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock( QueueMutex );
+      Stop = true;
+   }
+   Condition.notify_all();
+   for (auto& worker : Workers) worker.join();
+}
+
+ThreadPool& ThreadPool::getInstance()
+{
+   static ThreadPool pool;
+   return pool;
+}
+
+void ThreadPool::work()
+{
+   while (true) {
+      std::function<void()> task;
+      {
+         std::unique_lock<std::mutex> lock( QueueMutex );
+         Condition.wait( lock, [this]() { return Stop || !Tasks.empty(); } );
+         if (Stop && Tasks.empty()) return;
+         task = std::move( Tasks.front() );
+         Tasks.pop();
+      }
+      task();
+   }
+}
+
+void ThreadPool::parallelFor(int begin, int end, int chunk_size, const std::function<void(int, int)>& task)
+{
+   if (end <= begin) return;
+
+   chunk_size = std::max( chunk_size, 1 );
+   const int chunk_num = (end - begin + chunk_size - 1) / chunk_size;
+   if (chunk_num == 1) {
+      task( begin, end );
+      return;
+   }
+
+   struct Progress
+   {
+      std::atomic<int> Next{ 0 };
+      std::atomic<int> Done{ 0 };
+      std::mutex Mutex;
+      std::condition_variable Finished;
+   };
+   const auto progress = std::make_shared<Progress>();
+   const auto run_chunks = [progress, begin, end, chunk_size, chunk_num, &task]() {
+      for (int c = progress->Next++; c < chunk_num; c = progress->Next++) {
+         const int first = begin + c * chunk_size;
+         task( first, std::min( first + chunk_size, end ) );
+         if (++progress->Done == chunk_num) {
+            std::lock_guard<std::mutex> lock( progress->Mutex );
+            progress->Finished.notify_all();
+         }
+      }
+   };
+
+   // Helpers that start after every chunk is taken return without touching the task.
+   const int helper_num = std::min( chunk_num, getThreadNum() + 1 ) - 1;
+   for (int i = 0; i < helper_num; ++i) {
+      submit( [progress, chunk_num, run_chunks]() { if (progress->Next < chunk_num) run_chunks(); } );
+   }
+   run_chunks();
+
+   std::unique_lock<std::mutex> lock( progress->Mutex );
+   progress->Finished.wait( lock, [&progress, chunk_num]() { return progress->Done == chunk_num; } );
+}
\ No newline at end of file